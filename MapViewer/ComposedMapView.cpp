@@ -0,0 +1,186 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+#include "ComposedMapView.h"
+
+#include <QPainter>
+#include <algorithm>
+#include <cstring>
+
+void render_map_tile(const u8Array128RowMajor &content, int pixel_size,
+                     ARGB *dest, int64_t dest_stride) noexcept {
+  const int64_t row_pixels = 128 * int64_t(pixel_size);
+  for (int r = 0; r < 128; r++) {
+    ARGB *const first_row = dest + r * int64_t(pixel_size) * dest_stride;
+    // constant fills and copies are vectorized by the compiler
+    for (int c = 0; c < 128; c++) {
+      std::fill_n(first_row + c * pixel_size, pixel_size,
+                  map_color_to_ARGB[content(r, c)]);
+    }
+    for (int dr = 1; dr < pixel_size; dr++) {
+      memcpy(first_row + dr * dest_stride, first_row,
+             row_pixels * sizeof(ARGB));
+    }
+  }
+}
+
+const QImage *map_tile_cache::find(int map_idx, int scale) noexcept {
+  auto it = this->index.find(key_of(map_idx, scale));
+  if (it == this->index.end()) {
+    return nullptr;
+  }
+  this->tiles.splice(this->tiles.begin(), this->tiles, it->second);
+  return &it->second->second;
+}
+
+const QImage &map_tile_cache::emplace(int map_idx, int scale,
+                                      QImage &&tile) noexcept {
+  const key_t key = key_of(map_idx, scale);
+  auto it = this->index.find(key);
+  if (it != this->index.end()) {
+    this->bytes -= it->second->second.sizeInBytes();
+    this->tiles.erase(it->second);
+    this->index.erase(it);
+  }
+
+  this->bytes += tile.sizeInBytes();
+  this->tiles.emplace_front(key, std::move(tile));
+  this->index.emplace(key, this->tiles.begin());
+
+  while (this->bytes > this->capacity && this->tiles.size() > 1) {
+    auto &last = this->tiles.back();
+    this->bytes -= last.second.sizeInBytes();
+    this->index.erase(last.first);
+    this->tiles.pop_back();
+  }
+  return this->tiles.front().second;
+}
+
+void map_tile_cache::clear() noexcept {
+  this->tiles.clear();
+  this->index.clear();
+  this->bytes = 0;
+}
+
+ComposedMapView::ComposedMapView(QWidget *parent) : QWidget(parent) {
+  this->update_size();
+}
+
+ComposedMapView::~ComposedMapView() {}
+
+void ComposedMapView::set_maps(const std::vector<map> *maps_) noexcept {
+  this->maps = maps_;
+  this->tiles.clear();
+  this->update_size();
+}
+
+void ComposedMapView::set_arrangement(int rows, int cols,
+                                      bool is_col_major_) noexcept {
+  this->map_rows = std::max(rows, 0);
+  this->map_cols = std::max(cols, 0);
+  this->is_col_major = is_col_major_;
+  this->update_size();
+}
+
+void ComposedMapView::set_scale(int scale_) noexcept {
+  // tiles of other scales are kept, until they are evicted
+  this->requested_scale = std::clamp(scale_, 1, 255);
+  this->update_size();
+}
+
+void ComposedMapView::set_spacing(int spacing_) noexcept {
+  this->spacing = std::max(spacing_, 0);
+  this->update_size();
+}
+
+void ComposedMapView::update_size() noexcept {
+  // A widget can't be larger than QWIDGETSIZE_MAX, so the scale is reduced
+  // until the wall fits. If it doesn't fit even at scale 1, it's cut.
+  const int64_t max_maps = std::max({this->map_rows, this->map_cols, 1});
+  const int64_t max_cell =
+      (int64_t(QWIDGETSIZE_MAX) + this->spacing) / max_maps;
+  const int64_t max_scale = (max_cell - this->spacing) / 128;
+  this->scale =
+      int(std::clamp<int64_t>(max_scale, 1, this->requested_scale));
+
+  auto length_of = [this](int num_maps) -> int {
+    if (num_maps <= 0) {
+      return 0;
+    }
+    const int64_t cell = 128 * int64_t(this->scale) + this->spacing;
+    return int(std::min<int64_t>(num_maps * cell - this->spacing,
+                                 QWIDGETSIZE_MAX));
+  };
+  this->setFixedSize(length_of(this->map_cols), length_of(this->map_rows));
+  this->update();
+}
+
+int ComposedMapView::map_index_at(int r, int c) const noexcept {
+  if (this->maps == nullptr) {
+    return -1;
+  }
+  const int64_t idx = (this->is_col_major)
+                          ? (int64_t(c) * this->map_rows + r)
+                          : (int64_t(r) * this->map_cols + c);
+  if (idx >= int64_t(this->maps->size())) {
+    return -1;
+  }
+  return int(idx);
+}
+
+const QImage &ComposedMapView::tile_of(int map_idx) noexcept {
+  const QImage *cached = this->tiles.find(map_idx, this->scale);
+  if (cached != nullptr) {
+    return *cached;
+  }
+
+  const int size = 128 * this->scale;
+  QImage tile{size, size, QImage::Format_ARGB32};
+  render_map_tile((*this->maps)[map_idx].content(), this->scale,
+                  reinterpret_cast<ARGB *>(tile.scanLine(0)),
+                  tile.bytesPerLine() / int64_t(sizeof(ARGB)));
+  return this->tiles.emplace(map_idx, this->scale, std::move(tile));
+}
+
+void ComposedMapView::paintEvent(QPaintEvent *event) {
+  if (this->maps == nullptr || this->maps->empty()) {
+    return;
+  }
+  QPainter painter{this};
+
+  const int cell = 128 * this->scale + this->spacing;
+  const QRect dirty = event->rect();
+  const int r_begin = std::max(dirty.top() / cell, 0);
+  const int r_end = std::min(dirty.bottom() / cell + 1, this->map_rows);
+  const int c_begin = std::max(dirty.left() / cell, 0);
+  const int c_end = std::min(dirty.right() / cell + 1, this->map_cols);
+
+  for (int r = r_begin; r < r_end; r++) {
+    for (int c = c_begin; c < c_end; c++) {
+      const int map_idx = this->map_index_at(r, c);
+      if (map_idx < 0) {
+        continue;
+      }
+      painter.drawImage(QPoint{c * cell, r * cell}, this->tile_of(map_idx));
+    }
+  }
+}
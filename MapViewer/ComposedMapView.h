@@ -0,0 +1,105 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+#ifndef MAPVIEWER_COMPOSEDMAPVIEW_H
+#define MAPVIEWER_COMPOSEDMAPVIEW_H
+
+#include <QImage>
+#include <QPaintEvent>
+#include <QWidget>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "MapViewerWind.h"
+
+/// Fill a 128*pixel_size square image of a map. dest_stride is the count of
+/// pixels between the beginnings of 2 rows in dest.
+void render_map_tile(const u8Array128RowMajor &content, int pixel_size,
+                     ARGB *dest, int64_t dest_stride) noexcept;
+
+/// LRU cache of rendered maps, keyed by map index and scale.
+class map_tile_cache {
+ private:
+  using key_t = uint64_t;
+  /// Most recently used tiles are at front.
+  std::list<std::pair<key_t, QImage>> tiles;
+  std::unordered_map<key_t, decltype(tiles)::iterator> index;
+  size_t bytes{0};
+  size_t capacity;
+
+  static key_t key_of(int map_idx, int scale) noexcept {
+    return (uint64_t(map_idx) << 8) | uint64_t(scale & 0xFF);
+  }
+
+ public:
+  explicit map_tile_cache(size_t capacity_bytes) : capacity{capacity_bytes} {}
+
+  /// Returns nullptr if the tile isn't cached.
+  [[nodiscard]] const QImage *find(int map_idx, int scale) noexcept;
+  /// The inserted tile is never evicted immediately.
+  const QImage &emplace(int map_idx, int scale, QImage &&tile) noexcept;
+
+  void clear() noexcept;
+
+  [[nodiscard]] inline size_t memory_usage() const noexcept {
+    return this->bytes;
+  }
+};
+
+/// Draws maps as a wall, only tiles in the exposed area are rendered.
+class ComposedMapView : public QWidget {
+  Q_OBJECT
+ private:
+  const std::vector<map> *maps{nullptr};
+  int map_rows{1};
+  int map_cols{1};
+  bool is_col_major{false};
+  /// Set by set_scale, and scale is reduced from it if the wall is too large.
+  int requested_scale{1};
+  int scale{1};
+  int spacing{6};
+
+  map_tile_cache tiles{256ULL << 20};
+
+  void update_size() noexcept;
+  /// Index of the map at row r and column c of the wall, -1 if none.
+  [[nodiscard]] int map_index_at(int r, int c) const noexcept;
+  [[nodiscard]] const QImage &tile_of(int map_idx) noexcept;
+
+ protected:
+  void paintEvent(QPaintEvent *event) override;
+
+ public:
+  explicit ComposedMapView(QWidget *parent = nullptr);
+  ~ComposedMapView();
+
+  /// Cached tiles are dropped, call it whenever maps are reloaded.
+  void set_maps(const std::vector<map> *maps) noexcept;
+  void set_arrangement(int rows, int cols, bool is_col_major) noexcept;
+  void set_scale(int scale) noexcept;
+  void set_spacing(int spacing) noexcept;
+};
+
+#endif  // MAPVIEWER_COMPOSEDMAPVIEW_H
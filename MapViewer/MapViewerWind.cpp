@@ -20,11 +20,17 @@ This file is part of SlopeCraft.
     bilibili:https://space.bilibili.com/351429231
 */
 
+#include <QApplication>
+#include <QCryptographicHash>
+#include <QDir>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QFont>
+#include <QListWidgetItem>
 #include <QMessageBox>
 #include <QPainter>
 #include <QPen>
+#include <QStandardPaths>
 #include <iostream>
 #include <list>
 #include <mutex>
@@ -32,6 +38,7 @@ This file is part of SlopeCraft.
 #include "SlopeCraftL.h"
 
 #include "MapViewerWind.h"
+#include "ComposedMapView.h"
 #include "processMapFiles.h"
 #include "ui_MapViewerWind.h"
 
@@ -183,15 +190,12 @@ MapViewerWind::MapViewerWind(QWidget *parent)
 
   connect(ui->slider_resize_image, &QSlider::valueChanged, this,
           &MapViewerWind::render_composed);
-}
 
-MapViewerWind::~MapViewerWind() {
-  for (QLabel *label : this->labels) {
-    if (label != nullptr) delete label;
-  }
-  delete ui;
+  ui->composed_view->set_maps(&this->maps);
 }
 
+MapViewerWind::~MapViewerWind() { delete ui; }
+
 void MapViewerWind::update_contents() {
   this->reshape_tables();
   ui->label_show_map_count->setText(tr("地图数：") +
@@ -226,25 +230,8 @@ void MapViewerWind::reshape_tables() {
     ui->table_display_filename->setItem(r, c, item);
   }
 
-  for (QLabel *label : this->labels) {  // detach label and layout
-    if (ui->grid_layout_compose_maps->indexOf(label) >= 0) {
-      ui->grid_layout_compose_maps->removeWidget(label);
-    }
-    label->hide();
-  }
-
-  while (this->labels.size() < this->maps.size()) {
-    this->labels.emplace_back(new QLabel(this));
-    this->labels.back()->hide();
-    this->labels.back()->update();
-  }
-
-  for (int idx = 0; idx < int(this->maps.size()); idx++) {
-    const int r = (is_col_major) ? (idx % rows) : (idx / cols);
-    const int c = (is_col_major) ? (idx / rows) : (idx % cols);
-    if (r >= rows || c >= cols) continue;
-    ui->grid_layout_compose_maps->addWidget(this->labels[idx], r, c);
-  }
+  ui->composed_view->set_arrangement(rows, cols, is_col_major);
+  ui->composed_view->show();
 }
 
 void MapViewerWind::clear_all() {
@@ -253,12 +240,7 @@ void MapViewerWind::clear_all() {
   ui->label_show_single_map->setPixmap(QPixmap());
   ui->label_show_map_count->setText(tr("请选择地图文件"));
 
-  for (QLabel *label : this->labels) {
-    if (ui->grid_layout_compose_maps->indexOf(label) >= 0) {
-      ui->grid_layout_compose_maps->removeWidget(label);
-    }
-    label->hide();
-  }
+  ui->composed_view->hide();
 }
 
 void MapViewerWind::render_single_image() {
@@ -313,22 +295,18 @@ void MapViewerWind::render_single_image() {
   if (is_color_only_image_changed) {  // if color only image is changed, repaint
                                       // it
     new_image = QImage(cols, rows, QImage::Format_ARGB32);
-    new_image.fill(QColor(255, 255, 255, 255));
 
     Eigen::Map<
         Eigen::Array<ARGB, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>>
         map_new_image(reinterpret_cast<ARGB *>(new_image.scanLine(0)), rows,
                       cols);
 
-    const Eigen::Map<const Eigen::Array<ARGB, 128, 128, Eigen::RowMajor>>
-        image_map(reinterpret_cast<ARGB *>(
-            this->maps[current_idx].image.scanLine(0)));
+    render_map_tile(this->maps[current_idx].content(), pixel_size,
+                    reinterpret_cast<ARGB *>(new_image.scanLine(0)),
+                    new_image.bytesPerLine() / int64_t(sizeof(ARGB)));
 
-    for (int c = 0; c < image_map.cols(); c++) {
-      for (int r = 0; r < image_map.rows(); r++) {
-        map_new_image
-            .block(pixel_size * r, pixel_size * c, pixel_size, pixel_size)
-            .fill(image_map(r, c));
+    for (int c = 0; c < 128; c++) {
+      for (int r = 0; r < 128; r++) {
         const int basecolor = this->maps[current_idx].content()(r, c) / 4;
 
         if (basecolor > ::current_max_base_color) {  //  unlikely
@@ -503,27 +481,8 @@ void MapViewerWind::render_composed() {
   const int scale = ui->slider_resize_image->value();
   ui->label_show_compose_scaling->setText(QStringLiteral("×") +
                                           QString::number(scale));
-
-  const int rows = ui->spinbox_rows->value();
-  const int cols = ui->spinbox_cols->value();
-  const bool is_col_major = ui->radio_is_col_major->isChecked();
-
-  for (int idx = 0; idx < int(this->maps.size()); idx++) {
-    const int r = (is_col_major) ? (idx % rows) : (idx / cols);
-    const int c = (is_col_major) ? (idx / rows) : (idx % cols);
-    if (scale <= 1) {
-      this->labels[idx]->setPixmap(QPixmap::fromImage(this->maps[idx].image));
-    } else {
-      this->labels[idx]->setPixmap(QPixmap::fromImage(
-          (this->maps[idx].image.scaled(128 * scale, 128 * scale))));
-    }
-
-    if (r >= rows || c >= cols) {
-      this->labels[idx]->hide();
-    } else {
-      this->labels[idx]->show();
-    }
-  }
+  // tiles are rendered when they are painted
+  ui->composed_view->set_scale(scale);
 }
 
 void MapViewerWind::on_button_load_maps_clicked() {
@@ -532,7 +491,10 @@ void MapViewerWind::on_button_load_maps_clicked() {
   if (filenames.size() <= 0) {
     return;
   }
+  this->load_maps(filenames);
+}
 
+void MapViewerWind::load_maps(const QStringList &filenames) {
   this->clear_all();
   this->maps.clear();
   this->maps.resize(filenames.size());
@@ -540,28 +502,34 @@ void MapViewerWind::on_button_load_maps_clicked() {
   std::list<std::pair<QString, std::string>> error_list;
   std::mutex lock;
 
-#pragma omp parallel for schedule(static)
-  for (int idx = 0; idx < filenames.size(); idx++) {
-    std::string error_info;
-    if (!process_map_file(filenames[idx].toLocal8Bit().data(),
-                          (this->maps[idx].map_content).get(), &error_info)) {
-      lock.lock();
-
-      error_list.emplace_back(filenames[idx], error_info);
-
-      this->maps[idx].filename = "";
-
-      lock.unlock();
-    } else {
-      const int last_idx_of_reverse_slash = filenames[idx].lastIndexOf('\\');
-      const int last_idx_of_slash = filenames[idx].lastIndexOf('/');
-      const int last_idx_of_seperator =
-          std::max(last_idx_of_reverse_slash, last_idx_of_slash);
-
-      const int basename_length =
-          filenames[idx].length() - last_idx_of_seperator - 1;
-
-      this->maps[idx].filename = filenames[idx].last(basename_length);
+#pragma omp parallel
+  {
+    // each thread inflates files into its own buffer
+    std::vector<uint8_t> buffer;
+#pragma omp for schedule(static)
+    for (int idx = 0; idx < filenames.size(); idx++) {
+      std::string error_info;
+      if (!process_map_file(filenames[idx].toLocal8Bit().data(),
+                            (this->maps[idx].map_content).get(), &error_info,
+                            &buffer)) {
+        lock.lock();
+
+        error_list.emplace_back(filenames[idx], error_info);
+
+        this->maps[idx].filename = "";
+
+        lock.unlock();
+      } else {
+        const int last_idx_of_reverse_slash = filenames[idx].lastIndexOf('\\');
+        const int last_idx_of_slash = filenames[idx].lastIndexOf('/');
+        const int last_idx_of_seperator =
+            std::max(last_idx_of_reverse_slash, last_idx_of_slash);
+
+        const int basename_length =
+            filenames[idx].length() - last_idx_of_seperator - 1;
+
+        this->maps[idx].filename = filenames[idx].last(basename_length);
+      }
     }
   }
 
@@ -599,13 +567,13 @@ void MapViewerWind::on_button_load_maps_clicked() {
     }
   }
 
+  ui->composed_view->set_maps(&this->maps);
   this->update_contents();
 }
 
 void MapViewerWind::on_checkbox_composed_show_spacing_toggled(bool is_checked) {
   const int spacing = (is_checked) ? (6) : (0);
-  ui->grid_layout_compose_maps->setHorizontalSpacing(spacing);
-  ui->grid_layout_compose_maps->setVerticalSpacing(spacing);
+  ui->composed_view->set_spacing(spacing);
 }
 
 void MapViewerWind::on_button_save_single_clicked() {
@@ -672,3 +640,123 @@ void MapViewerWind::on_button_save_composed_clicked() {
 
   result.save(dest);
 }
+
+void MapViewerWind::on_button_scan_world_clicked() {
+  QString dir =
+      QFileDialog::getExistingDirectory(this, tr("选择存档或其data文件夹"));
+  if (dir.isEmpty()) {
+    return;
+  }
+  // both the world and its data folder are accepted
+  if (QFileInfo{dir + "/data"}.isDir()) {
+    dir += "/data";
+  }
+  dir = QDir{dir}.absolutePath();
+
+  const std::filesystem::path data_dir{dir.toStdU16String()};
+  const QString index_file =
+      QStandardPaths::writableLocation(QStandardPaths::CacheLocation) +
+      "/world_index/" +
+      QCryptographicHash::hash(dir.toUtf8(), QCryptographicHash::Md5)
+          .toHex() +
+      ".bin";
+  const std::filesystem::path index_path{index_file.toStdU16String()};
+
+  std::string error_info;
+  if (this->world_index.directory() != data_dir) {
+    // if there is no index yet, all maps are read
+    this->world_index.load(index_path, &error_info);
+  }
+
+  QApplication::setOverrideCursor(Qt::WaitCursor);
+  const auto result = this->world_index.update(data_dir);
+  const bool saved = this->world_index.save(index_path, &error_info);
+  QApplication::restoreOverrideCursor();
+
+  this->show_world_index();
+
+  if (!result.errors.empty()) {
+    QString info = tr("%1 个文件无法读取：").arg(result.errors.size());
+    constexpr size_t max_shown = 10;
+    for (size_t idx = 0; idx < std::min(max_shown, result.errors.size());
+         idx++) {
+      const auto &[filename, error] = result.errors[idx];
+      info += '\n' + QString::fromStdString(filename) + " : " +
+              QString::fromLocal8Bit(error.data());
+    }
+    QMessageBox::warning(this, tr("部分地图文件无法读取"), info);
+  }
+  if (!saved) {
+    QMessageBox::warning(this, tr("保存索引失败"),
+                         QString::fromLocal8Bit(error_info.data()));
+  }
+  ui->statusbar->showMessage(
+      tr("读取了 %1 个文件，复用了 %2 个索引，删除了 %3 个索引")
+          .arg(result.read)
+          .arg(result.reused)
+          .arg(result.removed));
+}
+
+void MapViewerWind::show_world_index() {
+  ui->list_world_maps->clear();
+  const auto &entries = this->world_index.entry_list();
+
+  // count of other maps with the same colors
+  std::vector<size_t> duplicates(entries.size(), 0);
+  const auto groups = this->world_index.find_duplicates();
+  for (const auto &group : groups) {
+    for (size_t idx : group) {
+      duplicates[idx] = group.size() - 1;
+    }
+  }
+
+  constexpr int thumbnail_size = map_index_entry::thumbnail_size;
+  const int icon_size = ui->list_world_maps->iconSize().width();
+  for (size_t idx = 0; idx < entries.size(); idx++) {
+    const auto &entry = entries[idx];
+    QImage thumbnail{thumbnail_size, thumbnail_size, QImage::Format_ARGB32};
+    for (int r = 0; r < thumbnail_size; r++) {
+      ARGB *const line = reinterpret_cast<ARGB *>(thumbnail.scanLine(r));
+      for (int c = 0; c < thumbnail_size; c++) {
+        line[c] = map_color_to_ARGB[entry.thumbnail[r * thumbnail_size + c]];
+      }
+    }
+
+    const QString filename = QString::fromStdString(entry.filename);
+    QListWidgetItem *item = new QListWidgetItem{
+        QIcon{QPixmap::fromImage(thumbnail.scaled(icon_size, icon_size))},
+        filename};
+    item->setData(Qt::UserRole, filename);
+
+    QString tooltip = tr("地图 %1\n比例：%2\n维度：%3")
+                          .arg(entry.map_id)
+                          .arg(entry.scale)
+                          .arg(QString::fromStdString(entry.dimension));
+    if (duplicates[idx] > 0) {
+      tooltip += tr("\n与另外 %1 张地图相同").arg(duplicates[idx]);
+      item->setBackground(QColor{255, 200, 200});
+    }
+    item->setToolTip(tooltip);
+    ui->list_world_maps->addItem(item);
+  }
+
+  ui->label_world_info->setText(tr("地图数：%1，重复的地图有 %2 组")
+                                    .arg(entries.size())
+                                    .arg(groups.size()));
+}
+
+void MapViewerWind::on_button_load_world_selected_clicked() {
+  const auto selected = ui->list_world_maps->selectedItems();
+  if (selected.empty()) {
+    return;
+  }
+
+  const QDir dir{
+      QString::fromStdU16String(this->world_index.directory().u16string())};
+  QStringList filenames;
+  for (const QListWidgetItem *item : selected) {
+    filenames.append(dir.filePath(item->data(Qt::UserRole).toString()));
+  }
+  this->load_maps(filenames);
+  ui->tabWidget->setCurrentWidget(ui->tab_load_maps);
+}
@@ -31,6 +31,8 @@ This file is part of SlopeCraft.
 #include <iostream>
 #include <memory>
 
+#include "map_index.h"
+
 using std::cout, std::endl;
 
 QT_BEGIN_NAMESPACE
@@ -89,9 +91,11 @@ class MapViewerWind : public QMainWindow {
   Ui::MapViewerWind *ui;
 
   std::vector<map> maps;
-  std::vector<QLabel *> labels;
+  map_index world_index;
 
  private:
+  void load_maps(const QStringList &filenames);
+  void show_world_index();
  private slots:
   void update_contents();
   void reshape_tables();
@@ -102,6 +106,8 @@ class MapViewerWind : public QMainWindow {
   void on_checkbox_composed_show_spacing_toggled(bool);
   void on_button_save_single_clicked();
   void on_button_save_composed_clicked();
+  void on_button_scan_world_clicked();
+  void on_button_load_world_selected_clicked();
 };
 
 #endif  // MAPVIEWERWIND_H
@@ -0,0 +1,329 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+#include "map_index.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <boost/uuid/detail/sha1.hpp>
+#include <cereal/archives/binary.hpp>
+#include <cereal/types/array.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+
+#include "processMapFiles.h"
+
+namespace buuid = boost::uuids::detail;
+namespace stdfs = std::filesystem;
+
+namespace {
+constexpr std::array<char, 4> index_magic{'S', 'C', 'M', 'I'};
+
+using digest_t = std::array<uint8_t, 20>;
+using map_content_t = Eigen::Array<uint8_t, 128, 128, Eigen::RowMajor>;
+
+/// Map id in filename like map_12.dat, -1 if it's not a map data file.
+int map_id_of(std::string_view filename) noexcept {
+  constexpr std::string_view prefix{"map_"};
+  constexpr std::string_view suffix{".dat"};
+  if (filename.size() <= prefix.size() + suffix.size() ||
+      !filename.starts_with(prefix) || !filename.ends_with(suffix)) {
+    return -1;
+  }
+  const std::string_view digits = filename.substr(
+      prefix.size(), filename.size() - prefix.size() - suffix.size());
+  int id = -1;
+  const auto [end, ec] =
+      std::from_chars(digits.data(), digits.data() + digits.size(), id);
+  if (ec != std::errc{} || end != digits.data() + digits.size() || id < 0) {
+    return -1;
+  }
+  return id;
+}
+
+digest_t hash_of_colors(const map_content_t &content) noexcept {
+  buuid::sha1 hash;
+  hash.process_bytes(content.data(), content.size());
+  buuid::sha1::digest_type dig;
+  hash.get_digest(dig);
+
+  // digest_type is 5 uint32 in older boost and 20 bytes in newer ones, write
+  // it in big-endian so that the index doesn't depend on either.
+  digest_t ret;
+  static_assert(sizeof(dig) == sizeof(ret));
+  constexpr size_t word_bytes = sizeof(dig[0]);
+  for (size_t word = 0; word < std::size(dig); word++) {
+    for (size_t byte = 0; byte < word_bytes; byte++) {
+      ret[word * word_bytes + byte] =
+          uint8_t(dig[word] >> (8 * (word_bytes - 1 - byte)));
+    }
+  }
+  return ret;
+}
+
+struct hash_of_digest {
+  size_t operator()(const digest_t &dig) const noexcept {
+    size_t ret;
+    memcpy(&ret, dig.data(), sizeof(ret));
+    return ret;
+  }
+};
+
+std::string path_to_u8(const stdfs::path &path) noexcept {
+  const std::u8string u8 = path.u8string();
+  return {reinterpret_cast<const char *>(u8.data()), u8.size()};
+}
+
+stdfs::path u8_to_path(std::string_view str) noexcept {
+  return stdfs::path{std::u8string{
+      reinterpret_cast<const char8_t *>(str.data()), str.size()}};
+}
+}  // namespace
+
+bool map_index::load(const stdfs::path &index_file,
+                     std::string *const error_info) noexcept {
+  this->clear();
+
+  std::ifstream ifs{index_file, std::ios::binary};
+  if (!ifs) {
+    if (error_info != nullptr) {
+      *error_info = "Failed to open " + path_to_u8(index_file);
+    }
+    return false;
+  }
+
+  try {
+    cereal::BinaryInputArchive bia{ifs};
+    std::array<char, 4> magic;
+    uint32_t version;
+    bia(magic, version);
+    if (magic != index_magic || version != format_version) {
+      if (error_info != nullptr) {
+        *error_info = path_to_u8(index_file) +
+                      " is not a map index, or it's of another version.";
+      }
+      return false;
+    }
+    std::string dir;
+    std::vector<map_index_entry> temp;
+    bia(dir, temp);
+    this->data_dir = u8_to_path(dir);
+    this->entries = std::move(temp);
+  } catch (const std::exception &e) {
+    this->clear();
+    if (error_info != nullptr) {
+      *error_info = "The map index is broken, detail: ";
+      *error_info += e.what();
+    }
+    return false;
+  }
+  return true;
+}
+
+bool map_index::save(const stdfs::path &index_file,
+                     std::string *const error_info) const noexcept {
+  std::error_code ec;
+  if (index_file.has_parent_path()) {
+    stdfs::create_directories(index_file.parent_path(), ec);
+  }
+  // write to a temporary file first, so that a crash never leaves a broken
+  // index
+  stdfs::path temp_file = index_file;
+  temp_file += ".tmp";
+  {
+    std::ofstream ofs{temp_file, std::ios::binary};
+    if (!ofs) {
+      if (error_info != nullptr) {
+        *error_info = "Failed to create " + path_to_u8(temp_file);
+      }
+      return false;
+    }
+    try {
+      cereal::BinaryOutputArchive boa{ofs};
+      boa(index_magic, format_version);
+      boa(path_to_u8(this->data_dir), this->entries);
+    } catch (const std::exception &e) {
+      if (error_info != nullptr) {
+        *error_info = "Failed to write map index, detail: ";
+        *error_info += e.what();
+      }
+      return false;
+    }
+  }
+
+  stdfs::rename(temp_file, index_file, ec);
+  if (ec) {
+    if (error_info != nullptr) {
+      *error_info = "Failed to replace " + path_to_u8(index_file) +
+                    ", detail: " + ec.message();
+    }
+    stdfs::remove(temp_file, ec);
+    return false;
+  }
+  return true;
+}
+
+map_index::update_result map_index::update(
+    const stdfs::path &data_dir_) noexcept {
+  update_result result;
+  if (data_dir_ != this->data_dir) {
+    this->entries.clear();
+    this->data_dir = data_dir_;
+  }
+
+  std::unordered_map<std::string, size_t> old_entries;
+  old_entries.reserve(this->entries.size());
+  for (size_t idx = 0; idx < this->entries.size(); idx++) {
+    old_entries.emplace(this->entries[idx].filename, idx);
+  }
+
+  struct pending_file {
+    stdfs::path path;
+    std::string filename;
+    int map_id;
+    int64_t file_size;
+    int64_t mtime;
+  };
+  std::vector<map_index_entry> new_entries;
+  std::vector<pending_file> pending;
+  size_t found_old = 0;
+
+  std::error_code ec;
+  for (auto it = stdfs::directory_iterator{this->data_dir, ec};
+       !ec && it != stdfs::directory_iterator{}; it.increment(ec)) {
+    std::error_code file_ec;
+    if (!it->is_regular_file(file_ec)) {
+      continue;
+    }
+    std::string filename = path_to_u8(it->path().filename());
+    const int map_id = map_id_of(filename);
+    if (map_id < 0) {
+      continue;
+    }
+    const int64_t file_size = int64_t(it->file_size(file_ec));
+    // the tick of file_clock differs between platforms
+    const int64_t mtime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              it->last_write_time(file_ec).time_since_epoch())
+                              .count();
+    if (file_ec) {
+      result.errors.emplace_back(filename, file_ec.message());
+      continue;
+    }
+
+    auto old = old_entries.find(filename);
+    if (old != old_entries.end()) {
+      found_old++;
+      map_index_entry &entry = this->entries[old->second];
+      if (entry.file_size == file_size && entry.mtime == mtime) {
+        new_entries.emplace_back(std::move(entry));
+        result.reused++;
+        continue;
+      }
+    }
+    pending.emplace_back(pending_file{.path = it->path(),
+                                      .filename = std::move(filename),
+                                      .map_id = map_id,
+                                      .file_size = file_size,
+                                      .mtime = mtime});
+  }
+  if (ec) {
+    result.errors.emplace_back(path_to_u8(this->data_dir), ec.message());
+  }
+  result.removed = old_entries.size() - found_old;
+
+  std::vector<std::optional<map_index_entry>> read_entries(pending.size());
+  std::mutex lock;
+#pragma omp parallel
+  {
+    // each thread has its own buffers
+    std::vector<uint8_t> buffer;
+    map_content_t content;
+    map_file_info info;
+    std::string error_info;
+#pragma omp for schedule(dynamic)
+    for (int64_t idx = 0; idx < int64_t(pending.size()); idx++) {
+      const pending_file &file = pending[idx];
+      if (!process_map_file(file.path.string().c_str(), &content, &error_info,
+                            &buffer, &info)) {
+        std::lock_guard lk{lock};
+        result.errors.emplace_back(file.filename, error_info);
+        continue;
+      }
+
+      map_index_entry entry;
+      entry.filename = file.filename;
+      entry.map_id = file.map_id;
+      entry.scale = info.scale;
+      entry.dimension = std::move(info.dimension);
+      entry.file_size = file.file_size;
+      entry.mtime = file.mtime;
+      entry.colors_hash = hash_of_colors(content);
+      constexpr int step = 128 / map_index_entry::thumbnail_size;
+      for (int r = 0; r < map_index_entry::thumbnail_size; r++) {
+        for (int c = 0; c < map_index_entry::thumbnail_size; c++) {
+          entry.thumbnail[r * map_index_entry::thumbnail_size + c] =
+              content(r * step, c * step);
+        }
+      }
+      read_entries[idx] = std::move(entry);
+    }
+  }
+
+  for (auto &entry : read_entries) {
+    if (entry.has_value()) {
+      new_entries.emplace_back(std::move(entry.value()));
+      result.read++;
+    }
+  }
+  std::sort(new_entries.begin(), new_entries.end(),
+            [](const map_index_entry &a, const map_index_entry &b) {
+              return a.map_id < b.map_id;
+            });
+  this->entries = std::move(new_entries);
+  return result;
+}
+
+std::vector<std::vector<size_t>> map_index::find_duplicates() const noexcept {
+  std::unordered_map<digest_t, std::vector<size_t>, hash_of_digest> groups;
+  for (size_t idx = 0; idx < this->entries.size(); idx++) {
+    groups[this->entries[idx].colors_hash].emplace_back(idx);
+  }
+
+  std::vector<std::vector<size_t>> ret;
+  for (auto &[hash, group] : groups) {
+    if (group.size() >= 2) {
+      ret.emplace_back(std::move(group));
+    }
+  }
+  std::sort(ret.begin(), ret.end(),
+            [](const std::vector<size_t> &a, const std::vector<size_t> &b) {
+              return a.front() < b.front();
+            });
+  return ret;
+}
@@ -0,0 +1,112 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+#ifndef MAPVIEWER_MAP_INDEX_H
+#define MAPVIEWER_MAP_INDEX_H
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// Summary of a map data file, enough to list it without reading the file.
+struct map_index_entry {
+  static constexpr int thumbnail_size = 32;
+
+  /// Filename without directory, like map_12.dat
+  std::string filename;
+  int map_id{-1};
+  int scale{0};
+  std::string dimension;
+  /// Used to tell whether the file is changed since it's indexed.
+  int64_t file_size{0};
+  /// Last write time in nanoseconds
+  int64_t mtime{0};
+  /// sha1 of the 128x128 map colors, in big-endian
+  std::array<uint8_t, 20> colors_hash{};
+  /// Map colors sampled every 128/thumbnail_size pixels, row-major
+  std::array<uint8_t, thumbnail_size * thumbnail_size> thumbnail{};
+
+  template <class archive>
+  void serialize(archive &ar) {
+    ar(this->filename, this->map_id, this->scale, this->dimension,
+       this->file_size, this->mtime, this->colors_hash, this->thumbnail);
+  }
+};
+
+/// Index of all map data files in the data folder of a world. It's saved to a
+/// file, so when the world is opened again, only new or changed maps are read.
+class map_index {
+ public:
+  static constexpr uint32_t format_version = 2;
+
+  struct update_result {
+    /// Entries that are unchanged since last update
+    size_t reused{0};
+    /// Files that are read in this update
+    size_t read{0};
+    /// Entries whose files are deleted
+    size_t removed{0};
+    /// Filename and error info of files that failed to read
+    std::vector<std::pair<std::string, std::string>> errors;
+  };
+
+ private:
+  std::filesystem::path data_dir;
+  /// Sorted by map id
+  std::vector<map_index_entry> entries;
+
+ public:
+  [[nodiscard]] inline const std::filesystem::path &directory() const noexcept {
+    return this->data_dir;
+  }
+  [[nodiscard]] inline const std::vector<map_index_entry> &entry_list()
+      const noexcept {
+    return this->entries;
+  }
+
+  inline void clear() noexcept {
+    this->data_dir.clear();
+    this->entries.clear();
+  }
+
+  /// Load an index saved by save(). The index is cleared if the file is
+  /// missing or broken.
+  bool load(const std::filesystem::path &index_file,
+            std::string *const error_info) noexcept;
+  bool save(const std::filesystem::path &index_file,
+            std::string *const error_info) const noexcept;
+
+  /// Scan map_*.dat in data_dir. Files with the same size and modification
+  /// time as indexed keep their entries, others are read in parallel. If the
+  /// index is of another folder, all files are read.
+  update_result update(const std::filesystem::path &data_dir) noexcept;
+
+  /// Groups of entries that have the same colors. Each group is a list of
+  /// indices in entry_list() and has at least 2 entries.
+  [[nodiscard]] std::vector<std::vector<size_t>> find_duplicates()
+      const noexcept;
+};
+
+#endif  // MAPVIEWER_MAP_INDEX_H
@@ -22,8 +22,12 @@ This file is part of SlopeCraft.
 
 #include "processMapFiles.h"
 
+#include <algorithm>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <span>
+#include <string_view>
 #include <vector>
 #include <zlib.h>
 
@@ -34,16 +38,14 @@ using std::cout, std::endl;
 bool uncompress_map_file(const char *filename, std::vector<uint8_t> *const dest,
                          std::string *const error_info);
 
+const uint8_t *find_color_by_nbt(std::span<const uint8_t> inflated,
+                                 map_file_info *const info) noexcept;
+
 const uint8_t *find_color_begin(const std::vector<uint8_t> &inflated,
                                 std::string *const error_info);
 
 bool uncompress_map_file(const char *filename, std::vector<uint8_t> *const dest,
                          std::string *const error_info) {
-  dest->clear();
-
-  const size_t source_size = std::filesystem::file_size(filename);
-  dest->reserve(4 * source_size);
-
   gzFile gz_file = ::gzopen(filename, "rb");
 
   if (gz_file == nullptr) {
@@ -56,21 +58,312 @@ bool uncompress_map_file(const char *filename, std::vector<uint8_t> *const dest,
     }
     return false;
   }
+  // must be set before the first read
+  ::gzbuffer(gz_file, 128 * 1024);
 
+  // The buffer is reused between files, so its capacity is usually large
+  // enough already. It only grows by what's about to be inflated, since
+  // resizing zero-fills the new bytes, and filling the whole capacity for
+  // every file costs as much as inflating it.
+  const size_t source_size = std::filesystem::file_size(filename);
+  const size_t step = std::max(4 * source_size, size_t(64 * 1024));
+  dest->clear();
+  dest->reserve(step);
+
+  size_t inflated_bytes = 0;
   while (true) {
-    dest->emplace_back();
-    if (::gzfread(&dest->back(), 1, 1, gz_file) <= 0) {
-      dest->pop_back();
+    dest->resize(inflated_bytes + step);
+    const int bytes = ::gzread(gz_file, dest->data() + inflated_bytes,
+                               unsigned(step));
+    if (bytes < 0) {
+      if (error_info != nullptr) {
+        int errnum = 0;
+        *error_info = "Failed to inflate map data file ";
+        *error_info += filename;
+        *error_info += ", detail: ";
+        *error_info += ::gzerror(gz_file, &errnum);
+      }
+      ::gzclose(gz_file);
+      return false;
+    }
+    if (bytes == 0) {
       break;
     }
+    inflated_bytes += size_t(bytes);
   }
 
   ::gzclose(gz_file);
-  dest->shrink_to_fit();
+  dest->resize(inflated_bytes);
 
   return true;
 }
 
+namespace {
+// Minimal reader of uncompressed java NBT, only walks through tags.
+class nbt_walker {
+ private:
+  const uint8_t *ptr;
+  const uint8_t *const end;
+
+ public:
+  static constexpr uint8_t tag_end = 0;
+  static constexpr uint8_t tag_byte_array = 7;
+  static constexpr uint8_t tag_compound = 10;
+  static constexpr int max_depth = 512;
+
+  explicit nbt_walker(std::span<const uint8_t> src)
+      : ptr{src.data()}, end{src.data() + src.size()} {}
+
+  [[nodiscard]] const uint8_t *position() const noexcept { return this->ptr; }
+
+  [[nodiscard]] bool skip(size_t bytes) noexcept {
+    if (size_t(this->end - this->ptr) < bytes) {
+      return false;
+    }
+    this->ptr += bytes;
+    return true;
+  }
+
+  [[nodiscard]] bool read_u8(uint8_t *val) noexcept {
+    if (this->ptr >= this->end) {
+      return false;
+    }
+    *val = *this->ptr++;
+    return true;
+  }
+
+  // NBT is big-endian
+  [[nodiscard]] bool read_u16(uint16_t *val) noexcept {
+    if (this->end - this->ptr < 2) {
+      return false;
+    }
+    *val = uint16_t((this->ptr[0] << 8) | this->ptr[1]);
+    this->ptr += 2;
+    return true;
+  }
+
+  [[nodiscard]] bool read_i32(int32_t *val) noexcept {
+    if (this->end - this->ptr < 4) {
+      return false;
+    }
+    *val = int32_t((uint32_t(this->ptr[0]) << 24) |
+                   (uint32_t(this->ptr[1]) << 16) |
+                   (uint32_t(this->ptr[2]) << 8) | uint32_t(this->ptr[3]));
+    this->ptr += 4;
+    return true;
+  }
+
+  [[nodiscard]] bool read_name(std::string_view *name) noexcept {
+    uint16_t len;
+    if (!this->read_u16(&len)) {
+      return false;
+    }
+    const char *const begin = reinterpret_cast<const char *>(this->ptr);
+    if (!this->skip(len)) {
+      return false;
+    }
+    *name = std::string_view{begin, len};
+    return true;
+  }
+
+  // Read type and name of the next tag in a compound, type is tag_end at the
+  // end of compound.
+  [[nodiscard]] bool read_tag_header(uint8_t *type,
+                                     std::string_view *name) noexcept {
+    if (!this->read_u8(type)) {
+      return false;
+    }
+    if (*type == tag_end) {
+      return true;
+    }
+    return this->read_name(name);
+  }
+
+  [[nodiscard]] bool skip_array(size_t ele_bytes) noexcept {
+    int32_t len;
+    if (!this->read_i32(&len) || len < 0) {
+      return false;
+    }
+    return this->skip(size_t(len) * ele_bytes);
+  }
+
+  [[nodiscard]] bool skip_payload(uint8_t type, int depth = 0) noexcept {
+    if (depth > max_depth) {
+      return false;
+    }
+    switch (type) {
+      case 1:
+        return this->skip(1);
+      case 2:
+        return this->skip(2);
+      case 3:
+      case 5:
+        return this->skip(4);
+      case 4:
+      case 6:
+        return this->skip(8);
+      case tag_byte_array:
+        return this->skip_array(1);
+      case 8: {
+        std::string_view str;
+        return this->read_name(&str);
+      }
+      case 9: {
+        uint8_t ele_type;
+        int32_t len;
+        if (!this->read_u8(&ele_type) || !this->read_i32(&len) || len < 0) {
+          return false;
+        }
+        for (int32_t idx = 0; idx < len; idx++) {
+          if (!this->skip_payload(ele_type, depth + 1)) {
+            return false;
+          }
+        }
+        return true;
+      }
+      case tag_compound:
+        while (true) {
+          uint8_t sub_type;
+          std::string_view name;
+          if (!this->read_tag_header(&sub_type, &name)) {
+            return false;
+          }
+          if (sub_type == tag_end) {
+            return true;
+          }
+          if (!this->skip_payload(sub_type, depth + 1)) {
+            return false;
+          }
+        }
+      case 11:
+        return this->skip_array(4);
+      case 12:
+        return this->skip_array(8);
+      default:
+        return false;
+    }
+  }
+
+  // Move to the payload of a direct child of the current compound. Returns
+  // false if the compound ends before the tag is found.
+  [[nodiscard]] bool seek_child(std::string_view child_name,
+                                uint8_t child_type) noexcept {
+    while (true) {
+      uint8_t type;
+      std::string_view name;
+      if (!this->read_tag_header(&type, &name) || type == tag_end) {
+        return false;
+      }
+      if (type == child_type && name == child_name) {
+        return true;
+      }
+      if (!this->skip_payload(type)) {
+        return false;
+      }
+    }
+  }
+};
+}  // namespace
+
+const uint8_t *find_color_by_nbt(std::span<const uint8_t> inflated,
+                                 map_file_info *const info) noexcept {
+  nbt_walker walker{inflated};
+  uint8_t root_type;
+  std::string_view root_name;
+  if (!walker.read_tag_header(&root_type, &root_name) ||
+      root_type != nbt_walker::tag_compound) {
+    return nullptr;
+  }
+  if (!walker.seek_child("data", nbt_walker::tag_compound)) {
+    return nullptr;
+  }
+
+  const uint8_t *colors = nullptr;
+  while (true) {
+    uint8_t type;
+    std::string_view name;
+    if (!walker.read_tag_header(&type, &name)) {
+      return nullptr;
+    }
+    if (type == nbt_walker::tag_end) {
+      break;
+    }
+
+    if (type == nbt_walker::tag_byte_array && name == "colors") {
+      int32_t len;
+      if (!walker.read_i32(&len) || len != 128 * 128) {
+        return nullptr;
+      }
+      colors = walker.position();
+      if (!walker.skip(128 * 128)) {
+        return nullptr;
+      }
+      if (info == nullptr) {
+        // nothing else to read
+        break;
+      }
+      continue;
+    }
+
+    if (info != nullptr && type == 1 && name == "scale") {
+      uint8_t scale;
+      if (!walker.read_u8(&scale)) {
+        return nullptr;
+      }
+      info->scale = int(int8_t(scale));
+      continue;
+    }
+
+    if (info != nullptr && name == "dimension") {
+      // dimension is a string since 1.16, and a number before it
+      std::string_view dim;
+      int32_t dim_id = 0;
+      if (type == 8) {
+        if (!walker.read_name(&dim)) {
+          return nullptr;
+        }
+        info->dimension = dim;
+        continue;
+      }
+      if (type == 1) {
+        uint8_t temp;
+        if (!walker.read_u8(&temp)) {
+          return nullptr;
+        }
+        dim_id = int8_t(temp);
+      } else if (type == 3) {
+        if (!walker.read_i32(&dim_id)) {
+          return nullptr;
+        }
+      } else {
+        if (!walker.skip_payload(type)) {
+          return nullptr;
+        }
+        continue;
+      }
+      switch (dim_id) {
+        case 0:
+          info->dimension = "minecraft:overworld";
+          break;
+        case -1:
+          info->dimension = "minecraft:the_nether";
+          break;
+        case 1:
+          info->dimension = "minecraft:the_end";
+          break;
+        default:
+          info->dimension = std::to_string(dim_id);
+      }
+      continue;
+    }
+
+    if (!walker.skip_payload(type)) {
+      return nullptr;
+    }
+  }
+  return colors;
+}
+
 const uint8_t *find_color_begin(const std::vector<uint8_t> &inflated,
                                 std::string *const error_info) {
   if (inflated.size() <= 128 * 128 * sizeof(char)) {
@@ -123,6 +416,15 @@ bool process_map_file(
     const char *filename,
     Eigen::Array<uint8_t, 128, 128, Eigen::RowMajor> *const dest,
     std::string *const error_info) {
+  std::vector<uint8_t> buffer;
+  return process_map_file(filename, dest, error_info, &buffer);
+}
+
+bool process_map_file(
+    const char *filename,
+    Eigen::Array<uint8_t, 128, 128, Eigen::RowMajor> *const dest,
+    std::string *const error_info, std::vector<uint8_t> *const buffer,
+    map_file_info *const info) {
 
   if (filename == nullptr || strlen(filename) <= 0) {
     if (error_info != nullptr)
@@ -130,9 +432,9 @@ bool process_map_file(
     return false;
   }
 
-  if (dest == nullptr) {
+  if (dest == nullptr || buffer == nullptr) {
     if (error_info != nullptr)
-      *error_info = "Invalid input : dest";
+      *error_info = "Invalid input : dest or buffer";
     return false;
   }
 
@@ -144,13 +446,18 @@ bool process_map_file(
     return false;
   }
 
-  std::vector<uint8_t> inflated;
-
-  if (!uncompress_map_file(filename, &inflated, error_info)) {
+  if (!uncompress_map_file(filename, buffer, error_info)) {
     return false;
   }
 
-  const uint8_t *const color_ptr = find_color_begin(inflated, error_info);
+  if (info != nullptr) {
+    *info = map_file_info{};
+  }
+  const uint8_t *color_ptr = find_color_by_nbt(*buffer, info);
+  if (color_ptr == nullptr) {
+    // fall back to searching the raw bytes, in case the nbt is malformed
+    color_ptr = find_color_begin(*buffer, error_info);
+  }
 
   if (color_ptr == nullptr) {
     return false;
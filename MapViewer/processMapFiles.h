@@ -38,4 +38,18 @@ bool process_map_file(
     Eigen::Array<uint8_t, 128, 128, Eigen::RowMajor> *const dest,
     std::string *const error_info);
 
+struct map_file_info {
+  int scale{0};
+  std::string dimension;
+};
+
+// Same as above, but the inflated file is stored in buffer. Reuse the buffer
+// when processing many files to avoid reallocating. Other fields of the map
+// are written to info if it's not null.
+bool process_map_file(
+    const char *filename,
+    Eigen::Array<uint8_t, 128, 128, Eigen::RowMajor> *const dest,
+    std::string *const error_info, std::vector<uint8_t> *const buffer,
+    map_file_info *const info = nullptr);
+
 #endif // PROCESSMAPFILES_H
@@ -0,0 +1,191 @@
+#include <map_index.h>
+#include <zlib.h>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using std::cout, std::endl;
+namespace stdfs = std::filesystem;
+
+using colors_t = std::array<uint8_t, 128 * 128>;
+
+// sha1 of the colors made by make_colors, computed by another sha1
+// implementation
+constexpr std::string_view sha1_of_zeros =
+    "897256b6709e1a4da9daba92b6bde39ccfccd8c1";
+constexpr std::string_view sha1_of_pattern =
+    "02a2dfe46b593b7eaaf31a7638ee016d53f67fcf";
+
+colors_t make_colors(bool pattern) {
+  colors_t ret;
+  for (size_t idx = 0; idx < ret.size(); idx++) {
+    ret[idx] = pattern ? uint8_t(idx % 64) : 0;
+  }
+  return ret;
+}
+
+void write_name(std::vector<uint8_t> &nbt, std::string_view name) {
+  nbt.emplace_back(uint8_t(name.size() >> 8));
+  nbt.emplace_back(uint8_t(name.size()));
+  nbt.insert(nbt.end(), name.begin(), name.end());
+}
+
+// Write a gzipped map data file like minecraft does, with only the tags read
+// by MapViewer.
+bool write_map(const stdfs::path &file, const colors_t &colors, int scale) {
+  std::vector<uint8_t> nbt;
+  nbt.emplace_back(10);
+  write_name(nbt, "");
+  nbt.emplace_back(10);
+  write_name(nbt, "data");
+
+  nbt.emplace_back(1);
+  write_name(nbt, "scale");
+  nbt.emplace_back(uint8_t(scale));
+
+  nbt.emplace_back(8);
+  write_name(nbt, "dimension");
+  write_name(nbt, "minecraft:overworld");
+
+  nbt.emplace_back(7);
+  write_name(nbt, "colors");
+  for (int shift : {24, 16, 8, 0}) {
+    nbt.emplace_back(uint8_t(colors.size() >> shift));
+  }
+  nbt.insert(nbt.end(), colors.begin(), colors.end());
+
+  nbt.emplace_back(0);
+  nbt.emplace_back(0);
+
+  gzFile gz = ::gzopen(file.string().c_str(), "wb");
+  if (gz == nullptr) {
+    return false;
+  }
+  const int written = ::gzwrite(gz, nbt.data(), unsigned(nbt.size()));
+  return ::gzclose(gz) == Z_OK && written == int(nbt.size());
+}
+
+std::string to_hex(const std::array<uint8_t, 20> &hash) {
+  std::string ret;
+  for (uint8_t byte : hash) {
+    char temp[3];
+    std::snprintf(temp, sizeof(temp), "%02x", byte);
+    ret += temp;
+  }
+  return ret;
+}
+
+bool check_result(const map_index::update_result &res, size_t reused,
+                  size_t read, size_t removed, const char *when) {
+  for (const auto &[filename, error] : res.errors) {
+    cout << "Error : failed to read " << filename << ", detail: " << error
+         << endl;
+  }
+  if (!res.errors.empty() || res.reused != reused || res.read != read ||
+      res.removed != removed) {
+    cout << "Error : " << when << ", " << res.reused << " reused, "
+         << res.read << " read and " << res.removed
+         << " removed, but expected " << reused << ", " << read << " and "
+         << removed << endl;
+    return false;
+  }
+  return true;
+}
+
+bool check_duplicates(const map_index &index,
+                      const std::vector<std::vector<size_t>> &expected,
+                      const char *when) {
+  if (index.find_duplicates() != expected) {
+    cout << "Error : " << when << ", find_duplicates gives "
+         << index.find_duplicates().size() << " groups, expected "
+         << expected.size() << endl;
+    return false;
+  }
+  return true;
+}
+
+int main() {
+  const stdfs::path dir =
+      stdfs::temp_directory_path() / "SlopeCraft_test_map_index";
+  stdfs::remove_all(dir);
+  stdfs::create_directories(dir / "data");
+  const stdfs::path data_dir = dir / "data";
+  const stdfs::path index_file = dir / "maps.index";
+
+  const colors_t zeros = make_colors(false);
+  const colors_t pattern = make_colors(true);
+  if (!write_map(data_dir / "map_0.dat", zeros, 0) ||
+      !write_map(data_dir / "map_1.dat", pattern, 2) ||
+      !write_map(data_dir / "map_2.dat", zeros, 1) ||
+      !write_map(data_dir / "unrelated.dat", zeros, 0)) {
+    cout << "Error : failed to write map files to " << data_dir << endl;
+    return 1;
+  }
+
+  map_index index;
+  if (!check_result(index.update(data_dir), 0, 3, 0, "first update")) {
+    return 1;
+  }
+  const auto &entries = index.entry_list();
+  if (entries[0].map_id != 0 || entries[1].map_id != 1 ||
+      entries[2].map_id != 2 || entries[1].scale != 2 ||
+      entries[1].dimension != "minecraft:overworld") {
+    cout << "Error : entries are not read correctly." << endl;
+    return 1;
+  }
+  if (to_hex(entries[0].colors_hash) != sha1_of_zeros ||
+      to_hex(entries[1].colors_hash) != sha1_of_pattern) {
+    cout << "Error : hash of colors is " << to_hex(entries[0].colors_hash)
+         << " and " << to_hex(entries[1].colors_hash) << ", expected "
+         << sha1_of_zeros << " and " << sha1_of_pattern << endl;
+    return 1;
+  }
+  if (!check_duplicates(index, {{0, 2}}, "first update")) {
+    return 1;
+  }
+
+  // unchanged files are reused by a loaded index
+  std::string error;
+  if (!index.save(index_file, &error)) {
+    cout << "Error : failed to save index, detail: " << error << endl;
+    return 1;
+  }
+  map_index loaded;
+  if (!loaded.load(index_file, &error)) {
+    cout << "Error : failed to load index, detail: " << error << endl;
+    return 1;
+  }
+  if (!check_result(loaded.update(data_dir), 3, 0, 0, "unchanged")) {
+    return 1;
+  }
+
+  // a changed file is read again. Its time is moved, since some file systems
+  // have coarse timestamps.
+  const stdfs::path map_1 = data_dir / "map_1.dat";
+  const auto old_time = stdfs::last_write_time(map_1);
+  if (!write_map(map_1, zeros, 2)) {
+    cout << "Error : failed to rewrite " << map_1 << endl;
+    return 1;
+  }
+  stdfs::last_write_time(map_1, old_time + std::chrono::seconds{2});
+  if (!check_result(loaded.update(data_dir), 2, 1, 0, "changed") ||
+      !check_duplicates(loaded, {{0, 1, 2}}, "changed")) {
+    return 1;
+  }
+
+  // removed files are removed from the index
+  stdfs::remove(data_dir / "map_0.dat");
+  if (!check_result(loaded.update(data_dir), 2, 0, 1, "removed") ||
+      !check_duplicates(loaded, {{0, 1}}, "removed")) {
+    return 1;
+  }
+
+  stdfs::remove_all(dir);
+  cout << "Success" << endl;
+  return 0;
+}
@@ -6,6 +6,8 @@
 #include <QTableWidget>
 #include <magic_enum.hpp>
 #include <QDesktopServices>
+#include <QCloseEvent>
+#include <QTimer>
 
 const QString SCWind::update_url{
     "https://api.github.com/repos/SlopeCraft/SlopeCraft/releases"};
@@ -197,6 +199,26 @@ SCWind::SCWind(QWidget *parent) : QMainWindow(parent), ui(new Ui::SCWind) {
 
   connect(this->ui->pb_manage_block_list, &QPushButton::clicked, this,
           &SCWind::on_ac_blocklist_triggered);
+  // run convert/build/export in background
+  {
+    this->executor = new task_executor{this};
+    this->pb_cancel_tasks = new QPushButton{tr("取消任务"), this};
+    this->pb_cancel_tasks->setEnabled(false);
+    this->ui->statusbar->addPermanentWidget(this->pb_cancel_tasks);
+    connect(this->pb_cancel_tasks, &QPushButton::clicked, this->executor,
+            &task_executor::cancel);
+    connect(this->executor, &task_executor::running_changed, this,
+            &SCWind::when_executor_running_changed);
+    connect(this->executor, &task_executor::progress_changed, this,
+            [this](int finished, int total) {
+              QProgressBar *bar = this->current_bar();
+              if (bar == nullptr) {
+                return;
+              }
+              bar->setRange(0, total);
+              bar->setValue(finished);
+            });
+  }
 }
 
 SCWind::~SCWind() {
@@ -246,6 +268,11 @@ SlopeCraft::color_table *SCWind::current_color_table() noexcept {
       //                           tr("您设置的方块列表可能存在错误"));
       return nullptr;
     }
+    // Colors matched by one task are reused by the others. The cache dir is
+    // removed on exit, so nothing is loaded and they are kept in memory only,
+    // trimmed by trim_color_caches.
+    [[maybe_unused]] const bool colors_loaded = ptr->load_color_cache(
+        this->cache_root_dir().toLocal8Bit().data(), nullptr);
 
     auto it = this->color_tables.emplace(settings, std::move(ptr));
     return it.first->second.get();
@@ -276,6 +303,66 @@ SlopeCraft::ui_callbacks SCWind::ui_callbacks() const noexcept {
   };
 }
 
+SlopeCraft::ui_callbacks SCWind::worker_ui_callbacks() const noexcept {
+  return SlopeCraft::ui_callbacks{
+      .wind = const_cast<SCWind *>(this),
+      .cb_keep_awake = nullptr,
+      .cb_report_error =
+          [](void *wind, SCL_errorFlag ef, const char *msg) {
+            if (ef == SCL_errorFlag::OPERATION_CANCELLED) {
+              // cancelled by the user, nothing to report
+              return;
+            }
+            SCWind *self = reinterpret_cast<SCWind *>(wind);
+            QMetaObject::invokeMethod(
+                self,
+                [self, ef, message = QString::fromUtf8(msg)]() {
+                  self->report_error(ef, message.toUtf8().data());
+                },
+                Qt::QueuedConnection);
+          },
+      // several tasks run at the same time, none of them owns the title
+      .cb_report_working_status = nullptr,
+  };
+}
+
+void SCWind::when_executor_running_changed(bool running) noexcept {
+  // Batches are waited for in a nested event loop, so nothing but the cancel
+  // button may take user input, including the other windows.
+  if (running) {
+    for (QWidget *w : QApplication::topLevelWidgets()) {
+      if (w != this && w->isVisible() && w->isEnabled()) {
+        w->setEnabled(false);
+        this->windows_disabled_by_tasks.emplace_back(w);
+      }
+    }
+  } else {
+    for (auto &w : this->windows_disabled_by_tasks) {
+      if (w != nullptr) {
+        w->setEnabled(true);
+      }
+    }
+    this->windows_disabled_by_tasks.clear();
+  }
+  this->ui->centralwidget->setEnabled(!running);
+  this->ui->menubar->setEnabled(!running);
+  this->pb_cancel_tasks->setEnabled(running);
+  if (!running && this->close_requested) {
+    QTimer::singleShot(0, this, &SCWind::close);
+  }
+}
+
+void SCWind::closeEvent(QCloseEvent *event) {
+  if (this->executor->is_running()) {
+    // workers are using tasks of this window, wait for them to stop
+    this->close_requested = true;
+    this->executor->cancel();
+    event->ignore();
+    return;
+  }
+  QMainWindow::closeEvent(event);
+}
+
 SlopeCraft::progress_callbacks progress_callback(QProgressBar *bar) noexcept {
   return SlopeCraft::progress_callbacks{
       .widget = bar,
@@ -699,8 +786,7 @@ SCWind::convert_image(int idx) noexcept {
   return this->convert_image(this->tasks[idx]);
 }
 
-std::unique_ptr<SlopeCraft::converted_image, SlopeCraft::deleter>
-SCWind::convert_image(const cvt_task &task) noexcept {
+const SlopeCraft::color_table *SCWind::color_table_for_convert() noexcept {
   auto ctable = this->current_color_table();
   if (ctable == nullptr) {
     QMessageBox::critical(
@@ -724,49 +810,238 @@ SCWind::convert_image(const cvt_task &task) noexcept {
       return nullptr;
     }
   }
+  return ctable;
+}
 
-  const QImage &raw = task.original_image;
-  {
-    SlopeCraft::const_image_reference img{
-        .data = (const uint32_t *)raw.scanLine(0),
-        .rows = static_cast<size_t>(raw.height()),
-        .cols = static_cast<size_t>(raw.width()),
-    };
-    auto cvted_img = ctable->convert_image(img, this->current_convert_option());
+std::unique_ptr<SlopeCraft::converted_image, SlopeCraft::deleter>
+SCWind::convert_image(const cvt_task &task) noexcept {
+  const cvt_task *const taskp = &task;
+  auto results = this->convert_images({&taskp, 1});
+  return std::move(results[0]);
+}
+
+std::unique_ptr<SlopeCraft::converted_image, SlopeCraft::deleter>
+SCWind::convert_image_progressively(int idx) noexcept {
+  assert(idx >= 0);
+  assert(idx < (int)this->tasks.size());
+  const auto ctable = this->color_table_for_convert();
+  if (ctable == nullptr) {
+    return nullptr;
+  }
+
+  const QImage raw = this->tasks[idx].original_image;
+  std::unique_ptr<SlopeCraft::progressive_preview, SlopeCraft::deleter>
+      preview{ctable->create_progressive_preview(
+          SlopeCraft::const_image_reference{
+              .data = (const uint32_t *)raw.scanLine(0),
+              .rows = static_cast<size_t>(raw.height()),
+              .cols = static_cast<size_t>(raw.width()),
+              .stride = static_cast<size_t>(raw.bytesPerLine()) /
+                        sizeof(uint32_t),
+          })};
+  if (preview == nullptr) {
+    return nullptr;
+  }
+
+  SlopeCraft::convert_option option = this->current_convert_option();
+  option.progress = {};
+  option.ui = this->worker_ui_callbacks();
+
+  // The executor waits in a local event loop, where the timer polls passes.
+  QTimer timer;
+  timer.setInterval(100);
+  int shown_passes = 0;
+  connect(&timer, &QTimer::timeout, this, [this, &preview, &shown_passes]() {
+    if (preview->finished_passes() <= shown_passes) {
+      return;
+    }
+    QImage img{int(preview->cols()), int(preview->rows()),
+               QImage::Format_ARGB32};
+    shown_passes = preview->get_preview((uint32_t *)img.scanLine(0));
+    this->ui->lb_cvted_image->setPixmap(QPixmap::fromImage(img));
+    this->ui->tw_cvt_image->setCurrentIndex(1);
+  });
+  timer.start();
+
+  auto results = this->executor->run(
+      1, [&preview, &option](size_t, const SlopeCraft::cancel_token &token) {
+        SlopeCraft::convert_option opt = option;
+        opt.cancel = token;
+        return std::unique_ptr<SlopeCraft::converted_image,
+                               SlopeCraft::deleter>{
+            preview->run(opt) ? preview->take_result() : nullptr};
+      });
+  timer.stop();
+  this->trim_color_caches();
+  return std::move(results[0]);
+}
+
+std::vector<std::unique_ptr<SlopeCraft::converted_image, SlopeCraft::deleter>>
+SCWind::convert_images(std::span<const cvt_task *const> tasks) noexcept {
+  const auto ctable = this->color_table_for_convert();
+  if (ctable == nullptr) {
+    return std::vector<
+        std::unique_ptr<SlopeCraft::converted_image, SlopeCraft::deleter>>(
+        tasks.size());
+  }
+
+  SlopeCraft::convert_option option = this->current_convert_option();
+  option.progress = {};
+  option.ui = this->worker_ui_callbacks();
+
+  // QImage is implicitly shared, so workers can hold copies cheaply
+  std::vector<QImage> images;
+  images.reserve(tasks.size());
+  for (const cvt_task *taskp : tasks) {
+    images.emplace_back(taskp->original_image);
+  }
+
+  auto results = this->executor->run(
+      images.size(), [ctable, &images, &option](
+                         size_t i, const SlopeCraft::cancel_token &token) {
+        const QImage &raw = images[i];
+        SlopeCraft::const_image_reference img{
+            .data = (const uint32_t *)raw.scanLine(0),
+            .rows = static_cast<size_t>(raw.height()),
+            .cols = static_cast<size_t>(raw.width()),
+            .stride = static_cast<size_t>(raw.bytesPerLine()) /
+                      sizeof(uint32_t),
+        };
+        SlopeCraft::convert_option opt = option;
+        opt.cancel = token;
+        return std::unique_ptr<SlopeCraft::converted_image,
+                               SlopeCraft::deleter>{
+            ctable->convert_image(img, opt)};
+      });
+  this->trim_color_caches();
+  return results;
+}
+
+void SCWind::trim_color_caches() noexcept {
+  // about 64 bytes each, enough for colors of several large photos
+  constexpr size_t max_cached_colors = size_t(1) << 18;
+  const size_t capacity =
+      this->should_auto_cache(true) ? 0 : max_cached_colors;
+  for (auto &[settings, table] : this->color_tables) {
+    table->trim_color_cache(capacity);
+  }
+}
+
+bool SCWind::convert_all_if_need(std::span<cvt_task *const> tasks) noexcept {
+  const auto table = this->current_color_table();
+  const auto opt = this->current_convert_option();
+
+  std::vector<cvt_task *> to_convert;
+  for (cvt_task *taskp : tasks) {
+    if (not taskp->is_converted_with(table, opt)) {
+      to_convert.emplace_back(taskp);
+    }
+  }
+  if (to_convert.empty()) {
+    return true;
+  }
 
-    return std::unique_ptr<SlopeCraft::converted_image, SlopeCraft::deleter>{
-        cvted_img};
+  auto results = this->convert_images(to_convert);
+  bool ok = true;
+  for (size_t i = 0; i < to_convert.size(); i++) {
+    if (results[i] == nullptr) {
+      ok = false;
+      continue;
+    }
+    to_convert[i]->set_converted(table, opt, std::move(results[i]));
   }
+  return ok;
 }
 
-const SlopeCraft::converted_image &SCWind::convert_if_need(
+bool SCWind::convert_and_build_all_if_need(
+    std::span<cvt_task *const> tasks) noexcept {
+  if (!this->convert_all_if_need(tasks)) {
+    return false;
+  }
+  const auto table = this->current_color_table();
+  const auto cvt_opt = this->current_convert_option();
+  const auto build_opt = this->current_build_option();
+
+  const QString cache_root = this->cache_root_dir();
+  std::vector<convert_result *> to_build;
+  std::vector<const SlopeCraft::converted_image *> cvted_images;
+  for (cvt_task *taskp : tasks) {
+    auto &cvt_result = taskp->converted_images.at({table, cvt_opt});
+    // structures cached on disk are loaded instead of rebuilt
+    if (cvt_result.load_build_cache(*table, build_opt, cache_root) !=
+        nullptr) {
+      continue;
+    }
+    to_build.emplace_back(&cvt_result);
+    cvted_images.emplace_back(cvt_result.converted_image.get());
+  }
+  if (to_build.empty()) {
+    return true;
+  }
+
+  auto structures = this->build_3D(cvted_images);
+  bool ok = true;
+  for (size_t i = 0; i < to_build.size(); i++) {
+    if (structures[i] == nullptr) {
+      ok = false;
+      continue;
+    }
+    to_build[i]->set_built(build_opt, std::move(structures[i]));
+  }
+  return ok;
+}
+
+const SlopeCraft::converted_image *SCWind::convert_if_need(
     cvt_task &task) noexcept {
   const auto table = this->current_color_table();
   const auto opt = this->current_convert_option();
   if (not task.is_converted_with(table, opt)) {
     auto cvted = this->convert_image(task);
-    assert(cvted);
+    if (cvted == nullptr) {
+      return nullptr;
+    }
     task.set_converted(table, opt, std::move(cvted));
   }
 
   auto &cvted = task.converted_images[{table, opt}].converted_image;
   assert(cvted != nullptr);
-  return *cvted;
+  return cvted.get();
 }
 
 std::unique_ptr<SlopeCraft::structure_3D, SlopeCraft::deleter> SCWind::build_3D(
     const SlopeCraft::converted_image &cvted) noexcept {
-  auto ctable = this->current_color_table();
-  const auto opt = this->current_build_option();
-  auto str = ctable->build(cvted, opt);
-  return std::unique_ptr<SlopeCraft::structure_3D, SlopeCraft::deleter>{str};
+  const SlopeCraft::converted_image *const cvtedp = &cvted;
+  auto results = this->build_3D({&cvtedp, 1});
+  return std::move(results[0]);
+}
+
+std::vector<std::unique_ptr<SlopeCraft::structure_3D, SlopeCraft::deleter>>
+SCWind::build_3D(
+    std::span<const SlopeCraft::converted_image *const> cvted_images) noexcept {
+  const auto ctable = this->current_color_table();
+  SlopeCraft::build_options option = this->current_build_option();
+  option.ui = this->worker_ui_callbacks();
+  option.main_progressbar = {};
+  option.sub_progressbar = {};
+
+  return this->executor->run(
+      cvted_images.size(), [ctable, cvted_images, &option](
+                               size_t i, const SlopeCraft::cancel_token &token) {
+        SlopeCraft::build_options opt = option;
+        opt.cancel = token;
+        return std::unique_ptr<SlopeCraft::structure_3D, SlopeCraft::deleter>{
+            ctable->build(*cvted_images[i], opt)};
+      });
 }
 
-std::tuple<const SlopeCraft::converted_image &,
-           const SlopeCraft::structure_3D &>
+std::tuple<const SlopeCraft::converted_image *,
+           const SlopeCraft::structure_3D *>
 SCWind::convert_and_build_if_need(cvt_task &task) noexcept {
   const auto table = this->current_color_table();
-  const auto &cvted = this->convert_if_need(task);
+  const auto cvted = this->convert_if_need(task);
+  if (cvted == nullptr) {
+    return {nullptr, nullptr};
+  }
 
   assert(task.is_converted_with(table, this->current_convert_option()));
   auto &cvt_result =
@@ -776,14 +1051,16 @@ SCWind::convert_and_build_if_need(cvt_task &task) noexcept {
   if (auto str_3D = cvt_result.load_build_cache(*table, build_opt,
                                                 this->cache_root_dir())) {
     // The 3D structure is built, it exists in memory or can be loaded
-    return {cvted, *str_3D};
+    return {cvted, str_3D};
   }
   // Build 3D structure now
-  auto s = this->build_3D(cvted);
+  auto s = this->build_3D(*cvted);
   auto ptr = s.get();
-  assert(ptr != nullptr);
+  if (ptr == nullptr) {
+    return {cvted, nullptr};
+  }
   cvt_result.set_built(build_opt, std::move(s));
-  return {cvted, *ptr};
+  return {cvted, ptr};
 }
 
 // void SCWind::kernel_make_cvt_cache() noexcept {
@@ -817,7 +1094,14 @@ QImage get_converted_image(const SlopeCraft::converted_image &cvted) noexcept {
   QImage img{
       QSize{static_cast<int>(cvted.cols()), static_cast<int>(cvted.rows())},
       QImage::Format::Format_ARGB32};
-  cvted.get_converted_image(reinterpret_cast<uint32_t *>(img.scanLine(0)));
+  const SlopeCraft::image_reference dest{
+      .data = reinterpret_cast<uint32_t *>(img.scanLine(0)),
+      .rows = cvted.rows(),
+      .cols = cvted.cols(),
+      .stride = static_cast<size_t>(img.bytesPerLine()) / sizeof(uint32_t),
+  };
+  [[maybe_unused]] const bool ok = cvted.get_converted_image(dest);
+  assert(ok);
   return img;
 }
 
@@ -4,7 +4,10 @@
 #include <tuple>
 #include <vector>
 #include <memory>
+#include <span>
 #include <QMainWindow>
+#include <QPointer>
+#include <QPushButton>
 #include <QRadioButton>
 #include <QProgressBar>
 #include <QTranslator>
@@ -15,6 +18,7 @@
 #include "PoolModel.h"
 #include "ExportTableModel.h"
 #include "MemoryPolicyDialog.h"
+#include "task_executor.h"
 
 class SCWind;
 
@@ -171,6 +175,13 @@ class SCWind : public QMainWindow {
   memory_policy mem_policy{};
   // QString fileonly_export_dir{""};
 
+  task_executor* executor{nullptr};
+  QPushButton* pb_cancel_tasks{nullptr};
+  // close the window after the running tasks are cancelled
+  bool close_requested{false};
+  // other windows that are disabled while tasks run
+  std::vector<QPointer<QWidget>> windows_disabled_by_tasks;
+
  public:
   SlopeCraft::GA_converter_option GA_option{};
   task_pool tasks;
@@ -180,6 +191,8 @@ class SCWind : public QMainWindow {
   SlopeCraft::convert_option current_convert_option() noexcept;
 
   SlopeCraft::ui_callbacks ui_callbacks() const noexcept;
+  // Callbacks that can be called in worker threads of executor
+  SlopeCraft::ui_callbacks worker_ui_callbacks() const noexcept;
 
   std::array<QRadioButton*, 21 - 12 + 1> version_buttons() noexcept;
   std::array<const QRadioButton*, 21 - 12 + 1> version_buttons() const noexcept;
@@ -260,16 +273,50 @@ class SCWind : public QMainWindow {
                                 SlopeCraft::deleter>
   convert_image(const cvt_task&) noexcept;
 
-  [[nodiscard]] const SlopeCraft::converted_image& convert_if_need(
+  // Convert a task in executor, and show the preview of each pass in
+  // lb_cvted_image while it's running.
+  [[nodiscard]] std::unique_ptr<SlopeCraft::converted_image,
+                                SlopeCraft::deleter>
+  convert_image_progressively(int idx) noexcept;
+
+  // Convert tasks concurrently in executor. Results are nullptr if the
+  // conversion failed or is cancelled.
+  [[nodiscard]] std::vector<
+      std::unique_ptr<SlopeCraft::converted_image, SlopeCraft::deleter>>
+  convert_images(std::span<const cvt_task* const> tasks) noexcept;
+
+  // Convert all tasks that are not converted, returns false if any of them
+  // failed or is cancelled.
+  [[nodiscard]] bool convert_all_if_need(std::span<cvt_task* const>) noexcept;
+  // Convert and build all tasks that are not built, and load structures that
+  // are cached. All of them are in memory afterwards, so pass small batches.
+  [[nodiscard]] bool convert_and_build_all_if_need(
+      std::span<cvt_task* const>) noexcept;
+
+  [[nodiscard]] const SlopeCraft::converted_image* convert_if_need(
       cvt_task&) noexcept;
 
-  [[nodiscard]] std::tuple<const SlopeCraft::converted_image&,
-                           const SlopeCraft::structure_3D&>
+  [[nodiscard]] std::tuple<const SlopeCraft::converted_image*,
+                           const SlopeCraft::structure_3D*>
   convert_and_build_if_need(cvt_task&) noexcept;
 
   [[nodiscard]] std::unique_ptr<SlopeCraft::structure_3D, SlopeCraft::deleter>
   build_3D(const SlopeCraft::converted_image&) noexcept;
 
+  [[nodiscard]] std::vector<
+      std::unique_ptr<SlopeCraft::structure_3D, SlopeCraft::deleter>>
+  build_3D(std::span<const SlopeCraft::converted_image* const>) noexcept;
+
+  // Warn if the color table can't be used for conversion
+  [[nodiscard]] const SlopeCraft::color_table*
+  color_table_for_convert() noexcept;
+
+  // Colors matched by conversions are kept by color tables, trim them after
+  // each batch to follow the memory policy.
+  void trim_color_caches() noexcept;
+
+  void when_executor_running_changed(bool running) noexcept;
+
   std::tuple<const SlopeCraft::converted_image*,
              const SlopeCraft::structure_3D*>
   load_selected_3D() noexcept;
@@ -311,6 +358,9 @@ class SCWind : public QMainWindow {
   [[nodiscard]] tl::expected<QString, QString> get_command(
       const SlopeCraft::converted_image&, int begin_idx) const noexcept;
 
+ protected:
+  void closeEvent(QCloseEvent* event) override;
+
  signals:
   void image_changed();
 };
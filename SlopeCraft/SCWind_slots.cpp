@@ -284,8 +284,9 @@ void SCWind::on_pb_cvt_current_clicked() noexcept {
   }
 
   {
-    auto cvted = this->convert_image(sel.value());
+    auto cvted = this->convert_image_progressively(sel.value());
     if (!cvted) {
+      this->refresh_current_cvt_display(sel.value());
       return;
     }
     this->tasks[sel.value()].set_converted(this->current_color_table(),
@@ -302,16 +303,13 @@ void SCWind::on_pb_cvt_current_clicked() noexcept {
 }
 
 void SCWind::on_pb_cvt_all_clicked() noexcept {
-  for (int idx = 0; idx < (int)this->tasks.size(); idx++) {
-    auto &task = this->tasks[idx];
-    if (task.is_converted_with(this->current_color_table(),
-                               this->current_convert_option())) {
-      continue;
-    }
-    auto cvted = this->convert_image(idx);
-    task.set_converted(this->current_color_table(),
-                       this->current_convert_option(), std::move(cvted));
+  std::vector<cvt_task *> all_tasks;
+  all_tasks.reserve(this->tasks.size());
+  for (auto &task : this->tasks) {
+    all_tasks.emplace_back(&task);
   }
+  // images that failed or are cancelled stay unconverted
+  [[maybe_unused]] const bool ok = this->convert_all_if_need(all_tasks);
   emit this->image_changed();
 }
 
@@ -498,14 +496,6 @@ void SCWind::on_pb_preview_compress_effect_clicked() noexcept {
     return;                                                      \
   }
 
-#define SC_PRIVATE_MARCO_PROCESS_EXPORT_ERROR_on_pb_export_all_clicked \
-  if (report_err_fun(export_name, taskp) ==                            \
-      QMessageBox::StandardButton::Ignore) {                           \
-    continue;                                                          \
-  } else {                                                             \
-    return;                                                            \
-  }
-
 void SCWind::on_pb_export_all_clicked() noexcept {
   {
     auto ctable = this->current_color_table();
@@ -614,54 +604,120 @@ void SCWind::on_pb_export_all_clicked() noexcept {
     }
   }
 
-  for (auto taskp : tasks_to_export) {
+  const auto worker_ui = this->worker_ui_callbacks();
+  opt_lite.ui = opt_nbt.ui = opt_WE.ui = opt_fd.ui = worker_ui;
+  opt_lite.progressbar = opt_nbt.progressbar = opt_WE.progressbar =
+      opt_fd.progressbar = {};
+  const auto ctable = this->current_color_table();
+
+  // Tasks are built and exported batch by batch, and structures of finished
+  // batches are cached, so that a large batch doesn't stay in memory at once.
+  const size_t batch_size = this->executor->max_parallel_jobs();
+  int fail_count = 0;
+  QString fail_tasks{""};
+  // exports that are cancelled or never started
+  int cancel_count = 0;
+  for (size_t beg = 0; beg < tasks_to_export.size(); beg += batch_size) {
+    if (cancel_count > 0) {
+      cancel_count += int(tasks_to_export.size() - beg);
+      break;
+    }
+    const size_t end = std::min(beg + batch_size, tasks_to_export.size());
+    const std::span<cvt_task *const> batch{tasks_to_export.data() + beg,
+                                           end - beg};
+
     if (this->should_auto_cache(false)) {
       this->auto_cache_3D();
     }
+    if (!this->convert_and_build_all_if_need(batch)) {
+      // errors are reported by callbacks, or the user cancelled it
+      cancel_count += int(tasks_to_export.size() - beg);
+      break;
+    }
 
-    auto [cvted, str3D] = this->convert_and_build_if_need(*taskp);
-
-    const std::string export_name =
-        get_export_name(*taskp).toLocal8Bit().data();
-
-    auto report_err_fun = [this](std::string_view export_name,
-                                 const cvt_task *taskp) {
-      return QMessageBox::warning(
-          this, tr("导出失败"),
-          tr("导出%1时失败。原图像文件名为%"
-             "2\n点击 Ignore 将跳过这个图像，点击 Cancel 将放弃导出任务。")
-              .arg(export_name.data(), taskp->filename),
-          QMessageBox::StandardButtons{QMessageBox::StandardButton::Ignore,
-                                       QMessageBox::StandardButton::Cancel});
-    };
-
-    switch (export_type) {
-      case export_type::litematica:
-        if (!str3D.export_litematica(export_name.c_str(), opt_lite)) {
-          SC_PRIVATE_MARCO_PROCESS_EXPORT_ERROR_on_pb_export_all_clicked;
-        }
-        break;
-
-      case export_type::vanilla_structure:
-        if (!str3D.export_vanilla_structure(export_name.c_str(), opt_nbt)) {
-          SC_PRIVATE_MARCO_PROCESS_EXPORT_ERROR_on_pb_export_all_clicked;
-        }
-        break;
-      case export_type::WE_schem:
-        if (!str3D.export_WE_schem(export_name.c_str(), opt_WE)) {
-          SC_PRIVATE_MARCO_PROCESS_EXPORT_ERROR_on_pb_export_all_clicked;
-        }
-        break;
-      case export_type::flat_diagram:
-        if (!str3D.export_flat_diagram(export_name.c_str(),
-                                       *this->current_color_table(), opt_fd)) {
-          SC_PRIVATE_MARCO_PROCESS_EXPORT_ERROR_on_pb_export_all_clicked;
-        }
-        break;
-      default:
+    // Structures are loaded in the UI thread, and exported concurrently.
+    std::vector<const SlopeCraft::structure_3D *> structures;
+    std::vector<std::string> export_names;
+    structures.reserve(batch.size());
+    export_names.reserve(batch.size());
+    for (auto taskp : batch) {
+      auto [cvted, str3D] = this->convert_and_build_if_need(*taskp);
+      if (str3D == nullptr) {
         return;
+      }
+      structures.emplace_back(str3D);
+      export_names.emplace_back(get_export_name(*taskp).toLocal8Bit().data());
+    }
+
+    // nullopt means skipped or cancelled
+    auto results = this->executor->run(
+        structures.size(),
+        [&](size_t i,
+            const SlopeCraft::cancel_token &token) -> std::optional<bool> {
+          const auto &str3D = *structures[i];
+          const char *const export_name = export_names[i].c_str();
+          bool ok = false;
+          switch (export_type) {
+            case export_type::litematica: {
+              auto opt = opt_lite;
+              opt.cancel = token;
+              ok = str3D.export_litematica(export_name, opt);
+              break;
+            }
+            case export_type::vanilla_structure: {
+              auto opt = opt_nbt;
+              opt.cancel = token;
+              ok = str3D.export_vanilla_structure(export_name, opt);
+              break;
+            }
+            case export_type::WE_schem: {
+              auto opt = opt_WE;
+              opt.cancel = token;
+              ok = str3D.export_WE_schem(export_name, opt);
+              break;
+            }
+            case export_type::flat_diagram: {
+              auto opt = opt_fd;
+              opt.cancel = token;
+              ok = str3D.export_flat_diagram(export_name, *ctable, opt);
+              break;
+            }
+            default:
+              return std::nullopt;
+          }
+          if (!ok && token.is_cancelled()) {
+            return std::nullopt;
+          }
+          return ok;
+        });
+
+    for (size_t i = 0; i < results.size(); i++) {
+      if (!results[i].has_value()) {
+        cancel_count++;
+        continue;
+      }
+      if (results[i].value()) {
+        continue;
+      }
+      fail_count++;
+      fail_tasks.append(
+          QStringLiteral("%1 (%2)\n")
+              .arg(export_names[i].c_str(), batch[i]->filename));
     }
   }
+  if (this->should_auto_cache(false)) {
+    this->auto_cache_3D();
+  }
+
+  if (fail_count > 0) {
+    QMessageBox::warning(this, tr("%1 个文件导出失败").arg(fail_count),
+                         tr("导出失败的文件依次为：\n%1").arg(fail_tasks));
+  }
+  if (cancel_count > 0) {
+    QMessageBox::information(
+        this, tr("导出未完成"),
+        tr("%1 个文件因取消或出错而没有导出。").arg(cancel_count));
+  }
 }
 
 void SCWind::on_pb_export_file_clicked() noexcept {
@@ -713,7 +769,13 @@ void SCWind::on_pb_export_file_clicked() noexcept {
   QString fail_tasks = "";
   for (int idx = 0; idx < int(this->tasks.size()); idx++) {
     auto &task = this->tasks.at(idx);
-    auto &cvted_img = this->convert_if_need(task);
+    const auto cvted_img = this->convert_if_need(task);
+    if (cvted_img == nullptr) {
+      fail_count++;
+      fail_tasks.append(task.filename);
+      fail_tasks.push_back('\n');
+      continue;
+    }
     //    this->kernel_set_image(idx);
     //    bool need_to_convert{true};
     //    if (task.is_converted()) {
@@ -737,7 +799,7 @@ void SCWind::on_pb_export_file_clicked() noexcept {
         .progress = progress_callback(this->ui->pbar_export),
         .ui = this->ui_callbacks(),
     };
-    const bool ok = cvted_img.export_map_data(option);
+    const bool ok = cvted_img->export_map_data(option);
     if (!ok) {
       fail_count++;
       fail_tasks.append(task.filename);
@@ -856,6 +918,8 @@ void SCWind::connect_slots() noexcept {
 void SCWind::on_ac_about_triggered() noexcept {
   QString info;
   info += QStringLiteral("SlopeCraft %1").arg(SlopeCraft::SCL_getSCLVersion());
+  info += "\n";
+  info += QStringLiteral("SIMD: %1").arg(SlopeCraft::SCL_get_simd_arch());
   info += "\n\n";
   info +=
       tr("SlopeCraft 是一款由 ToKiNoBug 开发的立体地图画生成器，主要用于"
@@ -218,6 +218,7 @@ struct convert_result {
     opt.ui = {};
     opt.main_progressbar = {};
     opt.sub_progressbar = {};
+    opt.cancel = {};
     auto it = this->built_structures.find(opt);
     if (it == built_structures.end()) {
       this->built_structures.emplace(opt,
@@ -282,6 +283,7 @@ struct cvt_task {
     }
     option.ui = {};
     option.progress = {};
+    option.cancel = {};
     convert_input cvt_input = convert_input{table, option};
     auto it = this->converted_images.find(cvt_input);
     if (it == this->converted_images.end()) {
@@ -0,0 +1,46 @@
+#include "task_executor.h"
+#include <QEventLoop>
+#include <QThread>
+#include <QTimer>
+#include <algorithm>
+
+task_executor::task_executor(QObject* parent) : QObject{parent} {
+  // Each job is parallelized with OpenMP inside SlopeCraftL, so fewer jobs
+  // run at the same time to avoid oversubscribing the cpu.
+  this->pool.setMaxThreadCount(std::max(1, QThread::idealThreadCount() / 2));
+}
+
+task_executor::~task_executor() {
+  this->cancel();
+  this->pool.waitForDone();
+}
+
+void task_executor::cancel() noexcept {
+  if (this->current_batch != nullptr) {
+    this->current_batch->cancelled = true;
+  }
+}
+
+void task_executor::start_job(std::function<void()> job) noexcept {
+  this->pool.start(std::move(job));
+}
+
+void task_executor::wait_for(const std::shared_ptr<batch_state>& batch,
+                             size_t total) noexcept {
+  if (batch->finished >= total) {
+    emit this->progress_changed(int(total), int(total));
+    return;
+  }
+  QEventLoop loop;
+  QTimer timer;
+  timer.setInterval(50);
+  connect(&timer, &QTimer::timeout, &loop, [this, &batch, &loop, total]() {
+    const size_t finished = batch->finished;
+    emit this->progress_changed(int(finished), int(total));
+    if (finished >= total) {
+      loop.quit();
+    }
+  });
+  timer.start();
+  loop.exec();
+}
@@ -0,0 +1,103 @@
+#ifndef SLOPECRAFT_SLOPECRAFT_TASK_EXECUTOR_H
+#define SLOPECRAFT_SLOPECRAFT_TASK_EXECUTOR_H
+
+#include <QObject>
+#include <QThreadPool>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#include <SlopeCraftL.h>
+
+// Runs convert/build/export jobs in a thread pool, so that several tasks are
+// processed concurrently and the UI thread only waits for them.
+class task_executor : public QObject {
+  Q_OBJECT
+ private:
+  struct batch_state {
+    std::atomic<bool> cancelled{false};
+    std::atomic<size_t> finished{0};
+  };
+
+  QThreadPool pool;
+  std::shared_ptr<batch_state> current_batch{nullptr};
+
+  void start_job(std::function<void()> job) noexcept;
+  void wait_for(const std::shared_ptr<batch_state>& batch,
+                size_t total) noexcept;
+
+  [[nodiscard]] static SlopeCraft::cancel_token cancel_token_of(
+      batch_state& batch) noexcept {
+    return SlopeCraft::cancel_token{
+        .handle = &batch,
+        .cb_is_cancelled =
+            [](void* handle) {
+              return reinterpret_cast<batch_state*>(handle)->cancelled.load();
+            },
+    };
+  }
+
+ public:
+  explicit task_executor(QObject* parent = nullptr);
+  ~task_executor();
+
+  [[nodiscard]] inline bool is_running() const noexcept {
+    return this->current_batch != nullptr;
+  }
+
+  /// Count of jobs that run at the same time.
+  [[nodiscard]] inline size_t max_parallel_jobs() const noexcept {
+    return size_t(std::max(1, this->pool.maxThreadCount()));
+  }
+
+  /// Cancel the running batch. Jobs that haven't started are skipped, and
+  /// running jobs see it through their cancel_token.
+  void cancel() noexcept;
+
+  /// Run work(i, token) for i in [0, count) in the thread pool, and wait for
+  /// all of them in a local event loop so that the UI keeps responding.
+  /// Results are in the same order, the result of a skipped job is
+  /// default-constructed. Batches can't be nested, so everything that can
+  /// start another batch must be disabled on running_changed. work must not
+  /// touch widgets, use QMetaObject::invokeMethod to reach the UI thread.
+  template <class fun_t>
+  auto run(size_t count, fun_t&& work) noexcept -> std::vector<
+      std::invoke_result_t<fun_t&, size_t, const SlopeCraft::cancel_token&>> {
+    using result_t =
+        std::invoke_result_t<fun_t&, size_t, const SlopeCraft::cancel_token&>;
+    // std::vector<bool> can't be written by several threads
+    static_assert(!std::is_same_v<result_t, bool>);
+    auto results = std::make_shared<std::vector<result_t>>(count);
+    if (this->is_running() || count <= 0) {
+      return std::move(*results);
+    }
+
+    auto batch = std::make_shared<batch_state>();
+    const SlopeCraft::cancel_token token = cancel_token_of(*batch);
+    this->current_batch = batch;
+    emit this->running_changed(true);
+    emit this->progress_changed(0, int(count));
+
+    for (size_t i = 0; i < count; i++) {
+      this->start_job([i, batch, results, token, &work]() {
+        if (!batch->cancelled) {
+          (*results)[i] = work(i, token);
+        }
+        batch->finished++;
+      });
+    }
+    this->wait_for(batch, count);
+
+    this->current_batch = nullptr;
+    emit this->running_changed(false);
+    return std::move(*results);
+  }
+
+ signals:
+  void running_changed(bool running);
+  void progress_changed(int finished, int total);
+};
+
+#endif  // SLOPECRAFT_SLOPECRAFT_TASK_EXECUTOR_H
@@ -62,6 +62,17 @@ namespace SlopeCraft {
 extern const float RGBBasicSource[256 * 3];
 extern const std::unique_ptr<const colorset_basic_t> basic_colorset;
 
+/// Report OPERATION_CANCELLED if cancelled or timed out.
+inline bool report_if_cancelled(const cancel_token &cancel,
+                                const ui_callbacks &ui) noexcept {
+  if (!cancel.is_cancelled()) {
+    return false;
+  }
+  ui.report_error(errorFlag::OPERATION_CANCELLED,
+                  "The operation is cancelled or exceeded its deadline.");
+  return true;
+}
+
 }  // namespace SlopeCraft
 
 #define SC_HASH_ADD_DATA(hasher, obj) hasher.process_bytes(&obj, sizeof(obj));
@@ -433,6 +433,8 @@ double SCL_EXPORT SCL_getMutationProb(const GA_converter_option *a) {
 
 SCL_EXPORT const char *SCL_getSCLVersion() { return SC_VERSION_STR; }
 
+SCL_EXPORT const char *SCL_get_simd_arch() { return colordiff_simd_arch(); }
+
 SCL_EXPORT SCL_gameVersion SCL_basecolor_version(uint8_t basecolor) {
   if (basecolor <= 51) {
     return SCL_gameVersion::ANCIENT;
@@ -463,6 +465,9 @@ SCL_EXPORT void SCL_destroy_color_table(color_table *c) { delete c; }
 
 SCL_EXPORT void SCL_destroy_converted_image(converted_image *c) { delete c; }
 SCL_EXPORT void SCL_destroy_structure_3D(structure_3D *s) { delete s; }
+SCL_EXPORT void SCL_destroy_progressive_preview(progressive_preview *p) {
+  delete p;
+}
 
 SCL_EXPORT void SCL_get_base_color_ARGB32(uint32_t dest[64]) {
   for (int bc = 0; bc < 64; bc++) {
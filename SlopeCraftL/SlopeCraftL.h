@@ -25,6 +25,7 @@ This file is part of SlopeCraft.
 #include <cstdint>
 #include <cstddef>
 #include <cstring>
+#include <chrono>
 
 #include "SlopeCraftL_export.h"
 
@@ -241,6 +242,34 @@ struct ui_callbacks {
   }
 };
 
+// added in v5.3
+/// Lets a caller abort a long operation from another thread, or limit its
+/// running time. It is polled in long loops, and a cancelled operation fails
+/// with errorFlag::OPERATION_CANCELLED.
+struct cancel_token {
+  void *handle{nullptr};
+  bool (*cb_is_cancelled)(void *){nullptr};
+  /// The operation is cancelled once steady_clock reaches it, the default
+  /// value means no deadline.
+  std::chrono::steady_clock::time_point deadline{
+      std::chrono::steady_clock::time_point::max()};
+
+  inline void set_timeout(std::chrono::steady_clock::duration timeout) {
+    this->deadline = std::chrono::steady_clock::now() + timeout;
+  }
+
+  [[nodiscard]] inline bool is_cancelled() const {
+    if (this->deadline != std::chrono::steady_clock::time_point::max() &&
+        std::chrono::steady_clock::now() >= this->deadline) {
+      return true;
+    }
+    if (this->cb_is_cancelled) {
+      return this->cb_is_cancelled(this->handle);
+    }
+    return false;
+  }
+};
+
 struct convert_option {
   uint64_t caller_api_version{SC_VERSION_U64};
   SCL_convertAlgo algo{SCL_convertAlgo::RGB_Better};
@@ -248,6 +277,26 @@ struct convert_option {
   GA_converter_option ai_cvter_opt{};
   progress_callbacks progress{};
   ui_callbacks ui{};
+  // added in v5.3
+  cancel_token cancel{};
+};
+
+struct convert_images_statistics {
+  uint64_t caller_api_version{SC_VERSION_U64};
+  size_t num_images{0};
+  /// Colors looked up in the shared cache, counted once per image
+  uint64_t num_color_lookups{0};
+  uint64_t num_cache_hits{0};
+  /// Distinct colors in the cache after conversion
+  uint64_t num_cached_colors{0};
+  double seconds{0};
+
+  [[nodiscard]] inline double cache_hit_ratio() const noexcept {
+    if (this->num_color_lookups <= 0) {
+      return 0;
+    }
+    return double(this->num_cache_hits) / double(this->num_color_lookups);
+  }
 };
 
 struct map_data_file_options {
@@ -256,6 +305,7 @@ struct map_data_file_options {
   int begin_index{0};
   progress_callbacks progress{};
   ui_callbacks ui{};
+  cancel_token cancel{};
 };
 
 struct map_data_file_give_command_options {
@@ -294,6 +344,7 @@ struct build_options {
   ui_callbacks ui;
   progress_callbacks main_progressbar;
   progress_callbacks sub_progressbar;
+  cancel_token cancel{};
 };
 
 struct litematic_options {
@@ -302,12 +353,14 @@ struct litematic_options {
   const char *region_name_utf8 = "by SlopeCraft";
   ui_callbacks ui;
   progress_callbacks progressbar;
+  cancel_token cancel{};
 };
 struct vanilla_structure_options {
   uint64_t caller_api_version{SC_VERSION_U64};
   bool is_air_structure_void{true};
   ui_callbacks ui;
   progress_callbacks progressbar;
+  cancel_token cancel{};
 };
 struct WE_schem_options {
   uint64_t caller_api_version{SC_VERSION_U64};
@@ -317,6 +370,7 @@ struct WE_schem_options {
   int num_required_mods{0};
   ui_callbacks ui;
   progress_callbacks progressbar;
+  cancel_token cancel{};
 };
 
 struct flag_diagram_options {
@@ -331,6 +385,27 @@ struct flag_diagram_options {
 
   ui_callbacks ui{};
   progress_callbacks progressbar{};
+  cancel_token cancel{};
+};
+
+struct structure_diff_options {
+  uint64_t caller_api_version{SC_VERSION_U64};
+  ui_callbacks ui{};
+  progress_callbacks progressbar{};
+  cancel_token cancel{};
+};
+
+struct structure_diff_statistics {
+  uint64_t added_blocks{0};     // air -> block
+  uint64_t removed_blocks{0};   // block -> air
+  uint64_t replaced_blocks{0};  // block -> another block
+  uint64_t changed_regions{0};
+};
+
+// Box of blocks in a structure, indices are x, y, z
+struct structure_region {
+  uint64_t offset[3]{0, 0, 0};
+  uint64_t shape[3]{0, 0, 0};
 };
 
 struct test_blocklist_options {
@@ -345,11 +420,42 @@ struct const_image_reference {
   const uint32_t *data{nullptr};
   size_t rows{0};
   size_t cols{0};
+  // added in v5.3
+  // Pixels between the starts of 2 rows (2 columns if col-major), 0 means
+  // tightly packed.
+  size_t stride{0};
+  bool is_col_major{false};
+
+  [[nodiscard]] inline size_t outer_stride() const noexcept {
+    if (this->stride > 0) {
+      return this->stride;
+    }
+    return this->is_col_major ? this->rows : this->cols;
+  }
+};
+
+// added in v5.3
+// A caller-owned buffer to write an image into, laid out like
+// const_image_reference.
+struct image_reference {
+  uint32_t *data{nullptr};
+  size_t rows{0};
+  size_t cols{0};
+  size_t stride{0};
+  bool is_col_major{false};
+
+  [[nodiscard]] inline size_t outer_stride() const noexcept {
+    if (this->stride > 0) {
+      return this->stride;
+    }
+    return this->is_col_major ? this->rows : this->cols;
+  }
 };
 
 class color_table;
 class converted_image;
 class structure_3D;
+class progressive_preview;
 
 class color_table {
  public:
@@ -385,6 +491,40 @@ class color_table {
       const_image_reference original_img,
       const convert_option &option) const noexcept = 0;
 
+  // added in v5.3
+  /// Convert several images concurrently with a color cache shared among
+  /// them, for example frames of an animation. Results are written to
+  /// dest[0, num_images), stats can be nullptr. Returns false if any image
+  /// fails, whose dest[i] is nullptr while other results are kept. If
+  /// cancelled, all of dest are nullptr.
+  [[nodiscard]] virtual bool convert_images(
+      const const_image_reference *original_imgs, size_t num_images,
+      const convert_option &option, converted_image **dest,
+      convert_images_statistics *stats) const noexcept = 0;
+
+  // added in v5.3
+  /// Load colors matched in previous runs from the cache of this table in
+  /// cache_root_dir, a missing cache is not an error. They are kept by this
+  /// table and shared by all later conversions, which also add their colors.
+  /// Colors are loaded only by the first call, so call it before converting.
+  [[nodiscard]] virtual bool load_color_cache(
+      const char *cache_root_dir, string_deliver *error) noexcept = 0;
+  /// Write colors kept by this table back to the cache in cache_root_dir, the
+  /// most used ones are kept if an algorithm has more than capacity colors.
+  /// Call it once after a batch of conversions, it does nothing if
+  /// load_color_cache is never called.
+  [[nodiscard]] virtual bool save_color_cache(
+      const char *cache_root_dir, size_t capacity,
+      string_deliver *error) const noexcept = 0;
+  /// Remove the least used colors kept by this table until at most capacity
+  /// colors are left, so that they don't grow without limit in a long
+  /// session. Returns the number of removed colors.
+  virtual size_t trim_color_cache(size_t capacity) noexcept = 0;
+
+  /// Prepare a progressive conversion, original_img is copied.
+  [[nodiscard]] virtual progressive_preview *create_progressive_preview(
+      const_image_reference original_img) const noexcept = 0;
+
   [[nodiscard]] virtual bool has_convert_cache(
       const_image_reference original_img, const convert_option &option,
       const char *cache_dir) const noexcept = 0;
@@ -435,6 +575,13 @@ class converted_image {
   virtual void get_original_image(uint32_t *buffer) const noexcept = 0;
   //  virtual void get_dithered_image(uint32_t *buffer) const noexcept = 0;
   virtual void get_converted_image(uint32_t *buffer) const noexcept = 0;
+  // added in v5.3
+  /// Write into a caller buffer in any order and stride, without temporary
+  /// copies. Returns false if dest is null or its shape differs from this.
+  [[nodiscard]] virtual bool get_original_image(
+      const image_reference &dest) const noexcept = 0;
+  [[nodiscard]] virtual bool get_converted_image(
+      const image_reference &dest) const noexcept = 0;
 
   virtual void get_compressed_image(const structure_3D &structure,
                                     uint32_t *buffer) const noexcept = 0;
@@ -456,6 +603,41 @@ class converted_image {
       const vanilla_structure_options &) const noexcept = 0;
 };
 
+// added in v5.3
+/// Converts an image in several passes, so that a rough result can be shown
+/// quickly. A downsampled copy is converted first, then the image is refined
+/// tile by tile, and finally converted in full resolution. Matched colors are
+/// shared by all passes, so the last pass only looks them up. Tiles are
+/// skipped when dithering or using the GA converter, since the last pass
+/// would convert them again. run() is supposed to be called in a worker
+/// thread, while other threads poll the preview.
+class progressive_preview {
+ public:
+  virtual ~progressive_preview() = default;
+  [[nodiscard]] virtual size_t rows() const noexcept = 0;
+  [[nodiscard]] virtual size_t cols() const noexcept = 0;
+
+  /// Run all passes, call it only once. Returns false if the conversion
+  /// failed or is cancelled, and the preview published so far is kept.
+  [[nodiscard]] virtual bool run(const convert_option &option) noexcept = 0;
+
+  /// Number of passes published, 0 if no preview is available yet.
+  [[nodiscard]] virtual int finished_passes() const noexcept = 0;
+  /// Decided when run() starts, tiles are counted before it.
+  [[nodiscard]] virtual int total_passes() const noexcept = 0;
+  [[nodiscard]] inline bool is_finished() const noexcept {
+    return this->finished_passes() >= this->total_passes();
+  }
+
+  /// Copy the best available preview to buffer in row-major, which holds
+  /// rows()*cols() pixels. Returns the number of passes it contains.
+  virtual int get_preview(uint32_t *buffer) const noexcept = 0;
+
+  /// Take the full resolution result once all passes are finished, otherwise
+  /// returns nullptr. It can be taken only once.
+  [[nodiscard]] virtual converted_image *take_result() noexcept = 0;
+};
+
 class structure_3D {
  public:
   virtual ~structure_3D() = default;
@@ -477,6 +659,21 @@ class structure_3D {
       const flag_diagram_options &option) const noexcept = 0;
 
   [[nodiscard]] virtual uint64_t block_count() const noexcept = 0;
+
+  // added in v5.3
+  /// Make a delta structure of blocks that differ from old_build, which must
+  /// be in the same shape. Unchanged blocks are minecraft:structure_void in
+  /// the delta, which vanilla structure blocks and litematica don't place.
+  /// Removed blocks are explicit air, so export it without air as structure
+  /// void. The palette starts with structure_void. stat can be nullptr.
+  [[nodiscard]] virtual structure_3D *diff(
+      const structure_3D &old_build, const structure_diff_options &option,
+      structure_diff_statistics *stat) const noexcept = 0;
+  /// Boxes that cover all changed blocks of a delta structure, none for
+  /// structures that are not made by diff. Writes at most capacity regions
+  /// to buffer, and returns the total count.
+  virtual size_t get_changed_regions(structure_region *buffer,
+                                     size_t capacity) const noexcept = 0;
 };
 
 }  // namespace SlopeCraft
@@ -504,6 +701,7 @@ SCL_EXPORT void SCL_destroy_color_table(color_table *);
 
 SCL_EXPORT void SCL_destroy_converted_image(converted_image *);
 SCL_EXPORT void SCL_destroy_structure_3D(structure_3D *);
+SCL_EXPORT void SCL_destroy_progressive_preview(progressive_preview *);
 
 struct block_list_create_info {
   uint64_t caller_api_version{SC_VERSION_U64};
@@ -527,6 +725,8 @@ SCL_EXPORT bool SCL_haveTransparentPixel(const uint32_t *ARGB32,
 SCL_EXPORT SCL_gameVersion SCL_maxAvailableVersion();
 
 SCL_EXPORT const char *SCL_getSCLVersion();
+// Instruction set used to match colors, like "sse2" or "avx2".
+SCL_EXPORT const char *SCL_get_simd_arch();
 
 SCL_EXPORT const float *SCL_getBasicColorMapPtrs();
 SCL_EXPORT uint8_t SCL_maxBaseColor();
@@ -553,6 +753,9 @@ class deleter {
   void operator()(structure_3D *s) const noexcept {
     SCL_destroy_structure_3D(s);
   }
+  void operator()(progressive_preview *p) const noexcept {
+    SCL_destroy_progressive_preview(p);
+  }
 };
 }  //  namespace SlopeCraft
 
@@ -0,0 +1,258 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+#include "color_cache_file.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <span>
+#include <vector>
+#include <fmt/format.h>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+namespace {
+
+using TokiColor_t = TokiColor;
+
+constexpr std::array<char, 8> file_magic{'S', 'C', 'L', 'C',
+                                         'O', 'L', 'O', 'R'};
+constexpr uint32_t file_format_version = 2;
+
+struct file_header {
+  std::array<char, 8> magic;
+  uint32_t format_version;
+  uint32_t algo;
+  uint64_t table_hash;
+  uint64_t num_entries;
+};
+static_assert(sizeof(file_header) == 32);
+
+struct entry {
+  uint32_t argb;
+  uint8_t result;
+  std::array<uint8_t, 2> side_result;
+  uint8_t reserved;
+  float result_diff;
+  std::array<float, 2> side_selectivity;
+  /// Times the color is used in all previous runs
+  uint32_t uses;
+
+  [[nodiscard]] static entry from(ARGB argb, const TokiColor_t &tc,
+                                  uint32_t uses) noexcept {
+    return entry{.argb = argb,
+                 .result = tc.Result,
+                 .side_result = tc.sideResult,
+                 .reserved = 0,
+                 .result_diff = tc.ResultDiff,
+                 .side_selectivity = tc.sideSelectivity,
+                 .uses = uses};
+  }
+
+  [[nodiscard]] TokiColor_t to_toki_color() const noexcept {
+    TokiColor_t tc;
+    tc.Result = this->result;
+    tc.sideResult = this->side_result;
+    tc.ResultDiff = this->result_diff;
+    tc.sideSelectivity = this->side_selectivity;
+    return tc;
+  }
+};
+static_assert(sizeof(entry) == 24);
+
+[[nodiscard]] file_header make_header(uint64_t table_hash, SCL_convertAlgo algo,
+                                      uint64_t num_entries) noexcept {
+  return file_header{.magic = file_magic,
+                     .format_version = file_format_version,
+                     .algo = uint32_t(algo),
+                     .table_hash = table_hash,
+                     .num_entries = num_entries};
+}
+
+// A mapped cache file. Entries are valid until this object is destroyed.
+class mapped_cache {
+ private:
+  boost::iostreams::mapped_file_source file;
+  const char *entry_begin{nullptr};
+  size_t num_entries{0};
+
+ public:
+  /// Returns empty cache if the file doesn't exist.
+  [[nodiscard]] static tl::expected<std::unique_ptr<mapped_cache>, std::string>
+  open(const std::filesystem::path &filename, uint64_t table_hash,
+       SCL_convertAlgo algo) noexcept {
+    auto ret = std::make_unique<mapped_cache>();
+    std::error_code ec;
+    if (!std::filesystem::is_regular_file(filename, ec)) {
+      return ret;
+    }
+
+    try {
+      ret->file.open(filename.string());
+    } catch (const std::exception &e) {
+      return tl::make_unexpected(fmt::format("Failed to map file \"{}\": {}",
+                                             filename.string(), e.what()));
+    }
+
+    if (ret->file.size() < sizeof(file_header)) {
+      return tl::make_unexpected(
+          fmt::format("\"{}\" is too short to be a color cache file.",
+                      filename.string()));
+    }
+    file_header header;
+    memcpy(&header, ret->file.data(), sizeof(header));
+    const file_header expected = make_header(table_hash, algo, 0);
+    if (header.magic != expected.magic ||
+        header.format_version != expected.format_version ||
+        header.algo != expected.algo ||
+        header.table_hash != expected.table_hash) {
+      return tl::make_unexpected(fmt::format(
+          "\"{}\" is not a color cache of this color table and algorithm.",
+          filename.string()));
+    }
+    if (header.num_entries !=
+        (ret->file.size() - sizeof(file_header)) / sizeof(entry)) {
+      return tl::make_unexpected(
+          fmt::format("\"{}\" is truncated.", filename.string()));
+    }
+
+    ret->entry_begin = ret->file.data() + sizeof(file_header);
+    ret->num_entries = header.num_entries;
+    return ret;
+  }
+
+  [[nodiscard]] size_t size() const noexcept { return this->num_entries; }
+
+  [[nodiscard]] entry at(size_t idx) const noexcept {
+    assert(idx < this->num_entries);
+    entry e;
+    // the mapped file is not guaranteed to be aligned for entry.
+    memcpy(&e, this->entry_begin + idx * sizeof(entry), sizeof(entry));
+    return e;
+  }
+};
+
+}  // namespace
+
+namespace color_cache_file {
+
+tl::expected<size_t, std::string> load(const std::filesystem::path &file,
+                                       uint64_t table_hash,
+                                       SCL_convertAlgo algo,
+                                       color_cache_t &cache) noexcept {
+  auto mapped = mapped_cache::open(file, table_hash, algo);
+  if (!mapped) {
+    return tl::make_unexpected(std::move(mapped.error()));
+  }
+
+  const mapped_cache &src = *mapped.value();
+  for (size_t idx = 0; idx < src.size(); idx++) {
+    const entry e = src.at(idx);
+    const TokiColor_t tc = e.to_toki_color();
+    if (!tc.is_result_computed()) {
+      return tl::make_unexpected(fmt::format(
+          "\"{}\" contains an invalid color at {}.", file.string(), idx));
+    }
+    cache.insert(convert_unit{e.argb, algo}, tc, e.uses);
+  }
+  return src.size();
+}
+
+std::string save(const std::filesystem::path &file, uint64_t table_hash,
+                 SCL_convertAlgo algo, const color_cache_t &cache,
+                 size_t capacity) noexcept {
+  auto less_argb = [](const entry &a, const entry &b) {
+    return a.argb < b.argb;
+  };
+
+  std::vector<entry> entries;
+  cache.for_each([&entries, algo](const convert_unit &key,
+                                  const TokiColor_t &val, uint32_t uses) {
+    if (key.algo == algo && val.is_result_computed()) {
+      entries.emplace_back(entry::from(key._ARGB, val, uses));
+    }
+  });
+  std::sort(entries.begin(), entries.end(), less_argb);
+  const size_t num_in_memory = entries.size();
+
+  // Merge colors in the existing file, which may be written by other
+  // processes. Colors loaded from it are in memory already, with more uses.
+  // A broken file is simply overwritten.
+  {
+    auto old = mapped_cache::open(file, table_hash, algo);
+    if (old) {
+      const mapped_cache &src = *old.value();
+      for (size_t idx = 0; idx < src.size(); idx++) {
+        const entry e = src.at(idx);
+        if (!std::binary_search(entries.begin(),
+                                entries.begin() + num_in_memory, e,
+                                less_argb)) {
+          entries.emplace_back(e);
+        }
+      }
+    }
+  }
+
+  if (entries.empty()) {
+    return {};
+  }
+  if (entries.size() > capacity) {
+    // keep the most used colors
+    std::nth_element(entries.begin(), entries.begin() + capacity,
+                     entries.end(), [](const entry &a, const entry &b) {
+                       return a.uses > b.uses;
+                     });
+    entries.resize(capacity);
+  }
+  std::sort(entries.begin(), entries.end(), less_argb);
+
+  try {
+    std::filesystem::create_directories(file.parent_path());
+    // write to a temporary file first, so that readers never see a partial
+    // file.
+    std::filesystem::path temp_file = file;
+    temp_file += fmt::format(".{:x}.tmp", std::random_device{}());
+    bool ok = false;
+    {
+      std::ofstream ofs{temp_file, std::ios::binary};
+      const file_header header = make_header(table_hash, algo, entries.size());
+      ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+      ofs.write(reinterpret_cast<const char *>(entries.data()),
+                entries.size() * sizeof(entry));
+      ok = bool(ofs);
+    }
+    if (!ok) {
+      std::error_code ec;
+      std::filesystem::remove(temp_file, ec);
+      return fmt::format("Failed to write \"{}\"", temp_file.string());
+    }
+    std::filesystem::rename(temp_file, file);
+  } catch (const std::exception &e) {
+    return fmt::format("Failed to save color cache \"{}\": {}", file.string(),
+                       e.what());
+  }
+  return {};
+}
+
+}  // namespace color_cache_file
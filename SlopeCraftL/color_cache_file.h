@@ -0,0 +1,57 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+#ifndef SLOPECRAFT_COLOR_CACHE_FILE_H
+#define SLOPECRAFT_COLOR_CACHE_FILE_H
+
+#include <filesystem>
+#include <string>
+#include <tl/expected.hpp>
+#include <ColorManip/imageConvert.hpp>
+
+#include "SCLDefines.h"
+
+// Persistent cache of matched colors, stored under color_table's cache dir.
+// Each file holds colors of one color table and one algorithm, as a header
+// followed by fixed-size entries sorted by ARGB, each with a use count.
+namespace color_cache_file {
+
+// TokiColor is the same type as MapImageCvter::TokiColor_t
+using color_cache_t = libImageCvt::shared_color_cache<TokiColor>;
+
+/// Load all colors of algo in file to cache with their use counts. A missing
+/// file is not an error, it loads nothing. Returns the number of colors
+/// loaded.
+[[nodiscard]] tl::expected<size_t, std::string> load(
+    const std::filesystem::path &file, uint64_t table_hash,
+    SCL_convertAlgo algo, color_cache_t &cache) noexcept;
+
+/// Merge colors of algo in cache with those only in file, and write back. If
+/// there are more than capacity colors, the most used ones are kept.
+[[nodiscard]] std::string save(const std::filesystem::path &file,
+                               uint64_t table_hash, SCL_convertAlgo algo,
+                               const color_cache_t &cache,
+                               size_t capacity) noexcept;
+
+}  // namespace color_cache_file
+
+#endif  // SLOPECRAFT_COLOR_CACHE_FILE_H
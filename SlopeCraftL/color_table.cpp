@@ -223,6 +223,73 @@ std::filesystem::path color_table_impl::self_cache_dir(
   return fmt::format("{}/{:x}", cache_root_dir, this->hash());
 }
 
+std::filesystem::path color_table_impl::color_cache_filename(
+    const char *cache_root_dir, SCL_convertAlgo algo) const noexcept {
+  auto path = this->self_cache_dir(cache_root_dir);
+  path.append("colors");
+  // algorithms are letters which differ only in case
+  path.append(fmt::format("{:x}", int(algo)));
+  return path;
+}
+
+// Every algorithm has a cache file, the GA converter uses several of them.
+static constexpr std::array<SCL_convertAlgo, 6> color_cache_algos{
+    SCL_convertAlgo::RGB,   SCL_convertAlgo::RGB_Better, SCL_convertAlgo::HSV,
+    SCL_convertAlgo::Lab94, SCL_convertAlgo::Lab00,      SCL_convertAlgo::XYZ};
+
+std::string color_table_impl::load_color_cache(
+    const char *cache_root_dir) noexcept {
+  if (this->persistent_colors != nullptr) {
+    return {};
+  }
+  if (cache_root_dir == nullptr) {
+    return "cache_root_dir is nullptr";
+  }
+  this->persistent_colors = std::make_shared<color_cache_t>();
+  const uint64_t table_hash = this->hash();
+  std::string err;
+  for (auto algo : color_cache_algos) {
+    auto res = color_cache_file::load(
+        this->color_cache_filename(cache_root_dir, algo), table_hash, algo,
+        *this->persistent_colors);
+    // a broken file only loses its own colors
+    if (!res) {
+      err += res.error();
+      err.push_back('\n');
+    }
+  }
+  return err;
+}
+
+std::string color_table_impl::save_color_cache(
+    const char *cache_root_dir, size_t capacity) const noexcept {
+  if (this->persistent_colors == nullptr) {
+    return {};
+  }
+  if (cache_root_dir == nullptr) {
+    return "cache_root_dir is nullptr";
+  }
+  const uint64_t table_hash = this->hash();
+  std::string err;
+  for (auto algo : color_cache_algos) {
+    auto res = color_cache_file::save(
+        this->color_cache_filename(cache_root_dir, algo), table_hash, algo,
+        *this->persistent_colors, capacity);
+    if (!res.empty()) {
+      err += res;
+      err.push_back('\n');
+    }
+  }
+  return err;
+}
+
+size_t color_table_impl::trim_color_cache(size_t capacity) noexcept {
+  if (this->persistent_colors == nullptr) {
+    return 0;
+  }
+  return this->persistent_colors->shrink_to(capacity);
+}
+
 std::filesystem::path color_table_impl::convert_task_cache_filename(
     const_image_reference original_img, const convert_option &option,
     const char *cache_root_dir) const noexcept {
@@ -13,6 +13,7 @@
 #include "mc_block.h"
 #include "string_deliver.h"
 #include "converted_image.h"
+#include "color_cache_file.h"
 
 class color_table_impl : public SlopeCraft::color_table {
  public:
@@ -20,6 +21,8 @@ class color_table_impl : public SlopeCraft::color_table {
   SCL_mapTypes map_type_;
   SCL_gameVersion mc_version_;
   std::array<mc_block, 64> blocks;
+  /// Colors shared by all conversions once load_color_cache is called.
+  std::shared_ptr<color_cache_file::color_cache_t> persistent_colors{nullptr};
 
   color_map_ptrs colors() const noexcept final {
     return color_map_ptrs{.r_data = allowed->rgb_data(0),
@@ -48,6 +51,21 @@ class color_table_impl : public SlopeCraft::color_table {
       const_image_reference original_img,
       const convert_option &option) const noexcept final;
 
+  [[nodiscard]] bool convert_images(
+      const const_image_reference *original_imgs, size_t num_images,
+      const convert_option &option, converted_image **dest,
+      convert_images_statistics *stats) const noexcept final;
+
+  [[nodiscard]] progressive_preview *create_progressive_preview(
+      const_image_reference original_img) const noexcept final;
+
+  using color_cache_t = color_cache_file::color_cache_t;
+
+  /// Returns nullopt if cancelled.
+  [[nodiscard]] std::optional<converted_image_impl> convert_image_impl(
+      const_image_reference original_img, const convert_option &option,
+      color_cache_t *cache) const noexcept;
+
   [[nodiscard]] static std::optional<color_table_impl> create(
       const color_table_create_info &args) noexcept;
 
@@ -62,6 +80,30 @@ class color_table_impl : public SlopeCraft::color_table {
   [[nodiscard]] std::filesystem::path self_cache_dir(
       const char *cache_root_dir) const noexcept;
 
+  [[nodiscard]] std::filesystem::path color_cache_filename(
+      const char *cache_root_dir, SCL_convertAlgo algo) const noexcept;
+
+  [[nodiscard]] bool load_color_cache(const char *cache_root_dir,
+                                      string_deliver *error) noexcept final {
+    auto err = this->load_color_cache(cache_root_dir);
+    write_to_sd(error, err);
+    return err.empty();
+  }
+  [[nodiscard]] std::string load_color_cache(
+      const char *cache_root_dir) noexcept;
+
+  [[nodiscard]] bool save_color_cache(
+      const char *cache_root_dir, size_t capacity,
+      string_deliver *error) const noexcept final {
+    auto err = this->save_color_cache(cache_root_dir, capacity);
+    write_to_sd(error, err);
+    return err.empty();
+  }
+  [[nodiscard]] std::string save_color_cache(const char *cache_root_dir,
+                                             size_t capacity) const noexcept;
+
+  size_t trim_color_cache(size_t capacity) noexcept final;
+
   [[nodiscard]] std::filesystem::path convert_task_cache_filename(
       const_image_reference original_img, const convert_option &option,
       const char *cache_root_dir) const noexcept;
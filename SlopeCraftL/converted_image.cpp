@@ -3,6 +3,8 @@
 //
 
 #include <fmt/format.h>
+#include <omp.h>
+#include <algorithm>
 #include <boost/uuid/detail/md5.hpp>
 #include <utilities/ExternalConverters/GAConverter/GAConverter.h>
 #include "SCLDefines.h"
@@ -21,13 +23,103 @@ converted_image_impl::converted_image_impl(const color_table_impl &table)
 converted_image *color_table_impl::convert_image(
     const_image_reference original_img,
     const convert_option &option) const noexcept {
+  if (report_if_cancelled(option.cancel, option.ui)) {
+    return nullptr;
+  }
+  auto cvted = this->convert_image_impl(original_img, option,
+                                        this->persistent_colors.get());
+  option.ui.report_working_status(workStatus::none);
+  if (!cvted) {
+    report_if_cancelled(option.cancel, option.ui);
+    return nullptr;
+  }
+
+  option.progress.set_range(0, 4 * cvted->size(), 4 * cvted->size());
+  return new converted_image_impl{std::move(cvted.value())};
+}
+
+bool color_table_impl::convert_images(
+    const const_image_reference *original_imgs, size_t num_images,
+    const convert_option &option, converted_image **dest,
+    convert_images_statistics *stats) const noexcept {
+  if (num_images <= 0) {
+    return true;
+  }
+  if (original_imgs == nullptr || dest == nullptr) {
+    return false;
+  }
+
+  const double wtime = omp_get_wtime();
+  // colors loaded by load_color_cache are shared, otherwise only among these
+  // images.
+  std::unique_ptr<color_cache_t> local_cache;
+  color_cache_t *cache = this->persistent_colors.get();
+  if (cache == nullptr) {
+    local_cache = std::make_unique<color_cache_t>();
+    cache = local_cache.get();
+  }
+  const uint64_t lookups_before = cache->lookups();
+  const uint64_t hits_before = cache->hits();
+  option.progress.set_range(0, num_images, 0);
+
+  // Each image is converted by a single thread, since most colors are matched
+  // by the cache and a small image can not keep all threads busy.
+#pragma omp parallel for schedule(dynamic) if (num_images > 1)
+  for (int64_t i = 0; i < int64_t(num_images); i++) {
+    dest[i] = nullptr;
+    if (option.cancel.is_cancelled()) {
+      continue;
+    }
+    auto cvted = this->convert_image_impl(original_imgs[i], option, cache);
+    if (cvted) {
+      dest[i] = new converted_image_impl{std::move(cvted.value())};
+    }
+#pragma omp critical
+    { option.progress.add(1); }
+  }
+
+  option.ui.report_working_status(workStatus::none);
+  if (report_if_cancelled(option.cancel, option.ui)) {
+    for (size_t i = 0; i < num_images; i++) {
+      delete dest[i];
+      dest[i] = nullptr;
+    }
+    return false;
+  }
+
+  if (stats != nullptr) {
+    stats->num_images = num_images;
+    stats->num_color_lookups = cache->lookups() - lookups_before;
+    stats->num_cache_hits = cache->hits() - hits_before;
+    stats->num_cached_colors = cache->size();
+    stats->seconds = omp_get_wtime() - wtime;
+  }
+  // images converted successfully are kept even if others failed
+  return std::all_of(dest, dest + num_images,
+                     [](const converted_image *c) { return c != nullptr; });
+}
+
+std::optional<converted_image_impl> color_table_impl::convert_image_impl(
+    const_image_reference original_img, const convert_option &option,
+    color_cache_t *cache) const noexcept {
+  if (original_img.data == nullptr || original_img.rows <= 0 ||
+      original_img.cols <= 0) {
+    return std::nullopt;
+  }
   converted_image_impl cvted{*this};
+  cvted.converter.set_color_cache(cache);
+  cvted.converter.ui._cancelPtr = const_cast<cancel_token *>(&option.cancel);
+  cvted.converter.ui.cancelCheck = [](void *token) {
+    return reinterpret_cast<const cancel_token *>(token)->is_cancelled();
+  };
 
   const auto algo = (option.algo == convertAlgo::gaCvter)
                         ? convertAlgo::RGB_Better
                         : option.algo;
   cvted.converter.set_raw_image(original_img.data, original_img.rows,
-                                original_img.cols, false);
+                                original_img.cols, original_img.is_col_major,
+                                int64_t(original_img.outer_stride()));
+  bool ok = false;
   {
     heu::GAOption opt;
     opt.crossoverProb = option.ai_cvter_opt.crossoverProb;
@@ -36,13 +128,15 @@ converted_image *color_table_impl::convert_image(
     opt.maxFailTimes = option.ai_cvter_opt.maxFailTimes;
     opt.populationSize = option.ai_cvter_opt.popSize;
 
-    cvted.converter.convert_image(algo, option.dither, &opt);
+    ok = cvted.converter.convert_image(algo, option.dither, &opt);
   }
-
-  option.progress.set_range(0, 4 * cvted.size(), 4 * cvted.size());
-  option.ui.report_working_status(workStatus::none);
-
-  return new converted_image_impl{std::move(cvted)};
+  // the cache and the token live no longer than this conversion.
+  cvted.converter.set_color_cache(nullptr);
+  cvted.converter.ui = {};
+  if (!ok) {
+    return std::nullopt;
+  }
+  return cvted;
 }
 
 void converted_image_impl::get_compressed_image(
@@ -85,6 +179,10 @@ bool converted_image_impl::export_map_data(
   int fail_count = 0;
   for (int c = 0; c < cols; c++) {
     for (int r = 0; r < rows; r++) {
+      if (report_if_cancelled(option.cancel, option.ui)) {
+        option.ui.report_working_status(workStatus::none);
+        return false;
+      }
       const std::array<int, 2> offset = {r * 128, c * 128};
       std::filesystem::path current_filename = dir;
       current_filename.append(fmt::format("map_{}.dat", currentIndex));
@@ -235,7 +333,11 @@ converted_image_impl::height_info(const build_options &option) const noexcept {
   lossy_compressor compressor;
   compressor.ui = option.ui;
   compressor.progress_bar = option.sub_progressbar;
+  compressor.cancel = option.cancel;
   for (int64_t c = 0; c < map_color.cols(); c++) {
+    if (report_if_cancelled(option.cancel, option.ui)) {
+      return std::nullopt;
+    }
     // cerr << "Coloumn " << c << '\n';
     height_line HL;
     // getTokiColorPtr(c,&src[0]);
@@ -253,6 +355,9 @@ converted_image_impl::height_info(const build_options &option) const noexcept {
       Eigen::ArrayXi temp;
       HL.make(&ptr[0], compressor.getResult(), allow_lossless_compress, &temp);
       if (!success) {
+        if (report_if_cancelled(option.cancel, option.ui)) {
+          return std::nullopt;
+        }
         option.ui.report_error(
             SCL_errorFlag::LOSSYCOMPRESS_FAILED,
             fmt::format("Failed to compress the 3D structure at column {}. You "
@@ -299,7 +404,23 @@ uint64_t converted_image_impl::convert_task_hash(
     SC_HASH_ADD_DATA(hash, option.ai_cvter_opt.mutationProb)
   }
 
-  hash.process_bytes(original_img.data, original_img.rows * original_img.cols);
+  // Pixels are hashed in row-major order, so that the hash doesn't depend on
+  // the layout of the buffer.
+  const size_t outer_stride = original_img.outer_stride();
+  if (!original_img.is_col_major) {
+    for (size_t r = 0; r < original_img.rows; r++) {
+      hash.process_bytes(original_img.data + r * outer_stride,
+                         original_img.cols * sizeof(uint32_t));
+    }
+  } else {
+    std::vector<uint32_t> row(original_img.cols);
+    for (size_t r = 0; r < original_img.rows; r++) {
+      for (size_t c = 0; c < original_img.cols; c++) {
+        row[c] = original_img.data[c * outer_stride + r];
+      }
+      hash.process_bytes(row.data(), row.size() * sizeof(uint32_t));
+    }
+  }
 
   decltype(hash)::digest_type dig;
   hash.get_digest(dig);
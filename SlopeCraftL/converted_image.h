@@ -41,15 +41,36 @@ class converted_image_impl : public converted_image {
   int map_cols() const noexcept { return ceil(this->cols() / 128.0f); }
 
   void get_original_image(uint32_t *buffer) const noexcept final {
-    Eigen::Map<eimg_row_major> buf{buffer, static_cast<int64_t>(this->rows()),
-                                   static_cast<int64_t>(this->cols())};
-    buf = this->converter.raw_image();
+    this->converter.raw_image(buffer, false);
   }
   //  void get_dithered_image(uint32_t *buffer) const noexcept final {}
   void get_converted_image(uint32_t *buffer) const noexcept final {
     this->converter.converted_image(buffer, nullptr, nullptr, false);
   }
 
+  [[nodiscard]] bool fits(const image_reference &dest) const noexcept {
+    return dest.data != nullptr && dest.rows == this->rows() &&
+           dest.cols == this->cols() &&
+           dest.outer_stride() >= (dest.is_col_major ? dest.rows : dest.cols);
+  }
+  bool get_original_image(const image_reference &dest) const noexcept final {
+    if (!this->fits(dest)) {
+      return false;
+    }
+    this->converter.raw_image(dest.data, dest.is_col_major,
+                              int64_t(dest.outer_stride()));
+    return true;
+  }
+  bool get_converted_image(const image_reference &dest) const noexcept final {
+    if (!this->fits(dest)) {
+      return false;
+    }
+    this->converter.converted_image(dest.data, nullptr, nullptr,
+                                    dest.is_col_major,
+                                    int64_t(dest.outer_stride()));
+    return true;
+  }
+
   void get_compressed_image(const structure_3D &structure,
                             uint32_t *buffer) const noexcept final;
 
@@ -85,6 +85,13 @@ class solver_t
           heu::GADefaults<Var_t, args_t>::mFun> {
  public:
   void customOptAfterEachGeneration() {
+    if (this->_args.ptr->cancel.is_cancelled()) {
+      // no more generations after this one
+      heu::GAOption opt = this->option();
+      opt.maxGenerations = 0;
+      this->setOption(opt);
+      return;
+    }
     if (this->generation() % reportRate == 0) {
       std::clock_t &prevClock = this->_args.prevClock;
       std::clock_t curClock = std::clock();
@@ -152,6 +159,9 @@ bool lossy_compressor::compress(uint16_t maxHeight, bool allowNaturalCompress) {
   maxGeneration = 200;
   while (tryTimes < 3) {
     this->runGenetic(maxHeight, allowNaturalCompress);
+    if (this->cancel.is_cancelled()) {
+      return false;
+    }
     if (this->resultFitness() <= 0) {
       tryTimes++;
       maxFailTimes = -1;
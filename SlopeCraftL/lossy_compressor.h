@@ -50,6 +50,7 @@ class lossy_compressor {
 
   SlopeCraft::ui_callbacks ui;
   SlopeCraft::progress_callbacks progress_bar;
+  SlopeCraft::cancel_token cancel;
 
  private:
   friend class solver_t;
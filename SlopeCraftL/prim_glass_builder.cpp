@@ -149,6 +149,9 @@ glassMap prim_glass_builder::makeBridge(const TokiMap &_targetMap,
   }
   // qDebug("分区分块完毕，开始在每个分区内搭桥");
   for (int r = 0; r < rowCount; r++) {
+    if (this->cancel.is_cancelled()) {
+      return glassMap(0, 0);
+    }
     for (int c = 0; c < colCount; c++) {
       // qDebug()<<"开始处理第 ["<<r<<","<<c<<"] 块分区";
       glassMaps[r][c] = algos[r][c].make4SingleMap(
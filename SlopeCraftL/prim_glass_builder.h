@@ -95,6 +95,8 @@ class prim_glass_builder {
 
   SlopeCraft::ui_callbacks ui;
   SlopeCraft::progress_callbacks progress_bar;
+  // makeBridge returns an empty map once it's cancelled
+  SlopeCraft::cancel_token cancel;
 
  private:
   std::vector<rc_pos> targetPoints;
@@ -0,0 +1,241 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+#include "progressive_preview.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+int64_t ceil_div(int64_t a, int64_t b) noexcept { return (a + b - 1) / b; }
+
+int64_t lowres_stride(int64_t rows, int64_t cols) noexcept {
+  const int64_t pixels = rows * cols;
+  if (pixels <= progressive_preview_impl::max_lowres_pixels) {
+    return 1;
+  }
+  return int64_t(std::ceil(std::sqrt(
+      double(pixels) / progressive_preview_impl::max_lowres_pixels)));
+}
+
+progressive_preview_impl::eimg_row_major copy_image(
+    const_image_reference img) noexcept {
+  const Eigen::OuterStride<> outer_stride{int64_t(img.outer_stride())};
+  if (img.is_col_major) {
+    return Eigen::Map<const Eigen::ArrayXX<uint32_t>, Eigen::Unaligned,
+                      Eigen::OuterStride<>>{img.data, int64_t(img.rows),
+                                            int64_t(img.cols), outer_stride};
+  }
+  return Eigen::Map<const progressive_preview_impl::eimg_row_major,
+                    Eigen::Unaligned, Eigen::OuterStride<>>{
+      img.data, int64_t(img.rows), int64_t(img.cols), outer_stride};
+}
+
+int count_passes(int64_t stride, int64_t rows, int64_t cols,
+                 bool refine_by_tiles) noexcept {
+  const int64_t tiles =
+      ceil_div(rows, progressive_preview_impl::tile_size) *
+      ceil_div(cols, progressive_preview_impl::tile_size);
+  // a single tile is the same as the full resolution pass
+  const bool tiled = refine_by_tiles && tiles > 1;
+  return int(stride > 1) + int(tiled ? tiles : 0) + 1;
+}
+
+// Dithering spreads errors across tiles and the GA converter optimizes the
+// whole image, so tiles converted alone differ from the full image, which
+// converts them all over again.
+bool can_refine_by_tiles(const convert_option &option) noexcept {
+  return !option.dither && option.algo != SCL_convertAlgo::gaCvter;
+}
+}  // namespace
+
+progressive_preview_impl::progressive_preview_impl(
+    const color_table_impl &table_, const_image_reference original_img)
+    : table{table_},
+      original{copy_image(original_img)},
+      stride{lowres_stride(original_img.rows, original_img.cols)},
+      num_passes{count_passes(this->stride, original_img.rows,
+                              original_img.cols, true)} {
+  this->preview.setZero(this->original.rows(), this->original.cols());
+}
+
+std::optional<converted_image_impl> progressive_preview_impl::convert(
+    const_image_reference img, const convert_option &option) noexcept {
+  // colors loaded by the table are shared with other conversions
+  color_table_impl::color_cache_t *cache = this->table.persistent_colors.get();
+  if (cache == nullptr) {
+    cache = &this->cache;
+  }
+  return this->table.convert_image_impl(img, option, cache);
+}
+
+const_image_reference progressive_preview_impl::view_of_original(
+    int64_t row_begin, int64_t col_begin, int64_t rows,
+    int64_t cols) const noexcept {
+  return const_image_reference{
+      .data = &this->original(row_begin, col_begin),
+      .rows = static_cast<size_t>(rows),
+      .cols = static_cast<size_t>(cols),
+      .stride = static_cast<size_t>(this->original.cols()),
+  };
+}
+
+void progressive_preview_impl::publish(const converted_image_impl &cvted,
+                                       int64_t row_begin, int64_t col_begin,
+                                       int64_t scale) noexcept {
+  if (scale <= 1) {
+    // written into the preview in place
+    std::lock_guard lk{this->preview_lock};
+    const image_reference dest{
+        .data = &this->preview(row_begin, col_begin),
+        .rows = cvted.rows(),
+        .cols = cvted.cols(),
+        .stride = static_cast<size_t>(this->preview.cols()),
+    };
+    [[maybe_unused]] const bool ok = cvted.get_converted_image(dest);
+    assert(ok);
+    this->passes++;
+    return;
+  }
+
+  eimg_row_major pixels{static_cast<int64_t>(cvted.rows()),
+                        static_cast<int64_t>(cvted.cols())};
+  cvted.get_converted_image(pixels.data());
+
+  std::lock_guard lk{this->preview_lock};
+  for (int64_t r = 0; r < this->preview.rows(); r++) {
+    for (int64_t c = 0; c < this->preview.cols(); c++) {
+      this->preview(r, c) = pixels(r / scale, c / scale);
+    }
+  }
+  this->passes++;
+}
+
+bool progressive_preview_impl::run(const convert_option &option) noexcept {
+  if (report_if_cancelled(option.cancel, option.ui)) {
+    return false;
+  }
+  this->refine_by_tiles = can_refine_by_tiles(option);
+  this->num_passes = count_passes(this->stride, this->original.rows(),
+                                  this->original.cols(), this->refine_by_tiles);
+  // progress is counted by passes
+  convert_option pass_option = option;
+  pass_option.progress = {};
+  option.progress.set_range(0, this->num_passes, 0);
+
+  const bool ok = this->run_passes(pass_option, option.progress);
+  option.ui.report_working_status(workStatus::none);
+  if (!ok) {
+    report_if_cancelled(option.cancel, option.ui);
+  }
+  return ok;
+}
+
+bool progressive_preview_impl::run_passes(
+    const convert_option &option,
+    const progress_callbacks &progress) noexcept {
+  const int64_t rows = this->original.rows();
+  const int64_t cols = this->original.cols();
+
+  if (this->stride > 1) {
+    // Pixels are sampled instead of averaged, so that their colors appear in
+    // the full image as well and are reused by later passes.
+    eimg_row_major lowres{ceil_div(rows, this->stride),
+                          ceil_div(cols, this->stride)};
+    for (int64_t r = 0; r < lowres.rows(); r++) {
+      for (int64_t c = 0; c < lowres.cols(); c++) {
+        lowres(r, c) = this->original(r * this->stride, c * this->stride);
+      }
+    }
+    auto cvted = this->convert(
+        const_image_reference{
+            .data = lowres.data(),
+            .rows = static_cast<size_t>(lowres.rows()),
+            .cols = static_cast<size_t>(lowres.cols()),
+        },
+        option);
+    if (!cvted) {
+      return false;
+    }
+    this->publish(cvted.value(), 0, 0, this->stride);
+    progress.add(1);
+  }
+
+  const int64_t tile_rows = ceil_div(rows, tile_size);
+  const int64_t tile_cols = ceil_div(cols, tile_size);
+  if (this->refine_by_tiles && tile_rows * tile_cols > 1) {
+    for (int64_t tr = 0; tr < tile_rows; tr++) {
+      for (int64_t tc = 0; tc < tile_cols; tc++) {
+        const int64_t r_begin = tr * tile_size;
+        const int64_t c_begin = tc * tile_size;
+        const auto tile = this->view_of_original(
+            r_begin, c_begin, std::min(tile_size, rows - r_begin),
+            std::min(tile_size, cols - c_begin));
+        auto cvted = this->convert(tile, option);
+        if (!cvted) {
+          return false;
+        }
+        this->publish(cvted.value(), r_begin, c_begin, 1);
+        progress.add(1);
+      }
+    }
+  }
+
+  // Every color is matched by tiles already, so converting the full image
+  // only looks them up to make the result.
+  auto cvted = this->convert(this->view_of_original(0, 0, rows, cols), option);
+  if (!cvted) {
+    return false;
+  }
+  {
+    std::lock_guard lk{this->preview_lock};
+    this->result =
+        std::make_unique<converted_image_impl>(std::move(cvted.value()));
+  }
+  this->publish(*this->result, 0, 0, 1);
+  progress.add(1);
+  return true;
+}
+
+int progressive_preview_impl::get_preview(uint32_t *buffer) const noexcept {
+  std::lock_guard lk{this->preview_lock};
+  Eigen::Map<eimg_row_major>{buffer, this->preview.rows(),
+                             this->preview.cols()} = this->preview;
+  return this->passes;
+}
+
+converted_image *progressive_preview_impl::take_result() noexcept {
+  std::lock_guard lk{this->preview_lock};
+  if (this->passes < this->num_passes) {
+    return nullptr;
+  }
+  return this->result.release();
+}
+
+progressive_preview *color_table_impl::create_progressive_preview(
+    const_image_reference original_img) const noexcept {
+  if (original_img.data == nullptr || original_img.rows <= 0 ||
+      original_img.cols <= 0) {
+    return nullptr;
+  }
+  return new progressive_preview_impl{*this, original_img};
+}
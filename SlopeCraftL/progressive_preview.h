@@ -0,0 +1,104 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+#ifndef SLOPECRAFT_PROGRESSIVE_PREVIEW_H
+#define SLOPECRAFT_PROGRESSIVE_PREVIEW_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+#include "SlopeCraftL.h"
+#include "SCLDefines.h"
+#include "converted_image.h"
+#include "color_table.h"
+
+class progressive_preview_impl : public SlopeCraft::progressive_preview {
+ public:
+  using eimg_row_major = converted_image_impl::eimg_row_major;
+  /// The downsampled image has no more pixels than it.
+  static constexpr int64_t max_lowres_pixels = 128 * 128;
+  /// Same as a map, so tiles are refined map by map.
+  static constexpr int64_t tile_size = 128;
+
+ private:
+  const color_table_impl &table;
+  const eimg_row_major original;
+  /// Pixels of the downsampled image are taken every stride pixels.
+  const int64_t stride;
+  /// Both are decided by the option passed to run.
+  std::atomic<int> num_passes;
+  bool refine_by_tiles{true};
+
+  /// Used if the table has no persistent colors.
+  color_table_impl::color_cache_t cache;
+
+  mutable std::mutex preview_lock;
+  eimg_row_major preview;
+  std::atomic<int> passes{0};
+  std::unique_ptr<converted_image_impl> result{nullptr};
+
+  /// img is converted without copying, so tiles are passed as views.
+  [[nodiscard]] std::optional<converted_image_impl> convert(
+      const_image_reference img, const convert_option &option) noexcept;
+
+  /// View of a block of original
+  [[nodiscard]] const_image_reference view_of_original(
+      int64_t row_begin, int64_t col_begin, int64_t rows,
+      int64_t cols) const noexcept;
+
+  /// Returns false if any pass is cancelled.
+  [[nodiscard]] bool run_passes(const convert_option &option,
+                                const progress_callbacks &progress) noexcept;
+
+  /// Write converted pixels of a pass to the preview, each pixel is scaled to
+  /// scale*scale pixels.
+  void publish(const converted_image_impl &cvted, int64_t row_begin,
+               int64_t col_begin, int64_t scale) noexcept;
+
+ public:
+  progressive_preview_impl(const color_table_impl &table,
+                           const_image_reference original_img);
+
+  [[nodiscard]] size_t rows() const noexcept final {
+    return this->original.rows();
+  }
+  [[nodiscard]] size_t cols() const noexcept final {
+    return this->original.cols();
+  }
+
+  [[nodiscard]] bool run(const convert_option &option) noexcept final;
+
+  [[nodiscard]] int finished_passes() const noexcept final {
+    return this->passes;
+  }
+  [[nodiscard]] int total_passes() const noexcept final {
+    return this->num_passes;
+  }
+
+  int get_preview(uint32_t *buffer) const noexcept final;
+
+  [[nodiscard]] converted_image *take_result() noexcept final;
+};
+
+#endif  // SLOPECRAFT_PROGRESSIVE_PREVIEW_H
@@ -164,6 +164,9 @@ std::optional<structure_3D_impl> structure_3D_impl::create(
     }
   }
   fixed_opt.main_progressbar.set_range(0, 9 * cvted.size(), 8 * cvted.size());
+  if (report_if_cancelled(option.cancel, option.ui)) {
+    return std::nullopt;
+  }
   // build bridges
   if (table.map_type() == mapTypes::Slope &&
       fixed_opt.glass_method == glassBridgeSettings::withBridge) {
@@ -175,6 +178,7 @@ std::optional<structure_3D_impl> structure_3D_impl::create(
     prim_glass_builder glass_builder;
     glass_builder.ui = fixed_opt.ui;
     glass_builder.progress_bar = fixed_opt.sub_progressbar;
+    glass_builder.cancel = option.cancel;
     fixed_opt.ui.keep_awake();
     for (uint32_t y = 0; y < ret.schem.y_range(); y++) {
       fixed_opt.sub_progressbar.add(step);
@@ -191,6 +195,9 @@ std::optional<structure_3D_impl> structure_3D_impl::create(
         glassMap glass;
         // cerr << "Construct glass bridge at y=" << y << endl;
         glass = glass_builder.makeBridge(targetMap);
+        if (report_if_cancelled(option.cancel, option.ui)) {
+          return std::nullopt;
+        }
         for (int r = 0; r < glass.rows(); r++)
           for (int c = 0; c < glass.cols(); c++)
             if (ret.schem(r, y, c) == prim_glass_builder::air &&
@@ -207,6 +214,8 @@ std::optional<structure_3D_impl> structure_3D_impl::create(
   if (fixed_opt.connect_mushrooms) {
     ret.schem.process_mushroom_states();
   }
+  // most blocks are air in tall structures
+  ret.schem.compact();
   fixed_opt.main_progressbar.set_range(0, 9 * cvted.size(), 9 * cvted.size());
   fixed_opt.ui.report_working_status(workStatus::none);
 
@@ -217,6 +226,9 @@ std::optional<structure_3D_impl> structure_3D_impl::create(
 bool structure_3D_impl::export_litematica(
     const char *filename,
     const SlopeCraft::litematic_options &option) const noexcept {
+  if (report_if_cancelled(option.cancel, option.ui)) {
+    return false;
+  }
   option.ui.report_working_status(workStatus::writingMetaInfo);
   option.progressbar.set_range(0, 100 + this->schem.size(), 0);
   libSchem::litematic_info info{};
@@ -239,6 +251,9 @@ bool structure_3D_impl::export_litematica(
 bool structure_3D_impl::export_vanilla_structure(
     const char *filename,
     const SlopeCraft::vanilla_structure_options &option) const noexcept {
+  if (report_if_cancelled(option.cancel, option.ui)) {
+    return false;
+  }
   option.ui.report_working_status(workStatus::writingMetaInfo);
   option.progressbar.set_range(0, 100 + schem.size(), 0);
 
@@ -256,6 +271,9 @@ bool structure_3D_impl::export_vanilla_structure(
 bool structure_3D_impl::export_WE_schem(
     const char *filename,
     const SlopeCraft::WE_schem_options &option) const noexcept {
+  if (report_if_cancelled(option.cancel, option.ui)) {
+    return false;
+  }
   option.progressbar.set_range(0, 100, 0);
 
   libSchem::WorldEditSchem_info info;
@@ -295,6 +313,9 @@ bool structure_3D_impl::export_flat_diagram(
             .c_str());
     return false;
   }
+  if (report_if_cancelled(option.cancel, option.ui)) {
+    return false;
+  }
   const libFlatDiagram::fd_option fdopt{
       .row_start = 0,
       .row_end = this->schem.z_range(),
@@ -308,14 +329,21 @@ bool structure_3D_impl::export_flat_diagram(
   std::vector<Eigen::Array<uint32_t, 16, 16, Eigen::RowMajor>> img_list_rmj;
   img_list_rmj.reserve(this->schem.palette_size());
 
+  // a delta made by diff has the keep marker before air
+  const size_t first_block = (this->schem.palette_size() > 0 &&
+                              this->schem.palette()[0] ==
+                                  libSchem::Schem::keep_block_id)
+                                 ? 2
+                                 : 1;
   for (size_t pblkid = 0; pblkid < this->schem.palette_size(); pblkid++) {
-    if (pblkid == 0) {
+    if (pblkid < first_block) {
       img_list_rmj.emplace_back();
-      img_list_rmj[0].setZero();
+      img_list_rmj.back().setZero();
       continue;
     }
     std::string_view id = this->schem.palette()[pblkid];
-    const mc_block *blkp = table.find_block_for_index(pblkid - 1, id);
+    const mc_block *blkp =
+        table.find_block_for_index(int(pblkid - first_block), id);
     if (blkp == nullptr) {
       std::string blkid_full;
       blkid_full.reserve(64 * 2048);
@@ -366,8 +394,26 @@ bool structure_3D_impl::export_flat_diagram(
           "under GPLv3 license. You can find "
           "its repository at https://github.com/SlopeCraft/SlopeCraft")};
 
+  option.progressbar.set_range(0, int(fdopt.row_end), 0);
+  // only a cancellation seen by the writer stops it, a later one doesn't
+  // affect the finished png.
+  bool stopped = false;
+  auto progress = [&option, &fdopt, &stopped](int64_t pixel_rows_finished) {
+    option.progressbar.set_range(0, int(fdopt.row_end),
+                                 int(pixel_rows_finished / 16));
+    stopped = option.cancel.is_cancelled();
+    return !stopped;
+  };
+
   auto err = libFlatDiagram::export_flat_diagram(filename, fdopt,
-                                                 block_at_callback, txt);
+                                                 block_at_callback, txt,
+                                                 progress);
+  if (stopped) {
+    std::error_code ec;
+    std::filesystem::remove(filename, ec);
+    report_if_cancelled(option.cancel, option.ui);
+    return false;
+  }
   if (!err.empty()) {
     option.ui.report_error(errorFlag::EXPORT_FLAT_DIAGRAM_FAILURE, err.c_str());
     return false;
@@ -452,23 +498,71 @@ uint64_t structure_3D_impl::block_count() const noexcept {
   std::vector<uint8_t> LUT_is_air;
   LUT_is_air.reserve(this->schem.palette_size());
   for (auto &id : this->schem.palette()) {
-    if (id == "air" || id == "minecraft:air") {
+    if (id == "air" || id == "minecraft:air" ||
+        id == libSchem::Schem::keep_block_id) {
       LUT_is_air.emplace_back(1);
     } else {
       LUT_is_air.emplace_back(0);
     }
   }
 
+  const auto stat = this->schem.stat_blocks();
   uint64_t counter = 0;
-  for (int64_t i = 0; i < this->schem.size(); i++) {
-    const auto cur_blk_id = this->schem(i);
-    if (cur_blk_id >= LUT_is_air.size()) [[unlikely]] {
-      counter++;
-      continue;
-    }
-    if (!LUT_is_air[cur_blk_id]) {
-      counter++;
+  for (size_t blk_id = 0; blk_id < stat.size(); blk_id++) {
+    if (!LUT_is_air[blk_id]) {
+      counter += stat[blk_id];
     }
   }
   return counter;
-}
\ No newline at end of file
+}
+structure_3D *structure_3D_impl::diff(
+    const structure_3D &old_build_, const structure_diff_options &option,
+    structure_diff_statistics *stat) const noexcept {
+  const auto &old_build = dynamic_cast<const structure_3D_impl &>(old_build_);
+  if (report_if_cancelled(option.cancel, option.ui)) {
+    return nullptr;
+  }
+  libSchem::diff_statistics delta_stat;
+  structure_3D_impl ret;
+  {
+    auto res = this->schem.diff(
+        old_build.schem, &delta_stat, &ret.changed_regions,
+        [&option](int64_t finished, int64_t total) {
+          option.progressbar.set_range(0, int(total), int(finished));
+          return !option.cancel.is_cancelled();
+        });
+    if (report_if_cancelled(option.cancel, option.ui)) {
+      return nullptr;
+    }
+    if (!res) {
+      option.ui.report_error(errorFlag::DIFF_STRUCTURE_SHAPE_MISMATCH,
+                             res.error().c_str());
+      return nullptr;
+    }
+    ret.schem = std::move(res.value());
+  }
+  ret.map_color = this->map_color;
+
+  if (stat != nullptr) {
+    stat->added_blocks = delta_stat.added;
+    stat->removed_blocks = delta_stat.removed;
+    stat->replaced_blocks = delta_stat.replaced;
+    stat->changed_regions = ret.changed_regions.size();
+  }
+  return new structure_3D_impl{std::move(ret)};
+}
+
+size_t structure_3D_impl::get_changed_regions(
+    structure_region *buffer, size_t capacity) const noexcept {
+  if (buffer != nullptr) {
+    const size_t count = std::min(capacity, this->changed_regions.size());
+    for (size_t idx = 0; idx < count; idx++) {
+      const auto &r = this->changed_regions[idx];
+      for (size_t dim = 0; dim < 3; dim++) {
+        buffer[idx].offset[dim] = uint64_t(r.offset_xyz[dim]);
+        buffer[idx].shape[dim] = uint64_t(r.shape_xyz[dim]);
+      }
+    }
+  }
+  return this->changed_regions.size();
+}
@@ -17,6 +17,8 @@ class structure_3D_impl : public structure_3D {
   Eigen::ArrayXX<uint8_t>
       map_color;  // map color may be modified by lossy
                   // compression,so we store the modified one
+  /// Only structures made by diff have changed regions
+  std::vector<libSchem::region> changed_regions;
 
   size_t shape_x() const noexcept final { return this->schem.x_range(); }
   size_t shape_y() const noexcept final { return this->schem.y_range(); }
@@ -54,6 +56,12 @@ class structure_3D_impl : public structure_3D {
 
   uint64_t block_count() const noexcept final;
 
+  structure_3D *diff(const structure_3D &old_build,
+                     const structure_diff_options &option,
+                     structure_diff_statistics *stat) const noexcept final;
+  size_t get_changed_regions(structure_region *buffer,
+                             size_t capacity) const noexcept final;
+
   template <class archive>
   void load(archive &ar) {
     ar(this->map_color);
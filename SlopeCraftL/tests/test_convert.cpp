@@ -0,0 +1,356 @@
+#include <SlopeCraftL.h>
+
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+using std::cout, std::endl;
+
+template <class T>
+using scl_ptr = std::unique_ptr<T, SlopeCraft::deleter>;
+
+// A slope map table that allows every base color, all blocks are stone.
+scl_ptr<SlopeCraft::color_table> make_color_table() noexcept {
+  std::array<scl_ptr<SlopeCraft::mc_block_interface>, 64> blocks;
+  SlopeCraft::color_table_create_info info{
+      .map_type = SCL_mapTypes::Slope,
+      .mc_version = SCL_gameVersion::MC19,
+  };
+  for (size_t i = 0; i < blocks.size(); i++) {
+    blocks[i].reset(SlopeCraft::SCL_create_block());
+    blocks[i]->setId(i == 0 ? "minecraft:glass" : "minecraft:stone");
+    blocks[i]->setVersion(uint8_t(SCL_gameVersion::ANCIENT));
+    info.blocks[i] = blocks[i].get();
+    info.basecolor_allow_LUT[i] = true;
+  }
+  return scl_ptr<SlopeCraft::color_table>{
+      SlopeCraft::SCL_create_color_table(info)};
+}
+
+// Opaque pixels of distinct colors, different seeds give different colors.
+std::vector<uint32_t> distinct_pixels(size_t num, uint32_t seed) noexcept {
+  std::vector<uint32_t> ret(num);
+  for (size_t i = 0; i < num; i++) {
+    ret[i] = 0xFF'00'00'00 | ((seed & 0xFF) << 16) | uint32_t(i * 97 % 0xFFFF);
+  }
+  return ret;
+}
+
+// Convert a single image with convert_images, returns the statistics.
+std::optional<SlopeCraft::convert_images_statistics> convert_with_stats(
+    const SlopeCraft::color_table &table, const std::vector<uint32_t> &img,
+    std::vector<uint32_t> *converted = nullptr) noexcept {
+  const SlopeCraft::const_image_reference ref{
+      .data = img.data(), .rows = 1, .cols = img.size()};
+  SlopeCraft::convert_images_statistics stats;
+  SlopeCraft::converted_image *dest{nullptr};
+  if (!table.convert_images(&ref, 1, SlopeCraft::convert_option{}, &dest,
+                            &stats)) {
+    return std::nullopt;
+  }
+  scl_ptr<SlopeCraft::converted_image> cvted{dest};
+  if (converted != nullptr) {
+    converted->resize(cvted->size());
+    cvted->get_converted_image(converted->data());
+  }
+  return stats;
+}
+
+// Colors survive a save/load roundtrip, and the most used ones are kept when
+// the cache is truncated.
+bool test_color_cache(const std::filesystem::path &cache_root) noexcept {
+  const std::string root = cache_root.string();
+  const std::vector<uint32_t> often = distinct_pixels(64, 1);
+  const std::vector<uint32_t> rarely = distinct_pixels(64, 2);
+
+  std::vector<uint32_t> converted_before;
+  {
+    auto table = make_color_table();
+    if (table == nullptr || !table->load_color_cache(root.c_str(), nullptr)) {
+      cout << "Failed to load a missing color cache." << endl;
+      return false;
+    }
+    auto first = convert_with_stats(*table, often);
+    auto second = convert_with_stats(*table, often, &converted_before);
+    auto third = convert_with_stats(*table, rarely);
+    if (!first || !second || !third || first->num_cache_hits != 0 ||
+        second->num_cache_hits != often.size() ||
+        third->num_cache_hits != 0) {
+      cout << "Colors are not shared by conversions of the same table."
+           << endl;
+      return false;
+    }
+    if (!table->save_color_cache(root.c_str(), often.size(), nullptr)) {
+      cout << "Failed to save color cache." << endl;
+      return false;
+    }
+  }
+
+  auto table = make_color_table();
+  if (!table->load_color_cache(root.c_str(), nullptr)) {
+    cout << "Failed to load color cache." << endl;
+    return false;
+  }
+  std::vector<uint32_t> converted_after;
+  auto often_stats = convert_with_stats(*table, often, &converted_after);
+  if (!often_stats || often_stats->num_cache_hits != often.size() ||
+      often_stats->num_cached_colors != often.size() ||
+      converted_after != converted_before) {
+    cout << "Colors loaded from the cache are wrong." << endl;
+    return false;
+  }
+  auto rarely_stats = convert_with_stats(*table, rarely);
+  if (!rarely_stats || rarely_stats->num_cache_hits != 0) {
+    cout << "Less used colors are kept when the cache is truncated." << endl;
+    return false;
+  }
+
+  // trimming in memory keeps the most used colors as well
+  const size_t removed = table->trim_color_cache(often.size());
+  often_stats = convert_with_stats(*table, often);
+  rarely_stats = convert_with_stats(*table, rarely);
+  if (removed != rarely.size() || !often_stats || !rarely_stats ||
+      often_stats->num_cache_hits != often.size() ||
+      rarely_stats->num_cache_hits != 0) {
+    cout << "trim_color_cache removed " << removed
+         << " colors, but expected only the less used " << rarely.size()
+         << endl;
+    return false;
+  }
+  return true;
+}
+
+// A failed image makes convert_images return false, other results are kept.
+bool test_partial_failure() noexcept {
+  auto table = make_color_table();
+  const std::vector<uint32_t> pixels = distinct_pixels(64, 3);
+  const std::array<SlopeCraft::const_image_reference, 3> refs{{
+      {.data = pixels.data(), .rows = 8, .cols = 8},
+      {.data = nullptr, .rows = 8, .cols = 8},
+      {.data = pixels.data(), .rows = 1, .cols = 64},
+  }};
+  std::array<SlopeCraft::converted_image *, refs.size()> dest{};
+  const bool ok = table->convert_images(
+      refs.data(), refs.size(), SlopeCraft::convert_option{}, dest.data(),
+      nullptr);
+  std::array<scl_ptr<SlopeCraft::converted_image>, refs.size()> results;
+  for (size_t i = 0; i < refs.size(); i++) {
+    results[i].reset(dest[i]);
+  }
+  if (ok) {
+    cout << "convert_images returns true while an image failed." << endl;
+    return false;
+  }
+  if (results[0] == nullptr || results[1] != nullptr ||
+      results[2] == nullptr) {
+    cout << "Results of convert_images are wrong when an image failed."
+         << endl;
+    return false;
+  }
+  return true;
+}
+
+// An image stored in a buffer of some layout, padding is filled with garbage.
+struct layout_image {
+  size_t rows;
+  size_t cols;
+  size_t stride;
+  bool is_col_major;
+  std::vector<uint32_t> buffer;
+
+  layout_image(const std::vector<uint32_t> &row_major, size_t rows_,
+               size_t cols_, size_t stride_, bool is_col_major_) noexcept
+      : rows{rows_}, cols{cols_}, stride{stride_}, is_col_major{is_col_major_} {
+    this->buffer.assign(this->outer_stride() * (is_col_major ? cols : rows),
+                        0x12'34'56'78);
+    for (size_t r = 0; r < rows; r++) {
+      for (size_t c = 0; c < cols; c++) {
+        this->at(r, c) = row_major[r * cols + c];
+      }
+    }
+  }
+
+  size_t outer_stride() const noexcept {
+    return (this->stride > 0) ? this->stride
+                              : (this->is_col_major ? this->rows : this->cols);
+  }
+  uint32_t &at(size_t r, size_t c) noexcept {
+    return this->is_col_major ? this->buffer[c * this->outer_stride() + r]
+                              : this->buffer[r * this->outer_stride() + c];
+  }
+  SlopeCraft::const_image_reference cref() const noexcept {
+    return {.data = this->buffer.data(),
+            .rows = this->rows,
+            .cols = this->cols,
+            .stride = this->stride,
+            .is_col_major = this->is_col_major};
+  }
+  SlopeCraft::image_reference ref() noexcept {
+    return {.data = this->buffer.data(),
+            .rows = this->rows,
+            .cols = this->cols,
+            .stride = this->stride,
+            .is_col_major = this->is_col_major};
+  }
+};
+
+// The same image in tight row-major, padded row-major and col-major buffers
+// has the same cache and gives the same results.
+bool test_image_layouts(const std::filesystem::path &cache_root) noexcept {
+  const std::string root = cache_root.string();
+  constexpr size_t rows = 5;
+  constexpr size_t cols = 7;
+  const std::vector<uint32_t> pixels = distinct_pixels(rows * cols, 4);
+  const std::array<layout_image, 3> layouts{{
+      {pixels, rows, cols, 0, false},
+      {pixels, rows, cols, cols + 3, false},
+      {pixels, rows, cols, 0, true},
+  }};
+  const char *const names[] = {"tight row-major", "padded row-major",
+                               "col-major"};
+
+  auto table = make_color_table();
+  const SlopeCraft::convert_option option{};
+  std::optional<layout_image> expected;
+  for (size_t i = 0; i < layouts.size(); i++) {
+    const layout_image &src = layouts[i];
+    scl_ptr<SlopeCraft::converted_image> cvted{
+        table->convert_image(src.cref(), option)};
+    if (cvted == nullptr || cvted->rows() != rows || cvted->cols() != cols) {
+      cout << "Failed to convert " << names[i] << " image." << endl;
+      return false;
+    }
+
+    // read back in the same layout
+    layout_image original = src;
+    std::fill(original.buffer.begin(), original.buffer.end(), 0);
+    layout_image converted = original;
+    if (!cvted->get_original_image(original.ref()) ||
+        !cvted->get_converted_image(converted.ref())) {
+      cout << "Failed to get images of " << names[i] << " image." << endl;
+      return false;
+    }
+    for (size_t r = 0; r < rows; r++) {
+      for (size_t c = 0; c < cols; c++) {
+        if (original.at(r, c) != pixels[r * cols + c]) {
+          cout << "Original " << names[i] << " image is changed at (" << r
+               << ", " << c << ")." << endl;
+          return false;
+        }
+        if (expected.has_value() &&
+            converted.at(r, c) != expected->at(r, c)) {
+          cout << "Converted " << names[i]
+               << " image differs from the tight row-major one at (" << r
+               << ", " << c << ")." << endl;
+          return false;
+        }
+      }
+    }
+    if (!expected.has_value()) {
+      expected = std::move(converted);
+    }
+
+    if (i == 0 && !table->save_convert_cache(src.cref(), option, *cvted,
+                                             root.c_str(), nullptr)) {
+      cout << "Failed to save convert cache." << endl;
+      return false;
+    }
+    if (!table->has_convert_cache(src.cref(), option, root.c_str())) {
+      cout << "Convert cache is not found by " << names[i]
+           << " image, its task hash differs." << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Passes are counted as documented, cancellation keeps nothing, and the final
+// result is the same as a plain conversion.
+bool test_progressive_preview() noexcept {
+  auto table = make_color_table();
+  // downsampled, and 3x2 tiles
+  constexpr size_t rows = 300;
+  constexpr size_t cols = 200;
+  const std::vector<uint32_t> pixels = distinct_pixels(rows * cols, 5);
+  const SlopeCraft::const_image_reference ref{
+      .data = pixels.data(), .rows = rows, .cols = cols};
+
+  {
+    scl_ptr<SlopeCraft::progressive_preview> preview{
+        table->create_progressive_preview(ref)};
+    SlopeCraft::convert_option option{};
+    option.cancel.cb_is_cancelled = [](void *) { return true; };
+    if (preview == nullptr || preview->run(option) ||
+        preview->finished_passes() != 0 || preview->take_result() != nullptr) {
+      cout << "Cancelled progressive preview publishes passes." << endl;
+      return false;
+    }
+  }
+
+  for (bool dither : {false, true}) {
+    SlopeCraft::convert_option option{};
+    option.dither = dither;
+    scl_ptr<SlopeCraft::progressive_preview> preview{
+        table->create_progressive_preview(ref)};
+    if (preview == nullptr || !preview->run(option)) {
+      cout << "Failed to run progressive preview." << endl;
+      return false;
+    }
+    // tiles are skipped when dithering
+    const int expected_passes = dither ? 2 : 1 + 3 * 2 + 1;
+    if (preview->total_passes() != expected_passes ||
+        preview->finished_passes() != expected_passes) {
+      cout << "Progressive preview runs " << preview->finished_passes()
+           << " of " << preview->total_passes() << " passes, expected "
+           << expected_passes << endl;
+      return false;
+    }
+
+    scl_ptr<SlopeCraft::converted_image> result{preview->take_result()};
+    scl_ptr<SlopeCraft::converted_image> plain{
+        table->convert_image(ref, option)};
+    if (result == nullptr || plain == nullptr ||
+        preview->take_result() != nullptr) {
+      cout << "Result of progressive preview is not taken once." << endl;
+      return false;
+    }
+    std::vector<uint32_t> result_pixels(rows * cols);
+    std::vector<uint32_t> plain_pixels(rows * cols);
+    std::vector<uint32_t> preview_pixels(rows * cols);
+    result->get_converted_image(result_pixels.data());
+    plain->get_converted_image(plain_pixels.data());
+    preview->get_preview(preview_pixels.data());
+    if (result_pixels != plain_pixels || preview_pixels != plain_pixels) {
+      cout << "Result of progressive preview differs from convert_image, "
+              "dither = "
+           << dither << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+int main() {
+  const auto cache_root =
+      std::filesystem::temp_directory_path() /
+      ("test_convert_cache_" + std::to_string(std::random_device{}()));
+  bool ok = true;
+  ok = test_color_cache(cache_root) && ok;
+  ok = test_partial_failure() && ok;
+  ok = test_image_layouts(cache_root) && ok;
+  ok = test_progressive_preview() && ok;
+
+  std::error_code ec;
+  std::filesystem::remove_all(cache_root, ec);
+  if (!ok) {
+    return 1;
+  }
+  cout << "Success" << endl;
+  return 0;
+}
@@ -23,6 +23,7 @@ This file is part of SlopeCraft.
 #ifndef SLOPECRAFT_VISUALCRAFTL_PARSERESOURCEPACK_H
 #define SLOPECRAFT_VISUALCRAFTL_PARSERESOURCEPACK_H
 
+#include <map>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -449,6 +450,8 @@ struct state {
   }
   std::string key;
   std::string value;
+
+  bool operator==(const state &) const noexcept = default;
 };
 
 struct model_store_t {
@@ -456,6 +459,8 @@ struct model_store_t {
   block_model::face_rot x{block_model::face_rot::face_rot_0};
   block_model::face_rot y{block_model::face_rot::face_rot_0};
   bool uvlock{false};
+
+  bool operator==(const model_store_t &) const noexcept = default;
 };
 
 struct model_pass_t {
@@ -482,6 +487,58 @@ class state_list : public std::vector<state> {
   // bool contains_auto(const state_list &another) noexcept;
 };
 
+/// Maps block state keys and values to small integers, so that matching block
+/// states against variants and multiparts only compares integers.
+class state_interner {
+ public:
+  using id_t = uint32_t;
+  static constexpr id_t invalid_id = UINT32_MAX;
+
+  /// Returns the id of str, a new id is assigned if str is not met before.
+  id_t intern(std::string_view str) noexcept;
+  /// Returns the id of str, or invalid_id if str is never interned.
+  [[nodiscard]] id_t find(std::string_view str) const noexcept;
+
+  [[nodiscard]] size_t size() const noexcept { return this->ids.size(); }
+
+ private:
+  struct string_hash {
+    using is_transparent = void;
+    size_t operator()(std::string_view sv) const noexcept {
+      return std::hash<std::string_view>{}(sv);
+    }
+  };
+  std::unordered_map<std::string, id_t, string_hash, std::equal_to<>> ids;
+};
+
+struct compiled_state {
+  state_interner::id_t key;
+  state_interner::id_t value;
+};
+
+/// A state_list with interned keys and values. Keys or values that are never
+/// interned are stored as invalid_id, so they never match anything.
+class compiled_state_list : public std::vector<compiled_state> {
+ public:
+  void compile(const state_list &src, const state_interner &interner) noexcept;
+  void compile_and_intern(const state_list &src,
+                          state_interner &interner) noexcept;
+
+  /// Same as state_list::contains
+  [[nodiscard]] bool contains(const compiled_state_list &another) const noexcept;
+
+  /// Returns the value of the first state with given key, or invalid_id.
+  [[nodiscard]] state_interner::id_t value_of(
+      state_interner::id_t key) const noexcept {
+    for (const auto &s : *this) {
+      if (s.key == key) {
+        return s.value;
+      }
+    }
+    return state_interner::invalid_id;
+  }
+};
+
 bool process_full_id(std::string_view full_id, std::string *namespace_name,
                      std::string *pure_id, state_list *states) noexcept;
 
@@ -491,10 +548,15 @@ bool process_full_id(std::string_view full_id, std::string *namespace_name,
 class block_states_variant {
  public:
   model_pass_t block_model_name(const state_list &sl) const noexcept;
+  /// Requires compile to be called.
+  model_pass_t block_model_name(const compiled_state_list &sl) const noexcept;
 
   std::vector<std::pair<state_list, model_store_t>> LUT;
+  /// compiled_LUT[i] is the compiled state list of LUT[i].
+  std::vector<compiled_state_list> compiled_LUT;
 
   void sort() noexcept;
+  void compile(state_interner &interner) noexcept;
 };
 
 struct criteria {
@@ -520,6 +582,28 @@ class criteria_list_and : public std::vector<criteria> {
   bool match(const state_list &sl) const noexcept;
 };
 
+struct compiled_criteria {
+  state_interner::id_t key;
+  std::vector<state_interner::id_t> values;
+
+  [[nodiscard]] inline bool match(state_interner::id_t value) const noexcept {
+    for (auto v : this->values) {
+      if (v == value) return true;
+    }
+    return false;
+  }
+};
+
+/// Every kind of criteria in multipart is compiled to this form. A single
+/// criteria is an "or" of one group, and criteria_all_pass is an "and" of no
+/// groups.
+struct compiled_when {
+  std::vector<std::vector<compiled_criteria>> groups;
+  bool is_or{true};
+
+  [[nodiscard]] bool match(const compiled_state_list &sl) const noexcept;
+};
+
 struct criteria_list_or_and {
   std::vector<criteria_list_and> components;
   bool is_or{true};
@@ -541,7 +625,14 @@ class multipart_pair {
   std::vector<criteria_list_and> when_or;
   */
 
+  compiled_when compiled;
+
   bool match(const state_list &sl) const noexcept;
+  /// Requires compile to be called.
+  bool match(const compiled_state_list &sl) const noexcept {
+    return this->compiled.match(sl);
+  }
+  void compile(state_interner &interner) noexcept;
 };
 
 class block_state_multipart {
@@ -550,13 +641,82 @@ class block_state_multipart {
 
   std::vector<model_pass_t> block_model_names(
       const state_list &sl) const noexcept;
+  /// Requires compile to be called.
+  std::vector<model_pass_t> block_model_names(
+      const compiled_state_list &sl) const noexcept;
+
+  void compile(state_interner &interner) noexcept;
 };
 
+/// Parses a block state json. The fast parser is tried first, and nlohmann
+/// json is used as a fallback.
 bool parse_block_state(
     const char *const json_str_beg, const char *const end,
     std::variant<block_states_variant, block_state_multipart> *,
     bool *const is_dest_variant = nullptr) noexcept;
 
+bool parse_block_state_nlohmann(
+    const char *const json_str_beg, const char *const end,
+    std::variant<block_states_variant, block_state_multipart> *,
+    bool *const is_dest_variant = nullptr) noexcept;
+
+/// Parses block states with variants without building a json DOM.
+/// \return false if the json is not handled by the fast parser, for example
+/// it has multipart, escaped strings or anything that needs to be reported.
+/// Nothing is reported in this function, so the caller is expected to fall
+/// back to parse_block_state_nlohmann.
+bool parse_block_state_fast(const char *const json_str_beg,
+                            const char *const end,
+                            block_states_variant *dest) noexcept;
+
+struct face_json_temp {
+  std::string texture{""};
+  std::array<float, 4> uv{0, 0, 16, 16};
+  block_model::face_idx cullface_face;
+  bool have_cullface{false};
+  bool is_hidden{true};  ///< note that by default, is_hidden is true.
+
+  bool operator==(const face_json_temp &b) const noexcept {
+    if (this->is_hidden != b.is_hidden || this->texture != b.texture ||
+        this->uv != b.uv || this->have_cullface != b.have_cullface) {
+      return false;
+    }
+    return !this->have_cullface || this->cullface_face == b.cullface_face;
+  }
+};
+
+struct element_json_temp {
+  std::array<float, 3> from;
+  std::array<float, 3> to;
+  std::array<face_json_temp, 6> faces;
+
+  bool operator==(const element_json_temp &) const noexcept = default;
+};
+
+struct block_model_json_temp {
+  std::string parent{""};
+  std::map<std::string, std::string> textures;
+  std::vector<element_json_temp> elements;
+  bool is_inherited{false};
+
+  bool operator==(const block_model_json_temp &) const noexcept = default;
+};
+
+/// Parses a block model json, with the fast parser tried first.
+bool parse_single_model_json(const char *const json_beg,
+                             const char *const json_end,
+                             block_model_json_temp *const dest) noexcept;
+
+bool parse_single_model_json_nlohmann(
+    const char *const json_beg, const char *const json_end,
+    block_model_json_temp *const dest) noexcept;
+
+/// Similar to parse_block_state_fast, returns false if the json is not handled
+/// and nothing is reported.
+bool parse_single_model_json_fast(const char *const json_beg,
+                                  const char *const json_end,
+                                  block_model_json_temp *const dest) noexcept;
+
 }  // namespace resource_json
 
 std::optional<block_model::face_idx> string_to_face_idx(
@@ -598,6 +758,7 @@ class VCL_resource_pack {
     this->textures_original = std::move(src.textures_original);
     this->textures_override = std::move(src.textures_override);
     this->block_states = std::move(src.block_states);
+    this->state_interner = std::move(src.state_interner);
     this->colormap_foliage = std::move(src.colormap_foliage);
     this->colormap_grass = std::move(src.colormap_grass);
 
@@ -654,7 +815,10 @@ class VCL_resource_pack {
     this->textures_override.clear();
   }
   inline void clear_models() noexcept { this->block_models.clear(); }
-  inline void clear_block_states() noexcept { this->block_states.clear(); }
+  inline void clear_block_states() noexcept {
+    this->block_states.clear();
+    this->state_interner = {};
+  }
 
   inline void clear_texture_override() noexcept {
     this->textures_override.clear();
@@ -664,6 +828,7 @@ class VCL_resource_pack {
     std::string pure_id;
     // std::vector<std::pair<std::string, std::string>> traits;
     resource_json::state_list state_list;
+    resource_json::compiled_state_list compiled_state_list;
   };
 
   std::variant<model_with_rotation, block_model::model> find_model(
@@ -693,6 +858,8 @@ class VCL_resource_pack {
                      std::variant<resource_json::block_states_variant,
                                   resource_json::block_state_multipart>>
       block_states;
+  /// Keys and values of block states in block_states are interned here.
+  resource_json::state_interner state_interner;
   block_model::EImgRowMajor_t colormap_grass;
   block_model::EImgRowMajor_t colormap_foliage;
 
@@ -89,6 +89,90 @@ bool resource_json::state_list::contains(
   return true;
 }
 
+state_interner::id_t resource_json::state_interner::intern(
+    std::string_view str) noexcept {
+  auto it = this->ids.find(str);
+  if (it != this->ids.end()) {
+    return it->second;
+  }
+  const id_t id = id_t(this->ids.size());
+  this->ids.emplace(std::string{str}, id);
+  return id;
+}
+
+state_interner::id_t resource_json::state_interner::find(
+    std::string_view str) const noexcept {
+  auto it = this->ids.find(str);
+  if (it == this->ids.end()) {
+    return invalid_id;
+  }
+  return it->second;
+}
+
+void resource_json::compiled_state_list::compile(
+    const state_list &src, const state_interner &interner) noexcept {
+  this->resize(src.size());
+  for (size_t i = 0; i < src.size(); i++) {
+    (*this)[i] = compiled_state{interner.find(src[i].key),
+                                interner.find(src[i].value)};
+  }
+}
+
+void resource_json::compiled_state_list::compile_and_intern(
+    const state_list &src, state_interner &interner) noexcept {
+  this->resize(src.size());
+  for (size_t i = 0; i < src.size(); i++) {
+    (*this)[i] = compiled_state{interner.intern(src[i].key),
+                                interner.intern(src[i].value)};
+  }
+}
+
+bool resource_json::compiled_state_list::contains(
+    const compiled_state_list &another) const noexcept {
+  if (another.size() > this->size()) {
+    return false;
+  }
+
+  for (const compiled_state &s_json : another) {
+    bool is_current_state_matched = false;
+    for (const compiled_state &s_block : *this) {
+      if (s_json.key == s_block.key && s_json.value == s_block.value) {
+        is_current_state_matched = true;
+        break;
+      }
+    }
+    if (!is_current_state_matched) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool resource_json::compiled_when::match(
+    const compiled_state_list &sl) const noexcept {
+  size_t counter = 0;
+  for (const auto &group : this->groups) {
+    bool group_matched = true;
+    for (const compiled_criteria &c : group) {
+      // if value is not set, it is not considered as match
+      const state_interner::id_t value = sl.value_of(c.key);
+      if (value == state_interner::invalid_id || !c.match(value)) {
+        group_matched = false;
+        break;
+      }
+    }
+    if (group_matched) {
+      counter++;
+    }
+  }
+
+  if (this->is_or) {
+    return counter > 0;
+  }
+  return counter >= this->groups.size();
+}
+
 bool resource_json::criteria_list_and::match(
     const state_list &sl) const noexcept {
   const auto &cl = *this;
@@ -179,6 +263,28 @@ model_pass_t block_states_variant::block_model_name(
   return res;
 }
 
+model_pass_t block_states_variant::block_model_name(
+    const compiled_state_list &sl_blk) const noexcept {
+  assert(this->compiled_LUT.size() == this->LUT.size());
+  model_pass_t res;
+  res.model_name = nullptr;
+  for (size_t idx = 0; idx < this->compiled_LUT.size(); idx++) {
+    if (sl_blk.contains(this->compiled_LUT[idx])) {
+      res = model_pass_t(this->LUT[idx].second);
+      return res;
+    }
+  }
+
+  return res;
+}
+
+void block_states_variant::compile(state_interner &interner) noexcept {
+  this->compiled_LUT.resize(this->LUT.size());
+  for (size_t idx = 0; idx < this->LUT.size(); idx++) {
+    this->compiled_LUT[idx].compile_and_intern(this->LUT[idx].first, interner);
+  }
+}
+
 void block_states_variant::sort() noexcept {
   std::sort(LUT.begin(), LUT.end(),
             [](const std::pair<state_list, model_store_t> &a,
@@ -208,6 +314,65 @@ std::vector<model_pass_t> block_state_multipart::block_model_names(
   return res;
 }
 
+std::vector<model_pass_t> block_state_multipart::block_model_names(
+    const compiled_state_list &sl) const noexcept {
+  std::vector<model_pass_t> res;
+
+  for (const multipart_pair &pair : this->pairs) {
+    if (pair.match(sl)) {
+      for (const auto &ms : pair.apply_blockmodel) {
+        res.emplace_back(model_pass_t(ms));
+      }
+    }
+  }
+
+  return res;
+}
+
+compiled_criteria compile_criteria(const criteria &cr,
+                                   state_interner &interner) noexcept {
+  compiled_criteria ret;
+  ret.key = interner.intern(cr.key);
+  ret.values.reserve(cr.values.size());
+  for (const std::string &v : cr.values) {
+    ret.values.emplace_back(interner.intern(v));
+  }
+  return ret;
+}
+
+void multipart_pair::compile(state_interner &interner) noexcept {
+  this->compiled.groups.clear();
+
+  if (const criteria *when = std::get_if<criteria>(&this->criteria_variant)) {
+    this->compiled.is_or = true;
+    this->compiled.groups.push_back({compile_criteria(*when, interner)});
+    return;
+  }
+
+  if (std::get_if<criteria_all_pass>(&this->criteria_variant) != nullptr) {
+    this->compiled.is_or = false;
+    return;
+  }
+
+  const auto &when_or = std::get<criteria_list_or_and>(this->criteria_variant);
+  this->compiled.is_or = when_or.is_or;
+  this->compiled.groups.reserve(when_or.components.size());
+  for (const criteria_list_and &cl : when_or.components) {
+    std::vector<compiled_criteria> group;
+    group.reserve(cl.size());
+    for (const criteria &cr : cl) {
+      group.emplace_back(compile_criteria(cr, interner));
+    }
+    this->compiled.groups.emplace_back(std::move(group));
+  }
+}
+
+void block_state_multipart::compile(state_interner &interner) noexcept {
+  for (multipart_pair &pair : this->pairs) {
+    pair.compile(interner);
+  }
+}
+
 struct parse_bs_buffer {
   std::vector<std::pair<blkid::char_range, blkid::char_range>> attributes;
 };
@@ -222,6 +387,23 @@ bool resource_json::parse_block_state(
     const char *const json_str_beg, const char *const json_str_end,
     std::variant<block_states_variant, block_state_multipart> *dest,
     bool *const is_dest_variant) noexcept {
+  {
+    block_states_variant variant;
+    if (parse_block_state_fast(json_str_beg, json_str_end, &variant)) {
+      if (is_dest_variant != nullptr) *is_dest_variant = true;
+      *dest = std::move(variant);
+      return true;
+    }
+  }
+
+  return parse_block_state_nlohmann(json_str_beg, json_str_end, dest,
+                                    is_dest_variant);
+}
+
+bool resource_json::parse_block_state_nlohmann(
+    const char *const json_str_beg, const char *const json_str_end,
+    std::variant<block_states_variant, block_state_multipart> *dest,
+    bool *const is_dest_variant) noexcept {
   njson::object_t obj;
   try {
     obj = njson::parse(json_str_beg, json_str_end);
@@ -614,27 +796,6 @@ bool parse_block_state_multipart(const njson::object_t &obj,
   return true;
 }
 
-struct face_json_temp {
-  std::string texture{""};
-  std::array<float, 4> uv{0, 0, 16, 16};
-  block_model::face_idx cullface_face;
-  bool have_cullface{false};
-  bool is_hidden{true};  ///< note that by default, is_hidden is true.
-};
-
-struct element_json_temp {
-  std::array<float, 3> from;
-  std::array<float, 3> to;
-  std::array<face_json_temp, 6> faces;
-};
-
-struct block_model_json_temp {
-  std::string parent{""};
-  std::map<std::string, std::string> textures;
-  std::vector<element_json_temp> elements;
-  bool is_inherited{false};
-};
-
 std::optional<block_model::face_idx> string_to_face_idx(
     std::string_view str) noexcept {
   if (str == "up") {
@@ -681,9 +842,20 @@ const char *face_idx_to_string(block_model::face_idx f) noexcept {
   return nullptr;
 }
 
-bool parse_single_model_json(const char *const json_beg,
-                             const char *const json_end,
-                             block_model_json_temp *const dest) {
+bool resource_json::parse_single_model_json(
+    const char *const json_beg, const char *const json_end,
+    block_model_json_temp *const dest) noexcept {
+  if (parse_single_model_json_fast(json_beg, json_end, dest)) {
+    return true;
+  }
+  // the fast parser may leave a partially filled model.
+  *dest = block_model_json_temp{};
+  return parse_single_model_json_nlohmann(json_beg, json_end, dest);
+}
+
+bool resource_json::parse_single_model_json_nlohmann(
+    const char *const json_beg, const char *const json_end,
+    block_model_json_temp *const dest) noexcept {
   dest->textures.clear();
   dest->elements.clear();
   // disable exceptions, and ignore comments.
@@ -1260,6 +1432,8 @@ bool resource_pack::add_block_states(
       continue;
     }
 
+    std::visit([this](auto &val) { val.compile(this->state_interner); }, bs);
+
     const int substrlen = file.first.find_last_of('.');
     this->block_states.emplace(file.first.substr(0, substrlen), std::move(bs));
   }
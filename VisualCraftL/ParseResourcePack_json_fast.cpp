@@ -0,0 +1,568 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+#include <algorithm>
+#include <charconv>
+#include <string_view>
+
+#include <process_block_id.h>
+#include "ParseResourcePack.h"
+
+using namespace resource_json;
+
+// A tiny pull parser for the json files in resource packs. Blockstate and
+// model files are small, ascii only and rarely escaped, so strings are kept as
+// views into the source and no DOM is built. Whenever anything unusual is met
+// (escape sequences, non-ascii strings, duplicated keys, invalid values), the
+// parser gives up silently and the caller falls back to nlohmann json, which
+// reports errors properly.
+namespace {
+
+class json_cursor {
+ public:
+  json_cursor(const char *beg, const char *end, bool allow_comments) noexcept
+      : ptr{beg}, end{end}, allow_comments{allow_comments} {}
+
+  [[nodiscard]] bool skip_ws() noexcept {
+    while (this->ptr < this->end) {
+      const char c = *this->ptr;
+      if (c == ' ' || c == '\n' || c == '\r' || c == '\t') {
+        this->ptr++;
+        continue;
+      }
+      if (c != '/' || !this->allow_comments) {
+        return true;
+      }
+      if (this->ptr + 1 >= this->end) {
+        return false;
+      }
+      if (this->ptr[1] == '/') {
+        this->ptr = std::find(this->ptr + 2, this->end, '\n');
+        continue;
+      }
+      if (this->ptr[1] != '*') {
+        return false;
+      }
+      const std::string_view rest{this->ptr + 2, this->end};
+      const size_t pos = rest.find("*/");
+      if (pos == rest.npos) {
+        return false;
+      }
+      this->ptr = rest.data() + pos + 2;
+    }
+    return true;
+  }
+
+  /// Returns the first non-whitespace character, or '\0' at the end of file.
+  [[nodiscard]] char peek() noexcept {
+    if (!this->skip_ws() || this->ptr >= this->end) {
+      return '\0';
+    }
+    return *this->ptr;
+  }
+
+  [[nodiscard]] bool consume(char c) noexcept {
+    if (this->peek() != c) {
+      return false;
+    }
+    this->ptr++;
+    return true;
+  }
+
+  [[nodiscard]] bool at_end() noexcept {
+    return this->skip_ws() && this->ptr >= this->end;
+  }
+
+  [[nodiscard]] std::optional<std::string_view> string() noexcept {
+    if (!this->consume('"')) {
+      return std::nullopt;
+    }
+    const char *const beg = this->ptr;
+    for (; this->ptr < this->end; this->ptr++) {
+      const uint8_t c = uint8_t(*this->ptr);
+      if (c == '"') {
+        std::string_view ret{beg, this->ptr};
+        this->ptr++;
+        return ret;
+      }
+      // escaped, control or non-ascii characters are left to nlohmann json.
+      if (c == '\\' || c < 0x20 || c >= 0x80) {
+        return std::nullopt;
+      }
+    }
+    return std::nullopt;
+  }
+
+  [[nodiscard]] std::optional<double> number() noexcept {
+    if (!this->skip_ws()) {
+      return std::nullopt;
+    }
+    // validate the json number grammar first, since std::from_chars is less
+    // strict than json.
+    const char *p = this->ptr;
+    auto is_digit = [this](const char *p) {
+      return p < this->end && *p >= '0' && *p <= '9';
+    };
+    if (p < this->end && *p == '-') p++;
+    if (!is_digit(p)) return std::nullopt;
+    if (*p == '0') {
+      p++;
+    } else {
+      while (is_digit(p)) p++;
+    }
+    if (p < this->end && *p == '.') {
+      p++;
+      if (!is_digit(p)) return std::nullopt;
+      while (is_digit(p)) p++;
+    }
+    if (p < this->end && (*p == 'e' || *p == 'E')) {
+      p++;
+      if (p < this->end && (*p == '+' || *p == '-')) p++;
+      if (!is_digit(p)) return std::nullopt;
+      while (is_digit(p)) p++;
+    }
+
+    double val{0};
+    auto res = std::from_chars(this->ptr, p, val);
+    if (res.ec != std::errc{} || res.ptr != p) {
+      return std::nullopt;
+    }
+    this->ptr = p;
+    return val;
+  }
+
+  [[nodiscard]] std::optional<bool> boolean() noexcept {
+    if (!this->skip_ws()) {
+      return std::nullopt;
+    }
+    if (this->match_literal("true")) return true;
+    if (this->match_literal("false")) return false;
+    return std::nullopt;
+  }
+
+  [[nodiscard]] bool skip_value(int depth = 0) noexcept {
+    if (depth > 64) {
+      return false;
+    }
+    switch (this->peek()) {
+      case '{':
+        return this->object([this, depth](std::string_view) {
+          return this->skip_value(depth + 1);
+        });
+      case '[':
+        return this->array(
+            [this, depth](size_t) { return this->skip_value(depth + 1); });
+      case '"':
+        return this->string().has_value();
+      case 't':
+      case 'f':
+        return this->boolean().has_value();
+      case 'n':
+        return this->match_literal("null");
+      default:
+        return this->number().has_value();
+    }
+  }
+
+  /// Calls on_member(key) for each member, the callback must consume the value.
+  template <typename fun_t>
+  [[nodiscard]] bool object(fun_t &&on_member) noexcept {
+    if (!this->consume('{')) {
+      return false;
+    }
+    if (this->consume('}')) {
+      return true;
+    }
+    while (true) {
+      auto key = this->string();
+      if (!key || !this->consume(':')) {
+        return false;
+      }
+      if (!on_member(key.value())) {
+        return false;
+      }
+      if (this->consume(',')) {
+        continue;
+      }
+      return this->consume('}');
+    }
+  }
+
+  /// Calls on_element(index) for each element, the callback must consume the
+  /// value.
+  template <typename fun_t>
+  [[nodiscard]] bool array(fun_t &&on_element) noexcept {
+    if (!this->consume('[')) {
+      return false;
+    }
+    if (this->consume(']')) {
+      return true;
+    }
+    for (size_t idx = 0;; idx++) {
+      if (!on_element(idx)) {
+        return false;
+      }
+      if (this->consume(',')) {
+        continue;
+      }
+      return this->consume(']');
+    }
+  }
+
+ private:
+  const char *ptr;
+  const char *const end;
+  const bool allow_comments;
+
+  bool match_literal(std::string_view literal) noexcept {
+    if (std::string_view{this->ptr, this->end}.starts_with(literal)) {
+      this->ptr += literal.size();
+      return true;
+    }
+    return false;
+  }
+};
+
+/// Records keys that are already met in an object. nlohmann json keeps the
+/// last value for duplicated keys, so such files are left to it.
+class seen_keys {
+ public:
+  [[nodiscard]] bool first_time(int key_idx) noexcept {
+    const uint32_t mask = 1u << key_idx;
+    if (this->bits & mask) {
+      return false;
+    }
+    this->bits |= mask;
+    return true;
+  }
+  [[nodiscard]] bool contains(int key_idx) const noexcept {
+    return this->bits & (1u << key_idx);
+  }
+
+ private:
+  uint32_t bits{0};
+};
+
+bool parse_rotation(json_cursor &cursor, block_model::face_rot *dest) noexcept {
+  const char c = cursor.peek();
+  if (c != '-' && (c < '0' || c > '9')) {
+    // not a number, ignored
+    return cursor.skip_value();
+  }
+  auto val = cursor.number();
+  if (!val) {
+    return false;
+  }
+  const int ival = int(val.value());
+  if (!block_model::is_0_90_180_270(ival)) {
+    return false;
+  }
+  *dest = block_model::int_to_face_rot(ival);
+  return true;
+}
+
+bool parse_model_store(json_cursor &cursor, model_store_t *dest) noexcept {
+  enum : int { key_model, key_x, key_y, key_uvlock };
+  seen_keys seen;
+  const bool ok = cursor.object([&](std::string_view key) {
+    if (key == "model") {
+      if (!seen.first_time(key_model)) return false;
+      auto name = cursor.string();
+      if (!name) return false;
+      dest->model_name = name.value();
+      return true;
+    }
+    if (key == "x") {
+      if (!seen.first_time(key_x)) return false;
+      return parse_rotation(cursor, &dest->x);
+    }
+    if (key == "y") {
+      if (!seen.first_time(key_y)) return false;
+      return parse_rotation(cursor, &dest->y);
+    }
+    if (key == "uvlock") {
+      if (!seen.first_time(key_uvlock)) return false;
+      const char c = cursor.peek();
+      if (c == 't' || c == 'f') {
+        auto val = cursor.boolean();
+        if (!val) return false;
+        dest->uvlock = val.value();
+        return true;
+      }
+      return cursor.skip_value();
+    }
+    return cursor.skip_value();
+  });
+  return ok && seen.contains(key_model);
+}
+
+bool parse_variants(json_cursor &cursor,
+                    block_states_variant *const dest) noexcept {
+  using entry_t = std::pair<std::string_view, model_store_t>;
+  std::vector<entry_t> entries;
+
+  const bool ok = cursor.object([&](std::string_view key) {
+    model_store_t model;
+    if (cursor.peek() == '{') {
+      if (!parse_model_store(cursor, &model)) return false;
+    } else if (cursor.peek() == '[') {
+      // only the first model is used, others are weighted alternatives.
+      size_t count = 0;
+      const bool array_ok = cursor.array([&](size_t idx) {
+        count++;
+        if (idx == 0) {
+          return cursor.peek() == '{' && parse_model_store(cursor, &model);
+        }
+        return cursor.skip_value();
+      });
+      if (!array_ok || count <= 0) return false;
+    } else {
+      return false;
+    }
+    entries.emplace_back(key, std::move(model));
+    return true;
+  });
+  if (!ok) {
+    return false;
+  }
+
+  // nlohmann json iterates keys in sorted order, and block_states_variant::sort
+  // is not stable, so keep the same order to get exactly the same result.
+  std::sort(entries.begin(), entries.end(),
+            [](const entry_t &a, const entry_t &b) { return a.first < b.first; });
+  if (std::adjacent_find(entries.begin(), entries.end(),
+                         [](const entry_t &a, const entry_t &b) {
+                           return a.first == b.first;
+                         }) != entries.end()) {
+    return false;
+  }
+
+  dest->LUT.clear();
+  dest->LUT.reserve(entries.size());
+  std::vector<std::pair<blkid::char_range, blkid::char_range>> attributes;
+  for (auto &[key, model] : entries) {
+    std::pair<state_list, model_store_t> p;
+    if (key.size() > 1 && key != "normal" && key != "all" && key != "map") {
+      if (!blkid::process_state_list({key.data(), key.data() + key.size()},
+                                     &attributes, nullptr)) {
+        return false;
+      }
+      p.first.reserve(attributes.size());
+      for (const auto &attrib : attributes) {
+        state s;
+        s.key.assign(attrib.first.begin(), attrib.first.end());
+        s.value.assign(attrib.second.begin(), attrib.second.end());
+        p.first.emplace_back(std::move(s));
+      }
+    }
+    p.second = std::move(model);
+    dest->LUT.emplace_back(std::move(p));
+  }
+
+  dest->sort();
+  return true;
+}
+
+bool parse_face(json_cursor &cursor, face_json_temp *const f) noexcept {
+  enum : int { key_texture, key_cullface, key_uv };
+  seen_keys seen;
+  const bool ok = cursor.object([&](std::string_view key) {
+    if (key == "texture") {
+      if (!seen.first_time(key_texture)) return false;
+      auto texture = cursor.string();
+      if (!texture) return false;
+      if (texture->starts_with("block/")) {
+        f->texture = "minecraft:";
+        f->texture.append(texture.value());
+      } else {
+        f->texture = texture.value();
+      }
+      return true;
+    }
+    if (key == "cullface") {
+      if (!seen.first_time(key_cullface)) return false;
+      if (cursor.peek() != '"') {
+        return cursor.skip_value();
+      }
+      auto cullface = cursor.string();
+      if (!cullface) return false;
+      if (cullface->empty()) {
+        return true;
+      }
+      auto fidx = string_to_face_idx(cullface.value());
+      if (!fidx) return false;
+      f->cullface_face = fidx.value();
+      f->have_cullface = true;
+      return true;
+    }
+    if (key == "uv") {
+      if (!seen.first_time(key_uv)) return false;
+      if (cursor.peek() != '[') {
+        return cursor.skip_value();
+      }
+      std::array<float, 4> uv;
+      size_t count = 0;
+      const bool uv_ok = cursor.array([&](size_t idx) {
+        if (idx >= 4) return false;
+        auto val = cursor.number();
+        if (!val) return false;
+        uv[idx] = float(val.value());
+        count++;
+        return true;
+      });
+      if (!uv_ok || count != 4) return false;
+      f->uv = uv;
+      return true;
+    }
+    return cursor.skip_value();
+  });
+
+  if (!ok || !seen.contains(key_texture)) {
+    return false;
+  }
+  f->is_hidden = false;
+  return true;
+}
+
+bool parse_element(json_cursor &cursor, element_json_temp *const ele) noexcept {
+  enum : int { key_from, key_to, key_faces };
+  seen_keys seen;
+  const bool ok = cursor.object([&](std::string_view key) {
+    if (key == "from" || key == "to") {
+      const bool is_from = (key == "from");
+      if (!seen.first_time(is_from ? key_from : key_to)) return false;
+      std::array<float, 3> &dest = is_from ? ele->from : ele->to;
+      size_t count = 0;
+      const bool arr_ok = cursor.array([&](size_t idx) {
+        if (idx >= 3) return false;
+        auto val = cursor.number();
+        if (!val) return false;
+        dest[idx] = float(val.value());
+        count++;
+        return true;
+      });
+      return arr_ok && count == 3;
+    }
+    if (key == "faces") {
+      if (!seen.first_time(key_faces)) return false;
+      seen_keys seen_faces;
+      return cursor.object([&](std::string_view face_name) {
+        auto fidx = string_to_face_idx(face_name);
+        if (!fidx) return false;
+        if (!seen_faces.first_time(int(fidx.value()))) return false;
+        face_json_temp f;
+        if (!parse_face(cursor, &f)) return false;
+        ele->faces[int(fidx.value())] = std::move(f);
+        return true;
+      });
+    }
+    return cursor.skip_value();
+  });
+  return ok && seen.contains(key_from) && seen.contains(key_to) &&
+         seen.contains(key_faces);
+}
+
+}  // namespace
+
+bool resource_json::parse_block_state_fast(
+    const char *const json_str_beg, const char *const json_str_end,
+    block_states_variant *dest) noexcept {
+  json_cursor cursor{json_str_beg, json_str_end, false};
+
+  bool have_variants = false;
+  const bool ok = cursor.object([&](std::string_view key) {
+    if (key == "variants") {
+      if (have_variants) return false;
+      have_variants = true;
+      return parse_variants(cursor, dest);
+    }
+    if (key == "multipart") {
+      return false;
+    }
+    return cursor.skip_value();
+  });
+
+  return ok && have_variants && cursor.at_end();
+}
+
+bool resource_json::parse_single_model_json_fast(
+    const char *const json_beg, const char *const json_end,
+    block_model_json_temp *const dest) noexcept {
+  dest->textures.clear();
+  dest->elements.clear();
+
+  enum : int { key_parent, key_textures, key_elements };
+  seen_keys seen;
+  json_cursor cursor{json_beg, json_end, true};
+
+  const bool ok = cursor.object([&](std::string_view key) {
+    if (key == "parent") {
+      if (!seen.first_time(key_parent)) return false;
+      if (cursor.peek() != '"') {
+        return cursor.skip_value();
+      }
+      auto parent = cursor.string();
+      if (!parent) return false;
+      if (parent->starts_with("minecraft:")) {
+        parent->remove_prefix(sizeof("minecraft:") / sizeof(char) - 1);
+      }
+      dest->parent = parent.value();
+      return true;
+    }
+
+    if (key == "textures") {
+      if (!seen.first_time(key_textures)) return false;
+      if (cursor.peek() != '{') {
+        return cursor.skip_value();
+      }
+      return cursor.object([&](std::string_view texture_key) {
+        auto value = cursor.string();
+        if (!value) return false;
+        std::string texture_name;
+        if (value->starts_with("block/") || value->starts_with("blocks/")) {
+          texture_name = "minecraft:";
+        }
+        texture_name.append(value.value());
+        auto ret =
+            dest->textures.emplace(texture_key, std::move(texture_name));
+        return ret.second;
+      });
+    }
+
+    if (key == "elements") {
+      if (!seen.first_time(key_elements)) return false;
+      if (cursor.peek() != '[') {
+        return cursor.skip_value();
+      }
+      return cursor.array([&](size_t) {
+        element_json_temp ele;
+        if (!parse_element(cursor, &ele)) return false;
+        dest->elements.emplace_back(std::move(ele));
+        return true;
+      });
+    }
+
+    return cursor.skip_value();
+  });
+
+  return ok && cursor.at_end();
+}
@@ -29,6 +29,7 @@ bool VCL_resource_pack::copy(const VCL_resource_pack &src) noexcept {
   this->textures_original = src.textures_original;
   this->textures_override = src.textures_override;
   this->block_states = src.block_states;
+  this->state_interner = src.state_interner;
   this->block_models = src.block_models;
   this->colormap_foliage = src.colormap_foliage;
   this->colormap_grass = src.colormap_grass;
@@ -222,6 +223,8 @@ VCL_resource_pack::find_model(const std::string &block_state_str,
     return model_with_rotation{nullptr};
   }
 
+  buffer.compiled_state_list.compile(buffer.state_list, this->state_interner);
+
   constexpr bool display_statelist_here = false;
   if constexpr (display_statelist_here) {
     std::string msg = "statelist = [";
@@ -256,7 +259,7 @@ VCL_resource_pack::find_model(const std::string &block_state_str,
   if (it_state->second.index() == 0) {
     resource_json::model_pass_t model =
         std::get<resource_json::block_states_variant>(it_state->second)
-            .block_model_name(buffer.state_list);
+            .block_model_name(buffer.compiled_state_list);
 
     // face_exposed = block_model::invrotate(face_exposed, model.x, model.y);
 
@@ -298,7 +301,7 @@ VCL_resource_pack::find_model(const std::string &block_state_str,
   const auto &multipart =
       std::get<resource_json::block_state_multipart>(it_state->second);
 
-  const auto models = multipart.block_model_names(buffer.state_list);
+  const auto models = multipart.block_model_names(buffer.compiled_state_list);
   for (const auto &md : models) {
     if constexpr (false) {
       std::string msg =
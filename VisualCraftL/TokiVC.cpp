@@ -23,7 +23,9 @@ This file is part of SlopeCraft.
 #include "TokiVC.h"
 
 #include "VCL_internal.h"
+#include <atomic>
 #include <set>
+#include <span>
 #include <shared_mutex>
 #include <unordered_map>
 #include <variant>
@@ -39,6 +41,7 @@ VCL_block_state_list TokiVC::bsl;
 SCL_gameVersion TokiVC::version = SCL_gameVersion::MC19;
 VCL_face_t TokiVC::exposed_face = VCL_face_t::face_down;
 int TokiVC::max_block_layers = 3;
+int TokiVC::color_merge_bits = 0;
 bool TokiVC::is_render_quality_fast{true};
 VCL_biome_t TokiVC::biome{VCL_biome_t::the_void};
 
@@ -47,6 +50,9 @@ std::vector<std::variant<const VCL_block *, std::vector<const VCL_block *>>>
 
 std::unordered_map<const VCL_block *, uint16_t> TokiVC::blocks_allowed;
 
+Eigen::Array<uint16_t, Eigen::Dynamic, Eigen::Dynamic>
+    TokiVC::LUT_color_id_to_palette_ids;
+
 namespace TokiVC_internal {
 std::shared_mutex global_lock;
 bool is_basic_color_set_ready = false;
@@ -129,254 +135,336 @@ bool add_projection_image_for_bsl(const std::vector<VCL_block *> &bs_list,
   return true;
 }
 
-using mutlihash_color_blocks = std::unordered_multimap<
-    uint32_t, std::variant<const VCL_block *, std::vector<const VCL_block *>>>;
-
-bool add_color_non_transparent(
-    const std::vector<VCL_block *> &bs_nontransparent,
-    mutlihash_color_blocks &map_color_blocks) noexcept {
-  for (VCL_block *blkp : bs_nontransparent) {
-    auto ret = compute_mean_color(blkp->project_image_on_exposed_face);
-    if (not ret) {
-      return false;
-    }
-    auto mean_color = ret.value();
-
-    map_color_blocks.emplace(
-        ARGB32(mean_color[0], mean_color[1], mean_color[2]), blkp);
+using block_variant_t =
+    std::variant<const VCL_block *, std::vector<const VCL_block *>>;
 
-    // temp_rgb_rowmajor.emplace_back(ret);
-    // LUT_bcitb.emplace_back(blkp);
+size_t blocks_count(const block_variant_t &variant) noexcept {
+  if (variant.index() == 0) {
+    return 1;
   }
-  return true;
+
+  return std::get<1>(variant).size();
 }
 
-bool add_color_trans_to_nontrans(
-    const block_model::EImgRowMajor_t &front,
-    const std::vector<VCL_block *> &bs_nontransparent,
-    const std::vector<const VCL_block *> &accumulate_blocks,
-    mutlihash_color_blocks &map_color_blocks) noexcept {
-  if (front.size() <= 0) {
-    return false;
+bool compare_blocks_multi(std::span<const VCL_block *const> a,
+                          std::span<const VCL_block *const> b) {
+  if (a.size() != b.size()) {
+    return a.size() < b.size();
   }
 
-  for (VCL_block *blkp : bs_nontransparent) {
-    if (!blkp->is_background()) {
-      continue;
+  for (size_t i = 0; i < a.size(); i++) {
+    if (a[i] != b[i]) {
+      return VCL_compare_block(a[i], b[i]);
     }
-    bool ok = true;
-
-    std::array<uint8_t, 3> ret =
-        compose_image_and_mean(front, blkp->project_image_on_exposed_face, &ok);
+  }
+  // if is all same
+  return false;
+}
 
-    if (!ok) {
-      return false;
-    }
-    std::vector<const VCL_block *> blocks(accumulate_blocks);
-    blocks.emplace_back(blkp);
+bool compare_blocks_variant(const block_variant_t &a,
+                            const block_variant_t &b) noexcept {
+  if (blocks_count(a) != blocks_count(b)) {
+    return blocks_count(a) < blocks_count(b);
+  }
 
-    map_color_blocks.emplace(ARGB32(ret[0], ret[1], ret[2]), blocks);
+  if (a.index() != b.index()) {
+    // this should no happen, but is not fatal
+    return a.index() < b.index();
+  }
 
-    // temp_rgb_rowmajor.emplace_back(ret);
-    // LUT_bcitb.emplace_back(std::move(blocks));
+  if (a.index() == 0) {
+    return VCL_compare_block(std::get<0>(a), std::get<0>(b));
   }
 
-  return true;
+  return compare_blocks_multi(std::get<1>(a), std::get<1>(b));
 }
 
-bool add_color_trans_to_trans_recurs(
-    const int allowed_depth, const block_model::EImgRowMajor_t &front,
-    const std::vector<VCL_block *> &bs_transparent,
-    const std::vector<VCL_block *> &bs_nontransparent,
-    const std::vector<const VCL_block *> &accumulate_blocks,
-    mutlihash_color_blocks &map_color_blocks) noexcept {
-  if (allowed_depth <= 0) {
-    std::string msg =
-        fmt::format("Invalid value for allowed_depth : {}\n", allowed_depth);
-    VCL_report(VCL_report_type_t::error, msg.c_str());
+// Same as compare_blocks_variant(a,b) where a holds a std::vector, but doesn't
+// require the vector to be constructed.
+bool compare_blocks_multi_variant(std::span<const VCL_block *const> a,
+                                  const block_variant_t &b) noexcept {
+  if (a.size() != blocks_count(b)) {
+    return a.size() < blocks_count(b);
+  }
+  if (b.index() == 0) {
     return false;
   }
+  return compare_blocks_multi(a, std::get<1>(b));
+}
 
-  if (allowed_depth == 1) {
-    return add_color_trans_to_nontrans(front, bs_nontransparent,
-                                       accumulate_blocks, map_color_blocks);
-  }
-  block_model::EImgRowMajor_t img(front);
+struct color_blocks_item {
+  uint32_t color;
+  block_variant_t blocks;
+};
 
-  {
-    uint8_t min_alpha = 255;
-    for (int i = 0; i < front.size(); i++) {
-      min_alpha = std::min(min_alpha, getA(front(i)));
-    }
+// Maps a (possibly quantized) color to the cheapest combination of blocks that
+// produces it. Only the cheapest combination can be selected in the end, so
+// keeping the others is a waste of memory.
+using hash_color_blocks = std::unordered_map<uint32_t, color_blocks_item>;
 
-    // if multiple transparent block composed a non-transparent image, then the
-    // recursion terminate.
-    if (min_alpha >= 255) {
-      auto mean_opt = compute_mean_color(front);
+inline uint32_t quantized_color_key(uint32_t argb, int merge_bits) noexcept {
+  const uint32_t channel_mask = (0xFFu << merge_bits) & 0xFFu;
+  return argb & ARGB32(channel_mask, channel_mask, channel_mask, 0);
+}
 
-      if (not mean_opt) {
-        VCL_report(VCL_report_type_t::error,
-                   "Function add_color_trans_to_trans_recurs failed to "
-                   "compute mean color.\n");
-        return false;
-      }
-      auto &mean = mean_opt.value();
-      map_color_blocks.emplace(ARGB32(mean[0], mean[1], mean[2]),
-                               accumulate_blocks);
-      // LUT_bcitb.emplace_back(accumulate_blocks);
-      // temp_rgb_rowmajor.emplace_back(mean);
-      return true;
-    }
+void emplace_if_cheaper(hash_color_blocks &dest, int merge_bits,
+                        color_blocks_item &&item) noexcept {
+  const uint32_t key = quantized_color_key(item.color, merge_bits);
+  auto it = dest.find(key);
+  if (it == dest.end()) {
+    dest.emplace(key, std::move(item));
+    return;
   }
+  if (compare_blocks_variant(item.blocks, it->second.blocks)) {
+    it->second = std::move(item);
+  }
+}
 
-  for (const VCL_block *cblkp : bs_transparent) {
-    if (cblkp == accumulate_blocks.back()) {
-      continue;
-    }
-
-    memcpy(img.data(), front.data(), front.size() * sizeof(uint32_t));
-    std::vector<const VCL_block *> blocks(accumulate_blocks);
-    blocks.emplace_back(cblkp);
-
-    if (!compose_image_background_half_transparent(
-            img, cblkp->project_image_on_exposed_face)) {
-      VCL_report(VCL_report_type_t::error,
-                 "Function add_color_trans_to_trans_recurs failed "
-                 "because failed to compose image. This is possible caused by "
-                 "images have different sizes.\n");
+bool add_color_non_transparent(
+    const std::vector<VCL_block *> &bs_nontransparent, int merge_bits,
+    hash_color_blocks &map_color_blocks) noexcept {
+  for (VCL_block *blkp : bs_nontransparent) {
+    auto ret = compute_mean_color(blkp->project_image_on_exposed_face);
+    if (not ret) {
       return false;
     }
+    auto mean_color = ret.value();
 
-    if (!add_color_trans_to_trans_recurs(allowed_depth - 1, img, bs_transparent,
-                                         bs_nontransparent, blocks,
-                                         map_color_blocks)) {
-      VCL_report(VCL_report_type_t::error,
-                 "Function add_color_trans_to_trans_recurs failed "
-                 "because deeper recursion failed.\n");
+    emplace_if_cheaper(
+        map_color_blocks, merge_bits,
+        {ARGB32(mean_color[0], mean_color[1], mean_color[2]), blkp});
+  }
+  return true;
+}
+
+inline bool is_image_opaque(const block_model::EImgRowMajor_t &img) noexcept {
+  for (int i = 0; i < img.size(); i++) {
+    if (getA(img(i)) < 255) {
       return false;
     }
   }
-
   return true;
 }
 
-bool add_color_trans_to_trans_start_recurse(
-    const int max_allowed_depth, const std::vector<VCL_block *> &bs_transparent,
-    const std::vector<VCL_block *> &bs_nontransparent,
-    mutlihash_color_blocks &map_color_blocks) noexcept {
-  if (max_allowed_depth <= 0) {
-    return false;
+/// Enumerates all stacks of transparent blocks that start with one root block,
+/// optionally put on a background block. This is the same set of combinations
+/// that the old recursive implementation walked through layer by layer, but
+/// every prefix is composed only once and intermediate images live in a
+/// preallocated stack.
+class composed_color_enumerator {
+ public:
+  composed_color_enumerator(int max_layers,
+                            std::span<const VCL_block *const> transparent,
+                            std::span<const VCL_block *const> backgrounds,
+                            const VCL_block *cheapest_background,
+                            int merge_bits, hash_color_blocks &dest)
+      : max_layers{max_layers},
+        transparent{transparent},
+        backgrounds{backgrounds},
+        cheapest_background{cheapest_background},
+        merge_bits{merge_bits},
+        dest{dest} {
+    this->accumulate_blocks.reserve(max_layers);
+    this->image_stack.resize(max_layers);
+  }
+
+  bool run(const VCL_block *root) noexcept {
+    this->accumulate_blocks.clear();
+    this->accumulate_blocks.emplace_back(root);
+    return this->visit(root->project_image_on_exposed_face);
+  }
+
+ private:
+  const int max_layers;
+  std::span<const VCL_block *const> transparent;
+  std::span<const VCL_block *const> backgrounds;
+  const VCL_block *const cheapest_background;
+  const int merge_bits;
+  hash_color_blocks &dest;
+
+  std::vector<const VCL_block *> accumulate_blocks;
+  std::vector<block_model::EImgRowMajor_t> image_stack;
+
+  void emit(uint32_t argb) noexcept {
+    const uint32_t key = quantized_color_key(argb, this->merge_bits);
+    auto it = this->dest.find(key);
+    if (it == this->dest.end()) {
+      this->dest.emplace(key, color_blocks_item{argb, this->accumulate_blocks});
+      return;
+    }
+    if (compare_blocks_multi_variant(this->accumulate_blocks,
+                                     it->second.blocks)) {
+      it->second = color_blocks_item{argb, this->accumulate_blocks};
+    }
   }
 
-  std::vector<const VCL_block *> accum({nullptr});
+  bool emit_on_backgrounds(const block_model::EImgRowMajor_t &front,
+                           bool is_front_opaque) noexcept {
+    if (is_front_opaque) {
+      // Every background block gives the same color, and only the cheapest one
+      // can be selected.
+      if (this->cheapest_background == nullptr) {
+        return true;
+      }
+      auto mean = compute_mean_color(front);
+      if (not mean) {
+        return false;
+      }
+      this->accumulate_blocks.emplace_back(this->cheapest_background);
+      this->emit(ARGB32(mean.value()[0], mean.value()[1], mean.value()[2]));
+      this->accumulate_blocks.pop_back();
+      return true;
+    }
 
-  for (const VCL_block *cblkp : bs_transparent) {
-    accum[0] = cblkp;
-    if (!add_color_trans_to_trans_recurs(
-            max_allowed_depth - 1, cblkp->project_image_on_exposed_face,
-            bs_transparent, bs_nontransparent, accum, map_color_blocks)) {
-      VCL_report(
-          VCL_report_type_t::error,
-          "Function add_color_trans_to_trans_start_recurse failed "
-          "due to function call to add_color_trans_to_trans_recurs failed.\n");
-      return false;
+    for (const VCL_block *blkp : this->backgrounds) {
+      bool ok = true;
+      std::array<uint8_t, 3> ret = compose_image_and_mean(
+          front, blkp->project_image_on_exposed_face, &ok);
+      if (!ok) {
+        return false;
+      }
+      this->accumulate_blocks.emplace_back(blkp);
+      this->emit(ARGB32(ret[0], ret[1], ret[2]));
+      this->accumulate_blocks.pop_back();
     }
+    return true;
   }
 
-  return true;
-}
+  bool visit(const block_model::EImgRowMajor_t &front) noexcept {
+    const int depth = int(this->accumulate_blocks.size());
+    const bool is_front_opaque = is_image_opaque(front);
+    if (depth + 1 <= this->max_layers) {
+      if (!this->emit_on_backgrounds(front, is_front_opaque)) {
+        return false;
+      }
+    }
 
-size_t blocks_count(
-    const std::variant<const VCL_block *, std::vector<const VCL_block *>>
-        &variant) noexcept {
-  if (variant.index() == 0) {
-    return 1;
-  }
+    if (depth + 2 > this->max_layers) {
+      return true;
+    }
 
-  return std::get<1>(variant).size();
-}
+    // if multiple transparent block composed a non-transparent image, then the
+    // recursion terminate.
+    if (is_front_opaque) {
+      auto mean = compute_mean_color(front);
+      if (not mean) {
+        return false;
+      }
+      this->emit(ARGB32(mean.value()[0], mean.value()[1], mean.value()[2]));
+      return true;
+    }
 
-bool compare_blocks_multi(const std::vector<const VCL_block *> &a,
-                          const std::vector<const VCL_block *> &b) {
-  if (a.size() != b.size()) {
-    return a.size() < b.size();
-  }
+    block_model::EImgRowMajor_t &img = this->image_stack[depth];
+    for (const VCL_block *cblkp : this->transparent) {
+      if (cblkp == this->accumulate_blocks.back()) {
+        continue;
+      }
+      img = front;
+      if (!compose_image_background_half_transparent(
+              img, cblkp->project_image_on_exposed_face)) {
+        return false;
+      }
 
-  for (size_t i = 0; i < a.size(); i++) {
-    if (a[i] != b[i]) {
-      return VCL_compare_block(a[i], b[i]);
+      this->accumulate_blocks.emplace_back(cblkp);
+      const bool ok = this->visit(img);
+      this->accumulate_blocks.pop_back();
+      if (!ok) {
+        return false;
+      }
     }
+    return true;
   }
-  // if is all same
-  return false;
-}
-
-bool compare_blocks_variant(
-    const std::variant<const VCL_block *, std::vector<const VCL_block *>> &a,
-    const std::variant<const VCL_block *, std::vector<const VCL_block *>>
-        &b) noexcept {
-  if (blocks_count(a) != blocks_count(b)) {
-    return blocks_count(a) < blocks_count(b);
+};
+
+/// Computes colors of all combinations with at least one transparent block.
+/// Each root block is an independent task, and every thread reduces its
+/// results into a local hash before merging.
+bool add_color_composed(const int max_layers,
+                        const std::vector<VCL_block *> &bs_transparent,
+                        const std::vector<VCL_block *> &bs_nontransparent,
+                        const int merge_bits,
+                        hash_color_blocks &map_color_blocks) noexcept {
+  if (max_layers < 2 || bs_transparent.empty()) {
+    return true;
   }
 
-  if (a.index() != b.index()) {
-    // this should no happen, but is not fatal
-    return a.index() < b.index();
+  const std::vector<const VCL_block *> transparent{bs_transparent.begin(),
+                                                   bs_transparent.end()};
+  std::vector<const VCL_block *> backgrounds;
+  backgrounds.reserve(bs_nontransparent.size());
+  for (const VCL_block *blkp : bs_nontransparent) {
+    if (blkp->is_background()) {
+      backgrounds.emplace_back(blkp);
+    }
   }
-
-  if (a.index() == 0) {
-    return VCL_compare_block(std::get<0>(a), std::get<0>(b));
+  const VCL_block *cheapest_background = nullptr;
+  if (!backgrounds.empty()) {
+    cheapest_background =
+        *std::min_element(backgrounds.begin(), backgrounds.end(),
+                          [](const VCL_block *a, const VCL_block *b) {
+                            return VCL_compare_block(a, b);
+                          });
   }
 
-  return compare_blocks_multi(std::get<1>(a), std::get<1>(b));
-}
-
-void convert_blocks_and_colors_from_hash_vector(
-    mutlihash_color_blocks &src,
-    std::vector<std::array<uint8_t, 3>> &colors_temp,
-    std::vector<std::variant<const VCL_block *, std::vector<const VCL_block *>>>
-        &LUT_bcitb) noexcept {
-  std::vector<mutlihash_color_blocks::iterator> selected_variants;
-  selected_variants.reserve(src.size());
-
-  uint32_t prev_color = 0;
-  for (auto it = src.begin(); it != src.end(); ++it) {
-    if (prev_color == it->first) {
-      continue;
+  std::atomic_bool ok{true};
+#pragma omp parallel
+  {
+    hash_color_blocks local;
+    composed_color_enumerator enumerator{max_layers,   transparent,
+                                         backgrounds,  cheapest_background,
+                                         merge_bits,   local};
+#pragma omp for schedule(dynamic)
+    for (int idx = 0; idx < int(transparent.size()); idx++) {
+      if (!ok) {
+        continue;
+      }
+      if (!enumerator.run(transparent[idx])) {
+        ok = false;
+      }
     }
 
-    auto range = src.equal_range(it->first);
-
-    assert(range.first != range.second);
-
-    auto selected = range.first;
-
-    for (auto jt = range.first; jt != range.second; ++jt) {
-      // if price of jt is smaller than selected, update selected
-      if (compare_blocks_variant(jt->second, selected->second)) {
-        selected = jt;
+#pragma omp critical
+    {
+      map_color_blocks.reserve(map_color_blocks.size() + local.size());
+      for (auto &[key, item] : local) {
+        emplace_if_cheaper(map_color_blocks, merge_bits, std::move(item));
       }
     }
+  }
 
-    selected_variants.emplace_back(selected);
-    prev_color = selected->first;
+  if (!ok) {
+    VCL_report(VCL_report_type_t::error,
+               "Function add_color_composed failed because failed to compose "
+               "image. This is possible caused by images have different "
+               "sizes.\n");
+    return false;
   }
+  return true;
+}
 
-  std::sort(selected_variants.begin(), selected_variants.end(),
-            [](mutlihash_color_blocks::const_iterator a,
-               mutlihash_color_blocks::const_iterator b) -> bool {
-              return compare_blocks_variant(a->second, b->second);
+void convert_blocks_and_colors_from_hash(
+    hash_color_blocks &src, std::vector<std::array<uint8_t, 3>> &colors_temp,
+    std::vector<block_variant_t> &LUT_bcitb) noexcept {
+  std::vector<color_blocks_item *> selected_items;
+  selected_items.reserve(src.size());
+  for (auto &pair : src) {
+    selected_items.emplace_back(&pair.second);
+  }
+
+  std::sort(selected_items.begin(), selected_items.end(),
+            [](const color_blocks_item *a, const color_blocks_item *b) -> bool {
+              return compare_blocks_variant(a->blocks, b->blocks);
             });
 
   colors_temp.clear();
   LUT_bcitb.clear();
-  colors_temp.reserve(selected_variants.size());
-  LUT_bcitb.reserve(selected_variants.size());
+  colors_temp.reserve(selected_items.size());
+  LUT_bcitb.reserve(selected_items.size());
 
-  for (auto &it : selected_variants) {
-    LUT_bcitb.emplace_back(std::move(it->second));
+  for (color_blocks_item *item : selected_items) {
+    LUT_bcitb.emplace_back(std::move(item->blocks));
     colors_temp.emplace_back(std::array<uint8_t, 3>{
-        getR(it->first), getG(it->first), getB(it->first)});
+        getR(item->color), getG(item->color), getB(item->color)});
   }
 }
 
@@ -442,41 +530,51 @@ bool TokiVC::set_resource_no_lock() noexcept {
       return false;
     }
 
-    mutlihash_color_blocks map_color_blocks;
+    size_t num_background = 0;
+    for (const VCL_block *blkp : bs_nontransparent) {
+      num_background += blkp->is_background();
+    }
+    const VCL_color_num_estimation est = VCL_estimate_color_num_detailed(
+        TokiVC::max_block_layers, bs_transparent.size(), num_background,
+        bs_nontransparent.size() - num_background, TokiVC::color_merge_bits);
+    {
+      std::string msg = fmt::format(
+          "Estimated at most {:.0f} colors from {:.0f} block compositions, "
+          "peak memory of color hash is about {:.1f} MiB.\n",
+          est.num_colors, est.num_compositions,
+          est.peak_memory_bytes / (1024.0 * 1024.0));
+      VCL_report(VCL_report_type_t::information, msg.c_str());
+    }
 
-    if (!add_color_non_transparent(bs_nontransparent, map_color_blocks)) {
+    hash_color_blocks map_color_blocks;
+    // The estimation is an upper bound, so the hash never rehashes while
+    // thread-local results are merged into it. It's capped since the bound of
+    // many layers is far above the real count.
+    constexpr size_t max_reserved_colors = size_t(1) << 20;
+    map_color_blocks.reserve(
+        size_t(std::min(est.num_colors, double(max_reserved_colors))));
+
+    if (!add_color_non_transparent(bs_nontransparent, TokiVC::color_merge_bits,
+                                   map_color_blocks)) {
       VCL_report(VCL_report_type_t::error,
                  "Failed to compute mean colors for non transparent "
                  "images.\n");
       return false;
     }
 
-    //    {
-    //      std::string msg = fmt::format("Size of map_color_blocks = {}\n",
-    //                                    map_color_blocks.size());
-    //      VCL_report(VCL_report_type_t::information, msg.c_str());
-    //    }
-
-    for (int layers = 2; layers <= max_block_layers; layers++) {
-      if (!add_color_trans_to_trans_start_recurse(
-              layers, bs_transparent, bs_nontransparent, map_color_blocks)) {
-        VCL_report(VCL_report_type_t::error,
-                   "failed to compute colors for composed blocks.\n");
-        return false;
-      }
+    if (!add_color_composed(TokiVC::max_block_layers, bs_transparent,
+                            bs_nontransparent, TokiVC::color_merge_bits,
+                            map_color_blocks)) {
+      VCL_report(VCL_report_type_t::error,
+                 "failed to compute colors for composed blocks.\n");
+      return false;
     }
 
-    //    {
-    //      std::string msg = fmt::format("Size of map_color_blocks = {}\n",
-    //                                    map_color_blocks.size());
-    //      VCL_report(VCL_report_type_t::information, msg.c_str());
-    //    }
-
     std::vector<std::array<uint8_t, 3>> colors_temp;
     TokiVC::LUT_basic_color_idx_to_blocks.clear();
 
-    convert_blocks_and_colors_from_hash_vector(
-        map_color_blocks, colors_temp, TokiVC::LUT_basic_color_idx_to_blocks);
+    convert_blocks_and_colors_from_hash(map_color_blocks, colors_temp,
+                                        TokiVC::LUT_basic_color_idx_to_blocks);
 
     if (colors_temp.size() != TokiVC::LUT_basic_color_idx_to_blocks.size()) {
       std::string msg = fmt::format(
@@ -605,6 +703,38 @@ bool TokiVC::set_allowed_no_lock(
     }
   }
 
+  // Look up palette ids once for each color, so that building doesn't search
+  // blocks_allowed for every block.
+  TokiVC::LUT_color_id_to_palette_ids.setZero(
+      TokiVC::max_block_layers, TokiVC::LUT_basic_color_idx_to_blocks.size());
+  for (size_t idx = 0; idx < TokiVC::LUT_basic_color_idx_to_blocks.size();
+       idx++) {
+    auto palette_ids = TokiVC::LUT_color_id_to_palette_ids.col(idx);
+    if (!allowed_list[idx]) {
+      palette_ids[0] = 0xFFFF;
+      continue;
+    }
+
+    const auto &variant = LUT_basic_color_idx_to_blocks[idx];
+    std::span<const VCL_block *const> blocks;
+    if (variant.index() == 0) {
+      blocks = {&std::get<0>(variant), 1};
+    } else {
+      blocks = std::get<1>(variant);
+    }
+    if (blocks.size() > size_t(TokiVC::max_block_layers)) {
+      std::string msg = fmt::format(
+          "Color {} has {} layers, but max_block_layers is {}. This is an "
+          "internal error.",
+          idx, blocks.size(), TokiVC::max_block_layers);
+      VCL_report(VCL_report_type_t::error, msg.c_str());
+      return false;
+    }
+    for (size_t depth = 0; depth < blocks.size(); depth++) {
+      palette_ids[depth] = TokiVC::blocks_allowed.find(blocks[depth])->second;
+    }
+  }
+
   if (!TokiVC::colorset_allowed.apply_allowed(
           TokiVC::colorset_basic,
           reinterpret_cast<const bool *>(allowed_list.data()))) {
@@ -612,6 +742,9 @@ bool TokiVC::set_allowed_no_lock(
                "Function \"TokiVC::colorset_allowed.apply_allowed\" failed.");
     return false;
   }
+  // with multiple layers, allowed colors can be tens of thousands, so matching
+  // colors by a linear scan is too slow.
+  TokiVC::colorset_allowed.build_nn_index();
 
   TokiVC_internal::is_allowed_color_set_ready = true;
 
@@ -140,6 +140,7 @@ class TokiVC : public VCL_Kernel {
   static SCL_gameVersion version;
   static VCL_face_t exposed_face;
   static int max_block_layers;
+  static int color_merge_bits;
   static bool is_render_quality_fast;
   static VCL_biome_t biome;
 
@@ -160,6 +161,12 @@ class TokiVC : public VCL_Kernel {
 
   static std::unordered_map<const VCL_block *, uint16_t> blocks_allowed;
 
+  // Palette ids of each layer for each color, indexed by (layer, color id).
+  // Layers that a color doesn't use are air. For colors that are not allowed,
+  // the first layer is 0xFFFF.
+  static Eigen::Array<uint16_t, Eigen::Dynamic, Eigen::Dynamic>
+      LUT_color_id_to_palette_ids;
+
  private:
   VCL_Kernel_step _step{VCL_Kernel_step::VCL_wait_for_resource};
   bool imgcvter_prefer_gpu{false};
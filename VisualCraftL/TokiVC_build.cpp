@@ -74,63 +74,74 @@ bool TokiVC::build() noexcept {
 
   this->schem.fill(0);
 
-  std::atomic_bool ret = true;
+  const auto &LUT_palette_ids = TokiVC::LUT_color_id_to_palette_ids;
+  if (LUT_palette_ids.rows() != TokiVC::max_block_layers ||
+      LUT_palette_ids.cols() !=
+          int64_t(TokiVC::LUT_basic_color_idx_to_blocks.size())) {
+    VCL_report(VCL_report_type_t::error,
+               "Palette ids of colors are out of date, set allowed blocks "
+               "again. This is an internal error.");
+    return false;
+  }
+
+  // Coordinates are affine in (r, c, depth), so are the indices in schem.
+  int64_t offset_origin, stride_r, stride_c, stride_depth;
+  {
+    auto index_of = [this, &dirh](int64_t r, int64_t c, int64_t depth) {
+      const auto coord = dirh.coordinate_of(r, c, depth);
+      return this->schem.index_of(coord[0], coord[1], coord[2]);
+    };
+    offset_origin = index_of(0, 0, 0);
+    stride_r = index_of(1, 0, 0) - offset_origin;
+    stride_c = index_of(0, 1, 0) - offset_origin;
+    stride_depth = index_of(0, 0, 1) - offset_origin;
+  }
 
   const Eigen::ArrayXX<uint16_t> color_id_mat = this->img_cvter.color_id();
-  // #warning resume omp here
-#pragma omp parallel for schedule(static)
-  for (int64_t r = 0; r < this->img_cvter.rows(); r++) {
-    for (int64_t c = 0; c < this->img_cvter.cols(); c++) {
-      auto color_id = color_id_mat(r, c);
-      if (color_id >= 0xFFFF)
-        continue;  // full transparent pixels, use air instead
-
-      const auto &variant = TokiVC::LUT_basic_color_idx_to_blocks[color_id];
-
-      const VCL_block *const *blockpp = nullptr;
-      size_t depth_current = 0;
-
-      if (variant.index() == 0) {
-        blockpp = &std::get<0>(variant);
-        depth_current = 1;
-      } else {
-        const std::vector<const VCL_block *> &vec = std::get<1>(variant);
-        blockpp = vec.data();
-        depth_current = vec.size();
+  const int64_t rows = this->img_cvter.rows();
+  const int64_t cols = this->img_cvter.cols();
+  uint16_t *const schem_data = this->schem.data();
+
+  std::atomic<int64_t> invalid_color_count{0};
+#pragma omp parallel
+  {
+    std::vector<uint16_t> row_color_ids(cols);
+#pragma omp for schedule(static)
+    for (int64_t r = 0; r < rows; r++) {
+      for (int64_t c = 0; c < cols; c++) {
+        uint16_t color_id = color_id_mat(r, c);
+        if (color_id < 0xFFFF && (color_id >= LUT_palette_ids.cols() ||
+                                  LUT_palette_ids(0, color_id) >= 0xFFFF)) {
+          invalid_color_count++;
+          color_id = 0xFFFF;
+        }
+        row_color_ids[c] = color_id;
       }
 
-      for (size_t depth = 0; depth < depth_current; depth++) {
-        const auto coord = dirh.coordinate_of(r, c, depth);
-        const int64_t range[3] = {this->schem.x_range(), this->schem.y_range(),
-                                  this->schem.z_range()};
-        for (size_t di = 0; di < 3; di++) {
-          if (coord[di] < 0 || coord[di] >= range[di]) {
-            std::string msg =
-                fmt::format("coordinate out of range : {}, {}, {}.\n", coord[0],
-                            coord[1], coord[2]);
-            VCL_report(VCL_report_type_t::error, msg.c_str());
+      // write this row layer by layer, unused layers are filled with air.
+      for (int64_t depth = 0; depth < TokiVC::max_block_layers; depth++) {
+        uint16_t *const dest =
+            schem_data + offset_origin + r * stride_r + depth * stride_depth;
+        for (int64_t c = 0; c < cols; c++) {
+          const uint16_t color_id = row_color_ids[c];
+          if (color_id >= 0xFFFF) {
+            continue;  // full transparent pixels, use air instead
           }
+          dest[c * stride_c] = LUT_palette_ids(depth, color_id);
         }
-
-        const VCL_block *const blkp = blockpp[depth];
-
-        auto it = TokiVC::blocks_allowed.find(blkp);
-        if (it == TokiVC::blocks_allowed.end()) {
-          std::string msg = fmt::format(
-              "Failed to find VCL_block at address {} named {} in "
-              "allowed blocks. This is an internal error.",
-              (const void *)blkp, blkp->full_id_ptr()->c_str());
-          VCL_report(VCL_report_type_t::error, msg.c_str());
-          ret = false;
-        }
-
-        const uint16_t blk_id = it->second;
-
-        this->schem(coord[0], coord[1], coord[2]) = blk_id;
       }
     }
   }
 
+  const bool ret = (invalid_color_count <= 0);
+  if (!ret) {
+    std::string msg = fmt::format(
+        "{} pixels are converted to colors that are not allowed. This is an "
+        "internal error.",
+        invalid_color_count.load());
+    VCL_report(VCL_report_type_t::error, msg.c_str());
+  }
+
   this->schem.set_MC_major_version_number(TokiVC::version);
   this->schem.set_MC_version_number(
       MCDataVersion::suggested_version(TokiVC::version));
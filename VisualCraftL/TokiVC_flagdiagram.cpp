@@ -23,6 +23,7 @@ This file is part of SlopeCraft.
 #include "TokiVC.h"
 #include "VCL_internal.h"
 #include "VisualCraftL.h"
+#include <FlatDiagram.h>
 
 #ifdef min
 #undef min
@@ -40,23 +41,6 @@ void reverse_color(uint32_t *ptr, size_t num_pixels) noexcept {
   }
 }
 
-constexpr uint32_t reverse_byte(uint32_t v) noexcept {
-  const uint32_t a = (v & 0xFF'00'00'00) >> 24;
-  const uint32_t b = (v & 0x00'FF'00'00) >> 8;
-  const uint32_t c = (v & 0x00'00'FF'00) << 8;
-  const uint32_t d = (v & 0x00'00'00'FF) << 24;
-
-  return a | b | c | d;
-}
-
-void ARGB_to_AGBR(uint32_t *ptr, size_t num_pixels) noexcept {
-  for (uint32_t *p = ptr; p < ptr + num_pixels; p++) {
-    const uint32_t A = getA(*p);
-    *p = (*p) << 8 | A;
-    *p = reverse_byte(*p);
-  }
-}
-
 void TokiVC::draw_flag_diagram_to_memory(uint32_t *image_u8c3_rowmajor,
                                          const flag_diagram_option &opt,
                                          int layer_idx) const noexcept {
@@ -161,9 +145,6 @@ void TokiVC::flag_diagram(uint32_t *image_u8c3_rowmajor,
   this->draw_flag_diagram_to_memory(image_u8c3_rowmajor, opt, layer_idx);
 }
 
-#include <png.h>
-#include <zlib.h>
-
 bool TokiVC::export_flag_diagram(const char *png_filename,
                                  const flag_diagram_option &opt,
                                  int layer_idx) const noexcept {
@@ -177,109 +158,53 @@ bool TokiVC::export_flag_diagram(const char *png_filename,
 
   this->img_cvter.ui.rangeSet(0, this->img_cvter.rows(), 0);
 
-  const int64_t rows_capacity_by_blocks = 64;
-
-  block_model::EImgRowMajor_t buffer(rows_capacity_by_blocks * 16,
-                                     this->img_cvter.cols() * 16);
-
-  FILE *fp = fopen(png_filename, "wb");
-
-  if (fp == nullptr) {
-    std::string msg =
-        fmt::format("fopen failed to create png file {}.", png_filename);
-    VCL_report(VCL_report_type_t::error, msg.c_str());
-    return false;
-  }
-
-  png_struct *png =
-      png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-  if (png == nullptr) {
-    fclose(fp);
-    std::string msg = fmt::format(
-        "fopen failed to create png struct for png file {}.", png_filename);
-    VCL_report(VCL_report_type_t::error, msg.c_str());
-    return false;
-  }
-
-  png_info *png_info = png_create_info_struct(png);
-  if (png_info == nullptr) {
-    png_destroy_write_struct(&png, &png_info);
-    fclose(fp);
-    std::string msg =
-        fmt::format("fopen failed to create png info struct for png file {}.",
-                    png_filename);
-    VCL_report(VCL_report_type_t::error, msg.c_str());
-    return false;
-  }
-
-  png_init_io(png, fp);
-
-  png_set_compression_level(png, opt.png_compress_level);
-
-  png_set_compression_mem_level(png, opt.png_compress_memory_level);
-
-  // png_set_text_compression_level(png, 8);
-
-  png_set_IHDR(png, png_info, this->img_cvter.cols() * 16,
-               16 * (opt.row_end - opt.row_start), 8, PNG_COLOR_TYPE_RGB_ALPHA,
-               PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
-               PNG_FILTER_TYPE_DEFAULT);
-  png_write_info(png, png_info);
-
-  {
-    std::array<std::pair<std::string, std::string>, 4> txt{
-        std::make_pair<std::string, std::string>(
-            "Title", "Flat diagram generated by VisualCraftL."),
-        std::make_pair<std::string, std::string>("Software", "VisualCraftL"),
-        std::make_pair<std::string, std::string>(
-            "Description",
-            "This image is a flat diagram created by VisualCraftL, which is is "
-            "a subproject of SlopeCraft, developed by TokiNoBug."),
-        std::make_pair<std::string, std::string>(
-            "Comment",
-            "SlopeCraft is a free software published "
-            "under GPLv3 license. You can find "
-            "its repository at https://github.com/SlopeCraft/SlopeCraft")};
-
-    std::array<png_text, txt.size()> png_txts;
-
-    for (size_t i = 0; i < txt.size(); i++) {
-      png_txts[i].compression = -1;
-      png_txts[i].key = txt[i].first.data();
-      png_txts[i].text = txt[i].second.data();
-      // png.txts[i].key =
-    }
-
-    png_set_text(png, png_info, png_txts.data(), png_txts.size());
-  }
-
-  for (int64_t ridx = opt.row_start; ridx < opt.row_end;
-       ridx += rows_capacity_by_blocks) {
-    const int64_t rows_this_time =
-        std::min(opt.row_end - ridx, rows_capacity_by_blocks);
-    memset(buffer.data(), 0xFF, buffer.size() * sizeof(uint32_t));
+  const libFlatDiagram::png_band_option band_opt{
+      .rows = 16 * (opt.row_end - opt.row_start),
+      .cols = this->img_cvter.cols() * 16,
+      .band_rows = 0,
+      .band_row_granularity = 16,
+      .png_compress_level = opt.png_compress_level,
+      .png_compress_memory_level = opt.png_compress_memory_level,
+  };
+
+  auto draw_band = [this, &opt, layer_idx](
+                       int64_t pixel_row_beg, int64_t pixel_row_end,
+                       Eigen::Map<libFlatDiagram::EImgRowMajor_t> buffer) {
     this->draw_flag_diagram_to_memory(
         buffer.data(),
-        {opt.lib_version, ridx, ridx + rows_this_time,
-         opt.split_line_row_margin, opt.split_line_col_margin},
+        {opt.lib_version, opt.row_start + pixel_row_beg / 16,
+         opt.row_start + pixel_row_end / 16, opt.split_line_row_margin,
+         opt.split_line_col_margin},
         layer_idx);
+  };
 
-    ARGB_to_AGBR(buffer.data(),
-                 rows_this_time * 16 * this->img_cvter.cols() * 16);
-
-    for (int64_t pix_r = 0; pix_r < rows_this_time * 16; pix_r++) {
-      png_write_row(png, reinterpret_cast<const uint8_t *>(&buffer(pix_r, 0)));
-    }
-
+  auto progress = [this](int64_t pixel_rows_finished) {
     this->img_cvter.ui.rangeSet(0, this->img_cvter.rows(),
-                                ridx - opt.row_start);
+                                pixel_rows_finished / 16);
+    return true;
+  };
+
+  const std::array<std::pair<std::string, std::string>, 4> txt{
+      std::make_pair<std::string, std::string>(
+          "Title", "Flat diagram generated by VisualCraftL."),
+      std::make_pair<std::string, std::string>("Software", "VisualCraftL"),
+      std::make_pair<std::string, std::string>(
+          "Description",
+          "This image is a flat diagram created by VisualCraftL, which is is "
+          "a subproject of SlopeCraft, developed by TokiNoBug."),
+      std::make_pair<std::string, std::string>(
+          "Comment",
+          "SlopeCraft is a free software published "
+          "under GPLv3 license. You can find "
+          "its repository at https://github.com/SlopeCraft/SlopeCraft")};
+
+  const std::string err = libFlatDiagram::export_png_in_bands(
+      png_filename, band_opt, draw_band, txt, progress);
+  if (!err.empty()) {
+    VCL_report(VCL_report_type_t::error, err.c_str());
+    return false;
   }
 
-  png_write_end(png, png_info);
-
-  png_destroy_write_struct(&png, &png_info);
-  fclose(fp);
-
   this->img_cvter.ui.rangeSet(0, this->img_cvter.rows(),
                               this->img_cvter.rows());
   return true;
@@ -23,7 +23,10 @@ This file is part of SlopeCraft.
 #include "VisualCraftL.h"
 
 #include <stddef.h>
+#include <omp.h>
 
+#include <algorithm>
+#include <cmath>
 #include <mutex>
 #include <sstream>
 #include <span>
@@ -335,6 +338,51 @@ VCL_EXPORT_FUN double VCL_estimate_color_num(
   return num_stacked + num_nontransparent_non_background;
 }
 
+VCL_EXPORT_FUN VCL_color_num_estimation VCL_estimate_color_num_detailed(
+    size_t num_layers, size_t num_transparent, size_t num_background,
+    size_t num_nontransparent_non_background, uint8_t color_merge_bits) {
+  const double a = num_background;
+  const double b = num_transparent;
+  // count of transparent stacks with d blocks, adjacent blocks are different
+  auto num_stacks = [b](size_t d) -> double {
+    if (d <= 0) {
+      return 0;
+    }
+    return b * std::pow(std::max(b - 1, 0.0), d - 1);
+  };
+
+  double num_leaves = 0;     // transparent stacks on a background block
+  double num_opaque = 0;     // stacks that are opaque without background
+  double num_stack_img = 0;  // images of stacks with more than 1 blocks
+  for (size_t d = 1; d + 1 <= num_layers; d++) {
+    num_leaves += a * num_stacks(d);
+    if (d + 2 <= num_layers) {
+      num_opaque += num_stacks(d);
+    }
+    if (d >= 2) {
+      num_stack_img += num_stacks(d);
+    }
+  }
+
+  // merged colors have only the higher bits of each channel
+  const double max_distinct_colors =
+      std::pow(2.0, 24 - 3 * std::min<int>(color_merge_bits, 7));
+
+  VCL_color_num_estimation ret;
+  ret.num_colors =
+      std::min(num_leaves + num_opaque + a + num_nontransparent_non_background,
+               max_distinct_colors);
+  ret.num_compositions = num_leaves + num_stack_img;
+
+  // node of std::unordered_map with a std::vector of blocks
+  const double bytes_per_color =
+      64.0 + sizeof(void *) * std::max<size_t>(num_layers, 1);
+  // every thread holds a local hash, and they are merged into a global one
+  ret.peak_memory_bytes =
+      ret.num_colors * bytes_per_color * (omp_get_max_threads() + 1);
+  return ret;
+}
+
 VCL_EXPORT_FUN bool VCL_set_resource_copy(
     const VCL_resource_pack *const rp, const VCL_block_state_list *const bsl,
     const VCL_set_resource_option &option) {
@@ -355,6 +403,7 @@ VCL_EXPORT_FUN bool VCL_set_resource_copy(
   TokiVC::version = option.version;
   TokiVC::exposed_face = option.exposed_face;
   TokiVC::max_block_layers = option.max_block_layers;
+  TokiVC::color_merge_bits = std::min<int>(option.color_merge_bits, 7);
   TokiVC::biome = option.biome;
   TokiVC::is_render_quality_fast = option.is_render_quality_fast;
 
@@ -394,6 +443,7 @@ VCL_EXPORT_FUN bool VCL_set_resource_move(
   TokiVC::version = option.version;
   TokiVC::exposed_face = option.exposed_face;
   TokiVC::max_block_layers = option.max_block_layers;
+  TokiVC::color_merge_bits = std::min<int>(option.color_merge_bits, 7);
   TokiVC::biome = option.biome;
   TokiVC::is_render_quality_fast = option.is_render_quality_fast;
 
@@ -963,6 +1013,14 @@ VCL_EXPORT_FUN const char *VCL_get_GPU_api_name() {
   return ::gpu_wrapper::api_name();
 }
 
+VCL_EXPORT_FUN const char *VCL_get_simd_arch() {
+  return ::colordiff_simd_arch();
+}
+
+VCL_EXPORT_FUN bool VCL_set_simd_arch(const char *arch) {
+  return ::colordiff_set_simd_arch(arch);
+}
+
 VCL_EXPORT_FUN size_t VCL_platform_num() { return gpu_wrapper::platform_num(); }
 
 VCL_EXPORT_FUN VCL_GPU_Platform *VCL_get_platform(size_t platform_idx,
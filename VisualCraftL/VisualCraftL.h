@@ -313,12 +313,29 @@ struct VCL_set_resource_option {
   VCL_biome_t biome;
   VCL_face_t exposed_face;
   bool is_render_quality_fast;
+  // Colors that are equal after dropping this count of lower bits in every
+  // channel are merged, and only the cheapest block combination is kept. 0
+  // means only identical colors are merged.
+  uint8_t color_merge_bits{0};
 };
 
 VCL_EXPORT_FUN double VCL_estimate_color_num(
     size_t num_layers, size_t num_foreground, size_t num_background,
     size_t num_nontransparent_non_background);
 
+struct VCL_color_num_estimation {
+  // upper bound of colors in basic colorset, also bounded by color_merge_bits
+  double num_colors;
+  // number of images that will be composed to compute colors
+  double num_compositions;
+  // approximate peak memory of the color hash, in bytes
+  double peak_memory_bytes;
+};
+
+VCL_EXPORT_FUN VCL_color_num_estimation VCL_estimate_color_num_detailed(
+    size_t num_layers, size_t num_transparent, size_t num_background,
+    size_t num_nontransparent_non_background, uint8_t color_merge_bits);
+
 // set resource for kernel
 VCL_EXPORT_FUN bool VCL_set_resource_copy(
     const VCL_resource_pack *const rp, const VCL_block_state_list *const bsl,
@@ -475,6 +492,12 @@ VCL_EXPORT_FUN bool VCL_is_version_ok(
 VCL_EXPORT_FUN bool VCL_have_gpu_api();
 VCL_EXPORT_FUN const char *VCL_get_GPU_api_name();
 
+// Instruction set used by color matching on cpu, like "sse2" or "avx2".
+VCL_EXPORT_FUN const char *VCL_get_simd_arch();
+// Force color matching to use an instruction set, or detect again if arch is
+// nullptr. Returns false if it is not compiled or not supported by this cpu.
+VCL_EXPORT_FUN bool VCL_set_simd_arch(const char *arch);
+
 [[nodiscard]] VCL_EXPORT_FUN size_t VCL_platform_num();
 VCL_EXPORT_FUN VCL_GPU_Platform *VCL_get_platform(size_t platform_idx,
                                                   int *errorcode = nullptr);
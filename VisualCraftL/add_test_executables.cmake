@@ -49,6 +49,42 @@ include(${CMAKE_SOURCE_DIR}/cmake/configure_vanilla_zips_for_VCL_12.cmake)
 include(${CMAKE_SOURCE_DIR}/cmake/configure_vanilla_zips_for_VCL_latest.cmake)
 include(${CMAKE_SOURCE_DIR}/cmake/configure_images.cmake)
 
+# compare and benchmark json parsers
+add_executable(itest_VCL_parse_json tests/itest_VCL_parse_json.cpp)
+target_link_libraries(itest_VCL_parse_json PRIVATE VisualCraftL_static)
+target_include_directories(itest_VCL_parse_json PRIVATE
+    ${cli11_include_dir})
+
+add_test(NAME test_parse_json_12 COMMAND itest_VCL_parse_json ${VCL_resource_12} WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR})
+add_test(NAME test_parse_json_latest COMMAND itest_VCL_parse_json ${VCL_resource_latest} WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR})
+
+# compare and benchmark nearest neighbor index against linear scan
+add_executable(itest_VCL_nn_index tests/itest_VCL_nn_index.cpp)
+target_link_libraries(itest_VCL_nn_index PRIVATE VisualCraftL_static)
+target_include_directories(itest_VCL_nn_index PRIVATE
+    ${cli11_include_dir})
+
+foreach (_layers RANGE 1 3 1)
+    add_test(NAME test_nn_index_layer${_layers}
+        COMMAND itest_VCL_nn_index ${CMAKE_CURRENT_SOURCE_DIR}/VCL_blocks_fixed.json ${VCL_resource_latest} --version 20 --layers ${_layers}
+        WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR})
+endforeach (_layers RANGE 1 3 1)
+
+# the estimated color count must bound the real one
+add_executable(itest_VCL_color_num tests/itest_VCL_color_num.cpp)
+target_link_libraries(itest_VCL_color_num PRIVATE VisualCraftL_static)
+target_include_directories(itest_VCL_color_num PRIVATE
+    ${cli11_include_dir})
+
+foreach (_layers RANGE 1 3 1)
+    add_test(NAME test_color_num_layer${_layers}
+        COMMAND itest_VCL_color_num ${CMAKE_CURRENT_SOURCE_DIR}/VCL_blocks_fixed.json ${VCL_resource_latest} --version 20 --layers ${_layers}
+        WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR})
+endforeach (_layers RANGE 1 3 1)
+add_test(NAME test_color_num_merged
+    COMMAND itest_VCL_color_num ${CMAKE_CURRENT_SOURCE_DIR}/VCL_blocks_fixed.json ${VCL_resource_latest} --version 20 --layers 3 --merge-bits 2
+    WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR})
+
 add_test(NAME test_block_class COMMAND test_block_class WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR})
 
 # automatic tests
@@ -0,0 +1,130 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+#include "TokiVC.h"
+#include "VisualCraftL.h"
+
+#include <filesystem>
+#include <iostream>
+
+#include <CLI11.hpp>
+#include <fmt/format.h>
+
+using std::cout, std::endl;
+
+int main(int argc, char **argv) {
+  CLI::App app;
+  std::vector<std::string> input_files;
+  app.add_option("files", input_files, "json and resource packs.")
+      ->required()
+      ->check(CLI::ExistingFile);
+  int __version;
+  app.add_option("--version", __version, "MC version.")
+      ->default_val(19)
+      ->check(CLI::Range(12, int(max_version), "Avaliable versions."));
+  int __layers;
+  app.add_option("--layers", __layers, "Max layers")
+      ->default_val(3)
+      ->check(CLI::PositiveNumber);
+  int merge_bits;
+  app.add_option("--merge-bits", merge_bits,
+                 "Lower bits of each channel to ignore when merging colors.")
+      ->default_val(0)
+      ->check(CLI::Range(0, 7));
+  CLI11_PARSE(app, argc, argv);
+
+  const auto version = SCL_gameVersion(__version);
+  const VCL_face_t face = VCL_face_t::face_up;
+
+  VCL_Kernel *kernel = VCL_create_kernel();
+  if (kernel == nullptr) {
+    cout << "Failed to create kernel." << endl;
+    return 1;
+  }
+
+  {
+    std::vector<const char *> zip_filenames, json_filenames;
+    for (const std::string &i : input_files) {
+      std::filesystem::path p(i);
+      if (p.extension() == ".zip") {
+        zip_filenames.emplace_back(i.c_str());
+      }
+      if (p.extension() == ".json") {
+        json_filenames.emplace_back(i.c_str());
+      }
+    }
+
+    VCL_block_state_list *bsl = VCL_create_block_state_list(
+        json_filenames.size(), json_filenames.data());
+    VCL_resource_pack *rp =
+        VCL_create_resource_pack(zip_filenames.size(), zip_filenames.data());
+    if (bsl == nullptr || rp == nullptr) {
+      cout << "Failed to parse block state list or resource pack." << endl;
+      VCL_destroy_block_state_list(bsl);
+      VCL_destroy_resource_pack(rp);
+      VCL_destroy_kernel(kernel);
+      return 1;
+    }
+
+    VCL_set_resource_option option;
+    option.version = version;
+    option.max_block_layers = __layers;
+    option.exposed_face = face;
+    option.color_merge_bits = uint8_t(merge_bits);
+    const bool ok = VCL_set_resource_move(&rp, &bsl, option);
+    VCL_destroy_block_state_list(bsl);
+    VCL_destroy_resource_pack(rp);
+    if (!ok) {
+      cout << "Failed to set resource pack" << endl;
+      VCL_destroy_kernel(kernel);
+      return 1;
+    }
+  }
+
+  // the same blocks as the basic colorset is computed from
+  std::vector<VCL_block *> nontransparent, transparent;
+  TokiVC::bsl.avaliable_block_states_by_transparency(
+      version, face, &nontransparent, &transparent);
+  size_t num_background = 0;
+  for (const VCL_block *blkp : nontransparent) {
+    num_background += blkp->is_background();
+  }
+  const VCL_color_num_estimation est = VCL_estimate_color_num_detailed(
+      __layers, transparent.size(), num_background,
+      nontransparent.size() - num_background, uint8_t(merge_bits));
+
+  const size_t exact = VCL_num_basic_colors();
+  cout << fmt::format(
+              "{} layers, {} merged bits: {} colors, estimated at most {:.0f} "
+              "colors from {:.0f} compositions.",
+              __layers, merge_bits, exact, est.num_colors,
+              est.num_compositions)
+       << endl;
+
+  VCL_destroy_kernel(kernel);
+  if (exact == 0 || double(exact) > est.num_colors) {
+    cout << "The estimation is not an upper bound of the color count."
+         << endl;
+    return 1;
+  }
+  return 0;
+}
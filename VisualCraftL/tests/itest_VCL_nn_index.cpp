@@ -0,0 +1,214 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+#include "TokiVC.h"
+#include "VisualCraftL.h"
+
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <random>
+
+#include <CLI11.hpp>
+#include <fmt/format.h>
+
+using std::cout, std::endl;
+
+using allowed_t = libImageCvt::ImageCvter<false>::allowed_colorset_t;
+using TokiColor_t = libImageCvt::ImageCvter<false>::TokiColor_t;
+
+// Linear scan over all allowed colors, as newTokiColor does without index.
+std::pair<uint16_t, float> brute_force(const allowed_t &allowed,
+                                       const convert_unit cu,
+                                       Eigen::ArrayXf &diff) noexcept {
+  const Eigen::Array3f c3 = cu.to_c3();
+  std::span<const float, 3> c3span{c3.data(), 3};
+  diff.resize(allowed.color_count());
+  std::span<float> diff_span{diff.data(), (size_t)diff.size()};
+
+  switch (cu.algo) {
+    case SCL_convertAlgo::RGB:
+      colordiff_RGB_batch(allowed.rgb_data_span(0), allowed.rgb_data_span(1),
+                          allowed.rgb_data_span(2), c3span, diff_span);
+      break;
+    case SCL_convertAlgo::XYZ:
+      colordiff_RGB_batch(allowed.xyz_data_span(0), allowed.xyz_data_span(1),
+                          allowed.xyz_data_span(2), c3span, diff_span);
+      break;
+    case SCL_convertAlgo::HSV:
+      colordiff_HSV_batch(allowed.hsv_data_span(0), allowed.hsv_data_span(1),
+                          allowed.hsv_data_span(2), c3span, diff_span);
+      break;
+    case SCL_convertAlgo::Lab94:
+      colordiff_Lab94_batch(allowed.lab_data_span(0), allowed.lab_data_span(1),
+                            allowed.lab_data_span(2), c3span, diff_span);
+      break;
+    default:
+      abort();
+  }
+  int idx = 0;
+  const float min = diff.minCoeff(&idx);
+  return {allowed.color_id(idx), min};
+}
+
+struct bench_result {
+  size_t num_mismatch{0};
+  double seconds_index{0};
+  double seconds_brute_force{0};
+};
+
+bench_result bench(const allowed_t &allowed, SCL_convertAlgo algo,
+                   int num_colors) noexcept {
+  std::mt19937 rng{114514};
+  bench_result ret;
+  Eigen::ArrayXf diff;
+
+  for (int i = 0; i < num_colors; i++) {
+    const convert_unit cu{ARGB32(rng() % 256, rng() % 256, rng() % 256), algo};
+
+    TokiColor_t tc;
+    const auto t0 = std::chrono::steady_clock::now();
+    const uint16_t id = tc.compute(cu, allowed);
+    const auto t1 = std::chrono::steady_clock::now();
+    const auto [expected_id, expected_diff] = brute_force(allowed, cu, diff);
+    const auto t2 = std::chrono::steady_clock::now();
+
+    ret.seconds_index += std::chrono::duration<double>(t1 - t0).count();
+    ret.seconds_brute_force += std::chrono::duration<double>(t2 - t1).count();
+
+    // different colors with the same distance are both correct.
+    if (id != expected_id &&
+        std::abs(tc.ResultDiff - expected_diff) >
+            1e-4f * std::max(1.0f, expected_diff)) {
+      cout << fmt::format(
+                  "Mismatch for color {:#x}, algo {}: index gives {} with "
+                  "diff {}, but linear scan gives {} with diff {}",
+                  cu._ARGB, char(algo), id, tc.ResultDiff, expected_id,
+                  expected_diff)
+           << endl;
+      ret.num_mismatch++;
+    }
+  }
+  return ret;
+}
+
+int main(int argc, char **argv) {
+  CLI::App app;
+  std::vector<std::string> input_files;
+  app.add_option("files", input_files, "json and resource packs.")
+      ->required()
+      ->check(CLI::ExistingFile);
+  int __version;
+  app.add_option("--version", __version, "MC version.")
+      ->default_val(19)
+      ->check(CLI::Range(12, int(max_version), "Avaliable versions."));
+  int __layers;
+  app.add_option("--layers", __layers, "Max layers")
+      ->default_val(3)
+      ->check(CLI::PositiveNumber);
+  int num_colors;
+  app.add_option("--colors", num_colors, "Number of random colors to match.")
+      ->default_val(20000)
+      ->check(CLI::PositiveNumber);
+  CLI11_PARSE(app, argc, argv);
+
+  const auto version = SCL_gameVersion(__version);
+  const VCL_face_t face = VCL_face_t::face_up;
+
+  VCL_Kernel *kernel = VCL_create_kernel();
+  if (kernel == nullptr) {
+    cout << "Failed to create kernel." << endl;
+    return 1;
+  }
+
+  {
+    std::vector<const char *> zip_filenames, json_filenames;
+    for (const std::string &i : input_files) {
+      std::filesystem::path p(i);
+      if (p.extension() == ".zip") {
+        zip_filenames.emplace_back(i.c_str());
+      }
+      if (p.extension() == ".json") {
+        json_filenames.emplace_back(i.c_str());
+      }
+    }
+
+    VCL_block_state_list *bsl = VCL_create_block_state_list(
+        json_filenames.size(), json_filenames.data());
+    VCL_resource_pack *rp =
+        VCL_create_resource_pack(zip_filenames.size(), zip_filenames.data());
+    if (bsl == nullptr || rp == nullptr) {
+      cout << "Failed to parse block state list or resource pack." << endl;
+      VCL_destroy_block_state_list(bsl);
+      VCL_destroy_resource_pack(rp);
+      VCL_destroy_kernel(kernel);
+      return 1;
+    }
+
+    VCL_set_resource_option option;
+    option.version = version;
+    option.max_block_layers = __layers;
+    option.exposed_face = face;
+    const bool ok = VCL_set_resource_move(&rp, &bsl, option);
+    VCL_destroy_block_state_list(bsl);
+    VCL_destroy_resource_pack(rp);
+    if (!ok) {
+      cout << "Failed to set resource pack" << endl;
+      VCL_destroy_kernel(kernel);
+      return 1;
+    }
+  }
+
+  std::vector<VCL_block *> blocks;
+  blocks.resize(VCL_get_blocks_from_block_state_list_match(
+      VCL_get_block_state_list(), version, face, nullptr, 0));
+  VCL_get_blocks_from_block_state_list_match(
+      VCL_get_block_state_list(), version, face, blocks.data(), blocks.size());
+
+  if (!VCL_set_allowed_blocks(blocks.data(), blocks.size())) {
+    cout << "VCL_set_allowed_blocks failed." << endl;
+    VCL_destroy_kernel(kernel);
+    return 1;
+  }
+
+  const allowed_t &allowed = TokiVC::colorset_allowed;
+  cout << fmt::format("{} layers, {} allowed colors.", __layers,
+                      allowed.color_count())
+       << endl;
+
+  size_t num_mismatch = 0;
+  for (auto algo : {SCL_convertAlgo::RGB, SCL_convertAlgo::HSV,
+                    SCL_convertAlgo::Lab94, SCL_convertAlgo::XYZ}) {
+    const bench_result r = bench(allowed, algo, num_colors);
+    num_mismatch += r.num_mismatch;
+    cout << fmt::format(
+                "algo {}: {} mismatches, index {:.3f} ms, linear scan {:.3f} "
+                "ms, speed up {:.2f}x",
+                char(algo), r.num_mismatch, r.seconds_index * 1e3,
+                r.seconds_brute_force * 1e3,
+                r.seconds_brute_force / std::max(r.seconds_index, 1e-9))
+         << endl;
+  }
+
+  VCL_destroy_kernel(kernel);
+  return (num_mismatch > 0) ? 1 : 0;
+}
@@ -0,0 +1,181 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+#include "ParseResourcePack.h"
+#include "VisualCraftL.h"
+
+#include <chrono>
+#include <iostream>
+
+#include <CLI11.hpp>
+#include <fmt/format.h>
+
+using std::cout, std::endl;
+
+const std::unordered_map<std::string, zipped_file> *files_in(
+    const zipped_folder &root, std::initializer_list<std::string_view> path) {
+  const zipped_folder *folder = &root;
+  for (auto name : path) {
+    folder = folder->subfolder(name);
+    if (folder == nullptr) {
+      return nullptr;
+    }
+  }
+  return &folder->files;
+}
+
+struct bench_result {
+  size_t num_files{0};
+  size_t num_fast{0};
+  size_t num_mismatch{0};
+  double seconds_fast{0};
+  double seconds_nlohmann{0};
+};
+
+template <typename fun_t>
+double time_of(int repeat, fun_t &&fun) {
+  const auto begin = std::chrono::steady_clock::now();
+  for (int r = 0; r < repeat; r++) {
+    fun();
+  }
+  const auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - begin).count();
+}
+
+bench_result bench_block_states(
+    const std::unordered_map<std::string, zipped_file> &files, int repeat) {
+  using namespace resource_json;
+  bench_result ret;
+  for (const auto &[name, file] : files) {
+    if (!name.ends_with(".json")) continue;
+    ret.num_files++;
+    const char *const beg = (const char *)file.data();
+    const char *const end = beg + file.file_size();
+
+    block_states_variant fast;
+    const bool fast_ok = parse_block_state_fast(beg, end, &fast);
+    std::variant<block_states_variant, block_state_multipart> slow;
+    bool is_variant = false;
+    const bool slow_ok =
+        parse_block_state_nlohmann(beg, end, &slow, &is_variant);
+    if (fast_ok) {
+      ret.num_fast++;
+      if (!slow_ok || !is_variant ||
+          std::get<block_states_variant>(slow).LUT != fast.LUT) {
+        cout << "Mismatch in blockstates/" << name << endl;
+        ret.num_mismatch++;
+      }
+    }
+
+    ret.seconds_fast += time_of(repeat, [beg, end]() {
+      std::variant<block_states_variant, block_state_multipart> temp;
+      parse_block_state(beg, end, &temp);
+    });
+    ret.seconds_nlohmann += time_of(repeat, [beg, end]() {
+      std::variant<block_states_variant, block_state_multipart> temp;
+      parse_block_state_nlohmann(beg, end, &temp);
+    });
+  }
+  return ret;
+}
+
+bench_result bench_block_models(
+    const std::unordered_map<std::string, zipped_file> &files, int repeat) {
+  using namespace resource_json;
+  bench_result ret;
+  for (const auto &[name, file] : files) {
+    if (!name.ends_with(".json")) continue;
+    ret.num_files++;
+    const char *const beg = (const char *)file.data();
+    const char *const end = beg + file.file_size();
+
+    block_model_json_temp fast, slow;
+    const bool fast_ok = parse_single_model_json_fast(beg, end, &fast);
+    const bool slow_ok = parse_single_model_json_nlohmann(beg, end, &slow);
+    if (fast_ok) {
+      ret.num_fast++;
+      if (!slow_ok || !(fast == slow)) {
+        cout << "Mismatch in models/block/" << name << endl;
+        ret.num_mismatch++;
+      }
+    }
+
+    ret.seconds_fast += time_of(repeat, [beg, end]() {
+      block_model_json_temp temp;
+      parse_single_model_json(beg, end, &temp);
+    });
+    ret.seconds_nlohmann += time_of(repeat, [beg, end]() {
+      block_model_json_temp temp;
+      parse_single_model_json_nlohmann(beg, end, &temp);
+    });
+  }
+  return ret;
+}
+
+void print_result(std::string_view title, const bench_result &r) {
+  cout << fmt::format(
+              "{}: {} files, {} parsed by the fast parser, {} mismatches.\n"
+              "    fast parser (with fallback) : {:.3f} ms\n"
+              "    nlohmann json               : {:.3f} ms\n"
+              "    speed up                    : {:.2f}x",
+              title, r.num_files, r.num_fast, r.num_mismatch,
+              r.seconds_fast * 1e3, r.seconds_nlohmann * 1e3,
+              r.seconds_nlohmann / std::max(r.seconds_fast, 1e-9))
+       << endl;
+}
+
+int main(int argc, char **argv) {
+  CLI::App app;
+  std::string zip_file;
+  int repeat{10};
+  app.add_option("resource pack", zip_file, "Vanilla resource pack.")
+      ->required()
+      ->check(CLI::ExistingFile);
+  app.add_option("--repeat", repeat, "Times to parse each file.")
+      ->default_val(10)
+      ->check(CLI::PositiveNumber);
+  CLI11_PARSE(app, argc, argv);
+
+  bool ok = true;
+  const zipped_folder root = zipped_folder::from_zip(zip_file, &ok);
+  if (!ok) {
+    cout << "Failed to open " << zip_file << endl;
+    return 1;
+  }
+
+  auto block_states = files_in(root, {"assets", "minecraft", "blockstates"});
+  auto block_models = files_in(root, {"assets", "minecraft", "models", "block"});
+  if (block_states == nullptr || block_models == nullptr) {
+    cout << zip_file << " is not a valid vanilla resource pack." << endl;
+    return 1;
+  }
+
+  const bench_result rs = bench_block_states(*block_states, repeat);
+  print_result("blockstates", rs);
+  const bench_result rm = bench_block_models(*block_models, repeat);
+  print_result("models", rm);
+
+  if (rs.num_mismatch > 0 || rm.num_mismatch > 0) {
+    return 1;
+  }
+  return 0;
+}
@@ -22,8 +22,13 @@ This file is part of SlopeCraft.
 
 #include "CutterWind.h"
 #include "ui_CutterWind.h"
+#include "streaming_cutter.h"
 #include <QFileDialog>
 #include <QMessageBox>
+#include <QProgressDialog>
+
+// Larger pngs are not loaded into QImage, but cut by streaming.
+static constexpr int64_t max_loaded_pixels = 8192LL * 8192;
 
 CutterWind::CutterWind(QWidget *parent)
     : QMainWindow(parent), ui(new Ui::CutterWind) {
@@ -55,12 +60,28 @@ void CutterWind::loadImg() {
   if (path.isEmpty())
     return;
 
-  img.load(path);
-  img = img.convertToFormat(QImage::Format_ARGB32);
-  if (img.isNull()) {
-    QMessageBox::information(this, tr("打开图片失败"),
-                             tr("图片格式损坏，或者图片过于巨大。"));
-    return;
+  stream_source.clear();
+  if (path.endsWith(".png", Qt::CaseInsensitive)) {
+    streaming_cutter::png_size size;
+    const std::string err =
+        streaming_cutter::read_png_size(path.toLocal8Bit().data(), &size);
+    if (err.empty() && !size.interlaced &&
+        size.rows * size.cols > max_loaded_pixels) {
+      stream_source = path;
+      stream_size = QSize(int(size.cols), int(size.rows));
+      stream_smooth = false;
+      img = QImage();
+    }
+  }
+
+  if (stream_source.isEmpty()) {
+    img.load(path);
+    img = img.convertToFormat(QImage::Format_ARGB32);
+    if (img.isNull()) {
+      QMessageBox::information(this, tr("打开图片失败"),
+                               tr("图片格式损坏，或者图片过于巨大。"));
+      return;
+    }
   }
 
   updateImg();
@@ -77,11 +98,17 @@ void CutterWind::loadImg() {
 }
 
 void CutterWind::updateImg() const {
-  ui->imgDisplay->setPixmap(QPixmap::fromImage(img));
+  QSize size = img.size();
+  if (stream_source.isEmpty()) {
+    ui->imgDisplay->setPixmap(QPixmap::fromImage(img));
+  } else {
+    ui->imgDisplay->setText(tr("图片过大，不显示预览。切分时将逐行读取图片。"));
+    size = stream_size;
+  }
 
   ui->labelShowSize->setText(tr("图片尺寸（方块）：") +
-                             QString::number(img.height()) + tr("行 , ") +
-                             QString::number(img.width()) + tr("列"));
+                             QString::number(size.height()) + tr("行 , ") +
+                             QString::number(size.width()) + tr("列"));
 }
 
 void CutterWind::saveImg() {
@@ -90,6 +117,12 @@ void CutterWind::saveImg() {
   if (name.isEmpty())
     return;
 
+  if (!stream_source.isEmpty()) {
+    QMessageBox::information(this, tr("无法保存图片"),
+                             tr("过大的图片只能切分，不能保存。"));
+    return;
+  }
+
   img.save(name);
 }
 
@@ -103,6 +136,14 @@ void CutterWind::resizeImg() {
   int rows = ui->scaledRows->value();
   int cols = ui->scaledCols->value();
 
+  if (!stream_source.isEmpty()) {
+    // scaled when cutting
+    stream_size = stream_size.scaled(cols, rows, arm);
+    stream_smooth = (tm == Qt::TransformationMode::SmoothTransformation);
+    updateImg();
+    return;
+  }
+
   img = img.scaled(cols, rows, arm, tm);
 
   updateImg();
@@ -118,6 +159,11 @@ void CutterWind::cutImg() {
   dir = dir.replace("\\\\", "/");
   dir = dir.replace('\\', '/');
 
+  if (!stream_source.isEmpty()) {
+    cutImgByStreaming(dir + '/' + netRawFileName + '_');
+    return;
+  }
+
   QImage part(QSize(128, 128), QImage::Format_ARGB32);
 
   const int imgRN = img.height();
@@ -153,3 +199,27 @@ void CutterWind::cutImg() {
     }
   }
 }
+
+void CutterWind::cutImgByStreaming(const QString &fileNamePrefix) {
+  QProgressDialog progress(tr("正在切分图片"), QString(), 0, 1, this);
+  progress.setWindowModality(Qt::WindowModal);
+  progress.setMinimumDuration(0);
+
+  streaming_cutter::cut_option opt;
+  opt.rows = stream_size.height();
+  opt.cols = stream_size.width();
+  opt.smooth = stream_smooth;
+
+  const std::string err = streaming_cutter::cut_png(
+      stream_source.toLocal8Bit().data(),
+      fileNamePrefix.toLocal8Bit().toStdString(), opt,
+      [&progress](int64_t finished, int64_t total) {
+        progress.setMaximum(int(total));
+        progress.setValue(int(finished));
+      });
+
+  if (!err.empty()) {
+    QMessageBox::warning(this, tr("切分图片失败"),
+                         QString::fromLocal8Bit(err.data()));
+  }
+}
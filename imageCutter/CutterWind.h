@@ -47,7 +47,13 @@ private slots:
 private:
   void updateImg() const;
   void resizeImg();
+  void cutImgByStreaming(const QString &fileNamePrefix);
   QImage img;
+  // Images that are too large to load are cut by streaming_cutter, only the
+  // path, the scaled size and transformation mode are kept.
+  QString stream_source;
+  QSize stream_size;
+  bool stream_smooth{false};
   QString netRawFileName;
   QString rawFileSuffix;
   Ui::CutterWind *ui;
@@ -21,6 +21,7 @@ This file is part of SlopeCraft.
 */
 
 #include "CutterWind.h"
+#include "streaming_cutter.h"
 
 #include <QApplication>
 #include <QDesktopServices>
@@ -29,8 +30,64 @@ This file is part of SlopeCraft.
 #include <QMessageBox>
 #include <QTranslator>
 #include <QUrl>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string_view>
+
+// imageCutter --cut <input.png> [--output <dir>] [--rows <rows>]
+// [--cols <cols>] [--smooth]
+int cut_headless(int argc, char *argv[]) {
+  const char *input = nullptr;
+  std::filesystem::path output_dir{"."};
+  streaming_cutter::cut_option opt;
+  for (int i = 1; i < argc; i++) {
+    const std::string_view arg{argv[i]};
+    const bool has_value = (i + 1 < argc);
+    if (arg == "--cut" && has_value) {
+      input = argv[++i];
+    } else if (arg == "--output" && has_value) {
+      output_dir = argv[++i];
+    } else if (arg == "--rows" && has_value) {
+      opt.rows = std::atoll(argv[++i]);
+    } else if (arg == "--cols" && has_value) {
+      opt.cols = std::atoll(argv[++i]);
+    } else if (arg == "--smooth") {
+      opt.smooth = true;
+    }
+  }
+  if (input == nullptr) {
+    fprintf(stderr,
+            "Usage: imageCutter --cut <input.png> [--output <dir>] "
+            "[--rows <rows>] [--cols <cols>] [--smooth]\n");
+    return 1;
+  }
+
+  std::error_code ec;
+  std::filesystem::create_directories(output_dir, ec);
+  const std::string prefix =
+      (output_dir / std::filesystem::path{input}.stem()).string() + '_';
+
+  const std::string err = streaming_cutter::cut_png(
+      input, prefix, opt, [](int64_t finished, int64_t total) {
+        printf("\r%lld/%lld maps", (long long)finished, (long long)total);
+        fflush(stdout);
+      });
+  printf("\n");
+  if (!err.empty()) {
+    fprintf(stderr, "%s\n", err.data());
+    return 1;
+  }
+  return 0;
+}
 
 int main(int argc, char *argv[]) {
+  // cut without any window
+  for (int i = 0; i < argc; i++) {
+    if (std::string_view(argv[i]) == "--cut") {
+      return cut_headless(argc, argv);
+    }
+  }
 
   QApplication a(argc, argv);
 
@@ -0,0 +1,376 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+#include "streaming_cutter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <vector>
+#include <png.h>
+
+namespace {
+constexpr int64_t map_size = 128;
+
+int64_t ceil_div(int64_t a, int64_t b) noexcept { return (a + b - 1) / b; }
+
+// Reads a png row by row as 8-bit BGRA, which is ARGB32 on little-endian.
+// libpng reports errors by longjmp, so every function that calls libpng sets
+// its own jump point and creates no C++ objects after it.
+class png_row_reader {
+ private:
+  FILE *fp{nullptr};
+  png_struct *png{nullptr};
+  png_info *info{nullptr};
+
+  bool read_header(streaming_cutter::png_size *size) noexcept {
+    if (setjmp(png_jmpbuf(this->png))) {
+      return false;
+    }
+    png_init_io(this->png, this->fp);
+    png_set_sig_bytes(this->png, 8);
+    png_read_info(this->png, this->info);
+
+    png_uint_32 width, height;
+    int bit_depth, color_type, interlace;
+    png_get_IHDR(this->png, this->info, &width, &height, &bit_depth,
+                 &color_type, &interlace, nullptr, nullptr);
+
+    if (bit_depth == 16) {
+      png_set_strip_16(this->png);
+    }
+    if (color_type == PNG_COLOR_TYPE_PALETTE) {
+      png_set_palette_to_rgb(this->png);
+    }
+    if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8) {
+      png_set_expand_gray_1_2_4_to_8(this->png);
+    }
+    if (png_get_valid(this->png, this->info, PNG_INFO_tRNS)) {
+      png_set_tRNS_to_alpha(this->png);
+    }
+    if (color_type == PNG_COLOR_TYPE_GRAY ||
+        color_type == PNG_COLOR_TYPE_GRAY_ALPHA) {
+      png_set_gray_to_rgb(this->png);
+    }
+    // ignored if there is alpha channel already
+    png_set_filler(this->png, 0xFF, PNG_FILLER_AFTER);
+    png_set_bgr(this->png);
+    png_read_update_info(this->png, this->info);
+
+    size->rows = height;
+    size->cols = width;
+    size->interlaced = (interlace != PNG_INTERLACE_NONE);
+    return true;
+  }
+
+ public:
+  ~png_row_reader() {
+    if (this->png != nullptr) {
+      png_destroy_read_struct(&this->png, &this->info, nullptr);
+    }
+    if (this->fp != nullptr) {
+      fclose(this->fp);
+    }
+  }
+
+  std::string open(const char *filename,
+                   streaming_cutter::png_size *size) noexcept {
+    this->fp = fopen(filename, "rb");
+    if (this->fp == nullptr) {
+      return std::string{"Failed to open "} + filename;
+    }
+    uint8_t signature[8];
+    if (fread(signature, 1, 8, this->fp) != 8 ||
+        png_sig_cmp(signature, 0, 8) != 0) {
+      return std::string{filename} + " is not a png file.";
+    }
+    this->png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr,
+                                       nullptr, nullptr);
+    if (this->png == nullptr) {
+      return "Failed to create png read struct.";
+    }
+    this->info = png_create_info_struct(this->png);
+    if (this->info == nullptr) {
+      return "Failed to create png info struct.";
+    }
+    if (!this->read_header(size)) {
+      return std::string{"Failed to read png header of "} + filename;
+    }
+    return {};
+  }
+
+  bool read_row(uint32_t *dest) noexcept {
+    if (setjmp(png_jmpbuf(this->png))) {
+      return false;
+    }
+    png_read_row(this->png, reinterpret_cast<png_byte *>(dest), nullptr);
+    return true;
+  }
+};
+
+// Encode a 128x128 map. Rows of pixels are stride pixels apart.
+std::string write_map_png(const char *filename, const uint32_t *pixels,
+                          int64_t stride, int level) noexcept {
+  FILE *fp = fopen(filename, "wb");
+  if (fp == nullptr) {
+    return std::string{"Failed to create "} + filename;
+  }
+  png_struct *png =
+      png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+  if (png == nullptr) {
+    fclose(fp);
+    return "Failed to create png write struct.";
+  }
+  png_info *info = png_create_info_struct(png);
+  if (info == nullptr) {
+    png_destroy_write_struct(&png, nullptr);
+    fclose(fp);
+    return "Failed to create png info struct.";
+  }
+  if (setjmp(png_jmpbuf(png))) {
+    png_destroy_write_struct(&png, &info);
+    fclose(fp);
+    return std::string{"Failed to encode "} + filename;
+  }
+
+  png_init_io(png, fp);
+  png_set_compression_level(png, level);
+  png_set_IHDR(png, info, map_size, map_size, 8, PNG_COLOR_TYPE_RGB_ALPHA,
+               PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+               PNG_FILTER_TYPE_DEFAULT);
+  png_write_info(png, info);
+  png_set_bgr(png);
+  for (int64_t r = 0; r < map_size; r++) {
+    png_write_row(png, reinterpret_cast<png_const_bytep>(pixels + r * stride));
+  }
+  png_write_end(png, nullptr);
+  png_destroy_write_struct(&png, &info);
+
+  if (fclose(fp) != 0) {
+    return std::string{"Failed to write "} + filename;
+  }
+  return {};
+}
+
+struct tap {
+  int64_t src;
+  float weight;
+};
+// taps of each destination pixel, sorted by source index
+using taps_t = std::vector<std::vector<tap>>;
+
+taps_t make_taps(int64_t src_len, int64_t dst_len, bool smooth) noexcept {
+  taps_t taps(dst_len);
+  const double scale = double(src_len) / dst_len;
+  for (int64_t d = 0; d < dst_len; d++) {
+    auto &t = taps[d];
+    if (!smooth || src_len == dst_len) {
+      const int64_t nearest = int64_t(std::floor((d + 0.5) * scale));
+      t.push_back({std::min(nearest, src_len - 1), 1.0f});
+      continue;
+    }
+    if (dst_len < src_len) {
+      // box filter, weighted by overlapping length
+      const double begin = d * scale;
+      const double end = (d + 1) * scale;
+      const int64_t s_end =
+          std::min(int64_t(std::ceil(end)), src_len);
+      for (int64_t s = int64_t(std::floor(begin)); s < s_end; s++) {
+        const double w = std::min(end, s + 1.0) - std::max(begin, double(s));
+        if (w > 0) {
+          t.push_back({s, float(w / scale)});
+        }
+      }
+      continue;
+    }
+    // bilinear
+    const double pos = (d + 0.5) * scale - 0.5;
+    if (pos <= 0) {
+      t.push_back({0, 1.0f});
+      continue;
+    }
+    const int64_t s0 = std::min(int64_t(pos), src_len - 1);
+    const int64_t s1 = std::min(s0 + 1, src_len - 1);
+    const float frac = float(pos - std::floor(pos));
+    t.push_back({s0, 1.0f - frac});
+    if (s1 != s0) {
+      t.push_back({s1, frac});
+    } else {
+      t.back().weight = 1.0f;
+    }
+  }
+  return taps;
+}
+
+// bgr of the resampled pixel is premultiplied by alpha
+uint32_t pack_argb(const float *bgra) noexcept {
+  const float alpha = std::clamp(bgra[3] + 0.5f, 0.0f, 255.0f);
+  if (alpha < 1.0f) {
+    return 0;
+  }
+  uint32_t ret = uint32_t(alpha) << 24;
+  for (int ch = 0; ch < 3; ch++) {
+    const float val = std::clamp(bgra[ch] * 255.0f / bgra[3] + 0.5f, 0.0f,
+                                 255.0f);
+    ret |= uint32_t(val) << (8 * ch);
+  }
+  return ret;
+}
+}  // namespace
+
+std::string streaming_cutter::read_png_size(const char *filename,
+                                            png_size *size) noexcept {
+  png_row_reader reader;
+  return reader.open(filename, size);
+}
+
+std::string streaming_cutter::cut_png(const char *input,
+                                      std::string_view output_prefix,
+                                      const cut_option &opt,
+                                      const progress_callback_t &progress)
+    noexcept {
+  png_row_reader reader;
+  png_size src_size;
+  if (auto err = reader.open(input, &src_size); !err.empty()) {
+    return err;
+  }
+  if (src_size.interlaced) {
+    return std::string{input} +
+           " is interlaced, it can't be decoded row by row.";
+  }
+  if (src_size.rows <= 0 || src_size.cols <= 0) {
+    return std::string{input} + " is empty.";
+  }
+
+  const int64_t rows = (opt.rows > 0) ? opt.rows : src_size.rows;
+  const int64_t cols = (opt.cols > 0) ? opt.cols : src_size.cols;
+  const taps_t row_taps = make_taps(src_size.rows, rows, opt.smooth);
+  const taps_t col_taps = make_taps(src_size.cols, cols, opt.smooth);
+  // every pixel comes from exactly 1 source pixel
+  const bool is_nearest = !opt.smooth || (rows == src_size.rows &&
+                                          cols == src_size.cols);
+
+  const int64_t map_rows = ceil_div(rows, map_size);
+  const int64_t map_cols = ceil_div(cols, map_size);
+  // padded to whole maps, so that a map is a block of the band
+  const int64_t band_cols = map_cols * map_size;
+  std::vector<uint32_t> band(map_size * band_cols, 0xFFFFFFFF);
+
+  // decoded source rows [decoded - window.size(), decoded)
+  std::deque<std::vector<uint32_t>> window;
+  std::vector<std::vector<uint32_t>> spare_rows;
+  int64_t decoded = 0;
+
+  std::vector<std::string> errors(map_cols);
+  for (int64_t map_r = 0; map_r < map_rows; map_r++) {
+    const int64_t row_beg = map_r * map_size;
+    const int64_t row_end = std::min(row_beg + map_size, rows);
+    const int64_t src_beg = row_taps[row_beg].front().src;
+    const int64_t src_end = row_taps[row_end - 1].back().src + 1;
+
+    while (!window.empty() && decoded - int64_t(window.size()) < src_beg) {
+      spare_rows.emplace_back(std::move(window.front()));
+      window.pop_front();
+    }
+    while (decoded < src_end) {
+      std::vector<uint32_t> row;
+      if (!spare_rows.empty()) {
+        row = std::move(spare_rows.back());
+        spare_rows.pop_back();
+      }
+      row.resize(src_size.cols);
+      if (!reader.read_row(row.data())) {
+        return std::string{"Failed to decode "} + input;
+      }
+      decoded++;
+      if (decoded > src_beg) {
+        window.emplace_back(std::move(row));
+      }
+    }
+    const int64_t window_beg = decoded - int64_t(window.size());
+
+#pragma omp parallel
+    {
+      // bgra of a vertically resampled row. Colors are premultiplied by alpha,
+      // so that transparent pixels don't bleed their colors into neighbors.
+      std::vector<float> accum;
+#pragma omp for schedule(static)
+      for (int64_t r = row_beg; r < row_end; r++) {
+        uint32_t *const dst = band.data() + (r - row_beg) * band_cols;
+        if (is_nearest) {
+          const uint32_t *const src =
+              window[row_taps[r][0].src - window_beg].data();
+          for (int64_t c = 0; c < cols; c++) {
+            dst[c] = src[col_taps[c][0].src];
+          }
+          continue;
+        }
+
+        accum.assign(src_size.cols * 4, 0.0f);
+        for (const tap &rt : row_taps[r]) {
+          const auto *const src = reinterpret_cast<const uint8_t *>(
+              window[rt.src - window_beg].data());
+          for (int64_t i = 0; i < src_size.cols * 4; i += 4) {
+            const float weight_alpha = rt.weight * src[i + 3] / 255.0f;
+            for (int ch = 0; ch < 3; ch++) {
+              accum[i + ch] += weight_alpha * src[i + ch];
+            }
+            accum[i + 3] += rt.weight * src[i + 3];
+          }
+        }
+        for (int64_t c = 0; c < cols; c++) {
+          float bgra[4] = {0, 0, 0, 0};
+          for (const tap &ct : col_taps[c]) {
+            for (int ch = 0; ch < 4; ch++) {
+              bgra[ch] += ct.weight * accum[ct.src * 4 + ch];
+            }
+          }
+          dst[c] = pack_argb(bgra);
+        }
+      }
+    }
+    // the last band may be shorter than a map
+    std::fill(band.begin() + (row_end - row_beg) * band_cols, band.end(),
+              0xFFFFFFFF);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t map_c = 0; map_c < map_cols; map_c++) {
+      const std::string filename = std::string{output_prefix} +
+                                   std::to_string(map_r + map_c * map_rows) +
+                                   ".png";
+      errors[map_c] =
+          write_map_png(filename.c_str(), band.data() + map_c * map_size,
+                        band_cols, opt.png_compress_level);
+    }
+    for (auto &err : errors) {
+      if (!err.empty()) {
+        return err;
+      }
+    }
+
+    if (progress) {
+      progress((map_r + 1) * map_cols, map_rows * map_cols);
+    }
+  }
+  return {};
+}
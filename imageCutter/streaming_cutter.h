@@ -0,0 +1,67 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+#ifndef IMAGECUTTER_STREAMING_CUTTER_H
+#define IMAGECUTTER_STREAMING_CUTTER_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace streaming_cutter {
+
+struct png_size {
+  int64_t rows{0};
+  int64_t cols{0};
+  bool interlaced{false};
+};
+
+/// Read the header of a png only. Returns error info, empty on success.
+std::string read_png_size(const char *filename, png_size *size) noexcept;
+
+struct cut_option {
+  /// Size after scaling, 0 or negative means the same as the source.
+  int64_t rows{0};
+  int64_t cols{0};
+  /// Average pixels when shrinking and interpolate when enlarging, otherwise
+  /// take the nearest pixel.
+  bool smooth{false};
+  int png_compress_level{6};
+};
+
+/// Called by the calling thread after each row of maps is written.
+using progress_callback_t =
+    std::function<void(int64_t maps_finished, int64_t maps_total)>;
+
+/// Cut a png into 128x128 maps named <output_prefix><map_r + map_c * map_rows>
+/// .png, pixels out of the image are white. The png is decoded row by row,
+/// only a band of 128 scaled rows and the source rows it needs are kept in
+/// memory. Maps in a band are encoded in parallel. Interlaced pngs can't be
+/// decoded in this way. Returns error info, empty on success.
+std::string cut_png(const char *input, std::string_view output_prefix,
+                    const cut_option &opt,
+                    const progress_callback_t &progress = {}) noexcept;
+
+}  // namespace streaming_cutter
+
+#endif  // IMAGECUTTER_STREAMING_CUTTER_H
@@ -0,0 +1,139 @@
+#include <streaming_cutter.h>
+#include <QDir>
+#include <QImage>
+#include <QString>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+using std::cout, std::endl;
+
+// Transparent columns between opaque ones, and a half transparent gradient.
+// Colors of transparent pixels must not bleed into neighbors when scaled.
+QImage make_source(int rows, int cols) {
+  QImage img(cols, rows, QImage::Format_ARGB32);
+  for (int r = 0; r < rows; r++) {
+    auto *const line = reinterpret_cast<QRgb *>(img.scanLine(r));
+    for (int c = 0; c < cols; c++) {
+      if (r < rows / 2) {
+        line[c] = (c % 2 == 0) ? qRgba(255, r % 256, c % 256, 255)
+                               : qRgba(0, 0, 0, 0);
+      } else {
+        line[c] = qRgba(r % 256, c % 256, (r + c) % 256, 160);
+      }
+    }
+  }
+  return img;
+}
+
+// Same as CutterWind::cutImg, pixels out of the image are white.
+QImage map_of(const QImage &img, int map_r, int map_c) {
+  QImage part(128, 128, QImage::Format_ARGB32);
+  for (int r = 0; r < 128; r++) {
+    for (int c = 0; c < 128; c++) {
+      const int img_r = r + 128 * map_r;
+      const int img_c = c + 128 * map_c;
+      part.setPixel(c, r,
+                    (img_r < img.height() && img_c < img.width())
+                        ? img.pixel(img_c, img_r)
+                        : 0xFFFFFFFF);
+    }
+  }
+  return part;
+}
+
+// Compare premultiplied colors, where rounding errors of nearly transparent
+// pixels don't matter.
+bool compare(const QString &prefix, const QImage &expected, int tolerance,
+             const char *when) {
+  const int map_rows = (expected.height() + 127) / 128;
+  const int map_cols = (expected.width() + 127) / 128;
+  for (int map_r = 0; map_r < map_rows; map_r++) {
+    for (int map_c = 0; map_c < map_cols; map_c++) {
+      const QString filename =
+          prefix + QString::number(map_r + map_c * map_rows) + ".png";
+      const QImage streamed = QImage{filename}.convertToFormat(
+          QImage::Format_ARGB32_Premultiplied);
+      const QImage part = map_of(expected, map_r, map_c)
+                              .convertToFormat(
+                                  QImage::Format_ARGB32_Premultiplied);
+      if (streamed.size() != part.size()) {
+        cout << "Error : " << when << ", failed to load "
+             << filename.toStdString() << endl;
+        return false;
+      }
+      for (int r = 0; r < 128; r++) {
+        for (int c = 0; c < 128; c++) {
+          const QRgb a = streamed.pixel(c, r);
+          const QRgb b = part.pixel(c, r);
+          const int diff = std::max({std::abs(qRed(a) - qRed(b)),
+                                     std::abs(qGreen(a) - qGreen(b)),
+                                     std::abs(qBlue(a) - qBlue(b)),
+                                     std::abs(qAlpha(a) - qAlpha(b))});
+          if (diff > tolerance) {
+            cout << "Error : " << when << ", pixel (" << r << ", " << c
+                 << ") of map " << map_r << ", " << map_c << " is " << std::hex
+                 << a << ", but QImage gives " << b << std::dec << endl;
+            return false;
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+int main() {
+  QDir dir{QDir::temp().filePath("SlopeCraft_test_streaming_cutter")};
+  dir.removeRecursively();
+  if (!dir.mkpath(".")) {
+    cout << "Error : failed to create " << dir.path().toStdString() << endl;
+    return 1;
+  }
+
+  const QImage source = make_source(300, 384);
+  const QString source_file = dir.filePath("source.png");
+  if (!source.save(source_file)) {
+    cout << "Error : failed to save " << source_file.toStdString() << endl;
+    return 1;
+  }
+
+  struct test_case {
+    const char *name;
+    int rows;
+    int cols;
+    bool smooth;
+    QImage expected;
+    int tolerance;
+  };
+  const test_case cases[] = {
+      {"unscaled", 0, 0, false, source, 0},
+      // box filter
+      {"shrunk", 150, 192, true,
+       source.scaled(192, 150, Qt::IgnoreAspectRatio,
+                     Qt::SmoothTransformation),
+       3},
+  };
+
+  for (const test_case &tc : cases) {
+    const QString prefix = dir.filePath(QString{tc.name} + '_');
+    streaming_cutter::cut_option opt;
+    opt.rows = tc.rows;
+    opt.cols = tc.cols;
+    opt.smooth = tc.smooth;
+    const std::string err = streaming_cutter::cut_png(
+        source_file.toLocal8Bit().data(), prefix.toLocal8Bit().toStdString(),
+        opt);
+    if (!err.empty()) {
+      cout << "Error : " << tc.name << ", " << err << endl;
+      return 1;
+    }
+    if (!compare(prefix, tc.expected, tc.tolerance, tc.name)) {
+      return 1;
+    }
+  }
+
+  dir.removeRecursively();
+  cout << "Success" << endl;
+  return 0;
+}
@@ -22,8 +22,11 @@ This file is part of SlopeCraft.
 
 #include <Schem/Schem.h>
 #include <Schem/bit_shrink.h>
+#include <cereal/archives/binary.hpp>
 
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <vector>
 
 using std::cout, std::endl;
@@ -33,6 +36,13 @@ void test_bit_shrink(const uint16_t *const, const size_t u16_num,
 
 std::vector<std::string> generate_trash();
 
+std::string read_file(const char *filename);
+
+// Serialize src with cereal and load it into a new schem.
+libSchem::Schem cereal_roundtrip(const libSchem::Schem &src);
+
+bool same_blocks(const libSchem::Schem &a, const libSchem::Schem &b);
+
 const std::vector<std::string> trash_id = generate_trash();
 
 int main() {
@@ -116,9 +126,206 @@ int main() {
     return 1;
   }
 
+  // chunked storage should behave the same as dense
+  {
+    const auto dense_stat = schem.stat_blocks();
+    const int64_t dense_non_zero = schem.non_zero_count();
+    schem.to_chunked();
+    if (schem.stat_blocks() != dense_stat ||
+        schem.non_zero_count() != dense_non_zero) {
+      cout << "Block statistics changed after chunking." << endl;
+      return 1;
+    }
+  }
+
+  if (!schem.export_litematic("test12_chunked.litematic", info, nullptr,
+                              &error_str)) {
+    cout << "Failed to export file "
+         << "test12_chunked.litematic" << endl;
+    cout << "Error info = " << error_str << endl;
+    return 1;
+  }
+
+  if (!schem.export_structure("test12_chunked.nbt", true, nullptr,
+                              &error_str)) {
+    cout << "Failed to export file "
+         << "test12_chunked.nbt" << endl;
+    cout << "Error info = " << error_str << endl;
+    return 1;
+  }
+
+  if (!schem.export_WESchem("test12_chunked.schem", weinfo, nullptr,
+                            &error_str)) {
+    cout << "Failed to export file "
+         << "test12_chunked.schem" << endl;
+    cout << "Error info = " << error_str << endl;
+    return 1;
+  }
+
+  for (const auto &[dense_file, chunked_file] :
+       {std::pair{"test12.litematic", "test12_chunked.litematic"},
+        std::pair{"test12.nbt", "test12_chunked.nbt"},
+        std::pair{"test12.schem", "test12_chunked.schem"}}) {
+    const std::string dense_bytes = read_file(dense_file);
+    if (dense_bytes.empty() || dense_bytes != read_file(chunked_file)) {
+      cout << chunked_file << " differs from " << dense_file << endl;
+      return 1;
+    }
+  }
+
+  // a chunked schem is saved densely, and compacted again after loading
+  {
+    libSchem::Schem dense = cereal_roundtrip(schem);
+    if (dense.is_chunked() || !same_blocks(dense, schem)) {
+      cout << "Chunked schem changed after serialization." << endl;
+      return 1;
+    }
+
+    libSchem::Schem sparse;
+    sparse.set_MC_major_version_number(schem.MC_major_version_number());
+    sparse.set_MC_version_number(schem.MC_version_number());
+    sparse.set_block_id(ids.data(), ids.size());
+    sparse.resize(64, 32, 64);
+    sparse.set_zero();
+    sparse(1, 2, 3) = 5;
+    sparse(60, 30, 61) = 7;
+    sparse.to_chunked();
+    libSchem::Schem loaded = cereal_roundtrip(sparse);
+    if (!loaded.is_chunked() || !same_blocks(loaded, sparse)) {
+      cout << "Sparse schem is not compacted after serialization." << endl;
+      return 1;
+    }
+  }
+
+  // a schem has no delta to itself, and a changed block shows in the delta
+  {
+    const libSchem::Schem &cur = schem;
+    libSchem::diff_statistics stat;
+    auto same = schem.diff(schem, &stat);
+    if (!same || stat.changed() != 0 || same->non_zero_count() != 0) {
+      cout << "Diff of the same schem is not empty." << endl;
+      return 1;
+    }
+
+    libSchem::Schem old;
+    old.set_MC_major_version_number(schem.MC_major_version_number());
+    old.set_MC_version_number(schem.MC_version_number());
+    old.set_block_id(ids.data(), ids.size());
+    old.resize(schem.x_range(), schem.y_range(), schem.z_range());
+    for (int64_t idx = 0; idx < schem.size(); idx++) {
+      old(idx) = cur(idx);
+    }
+    // (0, 0, 0) is air now, so it's removed
+    old(0, 0, 0) = 1;
+    old(3, 4, 5) = (cur(3, 4, 5) + 1) % schem.palette_size();
+
+    std::vector<libSchem::region> regions;
+    auto delta = schem.diff(old, &stat, &regions);
+    if (!delta || stat.changed() != 2 || stat.removed != 1) {
+      cout << "Diff found wrong blocks." << endl;
+      return 1;
+    }
+    // unchanged cells are kept, removed cells are explicit air
+    const libSchem::Schem &d = delta.value();
+    bool palette_ok = d.palette_size() == schem.palette_size() + 1 &&
+                      d.palette()[0] == libSchem::Schem::keep_block_id;
+    for (size_t idx = 0; palette_ok && idx < schem.palette_size(); idx++) {
+      palette_ok = (d.palette()[idx + 1] == schem.palette()[idx]);
+    }
+    if (!palette_ok || d.non_zero_count() != 2 ||
+        d.palette()[d(0, 0, 0)] != "minecraft:air" ||
+        d(3, 4, 5) != cur(3, 4, 5) + 1) {
+      cout << "Delta has wrong palette or blocks." << endl;
+      return 1;
+    }
+    // both blocks are in the first section, which is clipped by the shape
+    const std::array<int64_t, 3> expected_shape{
+        schem.x_range(), schem.y_range(), schem.z_range()};
+    if (regions.size() != 1 ||
+        regions[0].offset_xyz != std::array<int64_t, 3>{0, 0, 0} ||
+        regions[0].shape_xyz != expected_shape) {
+      cout << "Diff found wrong regions." << endl;
+      return 1;
+    }
+    if (!delta->export_litematic("test12_delta.litematic", info, nullptr,
+                                 &error_str)) {
+      cout << "Failed to export file "
+           << "test12_delta.litematic" << endl;
+      cout << "Error info = " << error_str << endl;
+      return 1;
+    }
+  }
+
+  // changes in sections far apart make separate regions
+  {
+    auto make_empty = [&schem, &ids](libSchem::Schem &s) {
+      s.set_MC_major_version_number(schem.MC_major_version_number());
+      s.set_MC_version_number(schem.MC_version_number());
+      s.set_block_id(ids.data(), ids.size());
+      s.resize(40, 20, 40);
+      s.set_zero();
+    };
+    libSchem::Schem big, changed;
+    make_empty(big);
+    make_empty(changed);
+    changed(1, 1, 1) = 2;
+    changed(17, 2, 3) = 3;
+    changed(35, 18, 33) = 4;
+
+    std::vector<libSchem::region> regions;
+    auto delta = changed.diff(big, nullptr, &regions);
+    const std::vector<std::array<int64_t, 6>> expected{
+        {0, 0, 0, 32, 16, 16}, {32, 16, 32, 8, 4, 8}};
+    bool ok = delta.has_value() && regions.size() == expected.size();
+    for (size_t i = 0; ok && i < regions.size(); i++) {
+      for (size_t dim = 0; dim < 3; dim++) {
+        ok = ok && regions[i].offset_xyz[dim] == expected[i][dim] &&
+             regions[i].shape_xyz[dim] == expected[i][dim + 3];
+      }
+    }
+    if (!ok) {
+      cout << "Diff found wrong regions for separate changes." << endl;
+      return 1;
+    }
+  }
+
   return 0;
 }
 
+std::string read_file(const char *filename) {
+  std::ifstream ifs{filename, std::ios::binary};
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  return ss.str();
+}
+
+libSchem::Schem cereal_roundtrip(const libSchem::Schem &src) {
+  std::stringstream ss;
+  {
+    cereal::BinaryOutputArchive oa{ss};
+    oa(src);
+  }
+  libSchem::Schem ret;
+  {
+    cereal::BinaryInputArchive ia{ss};
+    ia(ret);
+  }
+  return ret;
+}
+
+bool same_blocks(const libSchem::Schem &a, const libSchem::Schem &b) {
+  if (a.palette() != b.palette() || a.x_range() != b.x_range() ||
+      a.y_range() != b.y_range() || a.z_range() != b.z_range()) {
+    return false;
+  }
+  for (int64_t idx = 0; idx < a.size(); idx++) {
+    if (a(idx) != b(idx)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 void test_bit_shrink(const uint16_t *const src, const size_t u16_num,
                      size_t block_types) {
   std::vector<uint64_t> shrinked;
@@ -24,7 +24,9 @@ This file is part of SlopeCraft.
 
 #include <math.h>
 #include <stdio.h>
+#include <algorithm>
 #include <utility>
+#include <xsimd/xsimd.hpp>
 
 #include <assert.h>
 
@@ -260,3 +262,134 @@ ARGB HSV2ARGB(float H, float S, float V) noexcept {
   HSV2RGB(H, S, V, r, g, b);
   return RGB2ARGB(r, g, b);
 }
+
+namespace {
+using batch_t = xsimd::batch<float>;
+constexpr size_t batch_size = batch_t::size;
+
+struct cvt_kernel_RGB {
+  void operator()(batch_t r, batch_t g, batch_t b, batch_t &c0, batch_t &c1,
+                  batch_t &c2) const noexcept {
+    c0 = xsimd::max(r, batch_t{threshold});
+    c1 = xsimd::max(g, batch_t{threshold});
+    c2 = xsimd::max(b, batch_t{threshold});
+  }
+};
+
+struct cvt_kernel_HSV {
+  // Branchless RGB2HSV. The 4 cases of swapping in RGB2HSV are:
+  // R is max and G>B : h = pi/3*((G-B)/delta+6)
+  // R is max and G<=B: h = pi/3*((B-G)/delta+6)
+  // G is max         : h = pi/3*((B-R)/delta+2)
+  // B is max         : h = pi/3*((R-G)/delta+4)
+  void operator()(batch_t r, batch_t g, batch_t b, batch_t &h, batch_t &s,
+                  batch_t &v) const noexcept {
+    const auto g_gt_b = g > b;
+    const batch_t max_gb = xsimd::select(g_gt_b, g, b);
+    const auto r_is_max = r > max_gb;
+
+    const batch_t max = xsimd::select(r_is_max, r, max_gb);
+    const batch_t delta = max - xsimd::min(r, xsimd::min(g, b));
+
+    const batch_t num_r_max = xsimd::select(g_gt_b, g - b, b - g);
+    const batch_t num_gb_max = xsimd::select(g_gt_b, b - r, r - g);
+    const batch_t K_gb_max =
+        xsimd::select(g_gt_b, batch_t{2.0f}, batch_t{4.0f});
+    const batch_t num = xsimd::select(r_is_max, num_r_max, num_gb_max);
+    const batch_t K = xsimd::select(r_is_max, batch_t{6.0f}, K_gb_max);
+
+    h = (num / (delta + threshold) + K) * float(M_PI / 3.0);
+    s = delta / (max + threshold);
+    v = max;
+  }
+};
+
+struct cvt_kernel_XYZ {
+  void operator()(batch_t r, batch_t g, batch_t b, batch_t &x, batch_t &y,
+                  batch_t &z) const noexcept {
+    x = r * 0.412453f + g * 0.357580f + b * 0.180423f;
+    y = r * 0.212671f + g * 0.715160f + b * 0.072169f;
+    z = r * 0.019334f + g * 0.119193f + b * 0.950227f;
+  }
+};
+
+struct cvt_kernel_Lab {
+  static batch_t f(batch_t I) noexcept {
+    return xsimd::select(I > batch_t{0.008856f}, xsimd::cbrt(I),
+                         I * 7.787f + 16.0f / 116.0f);
+  }
+
+  void operator()(batch_t r, batch_t g, batch_t b, batch_t &L, batch_t &a,
+                  batch_t &lab_b) const noexcept {
+    batch_t x, y, z;
+    cvt_kernel_XYZ{}(r, g, b, x, y, z);
+    x = f(x / 0.9504f);
+    y = f(y);
+    z = f(z / 1.0888f);
+    L = x * 116.0f - 16.0f;
+    a = (x - y) * 500.0f;
+    lab_b = (y - z) * 200.0f;
+  }
+};
+
+template <class kernel_t>
+void convert_batch_impl(const kernel_t &kernel, std::span<const ARGB> src,
+                        std::span<float> c0p, std::span<float> c1p,
+                        std::span<float> c2p) noexcept {
+  assert(src.size() == c0p.size());
+  assert(src.size() == c1p.size());
+  assert(src.size() == c2p.size());
+
+  alignas(64) std::array<std::array<float, batch_size>, 3> temp;
+  for (size_t idx = 0; idx < src.size(); idx += batch_size) {
+    const size_t num = std::min(batch_size, src.size() - idx);
+    // Unpack channels of a batch of colors, lanes beyond src are filled with 0.
+    for (size_t lane = 0; lane < batch_size; lane++) {
+      const ARGB argb = (lane < num) ? src[idx + lane] : 0;
+      temp[0][lane] = getR(argb) / 255.0f;
+      temp[1][lane] = getG(argb) / 255.0f;
+      temp[2][lane] = getB(argb) / 255.0f;
+    }
+
+    batch_t c0, c1, c2;
+    kernel(batch_t::load_aligned(temp[0].data()),
+           batch_t::load_aligned(temp[1].data()),
+           batch_t::load_aligned(temp[2].data()), c0, c1, c2);
+
+    if (num == batch_size) {
+      c0.store_unaligned(c0p.data() + idx);
+      c1.store_unaligned(c1p.data() + idx);
+      c2.store_unaligned(c2p.data() + idx);
+      continue;
+    }
+    c0.store_aligned(temp[0].data());
+    c1.store_aligned(temp[1].data());
+    c2.store_aligned(temp[2].data());
+    for (size_t lane = 0; lane < num; lane++) {
+      c0p[idx + lane] = temp[0][lane];
+      c1p[idx + lane] = temp[1][lane];
+      c2p[idx + lane] = temp[2][lane];
+    }
+  }
+}
+}  // namespace
+
+void ARGB2RGB_batch(std::span<const ARGB> src, std::span<float> r,
+                    std::span<float> g, std::span<float> b) noexcept {
+  convert_batch_impl(cvt_kernel_RGB{}, src, r, g, b);
+}
+
+void ARGB2HSV_batch(std::span<const ARGB> src, std::span<float> h,
+                    std::span<float> s, std::span<float> v) noexcept {
+  convert_batch_impl(cvt_kernel_HSV{}, src, h, s, v);
+}
+
+void ARGB2XYZ_batch(std::span<const ARGB> src, std::span<float> x,
+                    std::span<float> y, std::span<float> z) noexcept {
+  convert_batch_impl(cvt_kernel_XYZ{}, src, x, y, z);
+}
+
+void ARGB2Lab_batch(std::span<const ARGB> src, std::span<float> L,
+                    std::span<float> a, std::span<float> b) noexcept {
+  convert_batch_impl(cvt_kernel_Lab{}, src, L, a, b);
+}
@@ -0,0 +1,32 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+// Colordiff kernels for avx2, this file must be compiled with avx2 enabled.
+#include "ColorDiff_kernels.hpp"
+
+#if !XSIMD_WITH_AVX2
+#error "ColorDiff_avx2.cpp is compiled without avx2 enabled."
+#endif
+
+namespace colordiff_simd {
+const kernel_table kernels_avx2 = kernels<xsimd::avx2>::table();
+}  // namespace colordiff_simd
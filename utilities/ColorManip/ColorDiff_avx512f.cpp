@@ -0,0 +1,33 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+// Colordiff kernels for avx512f, this file must be compiled with avx512f
+// enabled.
+#include "ColorDiff_kernels.hpp"
+
+#if !XSIMD_WITH_AVX512F
+#error "ColorDiff_avx512f.cpp is compiled without avx512f enabled."
+#endif
+
+namespace colordiff_simd {
+const kernel_table kernels_avx512f = kernels<xsimd::avx512f>::table();
+}  // namespace colordiff_simd
@@ -0,0 +1,515 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+#ifndef COLORMANIP_COLORDIFF_KERNELS_HPP
+#define COLORMANIP_COLORDIFF_KERNELS_HPP
+
+#include "ColorManip.h"
+#include <cassert>
+#include <cmath>
+#include <span>
+#include <xsimd/xsimd.hpp>
+
+// Colordiff kernels are compiled once for each instruction set listed in
+// ColorManip/CMakeLists.txt, and one of them is selected at runtime.
+namespace colordiff_simd {
+
+/// Colordiff functions compiled for one instruction set.
+struct kernel_table {
+  const char *arch_name;
+
+  decltype(&::colordiff_RGB_batch) RGB_batch;
+  decltype(&::colordiff_RGBplus_batch) RGBplus_batch;
+  decltype(&::colordiff_HSV_batch) HSV_batch;
+  decltype(&::colordiff_Lab94_batch) Lab94_batch;
+
+  decltype(&::colordiff_RGB_argmin) RGB_argmin;
+  decltype(&::colordiff_RGBplus_argmin) RGBplus_argmin;
+  decltype(&::colordiff_HSV_argmin) HSV_argmin;
+  decltype(&::colordiff_Lab94_argmin) Lab94_argmin;
+};
+
+// Defined in ColorDiff_<arch>.cpp, if the instruction set is compiled.
+extern const kernel_table kernels_sse4_2;
+extern const kernel_table kernels_avx2;
+extern const kernel_table kernels_avx512f;
+
+/**
+ * \brief Colordiff kernels with xsimd batches of Arch.
+ *
+ * A source file instantiating this must be compiled with Arch enabled. Inline
+ * functions outside this template, like std::fill or std::cos, are emitted
+ * in every source file that calls them and the linker keeps only one copy,
+ * which may be compiled with avx512f. So kernels only call members of this
+ * template, xsimd functions on batches of Arch and trivial accessors of
+ * std::span, which are inlined in optimized builds. Scalar math goes through
+ * batches of Arch as well. Loads and stores are unaligned, since colorsets
+ * are only aligned for the baseline instruction set.
+ */
+template <class Arch>
+struct kernels {
+  using batch_t = xsimd::batch<float, Arch>;
+  static constexpr size_t batch_size = batch_t::size;
+  static constexpr float thre = 1e-10f;
+
+  static float square(float x) noexcept { return x * x; }
+
+  static bool is_nan(float x) noexcept { return x != x; }
+
+  static float scalar_sqrt(float x) noexcept {
+    return xsimd::sqrt(batch_t{x}).get(0);
+  }
+
+  static void assert_if_nan([[maybe_unused]] batch_t val) noexcept {
+    for (size_t i = 0; i < batch_size; i++) {
+      assert(!is_nan(val.get(i)));
+    }
+  }
+
+  // Each kernel computes diff between a fixed color and a batch of colors, or
+  // a single color for the tail. Batch and fused argmin functions share them,
+  // so they always give the same result.
+  struct kernel_RGB {
+    float r2, g2, b2;
+
+    explicit kernel_RGB(std::span<const float, 3> rgb2) noexcept
+        : r2{rgb2[0]}, g2{rgb2[1]}, b2{rgb2[2]} {}
+
+    batch_t operator()(batch_t r1, batch_t g1, batch_t b1) const noexcept {
+      auto dr = r1 - r2;
+      auto dg = g1 - g2;
+      auto db = b1 - b2;
+      return dr * dr + dg * dg + db * db;
+    }
+
+    float operator()(float r1, float g1, float b1) const noexcept {
+      const float dr = r1 - r2;
+      const float dg = g1 - g2;
+      const float db = b1 - b2;
+      return dr * dr + dg * dg + db * db;
+    }
+  };
+
+  struct kernel_RGBplus {
+    float r2, g2, b2;
+    float rr_plus_gg_plus_bb_2;
+
+    explicit kernel_RGBplus(std::span<const float, 3> c3) noexcept
+        : r2{c3[0]}, g2{c3[1]}, b2{c3[2]} {
+      this->rr_plus_gg_plus_bb_2 = (r2 * r2 + g2 * g2 + b2 * b2);
+    }
+
+    batch_t operator()(batch_t r1, batch_t g1, batch_t b1) const noexcept {
+      // const batch_t thre_{thre};
+      constexpr float w_r = 1.0f, w_g = 2.0f, w_b = 1.0f;
+
+      auto deltaR = r1 - r2;
+      auto deltaG = g1 - g2;
+      auto deltaB = b1 - b2;
+
+      batch_t SqrModSquare;
+      {
+        const batch_t rr_plus_gg_plus_bb_1 = r1 * r1 + g1 * g1 + b1 * b1;
+
+        SqrModSquare = rr_plus_gg_plus_bb_1 * rr_plus_gg_plus_bb_2;
+        SqrModSquare = xsimd::sqrt(SqrModSquare);
+      }
+      assert_if_nan(SqrModSquare);
+
+      const batch_t sigma_rgb = (r1 + g1 + b1 + r2 + g2 + b2) * float(1.0f / 3);
+
+      const batch_t sigma_rgb_plus_thre = sigma_rgb + thre;
+
+      const batch_t r1_plus_r2 = r1 + r2;
+      const batch_t g1_plus_g2 = g1 + g2;
+      const batch_t b1_plus_b2 = b1 + b2;
+      batch_t S_r, S_g, S_b;
+      {
+        batch_t temp_r = r1_plus_r2 / sigma_rgb_plus_thre;
+        batch_t temp_g = g1_plus_g2 / sigma_rgb_plus_thre;
+        batch_t temp_b = b1_plus_b2 / sigma_rgb_plus_thre;
+
+        S_r = min(temp_r, batch_t{1.0f});
+        S_g = min(temp_g, batch_t{1.0f});
+        S_b = min(temp_b, batch_t{1.0f});
+      }
+
+      const batch_t sumRGBsquare = r1 * r2 + g1 * g2 + b1 * b2;
+
+      batch_t theta;
+      {
+        batch_t temp1 = sumRGBsquare / (SqrModSquare + thre);
+
+        temp1 /= 1.01f;
+        const batch_t temp2 = acos(temp1);
+        // batch_t temp2 = _mm256_acos_ps__manually(temp1);
+        theta = temp2 * float(2.0 / M_PI);
+      }
+
+      const batch_t OnedDeltaR = abs(deltaR) / (r1_plus_r2 * thre);
+      const batch_t OnedDeltaG = abs(deltaG) / (g1_plus_g2 * thre);
+      const batch_t OnedDeltaB = abs(deltaB) / (b1_plus_b2 * thre);
+
+      const batch_t sumOnedDelta = OnedDeltaR + OnedDeltaG + OnedDeltaB + thre;
+
+      batch_t S_tr = OnedDeltaR / sumOnedDelta * (S_r * S_r);
+      batch_t S_tg = OnedDeltaG / sumOnedDelta * (S_g * S_g);
+      batch_t S_tb = OnedDeltaB / sumOnedDelta * (S_b * S_b);
+
+      batch_t S_theta = S_tr + S_tg + S_tb;
+
+      batch_t S_ratio;
+      {
+        batch_t max_r = max(r1, {r2});
+        batch_t max_g = max(g1, {g2});
+        batch_t max_b = max(b1, {b2});
+        S_ratio = max(max_r, max(max_g, max_b));
+      }
+      /*
+       *
+          const float result =
+              (S_r * S_r * w_r * deltaR * deltaR + S_g * S_g * w_g * deltaG *
+       deltaG + S_b * S_b * w_b * deltaB * deltaB) / (w_r + w_g + w_b) +
+       S_theta * S_ratio * theta * theta;
+       * */
+      batch_t diff;
+      {
+        batch_t temp_r = S_r * S_r * deltaR * deltaR * w_r;
+        batch_t temp_g = S_g * S_g * deltaG * deltaG * w_g;
+        batch_t temp_b = S_b * S_b * deltaB * deltaB * w_b;
+        batch_t wr_plus_wr_plus_wb{w_r + w_b + w_g};
+        batch_t temp_X = (temp_r + temp_g + temp_b) / wr_plus_wr_plus_wb;
+
+        batch_t temp_Y = S_theta * S_ratio * theta * theta;
+
+        diff = temp_X + temp_Y;
+      }
+      return diff;
+    }
+
+    float operator()(float r1, float g1, float b1) const noexcept {
+      return color_diff_RGB_plus(r1, g1, b1, r2, g2, b2);
+    }
+  };
+
+  struct kernel_HSV {
+    float h2, s2, v2;
+    float cos_h2, sin_h2;
+
+    explicit kernel_HSV(std::span<const float, 3> hsv2) noexcept
+        : h2{hsv2[0]}, s2{hsv2[1]}, v2{hsv2[2]} {
+      this->cos_h2 = xsimd::cos(batch_t{h2}).get(0);
+      this->sin_h2 = xsimd::sin(batch_t{h2}).get(0);
+    }
+
+    batch_t operator()(batch_t h1, batch_t s1, batch_t v1) const noexcept {
+      auto sv_1 = s1 * v1;
+      auto sv_2 = s2 * v2;
+
+      const auto dX = 50.0f * (cos(h1) * sv_1 - cos_h2 * sv_2);
+      const auto dY = 50.0f * (sin(h1) * sv_1 - sin_h2 * sv_2);
+      const auto dZ = 50.0f * (v1 - v2);
+
+      return dX * dX + dY * dY + dZ * dZ;
+    }
+
+    float operator()(float h1, float s1, float v1) const noexcept {
+      return color_diff_HSV(h2, s2, v2, h1, s1, v1);
+    }
+  };
+
+  struct kernel_Lab94 {
+    float L2, a2, b2;
+    float sqrt_C1_2;
+    float SC_2;
+
+    explicit kernel_Lab94(std::span<const float, 3> lab2) noexcept
+        : L2{lab2[0]}, a2{lab2[1]}, b2{lab2[2]} {
+      //__m256 C1_2;
+      this->sqrt_C1_2 = scalar_sqrt(a2 * a2 + b2 * b2);
+      this->SC_2 = square(sqrt_C1_2 * 0.045f + 1.0f);
+    }
+
+    batch_t operator()(batch_t L1, batch_t a1, batch_t b1) const noexcept {
+      batch_t deltaL_2;
+      {
+        batch_t Ldiff = L1 - L2;
+        deltaL_2 = (Ldiff * Ldiff);
+      }
+
+      batch_t C2_2 = ((a1 * a1) + (b1 * b1));
+
+      batch_t deltaCab_2;
+      {
+        batch_t temp = (sqrt_C1_2 - sqrt(C2_2));
+        deltaCab_2 = (temp * temp);
+      }
+
+      batch_t deltaHab_2;
+      {
+        batch_t a_diff = (a1 - a2);
+        batch_t b_diff = (b1 - b2);
+
+        deltaHab_2 = ((a_diff * a_diff) + (b_diff * b_diff));
+        deltaHab_2 = (deltaHab_2 - deltaCab_2);
+      }
+
+      // constexpr float SL = 1;
+      //  constexpr float kL = 1;
+      // constexpr float K1 = 0.045f;
+      constexpr float K2 = 0.015f;
+
+      batch_t SH_2;
+      {
+        batch_t temp = ((sqrt(C2_2) * K2) + 1.0f);
+        SH_2 = (temp * temp);
+      }
+
+      batch_t diff;
+      {
+        batch_t temp_C = (deltaCab_2 / SC_2);
+        batch_t temp_H = (deltaHab_2 / SH_2);
+        diff = (deltaL_2 + (temp_C + temp_H));
+      }
+      return diff;
+    }
+
+    float operator()(float L1, float a1, float b1) const noexcept {
+      // auto deltaL_2 = (Allowed->lab(0) - L).square();
+
+      const float deltaL_2 = (L1 - L2) * (L1 - L2);
+
+      const float C2_2 = a1 * a1 + b1 * b1;
+      float deltaCab_2;
+      {
+        float temp = sqrt_C1_2 - scalar_sqrt(C2_2);
+        deltaCab_2 = temp * temp;
+      }
+
+      float deltaHab_2;
+      {
+        float diff_a = a1 - a2;
+        float diff_b = b1 - b2;
+        deltaHab_2 = diff_a * diff_a + diff_b * diff_b - deltaCab_2;
+      }
+
+      float SH_2;
+      {
+        float temp = scalar_sqrt(C2_2) * 0.015f + 1.0f;
+        SH_2 = temp * temp;
+      }
+      // delete &SH_2;
+      return deltaL_2 + deltaCab_2 / SC_2 + deltaHab_2 / SH_2;
+    }
+  };
+
+  template <class kernel_t>
+  static void batch_impl(const kernel_t &kernel, std::span<const float> c0p,
+                         std::span<const float> c1p,
+                         std::span<const float> c2p,
+                         std::span<float> dest) noexcept {
+    assert(c0p.size() == c1p.size());
+    assert(c1p.size() == c2p.size());
+    assert(c2p.size() == dest.size());
+
+    const size_t color_count = c0p.size();
+    const size_t vec_size = color_count - color_count % batch_size;
+
+    for (size_t idx = 0; idx < vec_size; idx += batch_size) {
+      const batch_t c0 = batch_t::load_unaligned(c0p.data() + idx);
+      const batch_t c1 = batch_t::load_unaligned(c1p.data() + idx);
+      const batch_t c2 = batch_t::load_unaligned(c2p.data() + idx);
+      const batch_t diff = kernel(c0, c1, c2);
+      diff.store_unaligned(dest.data() + idx);
+    }
+
+    for (size_t idx = vec_size; idx < color_count; idx++) {
+      dest[idx] = kernel(c0p[idx], c1p[idx], c2p[idx]);
+    }
+  }
+
+  static void update_argmin(colordiff_argmin_t &best, float diff,
+                            int index) noexcept {
+    assert(!is_nan(diff));
+    // on ties, the smaller index wins like Eigen's minCoeff.
+    if (diff < best.diff || (diff == best.diff && index < best.index)) {
+      best.diff = diff;
+      best.index = index;
+    }
+  }
+
+  template <class kernel_t>
+  static void argmin_impl(const kernel_t &kernel, std::span<const float> c0p,
+                          std::span<const float> c1p,
+                          std::span<const float> c2p,
+                          std::span<const int> segment_ends,
+                          std::span<colordiff_argmin_t> result) noexcept {
+    assert(c0p.size() == c1p.size());
+    assert(c1p.size() == c2p.size());
+    assert(segment_ends.size() == result.size());
+    assert(!segment_ends.empty());
+    assert(size_t(segment_ends.back()) == c0p.size());
+    // lane indices are tracked in float, which is exact below 2^24.
+    assert(c0p.size() < (size_t(1) << 24));
+
+    for (size_t s = 0; s < result.size(); s++) {
+      result[s] = colordiff_argmin_t{INFINITY, -1};
+    }
+
+    const size_t color_count = c0p.size();
+    const size_t vec_size = color_count - color_count % batch_size;
+
+    alignas(64) float temp_diff[batch_size];
+    alignas(64) float temp_idx[batch_size];
+    for (size_t lane = 0; lane < batch_size; lane++) {
+      temp_idx[lane] = float(lane);
+    }
+    const batch_t lane_offset = batch_t::load_aligned(temp_idx);
+
+    // best diff and index of each lane in current segment
+    batch_t best_diff{INFINITY};
+    batch_t best_idx{-1.0f};
+    size_t seg = 0;
+
+    auto flush_lanes = [&]() {
+      best_diff.store_aligned(temp_diff);
+      best_idx.store_aligned(temp_idx);
+      for (size_t lane = 0; lane < batch_size; lane++) {
+        if (temp_idx[lane] >= 0) {
+          update_argmin(result[seg], temp_diff[lane], int(temp_idx[lane]));
+        }
+      }
+      best_diff = batch_t{INFINITY};
+      best_idx = batch_t{-1.0f};
+    };
+
+    auto update_scalar = [&](size_t idx, float diff) {
+      while (idx >= size_t(segment_ends[seg])) {
+        seg++;
+      }
+      update_argmin(result[seg], diff, int(idx));
+    };
+
+    for (size_t idx = 0; idx < vec_size; idx += batch_size) {
+      const batch_t c0 = batch_t::load_unaligned(c0p.data() + idx);
+      const batch_t c1 = batch_t::load_unaligned(c1p.data() + idx);
+      const batch_t c2 = batch_t::load_unaligned(c2p.data() + idx);
+      const batch_t diff = kernel(c0, c1, c2);
+
+      if (idx + batch_size <= size_t(segment_ends[seg])) {
+        // the whole batch is in current segment, keep the minimum in registers.
+        const auto is_better = diff < best_diff;
+        best_diff = xsimd::select(is_better, diff, best_diff);
+        best_idx = xsimd::select(is_better, lane_offset + float(idx), best_idx);
+        continue;
+      }
+
+      // the batch crosses segments, compare lane by lane.
+      flush_lanes();
+      diff.store_aligned(temp_diff);
+      for (size_t lane = 0; lane < batch_size; lane++) {
+        update_scalar(idx + lane, temp_diff[lane]);
+      }
+    }
+    flush_lanes();
+
+    for (size_t idx = vec_size; idx < color_count; idx++) {
+      update_scalar(idx, kernel(c0p[idx], c1p[idx], c2p[idx]));
+    }
+  }
+
+  static void RGB_batch(std::span<const float> r1p, std::span<const float> g1p,
+                        std::span<const float> b1p,
+                        std::span<const float, 3> rgb2,
+                        std::span<float> dest) noexcept {
+    batch_impl(kernel_RGB{rgb2}, r1p, g1p, b1p, dest);
+  }
+
+  static void RGBplus_batch(std::span<const float> r1p,
+                            std::span<const float> g1p,
+                            std::span<const float> b1p,
+                            std::span<const float, 3> rgb2,
+                            std::span<float> dest) noexcept {
+    batch_impl(kernel_RGBplus{rgb2}, r1p, g1p, b1p, dest);
+  }
+
+  static void HSV_batch(std::span<const float> h1p, std::span<const float> s1p,
+                        std::span<const float> v1p,
+                        std::span<const float, 3> hsv2,
+                        std::span<float> dest) noexcept {
+    batch_impl(kernel_HSV{hsv2}, h1p, s1p, v1p, dest);
+  }
+
+  static void Lab94_batch(std::span<const float> l1p,
+                          std::span<const float> a1p,
+                          std::span<const float> b1p,
+                          std::span<const float, 3> lab2,
+                          std::span<float> dest) noexcept {
+    batch_impl(kernel_Lab94{lab2}, l1p, a1p, b1p, dest);
+  }
+
+  static void RGB_argmin(std::span<const float> r1p,
+                         std::span<const float> g1p,
+                         std::span<const float> b1p,
+                         std::span<const float, 3> rgb2,
+                         std::span<const int> segment_ends,
+                         std::span<colordiff_argmin_t> result) noexcept {
+    argmin_impl(kernel_RGB{rgb2}, r1p, g1p, b1p, segment_ends, result);
+  }
+
+  static void RGBplus_argmin(std::span<const float> r1p,
+                             std::span<const float> g1p,
+                             std::span<const float> b1p,
+                             std::span<const float, 3> rgb2,
+                             std::span<const int> segment_ends,
+                             std::span<colordiff_argmin_t> result) noexcept {
+    argmin_impl(kernel_RGBplus{rgb2}, r1p, g1p, b1p, segment_ends, result);
+  }
+
+  static void HSV_argmin(std::span<const float> h1p,
+                         std::span<const float> s1p,
+                         std::span<const float> v1p,
+                         std::span<const float, 3> hsv2,
+                         std::span<const int> segment_ends,
+                         std::span<colordiff_argmin_t> result) noexcept {
+    argmin_impl(kernel_HSV{hsv2}, h1p, s1p, v1p, segment_ends, result);
+  }
+
+  static void Lab94_argmin(std::span<const float> l1p,
+                           std::span<const float> a1p,
+                           std::span<const float> b1p,
+                           std::span<const float, 3> lab2,
+                           std::span<const int> segment_ends,
+                           std::span<colordiff_argmin_t> result) noexcept {
+    argmin_impl(kernel_Lab94{lab2}, l1p, a1p, b1p, segment_ends, result);
+  }
+
+  static constexpr kernel_table table() noexcept {
+    return kernel_table{Arch::name(),    &RGB_batch,  &RGBplus_batch,
+                        &HSV_batch,      &Lab94_batch, &RGB_argmin,
+                        &RGBplus_argmin, &HSV_argmin, &Lab94_argmin};
+  }
+};
+
+}  // namespace colordiff_simd
+
+#endif  // COLORMANIP_COLORDIFF_KERNELS_HPP
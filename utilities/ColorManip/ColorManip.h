@@ -42,6 +42,18 @@ void Lab2XYZ(float L, float a, float b, float &X, float &Y, float &Z) noexcept;
 
 float Lab00_diff(float, float, float, float, float, float) noexcept;
 
+// Bulk versions of the conversions in convert_unit::to_c3. Colors in src are
+// converted into 3 planes, and all spans must have the same size. Values of RGB
+// are clamped to be positive as to_c3 does.
+void ARGB2RGB_batch(std::span<const ARGB> src, std::span<float> r,
+                    std::span<float> g, std::span<float> b) noexcept;
+void ARGB2HSV_batch(std::span<const ARGB> src, std::span<float> h,
+                    std::span<float> s, std::span<float> v) noexcept;
+void ARGB2XYZ_batch(std::span<const ARGB> src, std::span<float> x,
+                    std::span<float> y, std::span<float> z) noexcept;
+void ARGB2Lab_batch(std::span<const ARGB> src, std::span<float> L,
+                    std::span<float> a, std::span<float> b) noexcept;
+
 // float squeeze01(float) noexcept;
 ARGB RGB2ARGB(float, float, float) noexcept;
 ARGB HSV2ARGB(float, float, float) noexcept;
@@ -94,4 +106,53 @@ void colordiff_Lab94_batch(std::span<const float> l1, std::span<const float> a1,
                            std::span<const float, 3> lab2,
                            std::span<float> dest) noexcept;
 
+// colordiff_* functions are compiled for several instruction sets, and the
+// best one supported by the cpu is selected at runtime. Set environment
+// variable SLOPECRAFT_SIMD_ARCH to an instruction set name, like "sse2" or
+// "avx2", to force it.
+
+/// Name of the instruction set used by colordiff functions.
+const char *colordiff_simd_arch() noexcept;
+/// Force colordiff functions to use an instruction set, or detect again if
+/// name is nullptr. Returns false and keeps the selection if it is not
+/// compiled or not supported by this cpu.
+bool colordiff_set_simd_arch(const char *name) noexcept;
+
+/// The closest color in a range of colors. index is -1 for empty ranges.
+struct colordiff_argmin_t {
+  float diff;
+  int index;
+};
+
+// Fused versions of colordiff_*_batch. They find the closest color of each
+// segment in a single pass, without storing diffs. Segment s covers colors in
+// [segment_ends[s-1], segment_ends[s]), and the last end must be the color
+// count. Results are the same as running minCoeff on each segment of the batch
+// diff.
+void colordiff_RGB_argmin(std::span<const float> r1, std::span<const float> g1,
+                          std::span<const float> b1,
+                          std::span<const float, 3> rgb2,
+                          std::span<const int> segment_ends,
+                          std::span<colordiff_argmin_t> result) noexcept;
+
+void colordiff_RGBplus_argmin(std::span<const float> r1,
+                              std::span<const float> g1,
+                              std::span<const float> b1,
+                              std::span<const float, 3> rgb2,
+                              std::span<const int> segment_ends,
+                              std::span<colordiff_argmin_t> result) noexcept;
+
+void colordiff_HSV_argmin(std::span<const float> h1, std::span<const float> s1,
+                          std::span<const float> v1,
+                          std::span<const float, 3> hsv2,
+                          std::span<const int> segment_ends,
+                          std::span<colordiff_argmin_t> result) noexcept;
+
+void colordiff_Lab94_argmin(std::span<const float> l1,
+                            std::span<const float> a1,
+                            std::span<const float> b1,
+                            std::span<const float, 3> lab2,
+                            std::span<const int> segment_ends,
+                            std::span<colordiff_argmin_t> result) noexcept;
+
 #endif
\ No newline at end of file
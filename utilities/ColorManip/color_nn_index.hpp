@@ -0,0 +1,242 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+#ifndef COLORMANIP_COLOR_NN_INDEX_HPP
+#define COLORMANIP_COLOR_NN_INDEX_HPP
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <span>
+#include <vector>
+
+/**
+ * \brief A k-d tree over 3d colors for exact nearest neighbor search.
+ *
+ * The distance function is supplied at query time. Subtrees are pruned with a
+ * weighted squared euclidean distance to their bounding boxes, so the search
+ * is exact as long as the distance is never smaller than that lower bound.
+ * Ties are resolved to the smallest index, like a linear scan would do.
+ */
+class color_nn_index {
+ public:
+  static constexpr uint32_t leaf_size = 8;
+
+  struct result {
+    uint32_t index;
+    float distance;
+  };
+
+ private:
+  struct node {
+    std::array<float, 3> lo;
+    std::array<float, 3> hi;
+    uint32_t begin;
+    uint32_t end;
+    // index of the children, 0 for leaf nodes since root can not be a child.
+    uint32_t left;
+    uint32_t right;
+
+    inline bool is_leaf() const noexcept { return this->left == 0; }
+  };
+
+  std::vector<node> nodes;
+  // points reordered by the tree, so that each leaf is contiguous.
+  std::array<std::vector<float>, 3> points;
+  std::vector<uint32_t> original_index;
+
+ public:
+  color_nn_index() = default;
+
+  inline bool empty() const noexcept { return this->nodes.empty(); }
+  inline size_t size() const noexcept { return this->original_index.size(); }
+
+  void clear() noexcept {
+    this->nodes.clear();
+    for (auto &p : this->points) {
+      p.clear();
+    }
+    this->original_index.clear();
+  }
+
+  void build(std::span<const float> c0, std::span<const float> c1,
+             std::span<const float> c2) noexcept {
+    assert(c0.size() == c1.size());
+    assert(c1.size() == c2.size());
+    this->clear();
+    const uint32_t count = c0.size();
+    if (count <= 0) {
+      return;
+    }
+
+    const std::array<std::span<const float>, 3> src{c0, c1, c2};
+    this->original_index.resize(count);
+    std::iota(this->original_index.begin(), this->original_index.end(), 0);
+    this->nodes.reserve(2 * (count / leaf_size + 1));
+    this->build_node(src, 0, count);
+
+    for (int c = 0; c < 3; c++) {
+      this->points[c].resize(count);
+      for (uint32_t i = 0; i < count; i++) {
+        this->points[c][i] = src[c][this->original_index[i]];
+      }
+    }
+  }
+
+  /**
+   * \brief Find the point with minimum distance to q.
+   *
+   * \param dist Callable as dist(p0, p1, p2), returning the distance from q
+   * to point (p0, p1, p2).
+   * \param weight dist(p) must be no smaller than
+   * sum_c weight[c] * (p[c] - q[c])^2.
+   */
+  template <typename dist_fun_t>
+  result nearest(std::span<const float, 3> q, const dist_fun_t &dist,
+                 const std::array<float, 3> &weight) const noexcept {
+    assert(!this->empty());
+    result best{UINT32_MAX, INFINITY};
+
+    std::array<uint32_t, 64> stack;
+    int stack_top = 0;
+    stack[stack_top++] = 0;
+
+    while (stack_top > 0) {
+      const node &n = this->nodes[stack[--stack_top]];
+      if (this->lower_bound(n, q, weight) > best.distance) {
+        continue;
+      }
+
+      if (n.is_leaf()) {
+        for (uint32_t i = n.begin; i < n.end; i++) {
+          const float d =
+              dist(this->points[0][i], this->points[1][i], this->points[2][i]);
+          const uint32_t idx = this->original_index[i];
+          if (d < best.distance || (d == best.distance && idx < best.index)) {
+            best.distance = d;
+            best.index = idx;
+          }
+        }
+        continue;
+      }
+
+      // visit the nearer child first.
+      const float bound_l = this->lower_bound(this->nodes[n.left], q, weight);
+      const float bound_r = this->lower_bound(this->nodes[n.right], q, weight);
+      if (bound_l <= bound_r) {
+        stack[stack_top++] = n.right;
+        stack[stack_top++] = n.left;
+      } else {
+        stack[stack_top++] = n.left;
+        stack[stack_top++] = n.right;
+      }
+      assert(stack_top <= int(stack.size()));
+    }
+    return best;
+  }
+
+  /// Nearest point in plain squared euclidean distance.
+  result nearest_euclidean(std::span<const float, 3> q) const noexcept {
+    return this->nearest(
+        q,
+        [q](float p0, float p1, float p2) {
+          const float d0 = p0 - q[0];
+          const float d1 = p1 - q[1];
+          const float d2 = p2 - q[2];
+          return d0 * d0 + d1 * d1 + d2 * d2;
+        },
+        {1.0f, 1.0f, 1.0f});
+  }
+
+ private:
+  uint32_t build_node(const std::array<std::span<const float>, 3> &src,
+                      uint32_t begin, uint32_t end) noexcept {
+    const uint32_t this_idx = this->nodes.size();
+    this->nodes.emplace_back();
+    {
+      node &n = this->nodes.back();
+      n.begin = begin;
+      n.end = end;
+      n.left = 0;
+      n.right = 0;
+      for (int c = 0; c < 3; c++) {
+        n.lo[c] = INFINITY;
+        n.hi[c] = -INFINITY;
+      }
+      for (uint32_t i = begin; i < end; i++) {
+        for (int c = 0; c < 3; c++) {
+          const float val = src[c][this->original_index[i]];
+          n.lo[c] = std::min(n.lo[c], val);
+          n.hi[c] = std::max(n.hi[c], val);
+        }
+      }
+    }
+
+    if (end - begin <= leaf_size) {
+      return this_idx;
+    }
+
+    int split_dim = 0;
+    {
+      const node &n = this->nodes[this_idx];
+      float max_extent = -1;
+      for (int c = 0; c < 3; c++) {
+        if (n.hi[c] - n.lo[c] > max_extent) {
+          max_extent = n.hi[c] - n.lo[c];
+          split_dim = c;
+        }
+      }
+    }
+
+    const uint32_t mid = begin + (end - begin) / 2;
+    std::nth_element(this->original_index.begin() + begin,
+                     this->original_index.begin() + mid,
+                     this->original_index.begin() + end,
+                     [&src, split_dim](uint32_t a, uint32_t b) {
+                       return src[split_dim][a] < src[split_dim][b];
+                     });
+
+    // nodes may be reallocated during recursion, so don't hold references.
+    const uint32_t left = this->build_node(src, begin, mid);
+    const uint32_t right = this->build_node(src, mid, end);
+    this->nodes[this_idx].left = left;
+    this->nodes[this_idx].right = right;
+    return this_idx;
+  }
+
+  static float lower_bound(const node &n, std::span<const float, 3> q,
+                           const std::array<float, 3> &weight) noexcept {
+    float ret = 0;
+    for (int c = 0; c < 3; c++) {
+      const float d = std::max({n.lo[c] - q[c], q[c] - n.hi[c], 0.0f});
+      ret += weight[c] * d * d;
+    }
+    // leave some room for rounding errors, so that pruning never drops the
+    // exact result.
+    return ret * (1.0f - 1e-5f);
+  }
+};
+
+#endif  // COLORMANIP_COLOR_NN_INDEX_HPP
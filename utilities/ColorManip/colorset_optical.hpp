@@ -25,6 +25,7 @@ This file is part of SlopeCraft.
 
 #include "../SC_aligned_alloc.hpp"
 #include "ColorManip.h"
+#include "color_nn_index.hpp"
 #include <Eigen/Dense>
 #include <cmath>
 
@@ -141,14 +142,25 @@ class colorset_optical_basic : public colorset_optical_base {
 class colorset_optical_allowed : public colorset_optical_base {
  public:
   static constexpr uint16_t invalid_color_id = 0xFFFF;
+  /// Below this size, a linear scan is faster than the nearest neighbor index.
+  static constexpr int nn_index_min_color_count = 256;
+
+  enum class nn_space : uint8_t { rgb = 0, hsv_cone = 1, lab = 2, xyz = 3 };
 
  private:
   Eigen::Array<uint16_t, Eigen::Dynamic, 1> __color_id;
 
+  std::array<color_nn_index, 4> __nn_index;
+  float __max_chroma{0};
+
   void resize(int new_color_count) {
     colorset_optical_base::resize(new_color_count);
     __color_id.resize(new_color_count);
     __color_id.fill(invalid_color_id);
+    for (auto &idx : __nn_index) {
+      idx.clear();
+    }
+    __max_chroma = 0;
   }
 
  public:
@@ -196,6 +208,60 @@ class colorset_optical_allowed : public colorset_optical_base {
     assert(idx < __color_id.size());
     return __color_id[idx];
   }
+
+  /// HSV color difference is the euclidean distance in this cone space.
+  static std::array<float, 3> hsv_to_cone(float h, float s, float v) noexcept {
+    return {50.0f * std::cos(h) * s * v, 50.0f * std::sin(h) * s * v,
+            50.0f * v};
+  }
+
+  /// Build nearest neighbor indices in all color spaces. Indices are cleared
+  /// when colors change, and small colorsets are not indexed.
+  void build_nn_index() noexcept {
+    for (auto &idx : __nn_index) {
+      idx.clear();
+    }
+    __max_chroma = 0;
+    if (this->color_count() < nn_index_min_color_count) {
+      return;
+    }
+
+    const size_t count = this->color_count();
+    auto span_of = [count](const Eigen::ArrayXf &arr) {
+      return std::span<const float>{arr.data(), count};
+    };
+
+    __nn_index[uint8_t(nn_space::rgb)].build(
+        span_of(__rgb[0]), span_of(__rgb[1]), span_of(__rgb[2]));
+    __nn_index[uint8_t(nn_space::lab)].build(
+        span_of(__lab[0]), span_of(__lab[1]), span_of(__lab[2]));
+    __nn_index[uint8_t(nn_space::xyz)].build(
+        span_of(__xyz[0]), span_of(__xyz[1]), span_of(__xyz[2]));
+
+    std::array<std::vector<float>, 3> cone;
+    for (auto &c : cone) {
+      c.resize(count);
+    }
+    for (size_t i = 0; i < count; i++) {
+      const auto p = hsv_to_cone(__hsv[0][i], __hsv[1][i], __hsv[2][i]);
+      for (int c = 0; c < 3; c++) {
+        cone[c][i] = p[c];
+      }
+    }
+    __nn_index[uint8_t(nn_space::hsv_cone)].build(cone[0], cone[1], cone[2]);
+
+    __max_chroma = (__lab[1].head(count).square() +
+                    __lab[2].head(count).square())
+                       .sqrt()
+                       .maxCoeff();
+  }
+
+  inline const color_nn_index &nn_index(nn_space space) const noexcept {
+    return __nn_index[uint8_t(space)];
+  }
+
+  /// Max chroma among allowed colors, used to bound CIE94 distances.
+  inline float max_chroma() const noexcept { return __max_chroma; }
 };
 
 class TempVecOptical : public Eigen::Map<Eigen::ArrayXf> {
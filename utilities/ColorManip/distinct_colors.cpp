@@ -0,0 +1,161 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+#include "distinct_colors.h"
+
+#include <omp.h>
+
+#include <algorithm>
+#include <bit>
+
+namespace {
+constexpr size_t rgb_space = size_t{1} << 24;
+constexpr size_t bitset_words = rgb_space / 64;
+/// Images smaller than it are sorted, and every thread of the bitset path
+/// handles at least so many pixels.
+constexpr int64_t pixels_per_bitset = int64_t{1} << 18;
+
+inline bool is_opaque(ARGB argb) noexcept { return (argb >> 24) == 0xFF; }
+
+void extract_by_sorting(std::span<const ARGB> pixels,
+                        libImageCvt::distinct_colors &dest,
+                        bool with_index) noexcept {
+  dest.colors.assign(pixels.begin(), pixels.end());
+  std::sort(dest.colors.begin(), dest.colors.end());
+  dest.colors.erase(std::unique(dest.colors.begin(), dest.colors.end()),
+                    dest.colors.end());
+  if (!with_index) {
+    return;
+  }
+  dest.index.resize(pixels.size());
+#pragma omp parallel for schedule(static)
+  for (int64_t i = 0; i < int64_t(pixels.size()); i++) {
+    dest.index[i] = uint32_t(std::lower_bound(dest.colors.begin(),
+                                              dest.colors.end(), pixels[i]) -
+                             dest.colors.begin());
+  }
+}
+}  // namespace
+
+void libImageCvt::extract_distinct_colors(std::span<const ARGB> pixels,
+                                          distinct_colors &dest,
+                                          bool with_index) noexcept {
+  dest.clear();
+  const int64_t num_pixels = int64_t(pixels.size());
+  if (num_pixels < pixels_per_bitset) {
+    extract_by_sorting(pixels, dest, with_index);
+    return;
+  }
+
+  const int num_threads = int(std::clamp<int64_t>(
+      num_pixels / pixels_per_bitset, 1, omp_get_max_threads()));
+  std::vector<std::vector<uint64_t>> bitsets(num_threads);
+  std::vector<std::vector<ARGB>> translucent(num_threads);
+  // The team can be smaller than requested, for example when called inside
+  // another parallel region. Only bitsets of the real team are filled.
+  int team_size = 1;
+#pragma omp parallel num_threads(num_threads)
+  {
+    const int tid = omp_get_thread_num();
+#pragma omp single
+    team_size = omp_get_num_threads();
+    auto &bits = bitsets[tid];
+    auto &others = translucent[tid];
+    bits.assign(bitset_words, 0);
+#pragma omp for schedule(static)
+    for (int64_t i = 0; i < num_pixels; i++) {
+      const ARGB argb = pixels[i];
+      if (is_opaque(argb)) [[likely]] {
+        const uint32_t rgb = argb & 0x00'FF'FF'FF;
+        bits[rgb / 64] |= uint64_t{1} << (rgb % 64);
+      } else {
+        others.emplace_back(argb);
+      }
+    }
+    std::sort(others.begin(), others.end());
+    others.erase(std::unique(others.begin(), others.end()), others.end());
+  }
+
+  // merge all bitsets into the first one
+  std::vector<uint64_t> &merged = bitsets[0];
+#pragma omp parallel for schedule(static)
+  for (int64_t w = 0; w < int64_t(bitset_words); w++) {
+    uint64_t word = merged[w];
+    for (int t = 1; t < team_size; t++) {
+      word |= bitsets[t][w];
+    }
+    merged[w] = word;
+  }
+  for (int t = 1; t < team_size; t++) {
+    bitsets[t] = {};
+  }
+
+  // translucent colors have alpha < 0xFF, so they are sorted before opaque ones
+  for (const auto &others : translucent) {
+    dest.colors.insert(dest.colors.end(), others.begin(), others.end());
+  }
+  translucent.clear();
+  std::sort(dest.colors.begin(), dest.colors.end());
+  dest.colors.erase(std::unique(dest.colors.begin(), dest.colors.end()),
+                    dest.colors.end());
+  const size_t num_translucent = dest.colors.size();
+
+  // rank[w] is the count of opaque colors before word w
+  std::vector<uint32_t> rank(bitset_words);
+  uint32_t num_opaque = 0;
+  for (size_t w = 0; w < bitset_words; w++) {
+    rank[w] = num_opaque;
+    num_opaque += uint32_t(std::popcount(merged[w]));
+  }
+
+  dest.colors.resize(num_translucent + num_opaque);
+#pragma omp parallel for schedule(static)
+  for (int64_t w = 0; w < int64_t(bitset_words); w++) {
+    uint64_t word = merged[w];
+    size_t pos = num_translucent + rank[w];
+    while (word != 0) {
+      const int bit = std::countr_zero(word);
+      dest.colors[pos++] = 0xFF'00'00'00 | uint32_t(w * 64 + bit);
+      word &= word - 1;
+    }
+  }
+
+  if (!with_index) {
+    return;
+  }
+  const auto translucent_end = dest.colors.begin() + num_translucent;
+  dest.index.resize(pixels.size());
+#pragma omp parallel for schedule(static)
+  for (int64_t i = 0; i < num_pixels; i++) {
+    const ARGB argb = pixels[i];
+    if (is_opaque(argb)) [[likely]] {
+      const uint32_t rgb = argb & 0x00'FF'FF'FF;
+      const uint64_t below = (uint64_t{1} << (rgb % 64)) - 1;
+      dest.index[i] = uint32_t(num_translucent) + rank[rgb / 64] +
+                      uint32_t(std::popcount(merged[rgb / 64] & below));
+    } else {
+      dest.index[i] = uint32_t(
+          std::lower_bound(dest.colors.begin(), translucent_end, argb) -
+          dest.colors.begin());
+    }
+  }
+}
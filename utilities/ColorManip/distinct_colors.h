@@ -0,0 +1,57 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+#ifndef COLORMANIP_DISTINCT_COLORS_H
+#define COLORMANIP_DISTINCT_COLORS_H
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "ColorManip.h"
+
+namespace libImageCvt {
+
+/// Distinct colors of an image, and the index of every pixel among them.
+struct distinct_colors {
+  /// Sorted in ascending order.
+  std::vector<ARGB> colors;
+  /// colors[index[i]] is the color of pixel i. Empty if not requested.
+  std::vector<uint32_t> index;
+
+  inline void clear() noexcept {
+    this->colors.clear();
+    this->index.clear();
+  }
+};
+
+/// Find the distinct colors of pixels in parallel. Opaque colors are marked in
+/// a bitset of the 2^24 RGB space per thread, and bitsets are merged with OR.
+/// The few translucent colors are sorted instead. Small images are sorted
+/// directly, since clearing the bitsets would take longer.
+void extract_distinct_colors(std::span<const ARGB> pixels,
+                             distinct_colors &dest,
+                             bool with_index = true) noexcept;
+
+}  // namespace libImageCvt
+
+#endif  // COLORMANIP_DISTINCT_COLORS_H
@@ -28,8 +28,14 @@ This file is part of SlopeCraft.
 
 #include <Eigen/Dense>
 #include <GPU_interface.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <shared_mutex>
+#include <span>
 #include <thread>
 #include <type_traits>
 #include <unordered_map>
@@ -37,6 +43,7 @@ This file is part of SlopeCraft.
 
 #include "../SC_GlobalEnums.h"
 #include "ColorManip.h"
+#include "distinct_colors.h"
 #include "newColorSet.hpp"
 #include "newTokiColor.hpp"
 
@@ -81,6 +88,149 @@ struct GPU_wrapper_wrapper<false> {
   }
 };
 
+/**
+ * \brief Matched colors shared by several converters.
+ *
+ * All converters using a cache must have the same basic and allowed colorset.
+ * It's thread-safe, so that images can be converted concurrently. Keys are
+ * distributed into shards, each shard has its own lock.
+ */
+template <class TokiColor_t>
+class shared_color_cache {
+ public:
+  using hash_t = std::unordered_map<convert_unit, TokiColor_t, ::hash_cvt_unit>;
+
+ private:
+  static constexpr size_t num_shards = 64;
+  struct cached_color {
+    TokiColor_t color;
+    /// Times the color is stored or found, so that a persistent cache can keep
+    /// the most used colors. Counted under shared locks with atomic_ref.
+    mutable uint32_t uses{0};
+  };
+  struct shard {
+    mutable std::shared_mutex lock;
+    std::unordered_map<convert_unit, cached_color, ::hash_cvt_unit> colors;
+  };
+  std::array<shard, num_shards> shards;
+
+  std::atomic<uint64_t> num_lookups{0};
+  std::atomic<uint64_t> num_hits{0};
+
+  static size_t shard_index(const convert_unit &cu) noexcept {
+    const uint64_t h = ::hash_cvt_unit{}(cu);
+    return (h * 0x9E3779B97F4A7C15ULL) >> 58;
+  }
+  static_assert(num_shards == 64);
+
+ public:
+  /// Copy cached results to colors that are not computed yet in hash.
+  void fetch(hash_t &hash) noexcept {
+    uint64_t lookups = 0, hits = 0;
+    for (auto &[key, val] : hash) {
+      if (val.is_result_computed()) {
+        continue;
+      }
+      lookups++;
+      shard &s = this->shards[shard_index(key)];
+      std::shared_lock lk{s.lock};
+      auto it = s.colors.find(key);
+      if (it != s.colors.end()) {
+        val = it->second.color;
+        // other readers may count the same color
+        std::atomic_ref<uint32_t>{it->second.uses}.fetch_add(
+            1, std::memory_order_relaxed);
+        hits++;
+      }
+    }
+    this->num_lookups += lookups;
+    this->num_hits += hits;
+  }
+
+  /// Add all computed results in hash to the cache.
+  void store(const hash_t &hash) noexcept {
+    for (const auto &[key, val] : hash) {
+      if (!val.is_result_computed()) {
+        continue;
+      }
+      shard &s = this->shards[shard_index(key)];
+      std::unique_lock lk{s.lock};
+      s.colors.emplace(key, cached_color{val, 1});
+    }
+  }
+
+  /// Add a single computed result, existing results are kept.
+  void insert(const convert_unit &key, const TokiColor_t &val,
+              uint32_t uses) noexcept {
+    assert(val.is_result_computed());
+    shard &s = this->shards[shard_index(key)];
+    std::unique_lock lk{s.lock};
+    s.colors.emplace(key, cached_color{val, uses});
+  }
+
+  /// Visit every cached color as fun(const convert_unit &, const TokiColor_t
+  /// &, uint32_t uses). Don't modify the cache in fun.
+  template <class fun_t>
+  void for_each(fun_t &&fun) const {
+    for (const auto &s : this->shards) {
+      std::shared_lock lk{s.lock};
+      for (const auto &[key, val] : s.colors) {
+        const uint32_t uses =
+            std::atomic_ref<uint32_t>{val.uses}.load(std::memory_order_relaxed);
+        fun(key, val.color, uses);
+      }
+    }
+  }
+
+  /// Remove the least used colors until at most capacity colors are left.
+  /// Colors stored at the same time are kept. Returns the number of removed
+  /// colors.
+  size_t shrink_to(size_t capacity) {
+    std::vector<uint32_t> uses;
+    this->for_each([&uses](const convert_unit &, const TokiColor_t &,
+                           uint32_t u) { uses.emplace_back(u); });
+    if (uses.size() <= capacity) {
+      return 0;
+    }
+    // colors used less than threshold are removed, and some of the ties
+    const size_t num_to_remove = uses.size() - capacity;
+    std::nth_element(uses.begin(), uses.begin() + num_to_remove, uses.end());
+    const uint32_t threshold = uses[num_to_remove];
+    size_t ties_to_remove =
+        num_to_remove - size_t(std::count_if(
+                            uses.begin(), uses.begin() + num_to_remove,
+                            [threshold](uint32_t u) { return u < threshold; }));
+
+    size_t removed = 0;
+    for (auto &s : this->shards) {
+      std::unique_lock lk{s.lock};
+      for (auto it = s.colors.begin(); it != s.colors.end();) {
+        const uint32_t u = it->second.uses;
+        if (u < threshold || (u == threshold && ties_to_remove > 0)) {
+          ties_to_remove -= (u == threshold);
+          it = s.colors.erase(it);
+          removed++;
+        } else {
+          ++it;
+        }
+      }
+    }
+    return removed;
+  }
+
+  [[nodiscard]] size_t size() const noexcept {
+    size_t ret = 0;
+    for (const auto &s : this->shards) {
+      std::shared_lock lk{s.lock};
+      ret += s.colors.size();
+    }
+    return ret;
+  }
+
+  [[nodiscard]] uint64_t lookups() const noexcept { return this->num_lookups; }
+  [[nodiscard]] uint64_t hits() const noexcept { return this->num_hits; }
+};
+
 template <bool is_not_optical>
 class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
  public:
@@ -111,6 +261,13 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
   Eigen::ArrayXX<ARGB> _dithered_image;
   // Eigen::ArrayXX<colorid_t> colorid_matrix;
 
+  /// Distinct colors of _raw_image with the index of every pixel, extracted
+  /// once per image. Clear it whenever _raw_image is changed.
+  distinct_colors _raw_colors;
+
+  // not owned, may be shared with other converters.
+  shared_color_cache<TokiColor_t> *color_cache{nullptr};
+
  public:
   uiPack ui;
   // SCL_convertAlgo convert_algo{SCL_convertAlgo::RGB_Better};
@@ -118,6 +275,7 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
   inline void clear_images() noexcept {
     this->_raw_image.resize(0, 0);
     this->_dithered_image.resize(0, 0);
+    this->_raw_colors.clear();
   }
 
   /// When the colorset is changed, the hash must be cleared.
@@ -128,6 +286,13 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
 
   inline ::SCL_convertAlgo convert_algo() const noexcept { return this->algo; }
 
+  /// Matched colors will be fetched from and stored to cache. Pass nullptr to
+  /// detach.
+  inline void set_color_cache(
+      shared_color_cache<TokiColor_t> *cache) noexcept {
+    this->color_cache = cache;
+  }
+
   inline bool is_dither() const noexcept { return this->dither; }
 
   inline int64_t rows() const noexcept { return _raw_image.rows(); }
@@ -138,27 +303,59 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
 
   inline const auto &color_hash() const noexcept { return _color_hash; }
 
+  /// The image that colors are matched from. Without dithering it's usually
+  /// the raw image itself, and _dithered_image is left empty to avoid a copy.
+  inline const Eigen::ArrayXX<ARGB> &dithered_image() const noexcept {
+    return (this->_dithered_image.size() > 0) ? this->_dithered_image
+                                              : this->_raw_image;
+  }
+
+  /// Copy an image from the caller. stride is the count of pixels between the
+  /// starts of 2 columns (2 rows if row-major), 0 means tightly packed.
   void set_raw_image(const ARGB *const data, const int64_t _rows,
-                     const int64_t _cols,
-                     const bool is_col_major = true) noexcept {
+                     const int64_t _cols, const bool is_col_major = true,
+                     const int64_t stride = 0) noexcept {
     if (_rows <= 0 || _cols <= 0) {
       return;
     }
     if (data == nullptr) {
       return;
     }
+    this->_raw_colors.clear();
 
     if (is_col_major) {
-      Eigen::Map<const Eigen::Array<ARGB, Dynamic, Dynamic, Eigen::ColMajor>>
-          map(data, _rows, _cols);
+      Eigen::Map<const Eigen::Array<ARGB, Dynamic, Dynamic, Eigen::ColMajor>,
+                 Eigen::Unaligned, Eigen::OuterStride<>>
+          map(data, _rows, _cols,
+              Eigen::OuterStride<>{stride > 0 ? stride : _rows});
       this->_raw_image = map;
     } else {
-      Eigen::Map<const Eigen::Array<ARGB, Dynamic, Dynamic, Eigen::RowMajor>>
-          map(data, _rows, _cols);
+      Eigen::Map<const Eigen::Array<ARGB, Dynamic, Dynamic, Eigen::RowMajor>,
+                 Eigen::Unaligned, Eigen::OuterStride<>>
+          map(data, _rows, _cols,
+              Eigen::OuterStride<>{stride > 0 ? stride : _cols});
       this->_raw_image = map;
     }
   }
 
+  /// Copy the raw image to dest, stride works like set_raw_image.
+  void raw_image(ARGB *const dest, const bool is_dest_col_major,
+                 const int64_t stride = 0) const noexcept {
+    if (is_dest_col_major) {
+      Eigen::Map<Eigen::Array<ARGB, Dynamic, Dynamic, Eigen::ColMajor>,
+                 Eigen::Unaligned, Eigen::OuterStride<>>
+          map(dest, this->rows(), this->cols(),
+              Eigen::OuterStride<>{stride > 0 ? stride : this->rows()});
+      map = this->_raw_image;
+    } else {
+      Eigen::Map<Eigen::Array<ARGB, Dynamic, Dynamic, Eigen::RowMajor>,
+                 Eigen::Unaligned, Eigen::OuterStride<>>
+          map(dest, this->rows(), this->cols(),
+              Eigen::OuterStride<>{stride > 0 ? stride : this->cols()});
+      map = this->_raw_image;
+    }
+  }
+
   bool convert_image(::SCL_convertAlgo __algo, bool _dither,
                      bool try_gpu = false) noexcept {
     if (__algo == ::SCL_convertAlgo::gaCvter) {
@@ -170,31 +367,45 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
 
     this->algo = __algo;
     this->add_colors_to_hash();
+    if (this->color_cache != nullptr) {
+      this->color_cache->fetch(this->_color_hash);
+    }
     ui.rangeSet(0, 100, 25);
     if (!this->match_all_TokiColors(try_gpu)) {
+      // colors matched before failing or being cancelled are still valid
+      if (this->color_cache != nullptr) {
+        this->color_cache->store(this->_color_hash);
+      }
       return false;
     }
     ui.rangeSet(0, 100, 50);
 
+    bool dither_ok = true;
     if (this->dither) {
       switch (this->algo) {
         case ::SCL_convertAlgo::RGB:
-          this->template __impl_dither<::SCL_convertAlgo::RGB>();
+          dither_ok =
+              this->template __impl_dither<::SCL_convertAlgo::RGB>();
           break;
         case ::SCL_convertAlgo::RGB_Better:
-          this->template __impl_dither<::SCL_convertAlgo::RGB_Better>();
+          dither_ok =
+              this->template __impl_dither<::SCL_convertAlgo::RGB_Better>();
           break;
         case ::SCL_convertAlgo::HSV:
-          this->template __impl_dither<::SCL_convertAlgo::HSV>();
+          dither_ok =
+              this->template __impl_dither<::SCL_convertAlgo::HSV>();
           break;
         case ::SCL_convertAlgo::Lab94:
-          this->template __impl_dither<::SCL_convertAlgo::Lab94>();
+          dither_ok =
+              this->template __impl_dither<::SCL_convertAlgo::Lab94>();
           break;
         case ::SCL_convertAlgo::Lab00:
-          this->template __impl_dither<::SCL_convertAlgo::Lab00>();
+          dither_ok =
+              this->template __impl_dither<::SCL_convertAlgo::Lab00>();
           break;
         case ::SCL_convertAlgo::XYZ:
-          this->template __impl_dither<::SCL_convertAlgo::XYZ>();
+          dither_ok =
+              this->template __impl_dither<::SCL_convertAlgo::XYZ>();
           break;
 
         default:
@@ -202,7 +413,15 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
           return false;
       }
     } else {
-      this->_dithered_image = this->_raw_image;
+      // dithered_image() refers to the raw image then
+      this->_dithered_image.resize(0, 0);
+    }
+
+    if (this->color_cache != nullptr) {
+      this->color_cache->store(this->_color_hash);
+    }
+    if (!dither_ok) {
+      return false;
     }
 
     //    for (int64_t idx = 0; idx < this->_dithered_image.size(); idx++) {
@@ -225,8 +444,18 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
     Eigen::ArrayXX<colorid_t> result;
     result.setZero(this->rows(), this->cols());
 
+    if (this->has_pixel_index()) {
+      const auto ids = this->color_id_of_distinct_colors();
+      const auto &index = this->_raw_colors.index;
+      for (int64_t idx = 0; idx < this->size(); idx++) {
+        result(idx) = ids[index[idx]];
+      }
+      return result;
+    }
+
+    const auto &dithered = this->dithered_image();
     for (int64_t idx = 0; idx < this->size(); idx++) {
-      const auto current_color = this->_dithered_image(idx);
+      const auto current_color = dithered(idx);
 
       auto it = this->_color_hash.find(convert_unit(current_color, this->algo));
 
@@ -251,9 +480,19 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
     // memset(result.data(), 0, result.rows() * result.cols() *
     // sizeof(uint16_t));
 
+    if (this->has_pixel_index()) {
+      const auto ids = this->color_id_of_distinct_colors();
+      const auto &index = this->_raw_colors.index;
+      for (int64_t idx = 0; idx < this->size(); idx++) {
+        result(idx) = ids[index[idx]];
+      }
+      return;
+    }
+
+    const auto &dithered = this->dithered_image();
     for (int64_t idx = 0; idx < this->size(); idx++) {
-      auto it = this->_color_hash.find(
-          convert_unit(this->_dithered_image(idx), this->algo));
+      auto it =
+          this->_color_hash.find(convert_unit(dithered(idx), this->algo));
 
       if (it == this->_color_hash.end()) {
         abort();
@@ -267,7 +506,7 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
     assert(r >= 0 && r < this->rows());
     assert(c >= 0 && c < this->cols());
 
-    const auto current_color = this->_dithered_image(r, c);
+    const auto current_color = this->dithered_image()(r, c);
     auto it = this->_color_hash.find(convert_unit{current_color, this->algo});
     if (it == this->_color_hash.end()) {
       if (getA(current_color) > 0) {
@@ -284,10 +523,12 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
     converted_image(dest.data());
   }
 
+  /// Write the converted image to data_dest, stride works like
+  /// set_raw_image.
   inline void converted_image(
       ARGB *const data_dest, int64_t *const rows_dest = nullptr,
-      int64_t *const cols_dest = nullptr,
-      const bool is_dest_col_major = true) const noexcept {
+      int64_t *const cols_dest = nullptr, const bool is_dest_col_major = true,
+      const int64_t stride = 0) const noexcept {
     if (rows_dest != nullptr) {
       *rows_dest = this->rows();
     }
@@ -295,51 +536,116 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
       *cols_dest = this->cols();
     }
 
-    if (data_dest != nullptr) {
-      for (int64_t r = 0; r < rows(); r++) {
-        for (int64_t c = 0; c < cols(); c++) {
-          const int64_t idx =
-              (is_dest_col_major) ? (c * rows() + r) : (r * cols() + c);
-          const ARGB argb = this->_dithered_image(r, c);
-          auto it = this->_color_hash.find(convert_unit(argb, this->algo));
-          if (it == this->_color_hash.end()) {
-            abort();
-            return;
-          }
+    if (data_dest == nullptr) {
+      return;
+    }
+    const int64_t outer_stride =
+        (stride > 0) ? stride : (is_dest_col_major ? rows() : cols());
+    auto dest_index = [is_dest_col_major, outer_stride](int64_t r, int64_t c) {
+      return (is_dest_col_major) ? (c * outer_stride + r)
+                                 : (r * outer_stride + c);
+    };
+
+    if (this->has_pixel_index()) {
+      // every distinct color is looked up only once
+      const auto &distinct = this->_raw_colors.colors;
+      std::vector<ARGB> cvted(distinct.size());
+      for (size_t i = 0; i < distinct.size(); i++) {
+        cvted[i] = this->converted_color_of(distinct[i]);
+      }
+      const auto &index = this->_raw_colors.index;
+      for (int64_t c = 0; c < cols(); c++) {
+        for (int64_t r = 0; r < rows(); r++) {
+          data_dest[dest_index(r, c)] = cvted[index[c * rows() + r]];
+        }
+      }
+      return;
+    }
 
-          const auto color_id = it->second.color_id();
-          const auto color_index =
-              basic_colorset.colorindex_of_colorid(color_id);
-          if (color_index != allowed_colorset_t::invalid_color_id) {
-            data_dest[idx] = RGB2ARGB(basic_colorset.RGB(color_index, 0),
-                                      basic_colorset.RGB(color_index, 1),
-                                      basic_colorset.RGB(color_index, 2));
-          } else {
-            data_dest[idx] = 0x00'00'00'00;
-          }
+    const auto &dithered = this->dithered_image();
+    // neighbouring pixels often share a color, so the last lookup is reused.
+    ARGB last_argb = 0;
+    ARGB last_result = 0;
+    bool has_last = false;
+    for (int64_t r = 0; r < rows(); r++) {
+      for (int64_t c = 0; c < cols(); c++) {
+        const ARGB argb = dithered(r, c);
+        if (!has_last || argb != last_argb) {
+          last_argb = argb;
+          last_result = this->converted_color_of(argb);
+          has_last = true;
         }
+        data_dest[dest_index(r, c)] = last_result;
       }
     }
   }
 
+  /// Distinct colors of the raw image, empty before converting.
+  inline const auto &raw_colors() const noexcept { return this->_raw_colors; }
+
+ protected:
+  /// Whether pixels of dithered_image() can be found by _raw_colors.index
+  [[nodiscard]] inline bool has_pixel_index() const noexcept {
+    return this->_dithered_image.size() == 0 &&
+           int64_t(this->_raw_colors.index.size()) == this->size();
+  }
+
+  /// Color id of each color in _raw_colors, 0 for transparent colors that are
+  /// not matched.
+  std::vector<colorid_t> color_id_of_distinct_colors() const noexcept {
+    const auto &distinct = this->_raw_colors.colors;
+    std::vector<colorid_t> ids(distinct.size(), 0);
+    for (size_t i = 0; i < distinct.size(); i++) {
+      auto it = this->_color_hash.find(convert_unit(distinct[i], this->algo));
+      if (it == this->_color_hash.end()) {
+        if (getA(distinct[i]) > 0) {
+          abort();
+        }
+        continue;
+      }
+      ids[i] = it->second.color_id();
+    }
+    return ids;
+  }
+
+  /// The color that argb is converted to, argb must be matched already.
+  ARGB converted_color_of(ARGB argb) const noexcept {
+    auto it = this->_color_hash.find(convert_unit(argb, this->algo));
+    if (it == this->_color_hash.end()) {
+      abort();
+    }
+
+    const auto color_id = it->second.color_id();
+    const auto color_index = basic_colorset.colorindex_of_colorid(color_id);
+    if (color_index != allowed_colorset_t::invalid_color_id) {
+      return RGB2ARGB(basic_colorset.RGB(color_index, 0),
+                      basic_colorset.RGB(color_index, 1),
+                      basic_colorset.RGB(color_index, 2));
+    }
+    return 0x00'00'00'00;
+  }
+
  private:
   void add_colors_to_hash() noexcept {
     // this->_color_hash.clear();
 
-    for (int64_t idx = 0; idx < this->_raw_image.size(); idx++) {
-      const ARGB argb = this->_raw_image(idx);
-      convert_unit cu(argb, this->algo);
-      auto it = _color_hash.find(cu);
-
-      // this key isn't inserted
-      if (it == _color_hash.end()) this->_color_hash.emplace(cu, TokiColor_t());
+    // repeated colors are skipped by the prepass, instead of hashing each
+    // pixel. It's reused by later conversions of the same image.
+    if (int64_t(this->_raw_colors.index.size()) != this->size()) {
+      extract_distinct_colors(
+          {this->_raw_image.data(), size_t(this->_raw_image.size())},
+          this->_raw_colors);
+    }
+    this->_color_hash.reserve(this->_color_hash.size() +
+                              this->_raw_colors.colors.size());
+    for (const ARGB argb : this->_raw_colors.colors) {
+      this->_color_hash.try_emplace(convert_unit(argb, this->algo));
     }
   }
 
   bool match_all_TokiColors(bool try_gpu) noexcept {
     if constexpr (is_not_optical) {
-      this->match_all_TokiColors_cpu();
-      return true;
+      return this->match_all_TokiColors_cpu();
     } else {
       if constexpr (gpu_wrapper::have_api) {
         // If converter have gpu resources, compute by gpu
@@ -350,12 +656,12 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
         }
       }
       // otherwise compute by cpu
-      this->match_all_TokiColors_cpu();
-      return true;
+      return this->match_all_TokiColors_cpu();
     }
   }
 
-  void match_all_TokiColors_cpu() noexcept {
+  /// Returns false if cancelled by ui.
+  bool match_all_TokiColors_cpu() noexcept {
     // const int threadCount = omp_get_num_threads();
 
     std::vector<std::pair<const convert_unit, TokiColor_t> *> tasks;
@@ -367,10 +673,40 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
     }
     const size_t taskCount = tasks.size();
 
+    // convert all tasks into the colorspace in bulk, instead of one by one.
+    std::array<std::vector<float>, 3> task_c3;
+    {
+      std::vector<ARGB> task_argb(taskCount);
+      for (size_t tid = 0; tid < taskCount; tid++) {
+        task_argb[tid] = tasks[tid]->first._ARGB;
+      }
+      for (auto &plane : task_c3) {
+        plane.resize(taskCount);
+      }
+      convert_unit::to_c3_batch(this->algo, task_argb, task_c3[0], task_c3[1],
+                                task_c3[2]);
+    }
+
+    // polling is not free, so it's checked once in a while
+    constexpr int cancel_check_interval = 1024;
+    std::atomic<bool> cancelled{false};
 #pragma omp parallel for schedule(dynamic)
     for (int taskIdx = 0; taskIdx < (int)taskCount; taskIdx++) {
-      tasks[taskIdx]->second.compute(tasks[taskIdx]->first,
-                                     this->allowed_colorset);
+      if (taskIdx % cancel_check_interval == 0 && this->ui.isCancelled()) {
+        cancelled.store(true, std::memory_order_relaxed);
+      }
+      if (cancelled.load(std::memory_order_relaxed)) {
+        continue;
+      }
+      const convert_unit cu = tasks[taskIdx]->first;
+      if (cu.algo != this->algo) [[unlikely]] {
+        // left by a conversion with another algorithm.
+        tasks[taskIdx]->second.compute(cu, this->allowed_colorset);
+        continue;
+      }
+      const Eigen::Array3f c3{task_c3[0][taskIdx], task_c3[1][taskIdx],
+                              task_c3[2][taskIdx]};
+      tasks[taskIdx]->second.compute(cu, c3, this->allowed_colorset);
     }
     // #warning we should parallelize here
     /*
@@ -382,6 +718,7 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
       }
     }
   */
+    return !cancelled;
   }
 
   /// fill a colorid matrix according to raw image and colorhash
@@ -443,15 +780,25 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
     const uint64_t cpu_task_count = taskCount - gpu_task_count;
 
     if (gpu_task_count > 0) {
-      std::vector<std::array<float, 3>> task_colors(gpu_task_count);
+      std::vector<ARGB> task_argb(gpu_task_count);
       for (size_t tid = 0; tid < gpu_task_count; tid++) {
         if (tasks[tid]->first.algo != algo) {
           return false;
         }
+        task_argb[tid] = tasks[tid]->first._ARGB;
+      }
+
+      std::array<std::vector<float>, 3> task_c3;
+      for (auto &plane : task_c3) {
+        plane.resize(gpu_task_count);
+      }
+      convert_unit::to_c3_batch(algo, task_argb, task_c3[0], task_c3[1],
+                                task_c3[2]);
 
-        const Eigen::Array3f c3_eig = tasks[tid]->first.to_c3();
+      std::vector<std::array<float, 3>> task_colors(gpu_task_count);
+      for (size_t tid = 0; tid < gpu_task_count; tid++) {
         for (size_t channel = 0; channel < 3; channel++) {
-          task_colors[tid][channel] = c3_eig[channel];
+          task_colors[tid][channel] = task_c3[channel][tid];
         }
       }
 
@@ -554,8 +901,9 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
     return 0;
   }
 
+  /// Returns false if cancelled by ui.
   template <SCL_convertAlgo cvt_algo>
-  void __impl_dither() noexcept {
+  bool __impl_dither() noexcept {
     std::array<Eigen::ArrayXXf, 3> dither_c3;
     for (auto &i : dither_c3) {
       i.setZero(this->rows() + 2, this->cols() + 2);
@@ -564,24 +912,42 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
     // dest.setZero(this->rows(), this->cols());
     this->_dithered_image.setZero(this->rows(), this->cols());
 
-    for (int64_t r = 0; r < this->rows(); r++) {
+    if (int64_t(this->_raw_colors.index.size()) == this->size()) {
+      // only distinct colors are converted, and pixels are gathered by index
+      const auto &distinct = this->_raw_colors.colors;
+      std::array<std::vector<float>, 3> distinct_c3;
+      for (auto &plane : distinct_c3) {
+        plane.resize(distinct.size());
+      }
+      convert_unit::to_c3_batch(cvt_algo, distinct, distinct_c3[0],
+                                distinct_c3[1], distinct_c3[2]);
+      const auto &index = this->_raw_colors.index;
       for (int64_t c = 0; c < this->cols(); c++) {
-        auto it = this->_color_hash.find(
-            convert_unit(this->_raw_image(r, c), this->algo));
-        if (it == this->_color_hash.end()) {
-          // unreachable
-          abort();
-          return;
-        }
-        for (int ch = 0; ch < 3; ch++) {
-          dither_c3[ch](r + 1, c + 1) = it->first.to_c3()[ch];
+        for (int64_t r = 0; r < this->rows(); r++) {
+          const uint32_t k = index[c * this->rows() + r];
+          for (size_t ch = 0; ch < 3; ch++) {
+            dither_c3[ch](r + 1, c + 1) = distinct_c3[ch][k];
+          }
         }
       }
+    } else {
+      // Both matrices are column major, so each column of the raw image is
+      // converted in bulk into the inner part of a column of dither_c3.
+      for (int64_t c = 0; c < this->cols(); c++) {
+        const size_t rows = this->rows();
+        convert_unit::to_c3_batch(
+            cvt_algo, {&this->_raw_image(0, c), rows},
+            {&dither_c3[0](1, c + 1), rows}, {&dither_c3[1](1, c + 1), rows},
+            {&dither_c3[2](1, c + 1), rows});
+      }
     }
 
     // int64_t inserted_count = 0;
     bool is_dir_LR = true;
     for (int64_t row = 0; row < this->rows(); row++) {
+      if (this->ui.isCancelled()) {
+        return false;
+      }
       if (is_dir_LR)
         for (int64_t col = 0; col < this->cols(); col++) {
           if (::getA(this->_raw_image(row, col)) <= 0) {
@@ -593,14 +959,15 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
               dither_c3[2](row + 1, col + 1));
           // ditheredImage(r, c) = Current;
           this->_dithered_image(row, col) = current_argb;
-          auto it_to_old_color =
-              this->_color_hash.find(convert_unit(current_argb, this->algo));
+          const convert_unit cu(current_argb, this->algo);
+          const Eigen::Array3f current_c3 = cu.to_c3();
+          auto it_to_old_color = this->_color_hash.find(cu);
           // if this color isn't matched, match it.
           if (it_to_old_color == this->_color_hash.end()) {
-            convert_unit cu(current_argb, this->algo);
             auto ret = this->_color_hash.emplace(cu, TokiColor_t());
             it_to_old_color = ret.first;
-            it_to_old_color->second.compute(cu, this->allowed_colorset);
+            it_to_old_color->second.compute(cu, current_c3,
+                                            this->allowed_colorset);
             // inserted_count++;
           }
 
@@ -617,7 +984,7 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
 
           for (int ch = 0; ch < 3; ch++) {
             const float color_error =
-                it_to_old_color->first.to_c3()[ch] -
+                current_c3[ch] -
                 basic_colorset.color_value(cvt_algo, coloridx, ch);
             dither_c3[ch].block<2, 3>(row + 1, col + 1 - 1) +=
                 color_error * dithermap_LR;
@@ -633,13 +1000,15 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
               dither_c3[0](row + 1, col + 1), dither_c3[1](row + 1, col + 1),
               dither_c3[2](row + 1, col + 1));
           this->_dithered_image(row, col) = current_argb;
-          convert_unit cu(current_argb, this->algo);
+          const convert_unit cu(current_argb, this->algo);
+          const Eigen::Array3f current_c3 = cu.to_c3();
           auto it_to_old_color = this->_color_hash.find(cu);
           // if this color isn't matched, match it.
           if (it_to_old_color == this->_color_hash.end()) {
             auto ret = this->_color_hash.emplace(cu, TokiColor_t());
             it_to_old_color = ret.first;
-            it_to_old_color->second.compute(cu, this->allowed_colorset);
+            it_to_old_color->second.compute(cu, current_c3,
+                                            this->allowed_colorset);
             // inserted_count++;
           }
 
@@ -656,7 +1025,7 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
 
           for (int ch = 0; ch < 3; ch++) {
             const float color_error =
-                it_to_old_color->first.to_c3()[ch] -
+                current_c3[ch] -
                 basic_colorset.color_value(cvt_algo, coloridx, ch);
             dither_c3[ch].block<2, 3>(row + 1, col + 1 - 1) +=
                 color_error * dithermap_RL;
@@ -667,7 +1036,7 @@ class ImageCvter : public GPU_wrapper_wrapper<is_not_optical> {
 
       // report
     }
-    return;
+    return true;
   }
 
  public:
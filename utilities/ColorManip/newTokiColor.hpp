@@ -82,6 +82,29 @@ struct convert_unit {
     return c3;
   }
 
+  /// Bulk version of to_c3. Converts colors in src into 3 planes of floats.
+  static void to_c3_batch(::SCL_convertAlgo algo, std::span<const ARGB> src,
+                          std::span<float> c0, std::span<float> c1,
+                          std::span<float> c2) noexcept {
+    switch (algo) {
+      case ::SCL_convertAlgo::RGB:
+      case ::SCL_convertAlgo::RGB_Better:
+      case ::SCL_convertAlgo::gaCvter:
+        ARGB2RGB_batch(src, c0, c1, c2);
+        break;
+      case ::SCL_convertAlgo::HSV:
+        ARGB2HSV_batch(src, c0, c1, c2);
+        break;
+      case ::SCL_convertAlgo::Lab94:
+      case ::SCL_convertAlgo::Lab00:
+        ARGB2Lab_batch(src, c0, c1, c2);
+        break;
+      default:
+        ARGB2XYZ_batch(src, c0, c1, c2);
+        break;
+    }
+  }
+
   template <class archive>
   void save(archive &ar) const {
     ar(this->_ARGB, this->algo);
@@ -138,6 +161,13 @@ class newTokiColor
   }
 
   auto compute(convert_unit cu, const allowed_t &allowed) noexcept {
+    return this->compute(cu, cu.to_c3(), allowed);
+  }
+
+  /// Match a color whose c3 is already converted, either by cu.to_c3() or by
+  /// convert_unit::to_c3_batch. No diff is stored, so it doesn't allocate.
+  auto compute(convert_unit cu, const Eigen::Array3f &c3,
+               const allowed_t &allowed) noexcept {
     if (getA(cu._ARGB) == 0) {
       if constexpr (is_not_optical) {
         this->Result = 0;
@@ -157,7 +187,11 @@ class newTokiColor
       }
     }
 
-    const Eigen::Array3f c3 = cu.to_c3();
+    if constexpr (!is_not_optical) {
+      if (this->apply_nn_index(cu.algo, c3, allowed)) {
+        return this->result_color_id;
+      }
+    }
 
     switch (cu.algo) {
       case ::SCL_convertAlgo::RGB:
@@ -188,59 +222,67 @@ class newTokiColor
   }
 
  private:
-  auto find_result(const TempVectorXf_t &diff,
-                   const allowed_t &allowed_colorset) noexcept {
-    if (diff.isNaN().any()) {
-      for (int idx = 0; idx < diff.size(); idx++) {
-        assert(!std::isnan(diff[idx]));
-        assert(diff[idx] >= 0);
-      }
-    }
-    int tempidx = 0;
-    this->ResultDiff = diff.minCoeff(&tempidx);
-
+  using argmin_fun_t = void (*)(std::span<const float>, std::span<const float>,
+                                std::span<const float>,
+                                std::span<const float, 3>, std::span<const int>,
+                                std::span<colordiff_argmin_t>) noexcept;
+
+  // Match with a fused kernel, which finds the closest color of each depth in
+  // a single pass, so that diffs are neither stored nor scanned again.
+  auto apply_argmin(argmin_fun_t fun, const Eigen::Array3f &c3,
+                    std::array<std::span<const float>, 3> colors,
+                    const allowed_t &allowed_colorset) noexcept {
+    std::span<const float, 3> c3span{c3.data(), 3};
     if constexpr (is_not_optical) {
-      this->Result = allowed_colorset.Map(tempidx);
-      if (allowed_colorset.need_find_side) this->doSide(diff, allowed_colorset);
+      // allowed colors are sorted by depth.
+      std::array<int, 4> depth_ends;
+      for (int d = 0, end = 0; d < 4; d++) {
+        end += allowed_colorset.depth_count()[d];
+        depth_ends[d] = end;
+      }
+      assert(depth_ends[3] == allowed_colorset.color_count());
 
-      return this->Result;
+      std::array<colordiff_argmin_t, 4> depth_min;
+      fun(colors[0], colors[1], colors[2], c3span, depth_ends, depth_min);
+      return this->apply_depth_min(depth_min, allowed_colorset);
     } else {
-      this->result_color_id = allowed_colorset.color_id(tempidx);
-      // std::cout << tempidx << '\t' << this->result_color_id << '\n';
+      const std::array<int, 1> ends{allowed_colorset.color_count()};
+      colordiff_argmin_t min;
+      fun(colors[0], colors[1], colors[2], c3span, ends, {&min, 1});
+      assert(min.index >= 0);
+      this->ResultDiff = min.diff;
+      this->result_color_id = allowed_colorset.color_id(min.index);
       return this->color_id();
     }
   }
 
-  auto find_result(std::span<const float> &diff,
-                   const allowed_t &allowed_colorset) noexcept {
-    int minidx = 0;
-    float min = diff[0];
-
-    for (int i = 1; i < int(diff.size()); i++) {
-      assert(!std::isnan(diff[i]));
-      assert(diff[i] >= 0);
-      if (diff[i] < min) {
-        minidx = i;
-        min = diff[i];
+  // Take the closest color among the closest ones of each depth.
+  template <typename = void>
+  auto apply_depth_min(const std::array<colordiff_argmin_t, 4> &depth_min,
+                       const allowed_t &allowed_colorset) noexcept {
+    static_assert(is_not_optical);
+    int best_depth = -1;
+    for (int d = 0; d < 4; d++) {
+      if (depth_min[d].index < 0) continue;
+      // the former depth wins on ties, since its colors come first.
+      if (best_depth < 0 || depth_min[d].diff < depth_min[best_depth].diff) {
+        best_depth = d;
       }
     }
-    if constexpr (is_not_optical) {
-      this->Result = allowed_colorset.Map(minidx);
-      if (allowed_colorset.need_find_side) this->doSide(diff);
-
-      return this->Result;
-    } else {
-      this->result_color_id = allowed_colorset.color_id(minidx);
-      return this->color_id();
+    assert(best_depth >= 0);
+    this->ResultDiff = depth_min[best_depth].diff;
+    this->Result = allowed_colorset.Map(depth_min[best_depth].index);
+    if (allowed_colorset.need_find_side) {
+      this->doSide(depth_min, allowed_colorset);
     }
+    return this->Result;
   }
 
+  // Same as doSide, but takes the closest color of each depth.
   template <typename = void>
-  void doSide(const TempVectorXf_t &Diff, const allowed_t &allowed_colorset) {
+  void doSide(const std::array<colordiff_argmin_t, 4> &depth_min,
+              const allowed_t &allowed_colorset) noexcept {
     static_assert(is_not_optical);
-
-    int tempIndex = 0;
-    // Diff.array()+=10.0;ResultDiff+=10.0;
     this->sideSelectivity[0] = 1e35f;
     this->sideResult[0] = 0;
     this->sideSelectivity[1] = 1e35f;
@@ -248,98 +290,114 @@ class newTokiColor
 
     if (!allowed_colorset.need_find_side) return;
 
+    std::array<int, 2> side_depths;
     switch (this->Result % 4) {
       case 3:
         return;
-      case 0:  // 1,2
-        if (allowed_colorset.depth_count()[1]) {
-          this->sideSelectivity[0] =
-              Diff.segment(allowed_colorset.depth_count()[0],
-                           allowed_colorset.depth_count()[1])
-                  .minCoeff(&tempIndex);
-          this->sideResult[0] = allowed_colorset.Map(
-              allowed_colorset.depth_count()[0] + tempIndex);
-        }
-        if (allowed_colorset.depth_count()[2]) {
-          this->sideSelectivity[1] =
-              Diff.segment(allowed_colorset.depth_count()[0] +
-                               allowed_colorset.depth_count()[1],
-                           allowed_colorset.depth_count()[2])
-                  .minCoeff(&tempIndex);
-          this->sideResult[1] = allowed_colorset.Map(
-              allowed_colorset.depth_count()[0] +
-              allowed_colorset.depth_count()[1] + tempIndex);
-        }
+      case 0:
+        side_depths = {1, 2};
         break;
-      case 1:  // 0,2
-        if (allowed_colorset.depth_count()[0]) {
-          this->sideSelectivity[0] =
-              Diff.segment(0, allowed_colorset.depth_count()[0])
-                  .minCoeff(&tempIndex);
-          this->sideResult[0] = allowed_colorset.Map(0 + tempIndex);
-        }
-        if (allowed_colorset.depth_count()[2]) {
-          this->sideSelectivity[1] =
-              Diff.segment(allowed_colorset.depth_count()[0] +
-                               allowed_colorset.depth_count()[1],
-                           allowed_colorset.depth_count()[2])
-                  .minCoeff(&tempIndex);
-          this->sideResult[1] = allowed_colorset.Map(
-              allowed_colorset.depth_count()[0] +
-              allowed_colorset.depth_count()[1] + tempIndex);
-        }
+      case 1:
+        side_depths = {0, 2};
         break;
-      case 2:  // 0,1
-        if (allowed_colorset.depth_count()[0]) {
-          this->sideSelectivity[0] =
-              Diff.segment(0, allowed_colorset.depth_count()[0])
-                  .minCoeff(&tempIndex);
-          this->sideResult[0] = allowed_colorset.Map(0 + tempIndex);
-        }
-        if (allowed_colorset.depth_count()[1]) {
-          this->sideSelectivity[1] =
-              Diff.segment(allowed_colorset.depth_count()[0],
-                           allowed_colorset.depth_count()[1])
-                  .minCoeff(&tempIndex);
-          this->sideResult[1] = allowed_colorset.Map(
-              allowed_colorset.depth_count()[0] + tempIndex);
-        }
+      default:
+        side_depths = {0, 1};
         break;
     }
-    // sideSelectivity[0]-=1.0;sideSelectivity[1]-=1.0;
-    // sideSelectivity[0]*=100.0;sideSelectivity[1]*=100.0;
 
-    return;
+    for (int i = 0; i < 2; i++) {
+      const colordiff_argmin_t &side = depth_min[side_depths[i]];
+      if (side.index >= 0) {
+        this->sideSelectivity[i] = side.diff;
+        this->sideResult[i] = allowed_colorset.Map(side.index);
+      }
+    }
+  }
+
+  // Exact nearest neighbor search for large VisualCraft colorsets. Returns
+  // false if there is no index for this colorset or algorithm, then the caller
+  // should scan all colors. RGB_Better and Lab00 are not indexed, since they
+  // have no lower bound in terms of a euclidean distance.
+  template <typename = void>
+  bool apply_nn_index(::SCL_convertAlgo algo, const Eigen::Array3f &c3,
+                      const allowed_t &allowed_colorset) noexcept {
+    static_assert(!is_not_optical,
+                  "apply_nn_index is only avaliable for VisualCraftL.");
+    using space = colorset_optical_allowed::nn_space;
+    const std::span<const float, 3> q{c3.data(), 3};
+
+    color_nn_index::result r;
+    switch (algo) {
+      case ::SCL_convertAlgo::RGB: {
+        const auto &index = allowed_colorset.nn_index(space::rgb);
+        if (index.empty()) return false;
+        r = index.nearest_euclidean(q);
+        break;
+      }
+      case ::SCL_convertAlgo::XYZ: {
+        const auto &index = allowed_colorset.nn_index(space::xyz);
+        if (index.empty()) return false;
+        r = index.nearest_euclidean(q);
+        break;
+      }
+      case ::SCL_convertAlgo::HSV: {
+        const auto &index = allowed_colorset.nn_index(space::hsv_cone);
+        if (index.empty()) return false;
+        const auto cone = allowed_t::hsv_to_cone(c3[0], c3[1], c3[2]);
+        r = index.nearest_euclidean(cone);
+        break;
+      }
+      case ::SCL_convertAlgo::Lab94: {
+        const auto &index = allowed_colorset.nn_index(space::lab);
+        if (index.empty()) return false;
+        const float L2 = c3[0], a2 = c3[1], b2 = c3[2];
+        const float C1 = std::sqrt(a2 * a2 + b2 * b2);
+        const float SC_2 = (C1 * 0.045f + 1.0f) * (C1 * 0.045f + 1.0f);
+        // SC and SH are both >= 1, so the distance is no less than
+        // dL^2 + (da^2 + db^2) / max(SC, SH)^2.
+        const float SH_max = allowed_colorset.max_chroma() * 0.015f + 1.0f;
+        const float inv_S_2 = 1.0f / std::max(SC_2, SH_max * SH_max);
+
+        r = index.nearest(
+            q,
+            [L2, a2, b2, C1, SC_2](float L1, float a1, float b1) {
+              const float deltaL_2 = (L1 - L2) * (L1 - L2);
+              const float C2 = std::sqrt(a1 * a1 + b1 * b1);
+              const float deltaCab_2 = (C1 - C2) * (C1 - C2);
+              const float deltaHab_2 =
+                  (a1 - a2) * (a1 - a2) + (b1 - b2) * (b1 - b2) - deltaCab_2;
+              const float SH = C2 * 0.015f + 1.0f;
+              return deltaL_2 + deltaCab_2 / SC_2 + deltaHab_2 / (SH * SH);
+            },
+            {1.0f, inv_S_2, inv_S_2});
+        break;
+      }
+      default:
+        return false;
+    }
+
+    this->ResultDiff = r.distance;
+    this->result_color_id = allowed_colorset.color_id(r.index);
+    return true;
   }
 
   auto applyRGB(const Eigen::Array3f &c3,
                 const allowed_t &allowed_colorset) noexcept {
-    TempVectorXf_t Diff(allowed_colorset.color_count(), 1);
-    std::span<float> diff_span{Diff.data(), (size_t)Diff.size()};
-    std::span<const float, 3> c3span{c3.data(), 3};
-    colordiff_RGB_batch(allowed_colorset.rgb_data_span(0),
-                        allowed_colorset.rgb_data_span(1),
-                        allowed_colorset.rgb_data_span(2), c3span, diff_span);
-
-    // Data.CurrentColor-=allowedColors;
-    const auto ret = find_result(Diff, allowed_colorset);
-    return ret;
+    return apply_argmin(colordiff_RGB_argmin, c3,
+                        {allowed_colorset.rgb_data_span(0),
+                         allowed_colorset.rgb_data_span(1),
+                         allowed_colorset.rgb_data_span(2)},
+                        allowed_colorset);
   }
 
   auto applyRGB_plus(const Eigen::Array3f &c3,
                      const allowed_t &allowed_colorset) noexcept {
     // const ColorList &allowedColors = allowed_colorset._RGB;
-
-    TempVectorXf_t Diff(allowed_colorset.color_count(), 1);
-    std::span<float> diff_span{Diff.data(), (size_t)Diff.size()};
-    std::span<const float, 3> c3span{c3.data(), 3};
-    colordiff_RGBplus_batch(
-        allowed_colorset.rgb_data_span(0), allowed_colorset.rgb_data_span(1),
-        allowed_colorset.rgb_data_span(2), c3span, diff_span);
-
-    // Data.CurrentColor-=allowedColors;
-    const auto ret = find_result(Diff, allowed_colorset);
-    return ret;
+    return apply_argmin(colordiff_RGBplus_argmin, c3,
+                        {allowed_colorset.rgb_data_span(0),
+                         allowed_colorset.rgb_data_span(1),
+                         allowed_colorset.rgb_data_span(2)},
+                        allowed_colorset);
 
 #if false
     constexpr float w_r = 1.0f, w_g = 2.0f, w_b = 1.0f;
@@ -407,41 +465,29 @@ class newTokiColor
   auto applyHSV(const Eigen::Array3f &c3,
                 const allowed_t &allowed_colorset) noexcept {
     // const ColorList &allowedColors = allowed_colorset.HSV;
-
-    TempVectorXf_t Diff(allowed_colorset.color_count(), 1);
-    std::span<float> diff_span{Diff.data(), (size_t)Diff.size()};
-    std::span<const float, 3> c3span{c3.data(), 3};
-
-    colordiff_HSV_batch(allowed_colorset.hsv_data_span(0),
-                        allowed_colorset.hsv_data_span(1),
-                        allowed_colorset.hsv_data_span(2), c3span, diff_span);
-
-    return find_result(Diff, allowed_colorset);
+    return apply_argmin(colordiff_HSV_argmin, c3,
+                        {allowed_colorset.hsv_data_span(0),
+                         allowed_colorset.hsv_data_span(1),
+                         allowed_colorset.hsv_data_span(2)},
+                        allowed_colorset);
   }
 
   auto applyXYZ(const Eigen::Array3f &c3,
                 const allowed_t &allowed_colorset) noexcept {
-    TempVectorXf_t Diff(allowed_colorset.color_count(), 1);
-    std::span<float> diff_span{Diff.data(), (size_t)Diff.size()};
-    std::span<const float, 3> c3span{c3.data(), 3};
-    colordiff_RGB_batch(allowed_colorset.xyz_data_span(0),
-                        allowed_colorset.xyz_data_span(1),
-                        allowed_colorset.xyz_data_span(2), c3span, diff_span);
-
-    // Data.CurrentColor-=allowedColors;
-    const auto ret = find_result(Diff, allowed_colorset);
-    return ret;
+    return apply_argmin(colordiff_RGB_argmin, c3,
+                        {allowed_colorset.xyz_data_span(0),
+                         allowed_colorset.xyz_data_span(1),
+                         allowed_colorset.xyz_data_span(2)},
+                        allowed_colorset);
   }
 
   auto applyLab94(const Eigen::Array3f &c3,
                   const allowed_t &allowed_colorset) noexcept {
-    TempVectorXf_t Diff(allowed_colorset.color_count(), 1);
-    std::span<float> diff_span{Diff.data(), (size_t)Diff.size()};
-    std::span<const float, 3> c3span{c3.data(), 3};
-    colordiff_Lab94_batch(allowed_colorset.lab_data_span(0),
-                          allowed_colorset.lab_data_span(1),
-                          allowed_colorset.lab_data_span(2), c3span, diff_span);
-    return find_result(Diff, allowed_colorset);
+    return apply_argmin(colordiff_Lab94_argmin, c3,
+                        {allowed_colorset.lab_data_span(0),
+                         allowed_colorset.lab_data_span(1),
+                         allowed_colorset.lab_data_span(2)},
+                        allowed_colorset);
   }
 
   auto applyLab00(const Eigen::Array3f &c3,
@@ -451,15 +497,39 @@ class newTokiColor
     const float a1s = c3[1];
     const float b1s = c3[2];
     // const ColorList &allow = allowed_colorset.Lab;
-    TempVectorXf_t Diff(allowed_colorset.color_count(), 1);
 
-    for (int i = 0; i < allowed_colorset.color_count(); i++) {
-      Diff(i) =
-          Lab00_diff(L1s, a1s, b1s, allowed_colorset.Lab(i, 0),
-                     allowed_colorset.Lab(i, 1), allowed_colorset.Lab(i, 2));
-    }
+    // Lab00 is computed one by one, so find the closest color of each depth
+    // on the fly instead of storing all diffs and scanning them again.
+    auto argmin = [&](int beg, int end) {
+      colordiff_argmin_t ret{INFINITY, -1};
+      for (int i = beg; i < end; i++) {
+        const float diff =
+            Lab00_diff(L1s, a1s, b1s, allowed_colorset.Lab(i, 0),
+                       allowed_colorset.Lab(i, 1), allowed_colorset.Lab(i, 2));
+        assert(!std::isnan(diff));
+        if (ret.index < 0 || diff < ret.diff) {
+          ret = {diff, i};
+        }
+      }
+      return ret;
+    };
 
-    return find_result(Diff, allowed_colorset);
+    if constexpr (is_not_optical) {
+      // allowed colors are sorted by depth.
+      std::array<colordiff_argmin_t, 4> depth_min;
+      for (int d = 0, beg = 0; d < 4; d++) {
+        const int end = beg + allowed_colorset.depth_count()[d];
+        depth_min[d] = argmin(beg, end);
+        beg = end;
+      }
+      return this->apply_depth_min(depth_min, allowed_colorset);
+    } else {
+      const colordiff_argmin_t min = argmin(0, allowed_colorset.color_count());
+      assert(min.index >= 0);
+      this->ResultDiff = min.diff;
+      this->result_color_id = allowed_colorset.color_id(min.index);
+      return this->color_id();
+    }
   }
 
  public:
@@ -22,6 +22,14 @@ int list_gpu() noexcept;
 
 int run_task(task_t &) noexcept;
 
+// match colors one by one on CPU, like what newTokiColor does.
+double match_by_cpu(const task_t &, std::vector<uint16_t> &result_idx,
+                    std::vector<float> &result_diff) noexcept;
+
+// compare colordiff_*_argmin with colordiff_*_batch and minCoeff on random
+// segments of the colorset, some of which are empty.
+int check_fused_argmin(const task_t &, std::mt19937 &mt) noexcept;
+
 int main(int argc, char **argv) {
   CLI::App app;
 
@@ -147,6 +155,13 @@ int run_task(task_t &task) noexcept {
     eig_colorset = map_colorset.transpose();
   }
 
+  {
+    const int err = check_fused_argmin(task, mt);
+    if (err != 0) {
+      return err;
+    }
+  }
+
   if (gpu_wrapper::platform_num() <= 0) {
     cout << "No avaliable opencl platforms." << endl;
     return 0;
@@ -186,9 +201,172 @@ int run_task(task_t &task) noexcept {
     }
   }
 
+  std::vector<uint16_t> cpu_result_idx;
+  std::vector<float> cpu_result_diff;
+  const double cpu_wtime = match_by_cpu(task, cpu_result_idx, cpu_result_diff);
+  cout << "Matching colors one by one on CPU finished in " << cpu_wtime * 1e3
+       << " ms, " << gi->api_v() << " is " << cpu_wtime / wtime
+       << " times faster." << endl;
+
+  // Lab94 and RGB_Better are computed with slightly different formulas by gpu
+  // kernels, so only euclidean distances are compared.
+  if (task.algo == SCL_convertAlgo::RGB || task.algo == SCL_convertAlgo::XYZ ||
+      task.algo == SCL_convertAlgo::HSV) {
+    size_t mismatch = 0;
+    for (size_t tid = 0; tid < task.task_c3.size(); tid++) {
+      const float expected = cpu_result_diff[tid];
+      if (gi->result_idx_v()[tid] != cpu_result_idx[tid] &&
+          std::abs(gi->result_diff_v()[tid] - expected) >
+              1e-4f * std::max(expected, 1.0f)) {
+        mismatch++;
+      }
+    }
+    if (mismatch > 0) {
+      cout << "Error : " << mismatch << " tasks have different results on "
+           << gi->api_v() << " and CPU." << endl;
+      ret = 6;
+    }
+  }
+
   gpu_wrapper::gpu_interface::destroy(gi);
 
   cout << "Success" << endl;
 
   return ret;
-}
\ No newline at end of file
+}
+
+double match_by_cpu(const task_t &task, std::vector<uint16_t> &result_idx,
+                    std::vector<float> &result_diff) noexcept {
+  const int64_t color_count = task.colorset_c3.size();
+  // batch functions require aligned arrays for each channel.
+  std::array<Eigen::ArrayXf, 3> colorset;
+  for (int c = 0; c < 3; c++) {
+    colorset[c].resize(color_count);
+    for (int64_t i = 0; i < color_count; i++) {
+      colorset[c][i] = task.colorset_c3[i][c];
+    }
+  }
+  std::array<std::span<const float>, 3> spans;
+  for (int c = 0; c < 3; c++) {
+    spans[c] = {colorset[c].data(), size_t(color_count)};
+  }
+
+  result_idx.resize(task.task_c3.size());
+  result_diff.resize(task.task_c3.size());
+
+  double wtime = omp_get_wtime();
+#pragma omp parallel for schedule(static)
+  for (int64_t tid = 0; tid < int64_t(task.task_c3.size()); tid++) {
+    Eigen::ArrayXf diff(color_count);
+    std::span<float> diff_span{diff.data(), size_t(color_count)};
+    std::span<const float, 3> c3{task.task_c3[tid].data(), 3};
+    switch (task.algo) {
+      case SCL_convertAlgo::RGB:
+      case SCL_convertAlgo::XYZ:
+        colordiff_RGB_batch(spans[0], spans[1], spans[2], c3, diff_span);
+        break;
+      case SCL_convertAlgo::RGB_Better:
+        colordiff_RGBplus_batch(spans[0], spans[1], spans[2], c3, diff_span);
+        break;
+      case SCL_convertAlgo::HSV:
+        colordiff_HSV_batch(spans[0], spans[1], spans[2], c3, diff_span);
+        break;
+      case SCL_convertAlgo::Lab94:
+        colordiff_Lab94_batch(spans[0], spans[1], spans[2], c3, diff_span);
+        break;
+      case SCL_convertAlgo::Lab00:
+        for (int64_t i = 0; i < color_count; i++) {
+          diff[i] = Lab00_diff(c3[0], c3[1], c3[2], colorset[0][i],
+                               colorset[1][i], colorset[2][i]);
+        }
+        break;
+      default:
+        abort();
+    }
+    int idx = 0;
+    result_diff[tid] = diff.minCoeff(&idx);
+    result_idx[tid] = idx;
+  }
+  return omp_get_wtime() - wtime;
+}
+
+int check_fused_argmin(const task_t &task, std::mt19937 &mt) noexcept {
+  decltype(&colordiff_RGB_batch) batch_fun = nullptr;
+  decltype(&colordiff_RGB_argmin) argmin_fun = nullptr;
+  switch (task.algo) {
+    case SCL_convertAlgo::RGB:
+    case SCL_convertAlgo::XYZ:
+      batch_fun = colordiff_RGB_batch;
+      argmin_fun = colordiff_RGB_argmin;
+      break;
+    case SCL_convertAlgo::RGB_Better:
+      batch_fun = colordiff_RGBplus_batch;
+      argmin_fun = colordiff_RGBplus_argmin;
+      break;
+    case SCL_convertAlgo::HSV:
+      batch_fun = colordiff_HSV_batch;
+      argmin_fun = colordiff_HSV_argmin;
+      break;
+    case SCL_convertAlgo::Lab94:
+      batch_fun = colordiff_Lab94_batch;
+      argmin_fun = colordiff_Lab94_argmin;
+      break;
+    default:
+      // Lab00 has no fused version
+      return 0;
+  }
+
+  const int color_count = int(task.colorset_c3.size());
+  std::array<std::vector<float>, 3> colorset;
+  for (int c = 0; c < 3; c++) {
+    colorset[c].resize(color_count);
+    for (int i = 0; i < color_count; i++) {
+      colorset[c][i] = task.colorset_c3[i][c];
+    }
+  }
+
+  // segments of random lengths, every 4th one is empty
+  std::vector<int> segment_ends;
+  {
+    std::uniform_int_distribution<int> rand_len(1, 67);
+    int end = 0;
+    while (end < color_count) {
+      if (segment_ends.size() % 4 != 3) {
+        end = std::min(end + rand_len(mt), color_count);
+      }
+      segment_ends.emplace_back(end);
+    }
+    segment_ends.emplace_back(color_count);
+  }
+
+  std::vector<float> diff(color_count);
+  std::vector<colordiff_argmin_t> fused(segment_ends.size());
+  const size_t num_tasks = std::min<size_t>(task.task_c3.size(), 64);
+  for (size_t tid = 0; tid < num_tasks; tid++) {
+    std::span<const float, 3> c3{task.task_c3[tid].data(), 3};
+    batch_fun(colorset[0], colorset[1], colorset[2], c3, diff);
+    argmin_fun(colorset[0], colorset[1], colorset[2], c3, segment_ends,
+               fused);
+
+    int seg_beg = 0;
+    for (size_t s = 0; s < segment_ends.size(); s++) {
+      const int seg_end = segment_ends[s];
+      colordiff_argmin_t expected{INFINITY, -1};
+      if (seg_end > seg_beg) {
+        Eigen::Map<const Eigen::ArrayXf> seg{diff.data() + seg_beg,
+                                             seg_end - seg_beg};
+        expected.diff = seg.minCoeff(&expected.index);
+        expected.index += seg_beg;
+      }
+      if (fused[s].index != expected.index ||
+          (expected.index >= 0 && fused[s].diff != expected.diff)) {
+        cout << "Error : fused argmin of task " << tid << " in segment " << s
+             << " is " << fused[s].index << ", but " << expected.index
+             << " is expected." << endl;
+        return 7;
+      }
+      seg_beg = seg_end;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,148 @@
+#include <ColorManip.h>
+#include <xsimd/xsimd.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using std::cout, std::endl;
+
+using batch_fun_t = decltype(&colordiff_RGB_batch);
+using argmin_fun_t = decltype(&colordiff_RGB_argmin);
+
+struct algo_case {
+  const char *name;
+  batch_fun_t batch;
+  argmin_fun_t argmin;
+  // value range of each channel
+  std::array<std::array<float, 2>, 3> range;
+};
+
+const std::array<algo_case, 4> algos{{
+    {"RGB", colordiff_RGB_batch, colordiff_RGB_argmin,
+     {{{0, 1}, {0, 1}, {0, 1}}}},
+    {"RGBplus", colordiff_RGBplus_batch, colordiff_RGBplus_argmin,
+     {{{0, 1}, {0, 1}, {0, 1}}}},
+    {"HSV", colordiff_HSV_batch, colordiff_HSV_argmin,
+     {{{0, 6.2831853f}, {0, 1}, {0, 1}}}},
+    {"Lab94", colordiff_Lab94_batch, colordiff_Lab94_argmin,
+     {{{0, 100}, {-100, 100}, {-100, 100}}}},
+}};
+
+struct colors {
+  std::array<std::vector<float>, 3> channels;
+  std::array<float, 3> target;
+  // segments with different remainders of any batch size, and empty ones
+  std::vector<int> segment_ends;
+};
+
+colors random_colors(const algo_case &algo, std::mt19937 &mt) {
+  colors ret;
+  std::uniform_int_distribution<int> rand_len(0, 37);
+  int end = 0;
+  for (int s = 0; s < 16; s++) {
+    end += (s % 5 == 2) ? 0 : rand_len(mt);
+    ret.segment_ends.emplace_back(end);
+  }
+  for (size_t ch = 0; ch < 3; ch++) {
+    std::uniform_real_distribution<float> rand(algo.range[ch][0],
+                                               algo.range[ch][1]);
+    ret.channels[ch].resize(end);
+    for (float &val : ret.channels[ch]) {
+      val = rand(mt);
+    }
+    ret.target[ch] = rand(mt);
+  }
+  return ret;
+}
+
+struct results {
+  std::vector<float> diff;
+  std::vector<colordiff_argmin_t> argmin;
+};
+
+results compute(const algo_case &algo, const colors &c) {
+  results ret;
+  ret.diff.resize(c.channels[0].size());
+  algo.batch(c.channels[0], c.channels[1], c.channels[2], c.target, ret.diff);
+  ret.argmin.resize(c.segment_ends.size());
+  algo.argmin(c.channels[0], c.channels[1], c.channels[2], c.target,
+              c.segment_ends, ret.argmin);
+  return ret;
+}
+
+// Instruction sets may round differently, for example with fma.
+bool is_close(float a, float b) {
+  return std::abs(a - b) <= 1e-4f * std::max({std::abs(a), std::abs(b), 1.0f});
+}
+
+bool check(const char *arch, const algo_case &algo, const colors &c,
+           const results &expected) {
+  const results res = compute(algo, c);
+  for (size_t i = 0; i < res.diff.size(); i++) {
+    if (!is_close(res.diff[i], expected.diff[i])) {
+      cout << "Error : " << algo.name << " diff of color " << i << " with "
+           << arch << " is " << res.diff[i] << ", but baseline gives "
+           << expected.diff[i] << endl;
+      return false;
+    }
+  }
+  for (size_t s = 0; s < res.argmin.size(); s++) {
+    const colordiff_argmin_t &r = res.argmin[s];
+    const colordiff_argmin_t &e = expected.argmin[s];
+    // ties may be broken differently
+    const bool same_index =
+        r.index == e.index ||
+        (r.index >= 0 && e.index >= 0 &&
+         is_close(expected.diff[r.index], expected.diff[e.index]));
+    if (!same_index || (e.index >= 0 && !is_close(r.diff, e.diff))) {
+      cout << "Error : " << algo.name << " argmin of segment " << s
+           << " with " << arch << " is " << r.index << ", but baseline gives "
+           << e.index << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+int main() {
+  const std::string baseline = xsimd::default_arch::name();
+  std::vector<std::string> archs;
+  // archs that are not compiled or not supported are skipped
+  for (const char *arch : {xsimd::avx512f::name(), xsimd::avx2::name(),
+                           xsimd::sse4_2::name()}) {
+    if (baseline != arch && colordiff_set_simd_arch(arch)) {
+      archs.emplace_back(arch);
+    }
+  }
+  if (!colordiff_set_simd_arch(baseline.c_str())) {
+    cout << "Error : baseline " << baseline << " can not be selected." << endl;
+    return 1;
+  }
+  cout << "Comparing " << archs.size() << " instruction sets with baseline "
+       << baseline << endl;
+
+  std::mt19937 mt(20231019);
+  bool ok = true;
+  for (const algo_case &algo : algos) {
+    for (int rep = 0; rep < 8; rep++) {
+      const colors c = random_colors(algo, mt);
+      colordiff_set_simd_arch(baseline.c_str());
+      const results expected = compute(algo, c);
+      for (const std::string &arch : archs) {
+        colordiff_set_simd_arch(arch.c_str());
+        ok = check(arch.c_str(), algo, c, expected) && ok;
+      }
+    }
+  }
+  colordiff_set_simd_arch(nullptr);
+
+  if (!ok) {
+    return 1;
+  }
+  cout << "Success" << endl;
+  return 0;
+}
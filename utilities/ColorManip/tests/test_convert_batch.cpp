@@ -0,0 +1,69 @@
+#include <newTokiColor.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using std::cout, std::endl;
+
+// Grays, primaries and extremes are corner cases of HSV and Lab, the others
+// are random.
+std::vector<ARGB> test_colors(size_t num_random, std::mt19937 &mt) {
+  std::vector<ARGB> ret{0xFF'00'00'00, 0xFF'FF'FF'FF, 0xFF'80'80'80,
+                        0xFF'FF'00'00, 0xFF'00'FF'00, 0xFF'00'00'FF,
+                        0xFF'FF'FF'00, 0xFF'00'FF'FF, 0xFF'FF'00'FF,
+                        0xFF'01'00'00, 0x00'00'00'00, 0x7F'12'34'56};
+  std::uniform_int_distribution<uint32_t> rand;
+  while (ret.size() < num_random) {
+    ret.emplace_back(rand(mt));
+  }
+  return ret;
+}
+
+bool is_close(float a, float b) {
+  return std::abs(a - b) <= 1e-4f * std::max({std::abs(a), std::abs(b), 1.0f});
+}
+
+bool check(::SCL_convertAlgo algo, const char *name,
+           std::span<const ARGB> colors) {
+  std::array<std::vector<float>, 3> c3;
+  for (auto &channel : c3) {
+    channel.resize(colors.size());
+  }
+  convert_unit::to_c3_batch(algo, colors, c3[0], c3[1], c3[2]);
+
+  for (size_t i = 0; i < colors.size(); i++) {
+    const Eigen::Array3f expected = convert_unit{colors[i], algo}.to_c3();
+    for (int ch = 0; ch < 3; ch++) {
+      if (!is_close(c3[ch][i], expected[ch])) {
+        cout << "Error : " << name << " batch converts " << std::hex
+             << colors[i] << std::dec << " to " << c3[0][i] << ", "
+             << c3[1][i] << ", " << c3[2][i] << ", but to_c3 gives "
+             << expected.transpose() << endl;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int main() {
+  std::mt19937 mt(20231019);
+  bool ok = true;
+  // sizes that leave different remainders of any batch size
+  for (size_t size : {12, 13, 31, 1000, 4099}) {
+    const std::vector<ARGB> colors = test_colors(size, mt);
+    ok = check(::SCL_convertAlgo::RGB, "RGB", colors) && ok;
+    ok = check(::SCL_convertAlgo::HSV, "HSV", colors) && ok;
+    ok = check(::SCL_convertAlgo::XYZ, "XYZ", colors) && ok;
+    ok = check(::SCL_convertAlgo::Lab94, "Lab", colors) && ok;
+  }
+
+  if (!ok) {
+    return 1;
+  }
+  cout << "Success" << endl;
+  return 0;
+}
@@ -0,0 +1,99 @@
+#include <distinct_colors.h>
+#include <iostream>
+#include <omp.h>
+#include <algorithm>
+#include <random>
+
+using std::cout, std::endl;
+
+// distinct colors computed by sorting every pixel, without any shortcut
+libImageCvt::distinct_colors reference_of(std::span<const ARGB> pixels) {
+  libImageCvt::distinct_colors ret;
+  ret.colors.assign(pixels.begin(), pixels.end());
+  std::sort(ret.colors.begin(), ret.colors.end());
+  ret.colors.erase(std::unique(ret.colors.begin(), ret.colors.end()),
+                   ret.colors.end());
+  ret.index.resize(pixels.size());
+  for (size_t i = 0; i < pixels.size(); i++) {
+    ret.index[i] = uint32_t(
+        std::lower_bound(ret.colors.begin(), ret.colors.end(), pixels[i]) -
+        ret.colors.begin());
+  }
+  return ret;
+}
+
+// some opaque colors and a few translucent ones, like a real image
+std::vector<ARGB> random_image(size_t num_pixels, std::mt19937 &mt) {
+  std::uniform_int_distribution<uint32_t> rand_rgb(0, 0xFF'FF'FF);
+  std::uniform_int_distribution<int> rand_percent(0, 99);
+  std::uniform_int_distribution<uint32_t> rand_alpha(0, 0xFE);
+  std::vector<ARGB> palette(4096);
+  for (ARGB &argb : palette) {
+    argb = 0xFF'00'00'00 | rand_rgb(mt);
+  }
+  std::uniform_int_distribution<size_t> rand_idx(0, palette.size() - 1);
+
+  std::vector<ARGB> ret(num_pixels);
+  for (ARGB &argb : ret) {
+    const int percent = rand_percent(mt);
+    if (percent < 2) {
+      argb = (rand_alpha(mt) << 24) | (rand_rgb(mt) & 0x0F'0F'0F);
+    } else if (percent < 10) {
+      argb = 0xFF'00'00'00 | rand_rgb(mt);
+    } else {
+      argb = palette[rand_idx(mt)];
+    }
+  }
+  return ret;
+}
+
+bool check(std::span<const ARGB> pixels, const char *name) {
+  libImageCvt::distinct_colors result;
+  libImageCvt::extract_distinct_colors(pixels, result);
+  const auto expected = reference_of(pixels);
+  if (result.colors != expected.colors || result.index != expected.index) {
+    cout << "Error : distinct colors of " << name << " are wrong, "
+         << result.colors.size() << " colors found while "
+         << expected.colors.size() << " expected." << endl;
+    return false;
+  }
+
+  libImageCvt::extract_distinct_colors(pixels, result, false);
+  if (result.colors != expected.colors || !result.index.empty()) {
+    cout << "Error : distinct colors of " << name
+         << " are wrong when index is not required." << endl;
+    return false;
+  }
+  return true;
+}
+
+int main() {
+  std::mt19937 mt(20231019);
+
+  // small images are sorted, large ones go through bitsets
+  const std::vector<ARGB> small = random_image(1000, mt);
+  const std::vector<ARGB> large = random_image(size_t{3} << 20, mt);
+  bool ok = true;
+  ok = check(small, "small image") && ok;
+  ok = check(large, "large image") && ok;
+  ok = check(std::span<const ARGB>{}, "empty image") && ok;
+
+  // Inside another parallel region, the inner team has fewer threads than
+  // omp_get_max_threads() reports.
+  std::vector<std::vector<ARGB>> images(4);
+  for (auto &img : images) {
+    img = random_image(size_t{1} << 20, mt);
+  }
+  int failed = 0;
+#pragma omp parallel for schedule(static) reduction(+ : failed)
+  for (int i = 0; i < int(images.size()); i++) {
+    failed += !check(images[i], "image in nested parallel region");
+  }
+  ok = (failed == 0) && ok;
+
+  if (!ok) {
+    return 1;
+  }
+  cout << "Success" << endl;
+  return 0;
+}
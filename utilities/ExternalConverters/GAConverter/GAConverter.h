@@ -98,6 +98,14 @@ class GAConverter
   inline void __impl_recordFitness() noexcept {
     Base_t::template __impl_recordFitness<this_t>();
 
+    if (args().ui.isCancelled()) {
+      // no more generations after this one
+      heu::GAOption opt = option();
+      opt.maxGenerations = 0;
+      this->setOption(opt);
+      return;
+    }
+
     this->_args.strongMutation = generation() * 2 < option().maxGenerations;
     if (generation() % 10 == 0) {
       std::clock_t curT = std::clock();
@@ -1,8 +1,11 @@
-#include <png.h>
 #include "FlatDiagram.h"
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
 #include <stdio.h>
+#include <algorithm>
+#include <omp.h>
+#include <zlib.h>
 
 #include <fmt/format.h>
 
@@ -65,94 +68,331 @@ void libFlatDiagram::draw_flat_diagram_to_memory(
   }
 }
 
-std::string libFlatDiagram::export_flat_diagram(
-    std::string_view png_filename, const fd_option &opt,
-    const get_blk_image_callback_t &blk_image_at,
-    std::span<std::pair<std::string, std::string>> texts) noexcept {
-  const int64_t rows_capacity_by_blocks = 16;
+namespace {
 
-  EImgRowMajor_t buffer(rows_capacity_by_blocks * 16, opt.cols * 16);
+void write_u32_be(uint8_t *dest, uint32_t val) noexcept {
+  dest[0] = uint8_t(val >> 24);
+  dest[1] = uint8_t(val >> 16);
+  dest[2] = uint8_t(val >> 8);
+  dest[3] = uint8_t(val);
+}
 
-  FILE *fp = fopen(png_filename.data(), "wb");
+bool write_png_chunk(FILE *fp, const char type[4], const uint8_t *data,
+                     size_t length) noexcept {
+  // chunks are limited to 2^31-1 bytes, so split large data into chunks
+  constexpr size_t max_chunk_length = size_t(1) << 30;
+  do {
+    const size_t len = std::min(length, max_chunk_length);
+    uint8_t head[8];
+    write_u32_be(head, uint32_t(len));
+    memcpy(head + 4, type, 4);
 
-  if (fp == nullptr) {
-    return fmt::format("fopen failed to create png file {}.", png_filename);
+    uLong crc = crc32(0, head + 4, 4);
+    if (len > 0) {
+      // crc32_z returns 0 for nullptr
+      crc = crc32_z(crc, data, len);
+    }
+    uint8_t tail[4];
+    write_u32_be(tail, uint32_t(crc));
+
+    if (fwrite(head, 1, 8, fp) != 8) return false;
+    if (len > 0 && fwrite(data, 1, len, fp) != len) return false;
+    if (fwrite(tail, 1, 4, fp) != 4) return false;
+
+    data += len;
+    length -= len;
+  } while (length > 0);
+  return true;
+}
+
+struct png_band {
+  int64_t row_beg;
+  int64_t row_end;
+  libFlatDiagram::EImgRowMajor_t image;
+  // scanlines with filter bytes, this is what is deflated.
+  std::vector<uint8_t> filtered;
+  std::vector<uint8_t> compressed;
+  uint32_t adler;
+  std::string err;
+};
+
+// every row is prefixed with a filter byte. The first row in a band uses Sub
+// filter since the previous row is in another band, and others use Up filter.
+void filter_band(png_band &band, int64_t cols) noexcept {
+  const size_t row_bytes = cols * 4;
+  const int64_t rows = band.row_end - band.row_beg;
+  band.filtered.resize(rows * (row_bytes + 1));
+
+  for (int64_t r = 0; r < rows; r++) {
+    const uint8_t *cur = reinterpret_cast<const uint8_t *>(&band.image(r, 0));
+    uint8_t *dst = band.filtered.data() + r * (row_bytes + 1);
+    if (r == 0) {
+      dst[0] = 1;  // Sub
+      for (size_t i = 0; i < 4; i++) {
+        dst[1 + i] = cur[i];
+      }
+      for (size_t i = 4; i < row_bytes; i++) {
+        dst[1 + i] = uint8_t(cur[i] - cur[i - 4]);
+      }
+      continue;
+    }
+    const uint8_t *prev =
+        reinterpret_cast<const uint8_t *>(&band.image(r - 1, 0));
+    dst[0] = 2;  // Up
+    for (size_t i = 0; i < row_bytes; i++) {
+      dst[1 + i] = uint8_t(cur[i] - prev[i]);
+    }
   }
+}
 
-  png_struct *png =
-      png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-  if (png == nullptr) {
-    fclose(fp);
-    return fmt::format("fopen failed to create png struct for png file {}.",
-                       png_filename);
+// deflate a band into a raw deflate stream. The last 32KiB of the previous
+// band is used as dictionary, so the compress ratio is nearly the same as a
+// single stream.
+std::string deflate_band(png_band &band, std::span<const uint8_t> dictionary,
+                         bool is_last, int level, int mem_level) noexcept {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if (deflateInit2(&zs, level, Z_DEFLATED, -15, mem_level,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return "deflateInit2 failed.";
+  }
+  if (!dictionary.empty()) {
+    deflateSetDictionary(&zs, dictionary.data(), uInt(dictionary.size()));
   }
 
-  png_info *png_info = png_create_info_struct(png);
-  if (png_info == nullptr) {
-    png_destroy_write_struct(&png, &png_info);
-    fclose(fp);
-    return fmt::format(
-        "fopen failed to create png info struct for png file {}.",
-        png_filename);
+  band.compressed.resize(deflateBound(&zs, band.filtered.size()) + 16);
+  zs.next_in = band.filtered.data();
+  zs.avail_in = uInt(band.filtered.size());
+  zs.next_out = band.compressed.data();
+  zs.avail_out = uInt(band.compressed.size());
+
+  const int flush = is_last ? Z_FINISH : Z_FULL_FLUSH;
+  while (true) {
+    const int ret = deflate(&zs, flush);
+    if (ret == Z_STREAM_ERROR) {
+      deflateEnd(&zs);
+      return "deflate failed.";
+    }
+    if (is_last ? (ret == Z_STREAM_END)
+                : (zs.avail_in == 0 && zs.avail_out > 0)) {
+      break;
+    }
+    // output buffer is full, enlarge it.
+    const size_t used = band.compressed.size() - zs.avail_out;
+    band.compressed.resize(band.compressed.size() * 2);
+    zs.next_out = band.compressed.data() + used;
+    zs.avail_out = uInt(band.compressed.size() - used);
   }
+  band.compressed.resize(band.compressed.size() - zs.avail_out);
+  deflateEnd(&zs);
 
-  png_init_io(png, fp);
+  band.adler =
+      uint32_t(adler32_z(1, band.filtered.data(), band.filtered.size()));
+  return {};
+}
 
-  png_set_compression_level(png, opt.png_compress_level);
+}  // namespace
 
-  png_set_compression_mem_level(png, opt.png_compress_memory_level);
+std::string libFlatDiagram::export_png_in_bands(
+    std::string_view png_filename, const png_band_option &opt,
+    const draw_band_callback_t &draw_band,
+    std::span<const std::pair<std::string, std::string>> texts,
+    const band_progress_callback_t &progress) noexcept {
+  if (opt.rows <= 0 || opt.cols <= 0) {
+    return fmt::format("Invalid png size {} * {}.", opt.rows, opt.cols);
+  }
+  // width and height are 31-bit in IHDR
+  constexpr int64_t max_png_size = (int64_t(1) << 31) - 1;
+  if (opt.rows > max_png_size || opt.cols > max_png_size) {
+    return fmt::format(
+        "Png size {} * {} is too large, width and height must not exceed {}.",
+        opt.rows, opt.cols, max_png_size);
+  }
+  const int64_t granularity = std::max<int64_t>(opt.band_row_granularity, 1);
+  int64_t band_rows = opt.band_rows;
+  if (band_rows <= 0) {
+    // about 16MiB for each band
+    band_rows = (int64_t(16) << 20) / (opt.cols * 4);
+  }
+  band_rows = std::max((band_rows / granularity) * granularity, granularity);
 
-  // png_set_text_compression_level(png, 8);
+  const int level = opt.png_compress_level;
+  const int mem_level = std::clamp(opt.png_compress_memory_level, 1, 9);
 
-  png_set_IHDR(png, png_info, opt.cols * 16, 16 * (opt.row_end - opt.row_start),
-               8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
-               PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-  png_write_info(png, png_info);
+  FILE *fp = fopen(png_filename.data(), "wb");
+  if (fp == nullptr) {
+    return fmt::format("fopen failed to create png file {}.", png_filename);
+  }
+
+  auto close_with_error = [fp](std::string &&err) {
+    fclose(fp);
+    return std::move(err);
+  };
+  auto write_failed = [&close_with_error, png_filename]() {
+    return close_with_error(
+        fmt::format("Failed to write png file {}.", png_filename));
+  };
 
   {
-    std::vector<png_text> png_txts;
-    png_txts.reserve(texts.size());
-    for (auto &[first, second] : texts) {
-      png_text temp;
-      temp.compression = -1;
-      temp.key = first.data();
-      temp.text = second.data();
-      png_txts.emplace_back(temp);
+    constexpr uint8_t signature[8]{0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    if (fwrite(signature, 1, 8, fp) != 8) {
+      return write_failed();
     }
 
-    png_set_text(png, png_info, png_txts.data(), png_txts.size());
+    uint8_t ihdr[13];
+    write_u32_be(ihdr, uint32_t(opt.cols));
+    write_u32_be(ihdr + 4, uint32_t(opt.rows));
+    ihdr[8] = 8;   // bit depth
+    ihdr[9] = 6;   // RGBA
+    ihdr[10] = 0;  // deflate
+    ihdr[11] = 0;  // adaptive filtering
+    ihdr[12] = 0;  // no interlace
+    if (!write_png_chunk(fp, "IHDR", ihdr, sizeof(ihdr))) {
+      return write_failed();
+    }
+
+    std::vector<uint8_t> text_buf;
+    for (const auto &[key, text] : texts) {
+      text_buf.assign(key.begin(), key.end());
+      text_buf.push_back(0);
+      text_buf.insert(text_buf.end(), text.begin(), text.end());
+      if (!write_png_chunk(fp, "tEXt", text_buf.data(), text_buf.size())) {
+        return write_failed();
+      }
+    }
   }
 
-  try {
-    for (int64_t ridx = opt.row_start; ridx < opt.row_end;
-         ridx += rows_capacity_by_blocks) {
-      const int64_t rows_this_time =
-          std::min(opt.row_end - ridx, rows_capacity_by_blocks);
-      buffer.fill(0xFFFFFFFF);
+  const int64_t num_bands = (opt.rows + band_rows - 1) / band_rows;
+  const int64_t bands_per_wave =
+      std::min<int64_t>(std::max(omp_get_max_threads(), 1), num_bands);
 
-      fd_option opt_temp = opt;
-      opt_temp.row_start = ridx;
-      opt_temp.row_end = ridx + rows_this_time;
+  std::vector<png_band> bands(bands_per_wave);
+  std::vector<uint8_t> dictionary;
+  uint32_t adler = 1;
+  bool is_first_idat = true;
 
-      draw_flat_diagram_to_memory({buffer.data(), buffer.rows(), buffer.cols()},
-                                  opt_temp, blk_image_at);
+  for (int64_t wave_beg = 0; wave_beg < num_bands; wave_beg += bands_per_wave) {
+    const int64_t bands_this_wave =
+        std::min(num_bands - wave_beg, bands_per_wave);
 
-      ARGB_to_AGBR(buffer.data(), rows_this_time * 16 * opt.cols * 16);
+    // draw and filter bands
+#pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < bands_this_wave; i++) {
+      png_band &band = bands[i];
+      band.err.clear();
+      band.row_beg = (wave_beg + i) * band_rows;
+      band.row_end = std::min(band.row_beg + band_rows, opt.rows);
+      band.image.resize(band.row_end - band.row_beg, opt.cols);
+      try {
+        draw_band(band.row_beg, band.row_end,
+                  {band.image.data(), band.image.rows(), band.image.cols()});
+      } catch (const std::exception &e) {
+        band.err = fmt::format("Exception occurred while drawing png: {}",
+                               e.what());
+        continue;
+      }
+      ARGB_to_AGBR(band.image.data(), band.image.size());
+      filter_band(band, opt.cols);
+    }
 
-      for (int64_t pix_r = 0; pix_r < rows_this_time * 16; pix_r++) {
-        png_write_row(png,
-                      reinterpret_cast<const uint8_t *>(&buffer(pix_r, 0)));
+    for (int64_t i = 0; i < bands_this_wave; i++) {
+      if (!bands[i].err.empty()) {
+        return close_with_error(std::move(bands[i].err));
       }
     }
-  } catch (const std::exception &e) {
-    return fmt::format("Exception occurred while writing flat diagram: {}",
-                       e.what());
-  }
 
-  png_write_end(png, png_info);
+    // deflate bands, each one uses the tail of previous band as dictionary.
+#pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < bands_this_wave; i++) {
+      std::span<const uint8_t> dict{dictionary};
+      if (i > 0) {
+        const auto &prev = bands[i - 1].filtered;
+        const size_t dict_size = std::min<size_t>(prev.size(), 32768);
+        dict = {prev.data() + prev.size() - dict_size, dict_size};
+      }
+      const bool is_last = (wave_beg + i + 1 == num_bands);
+      bands[i].err =
+          deflate_band(bands[i], dict, is_last, level, mem_level);
+    }
 
-  png_destroy_write_struct(&png, &png_info);
-  fclose(fp);
+    for (int64_t i = 0; i < bands_this_wave; i++) {
+      png_band &band = bands[i];
+      if (!band.err.empty()) {
+        return close_with_error(std::move(band.err));
+      }
 
+      if (is_first_idat) {
+        // zlib header, the compression level is only a hint.
+        const uint8_t cmf = 0x78;
+        const int actual_level = (level < 0) ? Z_DEFAULT_COMPRESSION : level;
+        const uint8_t flevel = (actual_level < 0 || actual_level == 6) ? 2
+                               : (actual_level < 2)                    ? 0
+                               : (actual_level < 6)                    ? 1
+                                                                       : 3;
+        uint8_t flg = uint8_t(flevel << 6);
+        flg += uint8_t(31 - (uint32_t(cmf) * 256 + flg) % 31);
+        band.compressed.insert(band.compressed.begin(), {cmf, flg});
+        is_first_idat = false;
+      }
+
+      adler = uint32_t(adler32_combine(adler, band.adler,
+                                       z_off_t(band.filtered.size())));
+      if (wave_beg + i + 1 == num_bands) {
+        uint8_t trailer[4];
+        write_u32_be(trailer, adler);
+        band.compressed.insert(band.compressed.end(), trailer, trailer + 4);
+      }
+
+      if (!write_png_chunk(fp, "IDAT", band.compressed.data(),
+                           band.compressed.size())) {
+        return write_failed();
+      }
+    }
+
+    {
+      const auto &last = bands[bands_this_wave - 1].filtered;
+      const size_t dict_size = std::min<size_t>(last.size(), 32768);
+      dictionary.assign(last.end() - dict_size, last.end());
+    }
+
+    if (progress && !progress(bands[bands_this_wave - 1].row_end)) {
+      fclose(fp);
+      remove(png_filename.data());
+      return fmt::format("Exporting png file {} is stopped.", png_filename);
+    }
+  }
+
+  if (!write_png_chunk(fp, "IEND", nullptr, 0)) {
+    return write_failed();
+  }
+  fclose(fp);
   return {};
-}
\ No newline at end of file
+}
+
+std::string libFlatDiagram::export_flat_diagram(
+    std::string_view png_filename, const fd_option &opt,
+    const get_blk_image_callback_t &blk_image_at,
+    std::span<std::pair<std::string, std::string>> texts,
+    const band_progress_callback_t &progress) noexcept {
+  const png_band_option band_opt{
+      .rows = 16 * (opt.row_end - opt.row_start),
+      .cols = opt.cols * 16,
+      .band_rows = 0,
+      .band_row_granularity = 16,
+      .png_compress_level = opt.png_compress_level,
+      .png_compress_memory_level = opt.png_compress_memory_level,
+  };
+
+  auto draw_band = [&opt, &blk_image_at](int64_t pixel_row_beg,
+                                         int64_t pixel_row_end,
+                                         Eigen::Map<EImgRowMajor_t> buffer) {
+    buffer.fill(0xFFFFFFFF);
+    fd_option opt_temp = opt;
+    opt_temp.row_start = opt.row_start + pixel_row_beg / 16;
+    opt_temp.row_end = opt.row_start + pixel_row_end / 16;
+    draw_flat_diagram_to_memory(buffer, opt_temp, blk_image_at);
+  };
+
+  return export_png_in_bands(png_filename, band_opt, draw_band, texts,
+                             progress);
+}
@@ -56,10 +56,41 @@ void draw_flat_diagram_to_memory(Eigen::Map<EImgRowMajor_t> buffer,
                                  const fd_option &opt,
                                  const get_blk_image_callback_t &blk_image_at);
 
+struct png_band_option {
+  int64_t rows;  // by pixel
+  int64_t cols;  // by pixel
+  // rows of each band, 0 or negative means choose automatically.
+  int64_t band_rows{0};
+  // band_rows will be a multiple of this.
+  int64_t band_row_granularity{1};
+  int png_compress_level{9};
+  int png_compress_memory_level{8};
+};
+
+// draw rows [pixel_row_beg,pixel_row_end) into buffer, this callback will be
+// called from multiple threads at the same time.
+using draw_band_callback_t =
+    std::function<void(int64_t pixel_row_beg, int64_t pixel_row_end,
+                       Eigen::Map<EImgRowMajor_t> buffer)>;
+
+// called after each group of bands is written, on the calling thread. Return
+// false to stop exporting, then the incomplete png is removed.
+using band_progress_callback_t = std::function<bool(int64_t rows_finished)>;
+
+// Write an RGBA png band by band with bounded memory. Bands are drawn and
+// deflated in parallel as independent deflate streams, which are ended with
+// full flushes and concatenated into a single zlib stream.
+std::string export_png_in_bands(
+    std::string_view png_filename, const png_band_option &opt,
+    const draw_band_callback_t &draw_band,
+    std::span<const std::pair<std::string, std::string>> texts,
+    const band_progress_callback_t &progress = {}) noexcept;
+
 std::string export_flat_diagram(
     std::string_view png_filename, const fd_option &opt,
     const get_blk_image_callback_t &blk_image_at,
-    std::span<std::pair<std::string, std::string>> texts) noexcept;
+    std::span<std::pair<std::string, std::string>> texts,
+    const band_progress_callback_t &progress = {}) noexcept;
 
 }  // namespace libFlatDiagram
 
@@ -0,0 +1,524 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+#include "../GPU_interface.h"
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <thread>
+#include <vector>
+#include <fmt/format.h>
+#include <omp.h>
+#include <xsimd/xsimd.hpp>
+
+// This backend implements gpu_interface on CPU, so that the batched matching
+// path of VisualCraftL works without any GPU. Distances are computed in
+// tiles of tasks x colors, so that a tile of colorset stays in L1 cache
+// while it's compared with many tasks. Colors are vectorized by xsimd and
+// task tiles are distributed to threads by OpenMP.
+//
+// Like the OpenCL and Vulkan kernels, distance is computed as
+// diff(color_in_colorset, task), and the first color with minimum distance is
+// taken.
+
+namespace gpu_wrapper {
+
+enum class error_code : int {
+  ok = 0,
+  invalid_platform_index = 1800000000,
+  invalid_device_index = 1800001000,
+  set_colorset_failure = 1800002000,
+  set_tasks_failure = 1800003000,
+  execute_failure_no_colorset = 1800004000,
+  execute_failure_invalid_algo = 1800004001,
+};
+
+void set_error_code(int* dst_nullable, error_code code) noexcept {
+  if (dst_nullable) {
+    *dst_nullable = int(code);
+  }
+}
+
+using batch_t = xsimd::batch<float>;
+constexpr size_t batch_size = batch_t::size;
+template <typename T>
+using aligned_vector = std::vector<T, xsimd::aligned_allocator<T>>;
+
+constexpr size_t task_tile_size = 64;
+// 3 channels * 2048 * 4 bytes = 24KiB, fits in L1 data cache of most CPUs.
+constexpr size_t color_tile_size = 2048;
+static_assert(color_tile_size % batch_size == 0);
+
+constexpr float pi_fp32 = M_PI;
+
+namespace kernels {
+
+inline float square(float x) noexcept { return x * x; }
+
+struct RGB_XYZ {
+  batch_t c0, c1, c2;
+  explicit RGB_XYZ(const std::array<float, 3>& task) noexcept
+      : c0{task[0]}, c1{task[1]}, c2{task[2]} {}
+
+  batch_t operator()(batch_t r, batch_t g, batch_t b) const noexcept {
+    const batch_t dr = r - c0;
+    const batch_t dg = g - c1;
+    const batch_t db = b - c2;
+    return dr * dr + dg * dg + db * db;
+  }
+};
+
+struct RGB_Better {
+  float r2, g2, b2;
+  float norm2_2, sum_2;
+  explicit RGB_Better(const std::array<float, 3>& task) noexcept
+      : r2{task[0]},
+        g2{task[1]},
+        b2{task[2]},
+        norm2_2{task[0] * task[0] + task[1] * task[1] + task[2] * task[2]},
+        sum_2{task[0] + task[1] + task[2]} {}
+
+  batch_t operator()(batch_t r1, batch_t g1, batch_t b1) const noexcept {
+    constexpr float w_r = 1.0f, w_g = 2.0f, w_b = 1.0f;
+    constexpr float thre = 1e-4f;
+
+    const batch_t SqrModSquare = (r1 * r1 + g1 * g1 + b1 * b1) * norm2_2;
+    const batch_t dr = r1 - r2;
+    const batch_t dg = g1 - g2;
+    const batch_t db = b1 - b2;
+
+    const batch_t SigmaRGB = (r1 + g1 + b1 + sum_2) * (1.0f / 3);
+    const batch_t S_r = xsimd::min((r1 + r2) / (SigmaRGB + thre), batch_t{1});
+    const batch_t S_g = xsimd::min((g1 + g2) / (SigmaRGB + thre), batch_t{1});
+    const batch_t S_b = xsimd::min((b1 + b2) / (SigmaRGB + thre), batch_t{1});
+
+    const batch_t sumRGBSquare = r1 * r2 + g1 * g2 + b1 * b2;
+    const batch_t theta =
+        (2.0f / pi_fp32) *
+        xsimd::acos(sumRGBSquare / xsimd::sqrt(SqrModSquare + thre) / 1.01f);
+
+    const batch_t OnedDelta_r = xsimd::abs(dr) / (r1 + r2 + thre);
+    const batch_t OnedDelta_g = xsimd::abs(dg) / (g1 + g2 + thre);
+    const batch_t OnedDelta_b = xsimd::abs(db) / (b1 + b2 + thre);
+    const batch_t sumOnedDelta = OnedDelta_r + OnedDelta_g + OnedDelta_b + thre;
+
+    const batch_t S_theta = (OnedDelta_r * S_r * S_r + OnedDelta_g * S_g * S_g +
+                             OnedDelta_b * S_b * S_b) /
+                            sumOnedDelta;
+    const batch_t S_ratio = xsimd::max(
+        xsimd::max(xsimd::max(r1, batch_t{r2}), xsimd::max(g1, batch_t{g2})),
+        xsimd::max(b1, batch_t{b2}));
+
+    const batch_t part1 =
+        (S_r * S_r * dr * dr * w_r + S_g * S_g * dg * dg * w_g +
+         S_b * S_b * db * db * w_b) *
+        (1.0f / (w_r + w_g + w_b));
+    const batch_t part2 = S_theta * S_ratio * theta * theta;
+    return part1 + part2;
+  }
+};
+
+// HSV is compared in the cone space, where its distance is euclidean. The
+// colorset should be converted to cone by hsv_to_cone before.
+struct HSV_cone : public RGB_XYZ {
+  static std::array<float, 3> hsv_to_cone(float h, float s, float v) noexcept {
+    return {50.0f * std::cos(h) * s * v, 50.0f * std::sin(h) * s * v,
+            50.0f * v};
+  }
+  explicit HSV_cone(const std::array<float, 3>& task) noexcept
+      : RGB_XYZ{hsv_to_cone(task[0], task[1], task[2])} {}
+};
+
+struct Lab94 {
+  float L2, a2, b2;
+  float C2;
+  float SH_2;
+  explicit Lab94(const std::array<float, 3>& task) noexcept
+      : L2{task[0]},
+        a2{task[1]},
+        b2{task[2]},
+        C2{std::sqrt(task[1] * task[1] + task[2] * task[2])},
+        SH_2{square(C2 * 0.015f + 1.0f)} {}
+
+  batch_t operator()(batch_t L1, batch_t a1, batch_t b1) const noexcept {
+    const batch_t dL = L1 - L2;
+    const batch_t C1 = xsimd::sqrt(a1 * a1 + b1 * b1);
+    const batch_t deltaCab_2 = (C1 - C2) * (C1 - C2);
+    const batch_t da = a2 - a1;
+    const batch_t db = b2 - b1;
+    const batch_t deltaHab_2 = da * da + db * db - deltaCab_2;
+    const batch_t SC = C1 * 0.045f + 1.0f;
+    return dL * dL + deltaCab_2 / (SC * SC) + deltaHab_2 / SH_2;
+  }
+};
+
+inline float deg2rad(float deg) noexcept { return deg * pi_fp32 / 180.0f; }
+
+inline float color_diff_Lab00(float L1, float a1, float b1, float L2, float a2,
+                              float b2) noexcept {
+  const float C1sab = std::sqrt(a1 * a1 + b1 * b1);
+  const float C2sab = std::sqrt(a2 * a2 + b2 * b2);
+  const float mCsab = (C1sab + C2sab) / 2;
+  const float pow_mCsab_7 = std::pow(mCsab, 7.0f);
+  const float pow_25_7 = std::pow(25.0f, 7.0f);
+  const float G =
+      0.5f * (1 - std::sqrt(pow_mCsab_7 / (pow_mCsab_7 + pow_25_7)));
+  const float a1p = (1 + G) * a1;
+  const float a2p = (1 + G) * a2;
+  const float C1p = std::sqrt(a1p * a1p + b1 * b1);
+  const float C2p = std::sqrt(a2p * a2p + b2 * b2);
+  float h1p = (b1 == 0 && a1p == 0) ? 0 : std::atan2(b1, a1p);
+  if (h1p < 0) h1p += 2 * pi_fp32;
+  float h2p = (b2 == 0 && a2p == 0) ? 0 : std::atan2(b2, a2p);
+  if (h2p < 0) h2p += 2 * pi_fp32;
+
+  const float dLp = L2 - L1;
+  const float dCp = C2p - C1p;
+  float dhp = 0;
+  if (C1p * C2p != 0) {
+    if (std::abs(h2p - h1p) <= deg2rad(180)) {
+      dhp = h2p - h1p;
+    } else if (h2p - h1p > deg2rad(180)) {
+      dhp = h2p - h1p - deg2rad(360);
+    } else {
+      dhp = h2p - h1p + deg2rad(360);
+    }
+  }
+  const float dHp = 2 * std::sqrt(C1p * C2p) * std::sin(dhp / 2.0f);
+
+  const float mLp = (L1 + L2) / 2;
+  const float mCp = (C1p + C2p) / 2;
+  float mhp;
+  if (C1p * C2p == 0) {
+    mhp = h1p + h2p;
+  } else if (std::abs(h2p - h1p) <= deg2rad(180)) {
+    mhp = (h1p + h2p) / 2;
+  } else if (h1p + h2p < deg2rad(360)) {
+    mhp = (h1p + h2p + deg2rad(360)) / 2;
+  } else {
+    mhp = (h1p + h2p - deg2rad(360)) / 2;
+  }
+
+  const float T = 1 - 0.17f * std::cos(mhp - deg2rad(30)) +
+                  0.24f * std::cos(2 * mhp) +
+                  0.32f * std::cos(3 * mhp + deg2rad(6)) -
+                  0.20f * std::cos(4 * mhp - deg2rad(63));
+  const float dTheta =
+      deg2rad(30) * std::exp(-square((mhp - deg2rad(275)) / deg2rad(25)));
+  const float RC = 2 * std::sqrt(std::pow(mCp, 7.0f) /
+                                 (std::pow(25.0f, 7.0f) + std::pow(mCp, 7.0f)));
+  const float square_mLp_minus_50 = square(mLp - 50);
+  const float SL =
+      1 + 0.015f * square_mLp_minus_50 / std::sqrt(20 + square_mLp_minus_50);
+  const float SC = 1 + 0.045f * mCp;
+  const float SH = 1 + 0.015f * mCp * T;
+  const float RT = -RC * std::sin(2 * dTheta);
+
+  return square(dLp / SL) + square(dCp / SC) + square(dHp / SH) +
+         RT * (dCp / SC) * (dHp / SH);
+}
+
+// CIEDE2000 has too many branches to vectorize, so lanes are computed one by
+// one.
+struct Lab00 {
+  std::array<float, 3> task;
+  explicit Lab00(const std::array<float, 3>& t) noexcept : task{t} {}
+
+  batch_t operator()(batch_t L1, batch_t a1, batch_t b1) const noexcept {
+    alignas(batch_t::arch_type::alignment()) std::array<float, batch_size> l,
+        a, b, ret;
+    L1.store_aligned(l.data());
+    a1.store_aligned(a.data());
+    b1.store_aligned(b.data());
+    for (size_t i = 0; i < batch_size; i++) {
+      ret[i] = color_diff_Lab00(l[i], a[i], b[i], task[0], task[1], task[2]);
+    }
+    return batch_t::load_aligned(ret.data());
+  }
+};
+
+}  // namespace kernels
+
+const char* api_name() noexcept { return "CPU"; }
+
+size_t platform_num() noexcept { return 1; }
+
+class platform_impl : public platform_wrapper {
+ public:
+  const char* name_v() const noexcept final { return "CPU"; }
+  size_t num_devices_v() const noexcept final { return 1; }
+};
+
+platform_wrapper* platform_wrapper::create(size_t idx,
+                                           int* errorcode) noexcept {
+  if (idx != 0) {
+    set_error_code(errorcode, error_code::invalid_platform_index);
+    return nullptr;
+  }
+  set_error_code(errorcode, error_code::ok);
+  return new platform_impl;
+}
+
+void platform_wrapper::destroy(gpu_wrapper::platform_wrapper* p) noexcept {
+  delete p;
+}
+
+class device_impl : public device_wrapper {
+ public:
+  std::string name{fmt::format("{} threads, {}", omp_get_num_procs(),
+                               xsimd::default_arch::name())};
+  const char* name_v() const noexcept final { return this->name.c_str(); }
+};
+
+device_wrapper* device_wrapper::create(gpu_wrapper::platform_wrapper*,
+                                       size_t idx, int* ec) noexcept {
+  if (idx != 0) {
+    set_error_code(ec, error_code::invalid_device_index);
+    return nullptr;
+  }
+  set_error_code(ec, error_code::ok);
+  return new device_impl;
+}
+
+void device_wrapper::destroy(gpu_wrapper::device_wrapper* dw) noexcept {
+  delete dw;
+}
+
+class gpu_impl : public gpu_interface {
+ private:
+  // colorset in SoA, padded to a multiple of batch_size by repeating the last
+  // color, which never wins since the first minimum is taken.
+  std::array<aligned_vector<float>, 3> colorset;
+  // colorset converted to HSV cone, computed when needed.
+  std::array<aligned_vector<float>, 3> colorset_hsv_cone;
+  bool is_hsv_cone_ready{false};
+  size_t color_count{0};
+
+  std::vector<std::array<float, 3>> tasks;
+  std::vector<uint16_t> result_idx;
+  std::vector<float> result_diff;
+
+  error_code error{error_code::ok};
+  std::string error_message;
+
+  void set_error(error_code ec, std::string&& msg) noexcept {
+    this->error = ec;
+    this->error_message = std::move(msg);
+  }
+  // an error only describes the latest call
+  void clear_error() noexcept { this->set_error(error_code::ok, {}); }
+
+  template <class kernel_t>
+  void match(const std::array<aligned_vector<float>, 3>& colors) noexcept {
+    const size_t padded_count = colors[0].size();
+    const int64_t num_task_tiles =
+        (this->tasks.size() + task_tile_size - 1) / task_tile_size;
+
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t tile = 0; tile < num_task_tiles; tile++) {
+      const size_t task_begin = tile * task_tile_size;
+      const size_t task_end =
+          std::min(task_begin + task_tile_size, this->tasks.size());
+
+      std::array<batch_t, task_tile_size> min_diff;
+      std::array<xsimd::batch<uint32_t>, task_tile_size> min_idx;
+      min_diff.fill(batch_t{FLT_MAX});
+      min_idx.fill(xsimd::batch<uint32_t>{0});
+
+      for (size_t color_begin = 0; color_begin < padded_count;
+           color_begin += color_tile_size) {
+        const size_t color_end =
+            std::min(color_begin + color_tile_size, padded_count);
+
+        for (size_t tid = task_begin; tid < task_end; tid++) {
+          const kernel_t kernel{this->tasks[tid]};
+          batch_t& cur_min = min_diff[tid - task_begin];
+          auto& cur_idx = min_idx[tid - task_begin];
+
+          for (size_t cid = color_begin; cid < color_end; cid += batch_size) {
+            const batch_t diff =
+                kernel(batch_t::load_aligned(colors[0].data() + cid),
+                       batch_t::load_aligned(colors[1].data() + cid),
+                       batch_t::load_aligned(colors[2].data() + cid));
+            const auto is_less = diff < cur_min;
+            cur_min = xsimd::select(is_less, diff, cur_min);
+            cur_idx =
+                xsimd::select(xsimd::batch_bool_cast<uint32_t>(is_less),
+                              xsimd::batch<uint32_t>{uint32_t(cid)}, cur_idx);
+          }
+        }
+      }
+
+      // reduce lanes. Lane i has scanned colors whose index % batch_size == i
+      for (size_t tid = task_begin; tid < task_end; tid++) {
+        alignas(batch_t::arch_type::alignment())
+            std::array<float, batch_size> diffs;
+        alignas(batch_t::arch_type::alignment())
+            std::array<uint32_t, batch_size> idxs;
+        min_diff[tid - task_begin].store_aligned(diffs.data());
+        min_idx[tid - task_begin].store_aligned(idxs.data());
+
+        uint32_t best_idx = UINT32_MAX;
+        float best_diff = FLT_MAX;
+        for (size_t lane = 0; lane < batch_size; lane++) {
+          const uint32_t idx = idxs[lane] + lane;
+          if (diffs[lane] < best_diff ||
+              (diffs[lane] == best_diff && idx < best_idx)) {
+            best_diff = diffs[lane];
+            best_idx = idx;
+          }
+        }
+        this->result_idx[tid] =
+            std::min<uint32_t>(best_idx, this->color_count - 1);
+        this->result_diff[tid] = best_diff;
+      }
+    }
+  }
+
+  void prepare_hsv_cone() noexcept {
+    if (this->is_hsv_cone_ready) {
+      return;
+    }
+    const size_t padded_count = this->colorset[0].size();
+    for (auto& c : this->colorset_hsv_cone) {
+      c.resize(padded_count);
+    }
+    for (size_t i = 0; i < padded_count; i++) {
+      const auto cone = kernels::HSV_cone::hsv_to_cone(
+          this->colorset[0][i], this->colorset[1][i], this->colorset[2][i]);
+      for (size_t c = 0; c < 3; c++) {
+        this->colorset_hsv_cone[c][i] = cone[c];
+      }
+    }
+    this->is_hsv_cone_ready = true;
+  }
+
+ public:
+  gpu_impl() = default;
+
+  const char* api_v() const noexcept final { return "CPU"; }
+
+  void set_colorset_v(
+      size_t color_num,
+      const std::array<const float*, 3>& color_ptrs) noexcept final {
+    this->clear_error();
+    if (color_num <= 0 || color_num > UINT16_MAX) {
+      this->set_error(
+          error_code::set_colorset_failure,
+          fmt::format("Invalid number of colors: {}.", color_num));
+      return;
+    }
+    this->color_count = color_num;
+    this->is_hsv_cone_ready = false;
+    const size_t padded_count =
+        (color_num + batch_size - 1) / batch_size * batch_size;
+    for (size_t c = 0; c < 3; c++) {
+      auto& dst = this->colorset[c];
+      dst.resize(padded_count);
+      std::copy(color_ptrs[c], color_ptrs[c] + color_num, dst.begin());
+      std::fill(dst.begin() + color_num, dst.end(),
+                color_ptrs[c][color_num - 1]);
+    }
+  }
+
+  void set_task_v(size_t task_num,
+                  const std::array<float, 3>* data) noexcept final {
+    this->tasks.assign(data, data + task_num);
+    this->result_idx.resize(task_num);
+    this->result_diff.resize(task_num);
+  }
+
+  void execute_v(::SCL_convertAlgo algo, bool) noexcept final {
+    this->clear_error();
+    if (this->color_count <= 0) {
+      this->set_error(error_code::execute_failure_no_colorset,
+                      "Colorset is not set before execution.");
+      return;
+    }
+    switch (algo) {
+      case ::SCL_convertAlgo::RGB:
+      case ::SCL_convertAlgo::XYZ:
+        this->match<kernels::RGB_XYZ>(this->colorset);
+        return;
+      case ::SCL_convertAlgo::RGB_Better:
+        this->match<kernels::RGB_Better>(this->colorset);
+        return;
+      case ::SCL_convertAlgo::HSV:
+        this->prepare_hsv_cone();
+        this->match<kernels::HSV_cone>(this->colorset_hsv_cone);
+        return;
+      case ::SCL_convertAlgo::Lab94:
+        this->match<kernels::Lab94>(this->colorset);
+        return;
+      case ::SCL_convertAlgo::Lab00:
+        this->match<kernels::Lab00>(this->colorset);
+        return;
+      default:
+        this->set_error(error_code::execute_failure_invalid_algo,
+                        fmt::format("Invalid algorithm: {}", char(algo)));
+        return;
+    }
+  }
+
+  // computation finishes in execute_v.
+  void wait_v() noexcept final {}
+
+  size_t task_count_v() const noexcept final { return this->tasks.size(); }
+  std::string device_vendor_v() const noexcept final {
+    return fmt::format("CPU ({})", xsimd::default_arch::name());
+  }
+  const uint16_t* result_idx_v() const noexcept final {
+    return this->result_idx.data();
+  }
+  const float* result_diff_v() const noexcept final {
+    return this->result_diff.data();
+  }
+  // all tasks can be computed by this backend.
+  size_t local_work_group_size_v() const noexcept final { return 1; }
+
+  // error handling
+  int error_code_v() const noexcept final { return int(this->error); }
+  bool ok_v() const noexcept final { return this->error == error_code::ok; }
+  std::string error_detail_v() const noexcept final {
+    return this->error_message;
+  }
+};
+
+gpu_interface* gpu_interface::create(gpu_wrapper::platform_wrapper* pw,
+                                     gpu_wrapper::device_wrapper* dw) noexcept {
+  std::pair<int, std::string> temp;
+  return create(pw, dw, temp);
+}
+
+gpu_interface* gpu_interface::create(
+    platform_wrapper*, device_wrapper*,
+    std::pair<int, std::string>& err) noexcept {
+  err.first = 0;
+  err.second.clear();
+  return new gpu_impl;
+}
+
+void gpu_interface::destroy(gpu_wrapper::gpu_interface* gi) noexcept {
+  delete gi;
+}
+}  // namespace gpu_wrapper
@@ -24,7 +24,9 @@ This file is part of SlopeCraft.
 
 #include <ExternalConverters/ExternalConverterStaticInterface.h>
 #include <ExternalConverters/GAConverter/GAConverter.h>
+#include <algorithm>
 #include <fstream>
+#include <iterator>
 #include <cereal/archives/binary.hpp>
 #include <seralize_funs.hpp>
 
@@ -36,12 +38,11 @@ libMapImageCvt::MapImageCvter::MapImageCvter(
     : libImageCvt::ImageCvter<true>{basic, allowed},
       gacvter(new GACvter::GAConverter) {}
 
-void libMapImageCvt::MapImageCvter::convert_image(
+bool libMapImageCvt::MapImageCvter::convert_image(
     const ::SCL_convertAlgo algo, bool dither,
     const heu::GAOption *const opt) noexcept {
   if (algo != ::SCL_convertAlgo::gaCvter) {
-    Base_t::convert_image(algo, dither);
-    return;
+    return Base_t::convert_image(algo, dither);
   }
   // dither = false;
   constexpr int seed_num = 5;
@@ -53,7 +54,9 @@ void libMapImageCvt::MapImageCvter::convert_image(
   std::vector<const Eigen::ArrayXX<uint8_t> *> seeds(seed_num);
 
   for (int a = 0; a < seed_num; a++) {
-    Base_t::convert_image(seed_algos[a], false);
+    if (!Base_t::convert_image(seed_algos[a], false)) {
+      return false;
+    }
     cvtedmap[a] = this->mapcolor_matrix();
     seeds[a] = &cvtedmap[a];
   }
@@ -65,14 +68,52 @@ void libMapImageCvt::MapImageCvter::convert_image(
   gacvter->setUiPack(this->ui);
 
   gacvter->run();
+  if (this->ui.isCancelled()) {
+    return false;
+  }
 
-  Eigen::ArrayXX<ARGB> raw_image_cache = this->_raw_image;
+  // The GA result is converted in place of the raw image, they are swapped
+  // instead of copied.
+  Eigen::ArrayXX<ARGB> ga_result;
+  gacvter->resultImage(&ga_result);
+  std::swap(ga_result, this->_raw_image);
+  this->_raw_colors.clear();
 
-  gacvter->resultImage(&this->_raw_image);
+  const bool ok = Base_t::convert_image(::SCL_convertAlgo::RGB_Better, dither);
 
-  Base_t::convert_image(::SCL_convertAlgo::RGB_Better, dither);
+  std::swap(ga_result, this->_raw_image);
+  this->_raw_colors.clear();
+  if (!dither) {
+    // dithered_image() would refer to the original image after swapping back
+    this->_dithered_image = std::move(ga_result);
+  }
+  return ok;
+}
+
+std::vector<ARGB> libMapImageCvt::MapImageCvter::colors_to_cache()
+    const noexcept {
+  const auto &dithered = this->dithered_image();
+  distinct_colors temp;
+  const distinct_colors *raw_colors = &this->_raw_colors;
+  if (int64_t(raw_colors->index.size()) != this->size()) {
+    extract_distinct_colors(
+        {this->_raw_image.data(), size_t(this->_raw_image.size())}, temp,
+        false);
+    raw_colors = &temp;
+  }
+  if (&dithered == &this->_raw_image) {
+    return raw_colors->colors;
+  }
 
-  this->_raw_image = raw_image_cache;
+  distinct_colors dithered_colors;
+  extract_distinct_colors({dithered.data(), size_t(dithered.size())},
+                          dithered_colors, false);
+  std::vector<ARGB> ret;
+  ret.reserve(raw_colors->colors.size() + dithered_colors.colors.size());
+  std::set_union(raw_colors->colors.begin(), raw_colors->colors.end(),
+                 dithered_colors.colors.begin(), dithered_colors.colors.end(),
+                 std::back_inserter(ret));
+  return ret;
 }
 
 bool libMapImageCvt::MapImageCvter::save_cache(
@@ -129,8 +170,8 @@ bool libMapImageCvt::MapImageCvter::load_cache(
 
   this->load_from_itermediate(std::move(temp));
 
-  assert(this->_raw_image.rows() == this->_dithered_image.rows());
-  assert(this->_raw_image.cols() == this->_dithered_image.cols());
+  assert(this->_raw_image.rows() == this->dithered_image().rows());
+  assert(this->_raw_image.cols() == this->dithered_image().cols());
   return true;
 }
 
@@ -139,7 +180,7 @@ bool libMapImageCvt::MapImageCvter::load_cache(const char *filename) noexcept {
 
   this->load_from_itermediate(std::move(temp));
 
-  assert(this->_raw_image.rows() == this->_dithered_image.rows());
-  assert(this->_raw_image.cols() == this->_dithered_image.cols());
+  assert(this->_raw_image.rows() == this->dithered_image().rows());
+  assert(this->_raw_image.cols() == this->dithered_image().cols());
   return true;
 }
\ No newline at end of file
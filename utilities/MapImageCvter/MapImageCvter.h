@@ -62,8 +62,8 @@ class MapImageCvter : public ::libImageCvt::ImageCvter<true> {
 
   ~MapImageCvter() = default;
 
-  // override
-  void convert_image(const ::SCL_convertAlgo algo, bool dither,
+  // override. Returns false if cancelled by ui.
+  bool convert_image(const ::SCL_convertAlgo algo, bool dither,
                      const heu::GAOption *const opt) noexcept;
 
   inline Eigen::ArrayXX<uint8_t> mapcolor_matrix() const noexcept {
@@ -90,9 +90,10 @@ class MapImageCvter : public ::libImageCvt::ImageCvter<true> {
       return;
     }
     dest.clear();
+    const auto &dithered = this->dithered_image();
     for (int64_t r = 0; r < this->rows(); r++) {
-      auto it = this->_color_hash.find(
-          convert_unit(this->_dithered_image(r, col), this->algo));
+      auto it =
+          this->_color_hash.find(convert_unit(dithered(r, col), this->algo));
       dest.emplace_back(&it->second);
     }
   }
@@ -100,11 +101,13 @@ class MapImageCvter : public ::libImageCvt::ImageCvter<true> {
   // temp is a temporary container to pass ownership
   void load_from_itermediate(MapImageCvter &&temp) noexcept {
     this->_raw_image = std::move(temp._raw_image);
+    this->_raw_colors = std::move(temp._raw_colors);
     this->algo = temp.algo;
+    this->dither = temp.dither;
     this->_dithered_image = std::move(temp._dithered_image);
 
-    assert(this->_raw_image.rows() == this->_dithered_image.rows());
-    assert(this->_raw_image.cols() == this->_dithered_image.cols());
+    assert(this->_raw_image.rows() == this->dithered_image().rows());
+    assert(this->_raw_image.cols() == this->dithered_image().cols());
     if (this->_color_hash.empty()) {
       this->_color_hash = std::move(temp._color_hash);
     } else {
@@ -117,24 +120,20 @@ class MapImageCvter : public ::libImageCvt::ImageCvter<true> {
   friend class cereal::access;
   template <class archive>
   void save(archive &ar) const {
-    assert(this->_raw_image.rows() == this->_dithered_image.rows());
-    assert(this->_raw_image.cols() == this->_dithered_image.cols());
+    const auto &dithered = this->dithered_image();
+    assert(this->_raw_image.rows() == dithered.rows());
+    assert(this->_raw_image.cols() == dithered.cols());
     ar(this->_raw_image);
     ar(this->algo);
     ar(this->dither);
     // ar(this->_color_hash);
-    ar(this->_dithered_image);
+    // the format is kept, the raw image is written again if not dithered
+    ar(dithered);
     // save required colorset
     {
-      std::unordered_set<uint32_t> colors_dithered_img;
-      colors_dithered_img.reserve(this->_dithered_image.size());
-      for (int64_t i = 0; i < this->_dithered_image.size(); i++) {
-        colors_dithered_img.emplace(this->_dithered_image(i));
-        colors_dithered_img.emplace(this->_raw_image(i));
-      }
-
-      const size_t size_colorset = colors_dithered_img.size();
-      ar(size_colorset);
+      const std::vector<ARGB> colors_dithered_img = this->colors_to_cache();
+      std::vector<decltype(this->color_hash().begin())> found;
+      found.reserve(colors_dithered_img.size());
       for (uint32_t color : colors_dithered_img) {
         auto it =
             this->color_hash().find(convert_unit{color, this->convert_algo()});
@@ -142,7 +141,13 @@ class MapImageCvter : public ::libImageCvt::ImageCvter<true> {
           assert(getA(color) <= 0);
           continue;
         }
+        found.emplace_back(it);
+      }
 
+      // only colors in the hash are written, so they are counted afterwards
+      const size_t size_colorset = found.size();
+      ar(size_colorset);
+      for (auto it : found) {
         ar(it->first, it->second);
       }
     }
@@ -155,9 +160,16 @@ class MapImageCvter : public ::libImageCvt::ImageCvter<true> {
     ar(this->dither);
     // ar(this->_color_hash);
     ar(this->_dithered_image);
+    this->_raw_colors.clear();
+    if (this->_dithered_image.rows() == this->_raw_image.rows() &&
+        this->_dithered_image.cols() == this->_raw_image.cols() &&
+        (this->_dithered_image == this->_raw_image).all()) {
+      // a copy of the raw image, refer to the raw image instead
+      this->_dithered_image.resize(0, 0);
+    }
 
-    assert(this->_raw_image.rows() == this->_dithered_image.rows());
-    assert(this->_raw_image.cols() == this->_dithered_image.cols());
+    assert(this->_raw_image.rows() == this->dithered_image().rows());
+    assert(this->_raw_image.cols() == this->dithered_image().cols());
 
     {
       size_t size_colorset{0};
@@ -170,9 +182,10 @@ class MapImageCvter : public ::libImageCvt::ImageCvter<true> {
         this->_color_hash.emplace(key, val);
       }
 
-      for (int64_t i = 0; i < this->_dithered_image.size(); i++) {
+      const auto &dithered = this->dithered_image();
+      for (int64_t i = 0; i < dithered.size(); i++) {
         auto it = this->_color_hash.find(
-            convert_unit{this->_dithered_image(i), this->convert_algo()});
+            convert_unit{dithered(i), this->convert_algo()});
         if (it == this->_color_hash.end()) {
           throw std::runtime_error{
               "One or more colors not found in cached colorhash"};
@@ -181,6 +194,10 @@ class MapImageCvter : public ::libImageCvt::ImageCvter<true> {
     }
   }
 
+  /// Sorted colors of both the raw and the dithered image, the distinct
+  /// colors of the raw image are reused if they are extracted already.
+  [[nodiscard]] std::vector<ARGB> colors_to_cache() const noexcept;
+
  public:
   bool save_cache(const char *filename) const noexcept;
   bool examine_cache(const char *filename, uint64_t expected_task_hash,
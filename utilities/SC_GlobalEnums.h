@@ -171,6 +171,10 @@ enum class SCL_errorFlag : int {
   MEMORY_ALLOCATE_FAILED = 0x12,
 
   EXPORT_SCHEM_HAS_INVALID_ENTITY = 0x13,
+  /// The operation is cancelled by the caller, or exceeded its deadline.
+  OPERATION_CANCELLED = 0x14,
+  /// Two structures to diff are not in the same shape.
+  DIFF_STRUCTURE_SHAPE_MISMATCH = 0x15,
 };
 
 enum class SCL_workStatus : int {
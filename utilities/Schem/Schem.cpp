@@ -24,10 +24,14 @@ This file is part of SlopeCraft.
 
 #include <memory.h>
 
+#include <algorithm>
+#include <atomic>
 #include <ctime>
 #include <filesystem>
 #include <iostream>
+#include <unordered_map>
 #include <fmt/format.h>
+#include <omp.h>
 
 #include "../NBTWriter/NBTWriter.h"
 #include "bit_shrink.h"
@@ -44,9 +48,45 @@ void Schem::resize(int64_t x, int64_t y, int64_t z) {
   if (x < 0 || y < 0 || z < 0) {
     return;
   }
+  if (this->chunked) {
+    this->chunks = chunked_blocks{};
+    this->chunked = false;
+  }
   this->xzy.resize(x, z, y);
 }
 
+void Schem::to_chunked() noexcept {
+  if (this->chunked) {
+    return;
+  }
+  this->chunks.from_dense(this->xzy);
+  this->xzy.resize(0, 0, 0);
+  this->chunked = true;
+}
+
+void Schem::compact() noexcept {
+  if (this->chunked) {
+    return;
+  }
+  chunked_blocks temp;
+  temp.from_dense(this->xzy);
+  if (temp.memory_usage() >= this->xzy.size() * sizeof(ele_t)) {
+    return;
+  }
+  this->chunks = std::move(temp);
+  this->xzy.resize(0, 0, 0);
+  this->chunked = true;
+}
+
+void Schem::to_dense() noexcept {
+  if (!this->chunked) {
+    return;
+  }
+  this->chunks.to_dense(this->xzy);
+  this->chunks = chunked_blocks{};
+  this->chunked = false;
+}
+
 std::string Schem::check_size() const noexcept {
   return check_size(this->x_range(), this->y_range(), this->z_range());
 }
@@ -64,6 +104,11 @@ void Schem::stat_blocks(std::vector<size_t> &dest) const noexcept {
   dest.resize(this->palette_size());
   std::fill(dest.begin(), dest.end(), 0);
 
+  if (this->chunked) {
+    this->chunks.stat_blocks(dest);
+    return;
+  }
+
   for (ele_t block_index : *this) {
     assert(block_index < this->palette_size());
     dest[block_index] += 1;
@@ -93,6 +138,9 @@ void Schem::set_block_id(std::span<std::string_view> id) noexcept {
 }
 
 int64_t Schem::non_zero_count() const noexcept {
+  if (this->chunked) {
+    return this->chunks.non_zero_count();
+  }
   int64_t val = 0;
 
   for (int64_t i = 0; i < size(); i++) {
@@ -101,10 +149,22 @@ int64_t Schem::non_zero_count() const noexcept {
   return val;
 }
 
+bool Schem::have_invalid_block_chunked() const noexcept {
+  assert(this->chunked);
+  if (this->chunks.max_block() >= this->palette_size()) {
+    return true;
+  }
+  // elided sections are filled with 0
+  return this->palette_size() <= 0 && this->size() > 0;
+}
+
 bool Schem::have_invalid_block(
     int64_t *first_invalid_block_idx) const noexcept {
-  for (int64_t idx = 0; idx < xzy.size(); idx++) {
-    if (xzy(idx) >= block_id_list.size()) {
+  if (this->chunked && !this->have_invalid_block_chunked()) {
+    return false;
+  }
+  for (int64_t idx = 0; idx < this->size(); idx++) {
+    if ((*this)(idx) >= block_id_list.size()) {
       if (first_invalid_block_idx != nullptr) {
         *first_invalid_block_idx = idx;
       }
@@ -117,10 +177,13 @@ bool Schem::have_invalid_block(
 bool Schem::have_invalid_block(
     int64_t *first_invalid_block_x_pos, int64_t *first_invalid_block_y_pos,
     int64_t *first_invalid_block_z_pos) const noexcept {
+  if (this->chunked && !this->have_invalid_block_chunked()) {
+    return false;
+  }
   for (int64_t y = 0; y < y_range(); y++) {
     for (int64_t z = 0; z < z_range(); z++) {
       for (int64_t x = 0; x < x_range(); x++) {
-        if (this->xzy(x, z, y) >= block_id_list.size()) {
+        if ((*this)(x, y, z) >= block_id_list.size()) {
           if (first_invalid_block_x_pos != nullptr) {
             *first_invalid_block_x_pos = x;
           }
@@ -138,6 +201,139 @@ bool Schem::have_invalid_block(
   return false;
 }
 
+tl::expected<Schem, std::string> Schem::diff(
+    const Schem &old, diff_statistics *stat,
+    std::vector<region> *changed_regions,
+    const diff_progress_callback_t &progress) const noexcept {
+  if (old.x_range() != this->x_range() || old.y_range() != this->y_range() ||
+      old.z_range() != this->z_range()) {
+    return tl::make_unexpected(fmt::format(
+        "Can not diff schems of different shapes, [{}, {}, {}] vs [{}, {}, "
+        "{}]",
+        this->x_range(), this->y_range(), this->z_range(), old.x_range(),
+        old.y_range(), old.z_range()));
+  }
+
+  // map old blocks into the palette of this, unknown ids never match
+  std::vector<ele_t> old_to_new(old.palette_size(), invalid_ele_t);
+  {
+    std::unordered_map<std::string_view, ele_t> index_of_id;
+    index_of_id.reserve(this->palette_size());
+    for (size_t idx = 0; idx < this->palette_size(); idx++) {
+      index_of_id.emplace(this->block_id_list[idx], ele_t(idx));
+    }
+    for (size_t idx = 0; idx < old.palette_size(); idx++) {
+      auto it = index_of_id.find(old.block_id_list[idx]);
+      if (it != index_of_id.end()) {
+        old_to_new[idx] = it->second;
+      }
+    }
+  }
+
+  // block 0 keeps the old block, block k+1 is block k of this
+  Schem ret;
+  ret.MC_major_ver = this->MC_major_ver;
+  ret.MC_data_ver = this->MC_data_ver;
+  ret.block_id_list.reserve(this->palette_size() + 1);
+  ret.block_id_list.emplace_back(keep_block_id);
+  ret.block_id_list.insert(ret.block_id_list.end(),
+                           this->block_id_list.begin(),
+                           this->block_id_list.end());
+  ret.resize(this->x_range(), this->y_range(), this->z_range());
+  ret.set_zero();
+
+  constexpr int64_t w = chunked_blocks::section_width;
+  const std::array<int64_t, 3> sections{(this->x_range() + w - 1) / w,
+                                        (this->y_range() + w - 1) / w,
+                                        (this->z_range() + w - 1) / w};
+  const int64_t section_count = sections[0] * sections[1] * sections[2];
+  std::vector<uint8_t> section_changed(section_count, false);
+
+  std::atomic<int64_t> sections_finished{0};
+  std::atomic<bool> stopped{false};
+  int64_t added{0}, removed{0}, replaced{0};
+  // sections cover disjoint blocks of ret, so they can be written in parallel
+#pragma omp parallel for schedule(dynamic) reduction(+ : added, removed, replaced)
+  for (int64_t sidx = 0; sidx < section_count; sidx++) {
+    if (stopped) {
+      continue;
+    }
+    const int64_t sx = sidx % sections[0];
+    const int64_t sz = (sidx / sections[0]) % sections[2];
+    const int64_t sy = sidx / (sections[0] * sections[2]);
+    const int64_t x_end = std::min((sx + 1) * w, this->x_range());
+    const int64_t y_end = std::min((sy + 1) * w, this->y_range());
+    const int64_t z_end = std::min((sz + 1) * w, this->z_range());
+    bool changed = false;
+    for (int64_t y = sy * w; y < y_end; y++) {
+      for (int64_t z = sz * w; z < z_end; z++) {
+        for (int64_t x = sx * w; x < x_end; x++) {
+          const ele_t cur = (*this)(x, y, z);
+          const ele_t prev = old_to_new[old(x, y, z)];
+          if (cur == prev) {
+            continue;
+          }
+          changed = true;
+          if (old(x, y, z) == 0) {
+            added++;
+          } else if (cur == 0) {
+            removed++;
+          } else {
+            replaced++;
+          }
+          ret(x, y, z) = ele_t(cur + 1);
+        }
+      }
+    }
+    section_changed[sidx] = changed;
+
+    const int64_t finished = ++sections_finished;
+    // the master thread is the caller
+    if (progress && omp_get_thread_num() == 0 &&
+        !progress(finished, section_count)) {
+      stopped = true;
+    }
+  }
+  if (stopped) {
+    return tl::make_unexpected(std::string{"Diff is stopped."});
+  }
+
+  if (stat != nullptr) {
+    stat->added = added;
+    stat->removed = removed;
+    stat->replaced = replaced;
+  }
+
+  if (changed_regions != nullptr) {
+    changed_regions->clear();
+    for (int64_t sidx = 0; sidx < section_count; sidx++) {
+      if (!section_changed[sidx]) {
+        continue;
+      }
+      const int64_t sx = sidx % sections[0];
+      const int64_t sz = (sidx / sections[0]) % sections[2];
+      const int64_t sy = sidx / (sections[0] * sections[2]);
+      // merge with the previous section in the same row along x
+      if (sx > 0 && section_changed[sidx - 1]) {
+        auto &last = changed_regions->back();
+        last.shape_xyz[0] = std::min((sx + 1) * w, this->x_range()) -
+                            last.offset_xyz[0];
+        continue;
+      }
+      region r;
+      r.offset_xyz = {sx * w, sy * w, sz * w};
+      r.shape_xyz = {std::min(w, this->x_range() - sx * w),
+                     std::min(w, this->y_range() - sy * w),
+                     std::min(w, this->z_range() - sz * w)};
+      changed_regions->emplace_back(r);
+    }
+  }
+
+  // most blocks are kept in a delta
+  ret.compact();
+  return ret;
+}
+
 enum class __mushroom_type : uint8_t {
   not_mushroom = 0,
   red_mushroom = 1,
@@ -158,6 +354,9 @@ void Schem::process_mushroom_states() noexcept {
   std::array<ele_t, 64> u6_to_ele_stem;
   u6_to_ele_stem.fill(invalid_ele_t);
 
+  const bool was_chunked = this->chunked;
+  this->to_dense();
+
   // find exisiting mushroom blocks
   for (ele_t idx = 0; idx < ele_t(this->palette_size()); idx++) {
     const auto &block_id = this->block_id_list[idx];
@@ -287,6 +486,9 @@ void Schem::process_mushroom_states() noexcept {
       }
     }
   }
+  if (was_chunked) {
+    this->to_chunked();
+  }
   return;
 }
 
@@ -411,8 +613,14 @@ Schem::export_litematic(std::string_view filename,
 
       // write 3D
       std::vector<uint64_t> shrinked;
-      shrink_bits(this->xzy.data(), xzy.size(), this->palette_size(),
-                  &shrinked);
+      {
+        bit_shrinker shrinker{size_t(this->size()), int(this->palette_size()),
+                              &shrinked};
+        this->for_each_row(
+            [&shrinker](int64_t, int64_t, std::span<const ele_t> row) {
+              shrinker.push(row);
+            });
+      }
 
       lite.writeLongArrayHead("BlockStates", shrinked.size());
       {
@@ -550,49 +758,34 @@ Schem::export_structure(std::string_view filename,
   }
   // end a list
 
-  int64_t blocks_to_write = 0;
-
-  for (int64_t idx = 0; idx < xzy.size(); idx++) {
-    if (xzy(idx) == number_of_air) {
-      if (!is_air_structure_void) {
-        blocks_to_write++;
-      }
-    } else {
-      blocks_to_write++;
-    }
+  int64_t blocks_to_write = this->size();
+  if (is_air_structure_void && number_of_air < this->palette_size()) {
+    blocks_to_write -= this->stat_blocks()[number_of_air];
   }
+
   file.writeListHead("blocks", NBT::Compound, blocks_to_write);
   {
-    for (int64_t y = 0; y < y_range(); y++) {
-      for (int64_t z = 0; z < z_range(); z++) {
-        for (int64_t x = 0; x < x_range(); x++) {
-          bool should_write = false;
-
-          if (xzy(x, z, y) == number_of_air) {
-            if (!is_air_structure_void) {
-              should_write = true;
-            }
-          } else {
-            should_write = true;
-          }
-
-          if (should_write) {
-            file.writeCompound("This should never be shown");
-            {
-              file.writeListHead("pos", NBT::Int, 3);
-              {
-                file.writeInt("This should never be shown", x);
-                file.writeInt("This should never be shown", y);
-                file.writeInt("This should never be shown", z);
-              }
-              file.writeInt("state", (*this)(x, y, z));
-            }
-            file.endCompound();
-            // finish the block
+    this->for_each_row([&file, number_of_air, is_air_structure_void](
+                           int64_t y, int64_t z,
+                           std::span<const ele_t> row) {
+      for (int64_t x = 0; x < int64_t(row.size()); x++) {
+        if (row[x] == number_of_air && is_air_structure_void) {
+          continue;
+        }
+        file.writeCompound("This should never be shown");
+        {
+          file.writeListHead("pos", NBT::Int, 3);
+          {
+            file.writeInt("This should never be shown", x);
+            file.writeInt("This should never be shown", y);
+            file.writeInt("This should never be shown", z);
           }
+          file.writeInt("state", row[x]);
         }
+        file.endCompound();
+        // finish the block
       }
-    }
+    });
     // finish writing the whole 3D array
 
     // write entities
@@ -708,8 +901,12 @@ tl::expected<void, std::pair<SCL_errorFlag, std::string>> Schem::export_WESchem(
   };
 
   std::vector<uint8_t> blockdata;
-  ::shrink_bytes_weSchem(xzy.data(), xzy.size(), block_id_list.size(),
-                         &blockdata);
+  blockdata.reserve(this->size());
+  this->for_each_row([this, &blockdata](int64_t, int64_t,
+                                        std::span<const ele_t> row) {
+    ::shrink_bytes_weSchem_append(row.data(), row.size(),
+                                  this->block_id_list.size(), &blockdata);
+  });
   auto write_blocks = [&](const char *key) {
     file.writeByteArrayHead(key, blockdata.size());
     {
@@ -35,10 +35,12 @@ This file is part of SlopeCraft.
 #include <cereal/types/string.hpp>
 #include <cereal/types/vector.hpp>
 #include <exception>
+#include <functional>
 #include <concepts>
 
 #include "SC_GlobalEnums.h"
 #include "entity.h"
+#include "chunked_blocks.h"
 
 namespace libSchem {
 // template <int64_t max_block_count = 256>
@@ -64,6 +66,23 @@ struct WorldEditSchem_info {
   uint64_t date;  //< Miliseconds since 1970
 };
 
+/// An axis-aligned box of blocks.
+struct region {
+  std::array<int64_t, 3> offset_xyz{0, 0, 0};
+  std::array<int64_t, 3> shape_xyz{0, 0, 0};
+};
+
+/// Blocks changed between 2 schems, block 0 is taken as air.
+struct diff_statistics {
+  int64_t added{0};     ///< air -> block
+  int64_t removed{0};   ///< block -> air
+  int64_t replaced{0};  ///< block -> another block
+
+  [[nodiscard]] inline int64_t changed() const noexcept {
+    return this->added + this->removed + this->replaced;
+  }
+};
+
 class Schem {
  public:
   // using ele_t = std::conditional_t<(max_block_count > 256), uint16_t,
@@ -77,6 +96,10 @@ class Schem {
   /// best storage is [y][z][x] row-major
   Eigen::Tensor<ele_t, 3> xzy;
 
+  /// Sparse storage used when the schem is chunked, xzy is empty then.
+  chunked_blocks chunks;
+  bool chunked{false};
+
   std::vector<std::string> block_id_list;
 
   ::SCL_gameVersion MC_major_ver;
@@ -88,6 +111,7 @@ class Schem {
   Schem() { xzy.resize(0, 0, 0); }
   Schem(const Schem &) = delete;
   Schem(Schem &&) = default;
+  Schem &operator=(Schem &&) = default;
   Schem(int64_t x, int64_t y, int64_t z) {
     xzy.resize(x, y, z);
     xzy.setZero();
@@ -96,11 +120,35 @@ class Schem {
   std::string check_size() const noexcept;
   static std::string check_size(int64_t x, int64_t y, int64_t z) noexcept;
 
-  inline void set_zero() noexcept { xzy.setZero(); }
+  inline void set_zero() noexcept {
+    if (this->chunked) {
+      this->chunks.set_zero();
+      return;
+    }
+    xzy.setZero();
+  }
 
-  inline ele_t *data() noexcept { return xzy.data(); }
+  /// Whether blocks are stored in 16x16x16 sections with all-air sections
+  /// elided. Only the const accessors, statistics and exporters work in this
+  /// mode, call to_dense() before writing blocks.
+  inline bool is_chunked() const noexcept { return this->chunked; }
+
+  /// Move blocks into chunked storage and free the dense tensor.
+  void to_chunked() noexcept;
+  /// Move blocks back into the dense tensor.
+  void to_dense() noexcept;
+  /// Use chunked storage only if it takes less memory than the dense one.
+  void compact() noexcept;
+
+  inline ele_t *data() noexcept {
+    assert(!this->chunked);
+    return xzy.data();
+  }
 
-  inline const ele_t *data() const noexcept { return xzy.data(); }
+  inline const ele_t *data() const noexcept {
+    assert(!this->chunked);
+    return xzy.data();
+  }
 
   void resize(int64_t x, int64_t y, int64_t z);
 
@@ -109,7 +157,10 @@ class Schem {
                                                    this->MC_data_ver);
   }
 
-  inline const auto &tensor() const noexcept { return this->xzy; }
+  inline const auto &tensor() const noexcept {
+    assert(!this->chunked);
+    return this->xzy;
+  }
 
   inline const auto &palette() const noexcept { return this->block_id_list; }
 
@@ -117,47 +168,75 @@ class Schem {
     assert(x >= 0 && x < this->x_range());
     assert(y >= 0 && y < this->y_range());
     assert(z >= 0 && z < this->z_range());
+    assert(!this->chunked);
     return xzy(x, z, y);
   }
 
-  inline const ele_t &operator()(int64_t x, int64_t y,
-                                 int64_t z) const noexcept {
+  inline ele_t operator()(int64_t x, int64_t y, int64_t z) const noexcept {
     assert(x >= 0 && x < this->x_range());
     assert(y >= 0 && y < this->y_range());
     assert(z >= 0 && z < this->z_range());
+    if (this->chunked) {
+      return this->chunks.at(x, y, z);
+    }
     return xzy(x, z, y);
   }
 
+  /// Index of a block in data(), so that blocks can be written with strides.
+  inline int64_t index_of(int64_t x, int64_t y, int64_t z) const noexcept {
+    assert(!this->chunked);
+    return x + this->xzy.dimension(0) * (z + this->xzy.dimension(1) * y);
+  }
+
   inline ele_t &operator()(int64_t idx) noexcept {
     assert(idx >= 0 && idx < this->size());
+    assert(!this->chunked);
     return xzy(idx);
   }
 
-  inline const ele_t &operator()(int64_t idx) const noexcept {
+  inline ele_t operator()(int64_t idx) const noexcept {
     assert(idx >= 0 && idx < this->size());
+    if (this->chunked) {
+      const int64_t x = idx % this->x_range();
+      const int64_t z = (idx / this->x_range()) % this->z_range();
+      const int64_t y = idx / (this->x_range() * this->z_range());
+      return this->chunks.at(x, y, z);
+    }
     return xzy(idx);
   }
 
   inline const char *id_at(int64_t x, int64_t y, int64_t z) const noexcept {
-    assert(x >= 0 && x < this->x_range());
-    assert(y >= 0 && y < this->y_range());
-    assert(z >= 0 && z < this->z_range());
-    return block_id_list[xzy(x, z, y)].c_str();
+    return block_id_list[(*this)(x, y, z)].c_str();
   }
 
   inline const char *id_at(int64_t idx) const noexcept {
-    assert(idx >= 0 && idx < this->size());
-    return block_id_list[xzy(idx)].c_str();
+    return block_id_list[(*this)(idx)].c_str();
   }
 
-  inline ele_t *begin() noexcept { return xzy.data(); }
+  inline ele_t *begin() noexcept {
+    assert(!this->chunked);
+    return xzy.data();
+  }
 
-  inline const ele_t *begin() const noexcept { return xzy.data(); }
+  inline const ele_t *begin() const noexcept {
+    assert(!this->chunked);
+    return xzy.data();
+  }
 
-  inline ele_t *end() noexcept { return xzy.data() + xzy.size(); }
-  inline const ele_t *end() const noexcept { return xzy.data() + xzy.size(); }
+  inline ele_t *end() noexcept {
+    assert(!this->chunked);
+    return xzy.data() + xzy.size();
+  }
+
+  inline const ele_t *end() const noexcept {
+    assert(!this->chunked);
+    return xzy.data() + xzy.size();
+  }
 
   inline void fill(const ele_t _) noexcept {
+    if (this->chunked) {
+      this->to_dense();
+    }
     for (uint16_t &val : *this) {
       val = _;
     }
@@ -170,13 +249,21 @@ class Schem {
     return buf;
   }
 
-  inline int64_t x_range() const noexcept { return xzy.dimension(0); }
-  inline int64_t y_range() const noexcept { return xzy.dimension(2); }
-  inline int64_t z_range() const noexcept { return xzy.dimension(1); }
+  inline int64_t x_range() const noexcept {
+    return this->chunked ? this->chunks.x_range() : xzy.dimension(0);
+  }
+  inline int64_t y_range() const noexcept {
+    return this->chunked ? this->chunks.y_range() : xzy.dimension(2);
+  }
+  inline int64_t z_range() const noexcept {
+    return this->chunked ? this->chunks.z_range() : xzy.dimension(1);
+  }
 
   inline size_t palette_size() const noexcept { return block_id_list.size(); }
 
-  inline int64_t size() const noexcept { return xzy.size(); }
+  inline int64_t size() const noexcept {
+    return this->chunked ? this->chunks.size() : xzy.size();
+  }
 
   int64_t non_zero_count() const noexcept;
 
@@ -228,6 +315,37 @@ class Schem {
                           int64_t *first_invalid_block_y_pos,
                           int64_t *first_invalid_block_z_pos) const noexcept;
 
+  /// Id of the cells that a delta schem keeps unchanged. Vanilla structure
+  /// blocks and litematica don't place it when pasting.
+  static constexpr std::string_view keep_block_id = "minecraft:structure_void";
+
+  /// Called with finished and total sections on the calling thread, return
+  /// false to stop.
+  using diff_progress_callback_t =
+      std::function<bool(int64_t sections_finished, int64_t sections_total)>;
+
+  /**
+   * \brief Compare with an older schem of the same shape.
+   *
+   * \note Blocks are compared by id, so the palettes may differ. Block 0 of the
+   * result is keep_block_id, which fills all unchanged cells. It's followed by
+   * the palette of this, so removed blocks are written as explicit air (block
+   * 0 of this). Pasting the delta over the old build with structure void
+   * skipped gives this build. Don't export it with air as structure void.
+   * 16x16x16 sections are compared in parallel, and the result is compacted.
+   *
+   * \param stat Count of changed blocks, can be nullptr.
+   * \param changed_regions Boxes that cover all changed blocks, made of
+   * sections merged along x. Can be nullptr.
+   * \param progress Can be empty.
+   * \return The delta schem, or the error if shapes mismatch or progress
+   * returned false.
+   */
+  [[nodiscard]] tl::expected<Schem, std::string> diff(
+      const Schem &old, diff_statistics *stat = nullptr,
+      std::vector<region> *changed_regions = nullptr,
+      const diff_progress_callback_t &progress = {}) const noexcept;
+
   void process_mushroom_states() noexcept;
 
   void process_mushroom_states_fast() noexcept;
@@ -297,9 +415,33 @@ class Schem {
  private:
   friend class cereal::access;
 
+  bool have_invalid_block_chunked() const noexcept;
+
   tl::expected<void, std::pair<SCL_errorFlag, std::string>> pre_check(
       std::string_view filename, std::string_view extension) const noexcept;
 
+  /// Call fun(y, z, row) for each row of blocks along x, in the order of
+  /// [x][z][y] col-major. Works both in dense and chunked mode.
+  template <class fun_t>
+  void for_each_row(fun_t &&fun) const noexcept {
+    std::vector<ele_t> buffer;
+    if (this->chunked) {
+      buffer.resize(this->x_range());
+    }
+    for (int64_t y = 0; y < this->y_range(); y++) {
+      for (int64_t z = 0; z < this->z_range(); z++) {
+        if (this->chunked) {
+          this->chunks.decode_row(y, z, buffer);
+          fun(y, z, std::span<const ele_t>{buffer});
+        } else {
+          fun(y, z,
+              std::span<const ele_t>{&this->xzy(0, z, y),
+                                     size_t(this->x_range())});
+        }
+      }
+    }
+  }
+
   template <class archive>
   void save(archive &ar) const {
     ar(this->MC_major_ver);
@@ -307,6 +449,13 @@ class Schem {
     ar(this->block_id_list);
     const int64_t x{this->x_range()}, y{this->y_range()}, z{this->z_range()};
     ar(x, y, z);
+    if (this->chunked) {
+      // keep the same format as dense schem
+      Eigen::Tensor<ele_t, 3> temp;
+      this->chunks.to_dense(temp);
+      ar(cereal::binary_data(temp.data(), temp.size() * sizeof(uint16_t)));
+      return;
+    }
     ar(cereal::binary_data(this->xzy.data(),
                            this->xzy.size() * sizeof(uint16_t)));
   }
@@ -327,6 +476,8 @@ class Schem {
     this->resize(x, y, z);
     ar(cereal::binary_data(this->xzy.data(),
                            this->xzy.size() * sizeof(uint16_t)));
+    // blocks are always saved densely
+    this->compact();
   }
 };
 
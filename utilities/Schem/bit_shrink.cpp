@@ -154,19 +154,59 @@ bool process_block_id(
   return ok;
 }
 
+bit_shrinker::bit_shrinker(const size_t src_count, const int block_types,
+                           std::vector<uint64_t> *const dest) noexcept
+    : dest(dest) {
+  if (dest == nullptr || src_count <= 0 || block_types <= 1) {
+    return;
+  }
+  this->bits_per_element = std::ceil(std::log2(block_types));
+  assert(this->bits_per_element <= 16);
+
+  const size_t total_bits = this->bits_per_element * src_count;
+  dest->assign(libSchem::ceil_up_to(total_bits, 64) / 64, 0);
+}
+
+void bit_shrinker::push(std::span<const uint16_t> src) noexcept {
+  if (this->bits_per_element <= 0) {
+    return;
+  }
+  constexpr size_t bits_of_block = 8 * sizeof(uint64_t);
+  const uint64_t value_mask = (1ULL << this->bits_per_element) - 1;
+  uint64_t *const data = this->dest->data();
+  for (const uint16_t src_val : src) {
+    const uint64_t value = src_val & value_mask;
+    const size_t block_idx = this->pushed_bits / bits_of_block;
+    const size_t offset = this->pushed_bits % bits_of_block;
+    assert(block_idx < this->dest->size());
+    data[block_idx] |= value << offset;
+    if (offset + this->bits_per_element > bits_of_block) {
+      data[block_idx + 1] |= value >> (bits_of_block - offset);
+    }
+    this->pushed_bits += this->bits_per_element;
+  }
+}
+
 void shrink_bytes_weSchem(const uint16_t *src, const size_t src_count,
                           const int palette_max,
                           std::vector<uint8_t> *const dest) noexcept {
+  dest->clear();
+  shrink_bytes_weSchem_append(src, src_count, palette_max, dest);
+}
+
+void shrink_bytes_weSchem_append(const uint16_t *src, const size_t src_count,
+                                 const int palette_max,
+                                 std::vector<uint8_t> *const dest) noexcept {
   if (palette_max <= 128) {
-    dest->resize(src_count);
+    const size_t begin = dest->size();
+    dest->resize(begin + src_count);
     for (size_t idx = 0; idx < src_count; idx++) {
-      dest->at(idx) = src[idx] & 0xFF;
+      (*dest)[begin + idx] = src[idx] & 0xFF;
     }
     return;
   }
 
-  dest->reserve(src_count * 2);
-  dest->clear();
+  dest->reserve(dest->size() + src_count * 2);
 
   for (size_t idx = 0; idx < src_count; idx++) {
     uint16_t temp = src[idx];
@@ -180,4 +220,4 @@ void shrink_bytes_weSchem(const uint16_t *src, const size_t src_count,
       dest->emplace_back(byte);
     }
   }
-}
\ No newline at end of file
+}
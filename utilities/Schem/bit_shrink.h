@@ -24,6 +24,7 @@ This file is part of SlopeCraft.
 #define SCHEM_BITSHRINK_H
 
 #include <stdint.h>
+#include <span>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -41,6 +42,20 @@ void shrink_bits(const uint16_t *const src, const size_t src_count,
                  const int block_types,
                  std::vector<uint64_t> *const dest) noexcept;
 
+/// Same as shrink_bits, but blocks can be pushed piece by piece.
+class bit_shrinker {
+ private:
+  std::vector<uint64_t> *const dest;
+  int bits_per_element{0};
+  size_t pushed_bits{0};
+
+ public:
+  bit_shrinker(const size_t src_count, const int block_types,
+               std::vector<uint64_t> *const dest) noexcept;
+
+  void push(std::span<const uint16_t> src) noexcept;
+};
+
 inline auto to_pure_block_id(std::string_view id) noexcept {
   const size_t first_of_left_branket = id.find_first_of('[');
   if (first_of_left_branket == id.npos) {
@@ -58,6 +73,11 @@ void shrink_bytes_weSchem(const uint16_t *src, const size_t src_count,
                           const int palette_max,
                           std::vector<uint8_t> *const dest) noexcept;
 
+/// Same as shrink_bytes_weSchem, but dest is not cleared.
+void shrink_bytes_weSchem_append(const uint16_t *src, const size_t src_count,
+                                 const int palette_max,
+                                 std::vector<uint8_t> *const dest) noexcept;
+
 class __mushroom_sides {
  private:
   uint8_t val{0b111111};
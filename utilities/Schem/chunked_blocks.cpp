@@ -0,0 +1,277 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+#include "chunked_blocks.h"
+
+#include <algorithm>
+#include <bit>
+
+using namespace libSchem;
+
+void chunked_blocks::section::encode(
+    std::span<const ele_t, section_volume> blocks) noexcept {
+  std::array<ele_t, section_volume> sorted;
+  std::copy(blocks.begin(), blocks.end(), sorted.begin());
+  std::sort(sorted.begin(), sorted.end());
+  const auto unique_end = std::unique(sorted.begin(), sorted.end());
+
+  if (unique_end - sorted.begin() == 1 && sorted[0] == 0) {
+    // all air, elide this section
+    *this = section{};
+    return;
+  }
+
+  this->local_palette.assign(sorted.begin(), unique_end);
+  this->non_zero = int32_t(
+      std::count_if(blocks.begin(), blocks.end(), [](ele_t b) { return b; }));
+  this->packed.clear();
+  if (this->local_palette.size() <= 1) {
+    this->bits = 0;
+    return;
+  }
+
+  this->bits = uint8_t(std::bit_width(this->local_palette.size() - 1));
+  const int per_u64 = 64 / this->bits;
+  this->packed.resize((section_volume + per_u64 - 1) / per_u64, 0);
+  for (int idx = 0; idx < section_volume; idx++) {
+    const uint64_t local_id =
+        std::lower_bound(this->local_palette.begin(),
+                         this->local_palette.end(), blocks[idx]) -
+        this->local_palette.begin();
+    this->packed[idx / per_u64] |= local_id << ((idx % per_u64) * this->bits);
+  }
+}
+
+void chunked_blocks::section::decode(
+    std::span<ele_t, section_volume> blocks) const noexcept {
+  if (this->is_empty()) {
+    std::fill(blocks.begin(), blocks.end(), 0);
+    return;
+  }
+  if (this->bits == 0) {
+    std::fill(blocks.begin(), blocks.end(), this->local_palette[0]);
+    return;
+  }
+  for (int idx = 0; idx < section_volume; idx++) {
+    blocks[idx] = this->local_palette[this->index_at(idx)];
+  }
+}
+
+void chunked_blocks::section::set(int local_idx, ele_t value) noexcept {
+  const ele_t old = this->at(local_idx);
+  if (old == value) {
+    return;
+  }
+
+  const auto it = std::lower_bound(this->local_palette.begin(),
+                                   this->local_palette.end(), value);
+  const bool in_palette = (it != this->local_palette.end()) && (*it == value);
+  if (!in_palette || this->bits == 0) {
+    // the palette grows, so the indices must be repacked
+    std::array<ele_t, section_volume> blocks;
+    this->decode(blocks);
+    blocks[local_idx] = value;
+    this->encode(blocks);
+    return;
+  }
+
+  const int per_u64 = 64 / this->bits;
+  const int offset = (local_idx % per_u64) * this->bits;
+  const uint64_t mask = ((uint64_t{1} << this->bits) - 1) << offset;
+  uint64_t &word = this->packed[local_idx / per_u64];
+  word = (word & ~mask) |
+         (uint64_t(it - this->local_palette.begin()) << offset);
+
+  this->non_zero += int32_t(value != 0) - int32_t(old != 0);
+  if (this->non_zero == 0) {
+    *this = section{};
+  }
+}
+
+void chunked_blocks::resize(int64_t x, int64_t y, int64_t z) noexcept {
+  if (x < 0 || y < 0 || z < 0) {
+    return;
+  }
+  this->shape_xyz = {x, y, z};
+  for (size_t dim = 0; dim < 3; dim++) {
+    this->sections_xyz[dim] =
+        (this->shape_xyz[dim] + section_width - 1) / section_width;
+  }
+  this->sections.clear();
+  this->sections.resize(this->sections_xyz[0] * this->sections_xyz[1] *
+                        this->sections_xyz[2]);
+}
+
+void chunked_blocks::set(int64_t x, int64_t y, int64_t z,
+                         ele_t value) noexcept {
+  assert(x >= 0 && x < this->x_range());
+  assert(y >= 0 && y < this->y_range());
+  assert(z >= 0 && z < this->z_range());
+  section &s = this->sections[this->section_index(
+      x / section_width, y / section_width, z / section_width)];
+  s.set(section::local_index(x % section_width, y % section_width,
+                             z % section_width),
+        value);
+}
+
+size_t chunked_blocks::memory_usage() const noexcept {
+  size_t ret = 0;
+  for (const auto &s : this->sections) {
+    ret += s.memory_usage();
+  }
+  return ret;
+}
+
+int64_t chunked_blocks::non_zero_count() const noexcept {
+  int64_t val = 0;
+  for (const auto &s : this->sections) {
+    val += s.non_zero_count();
+  }
+  return val;
+}
+
+void chunked_blocks::stat_blocks(std::span<size_t> dest) const noexcept {
+  std::fill(dest.begin(), dest.end(), 0);
+  if (dest.empty()) {
+    return;
+  }
+
+  std::vector<int32_t> local_count;
+  local_count.reserve(section_volume);
+  for (const auto &s : this->sections) {
+    if (s.is_empty()) {
+      continue;
+    }
+    const auto &local_palette = s.palette();
+    if (s.bits_per_index() == 0) {
+      assert(local_palette[0] < dest.size());
+      dest[local_palette[0]] += section_volume;
+      continue;
+    }
+
+    local_count.assign(local_palette.size(), 0);
+    for (int idx = 0; idx < section_volume; idx++) {
+      local_count[s.index_at(idx)]++;
+    }
+    // zeros are counted later, because blocks out of range are padded by 0
+    for (size_t lid = 0; lid < local_palette.size(); lid++) {
+      if (local_palette[lid] == 0) {
+        continue;
+      }
+      assert(local_palette[lid] < dest.size());
+      dest[local_palette[lid]] += local_count[lid];
+    }
+  }
+  dest[0] = size_t(this->size() - this->non_zero_count());
+}
+
+chunked_blocks::ele_t chunked_blocks::max_block() const noexcept {
+  ele_t ret = 0;
+  for (const auto &s : this->sections) {
+    if (!s.is_empty()) {
+      ret = std::max(ret, s.palette().back());
+    }
+  }
+  return ret;
+}
+
+void chunked_blocks::decode_row(int64_t y, int64_t z,
+                                std::span<ele_t> dest) const noexcept {
+  assert(int64_t(dest.size()) >= this->x_range());
+  const int64_t sy = y / section_width;
+  const int64_t sz = z / section_width;
+  for (int64_t sx = 0; sx < this->sections_xyz[0]; sx++) {
+    const section &s = this->sections[this->section_index(sx, sy, sz)];
+    const int64_t x_begin = sx * section_width;
+    const int64_t x_end = std::min(x_begin + section_width, this->x_range());
+    if (s.is_empty()) {
+      std::fill(dest.begin() + x_begin, dest.begin() + x_end, 0);
+      continue;
+    }
+    for (int64_t x = x_begin; x < x_end; x++) {
+      dest[x] = s.at(section::local_index(x - x_begin, y % section_width,
+                                          z % section_width));
+    }
+  }
+}
+
+void chunked_blocks::from_dense(const Eigen::Tensor<ele_t, 3> &xzy) noexcept {
+  this->resize(xzy.dimension(0), xzy.dimension(2), xzy.dimension(1));
+
+  std::array<ele_t, section_volume> blocks;
+  for (int64_t sy = 0; sy < this->sections_xyz[1]; sy++) {
+    for (int64_t sz = 0; sz < this->sections_xyz[2]; sz++) {
+      for (int64_t sx = 0; sx < this->sections_xyz[0]; sx++) {
+        blocks.fill(0);
+        const int64_t x_begin = sx * section_width;
+        const int64_t x_count =
+            std::min(section_width, this->x_range() - x_begin);
+        for (int64_t ly = 0; ly < section_width; ly++) {
+          const int64_t y = sy * section_width + ly;
+          if (y >= this->y_range()) {
+            break;
+          }
+          for (int64_t lz = 0; lz < section_width; lz++) {
+            const int64_t z = sz * section_width + lz;
+            if (z >= this->z_range()) {
+              break;
+            }
+            const ele_t *src = &xzy(x_begin, z, y);
+            std::copy(src, src + x_count,
+                      blocks.begin() + section::local_index(0, ly, lz));
+          }
+        }
+        this->sections[this->section_index(sx, sy, sz)].encode(blocks);
+      }
+    }
+  }
+}
+
+void chunked_blocks::to_dense(Eigen::Tensor<ele_t, 3> &xzy) const noexcept {
+  xzy.resize(this->x_range(), this->z_range(), this->y_range());
+
+  std::array<ele_t, section_volume> blocks;
+  for (int64_t sy = 0; sy < this->sections_xyz[1]; sy++) {
+    for (int64_t sz = 0; sz < this->sections_xyz[2]; sz++) {
+      for (int64_t sx = 0; sx < this->sections_xyz[0]; sx++) {
+        this->sections[this->section_index(sx, sy, sz)].decode(blocks);
+        const int64_t x_begin = sx * section_width;
+        const int64_t x_count =
+            std::min(section_width, this->x_range() - x_begin);
+        for (int64_t ly = 0; ly < section_width; ly++) {
+          const int64_t y = sy * section_width + ly;
+          if (y >= this->y_range()) {
+            break;
+          }
+          for (int64_t lz = 0; lz < section_width; lz++) {
+            const int64_t z = sz * section_width + lz;
+            if (z >= this->z_range()) {
+              break;
+            }
+            const auto src = blocks.begin() + section::local_index(0, ly, lz);
+            std::copy(src, src + x_count, &xzy(x_begin, z, y));
+          }
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,190 @@
+/*
+ Copyright © 2021-2023  TokiNoBug
+This file is part of SlopeCraft.
+
+    SlopeCraft is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SlopeCraft is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SlopeCraft. If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/SlopeCraft/SlopeCraft
+    bilibili:https://space.bilibili.com/351429231
+*/
+
+#ifndef SCHEM_CHUNKED_BLOCKS_H
+#define SCHEM_CHUNKED_BLOCKS_H
+
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <span>
+#include <vector>
+#include <unsupported/Eigen/CXX11/Tensor>
+
+namespace libSchem {
+
+/// Sparse storage of a 3D block array. The volume is split into 16x16x16
+/// sections, each section stores a local palette and bit-packed indices into
+/// it. Sections that contain only block 0 (air) are not stored at all.
+class chunked_blocks {
+ public:
+  using ele_t = uint16_t;
+  static constexpr int64_t section_width = 16;
+  static constexpr int64_t section_volume =
+      section_width * section_width * section_width;
+
+  class section {
+   private:
+    /// Empty palette means that the whole section is air.
+    std::vector<ele_t> local_palette;
+    /// Count of blocks that are not 0 in this section.
+    int32_t non_zero{0};
+    /// Bits per index, 0 if the palette has only 1 element.
+    uint8_t bits{0};
+    /// Indices never cross the boundary of uint64_t
+    std::vector<uint64_t> packed;
+
+   public:
+    /// Local index of a block, [x][z][y] col-major like Schem.
+    static constexpr int local_index(int64_t x, int64_t y, int64_t z) noexcept {
+      return int(x + section_width * (z + section_width * y));
+    }
+
+    [[nodiscard]] inline bool is_empty() const noexcept {
+      return this->local_palette.empty();
+    }
+    [[nodiscard]] inline int32_t non_zero_count() const noexcept {
+      return this->non_zero;
+    }
+    [[nodiscard]] inline const auto &palette() const noexcept {
+      return this->local_palette;
+    }
+    [[nodiscard]] inline int bits_per_index() const noexcept {
+      return this->bits;
+    }
+
+    [[nodiscard]] inline ele_t at(int local_idx) const noexcept {
+      assert(local_idx >= 0 && local_idx < section_volume);
+      if (this->is_empty()) {
+        return 0;
+      }
+      if (this->bits == 0) {
+        return this->local_palette[0];
+      }
+      return this->local_palette[this->index_at(local_idx)];
+    }
+
+    /// Index in local palette
+    [[nodiscard]] inline int index_at(int local_idx) const noexcept {
+      assert(this->bits > 0);
+      const int per_u64 = 64 / this->bits;
+      const uint64_t word = this->packed[local_idx / per_u64];
+      const int offset = (local_idx % per_u64) * this->bits;
+      return int((word >> offset) & ((uint64_t{1} << this->bits) - 1));
+    }
+
+    /// Build palette and indices from all blocks of this section.
+    void encode(std::span<const ele_t, section_volume> blocks) noexcept;
+    void decode(std::span<ele_t, section_volume> blocks) const noexcept;
+
+    void set(int local_idx, ele_t value) noexcept;
+
+    [[nodiscard]] inline size_t memory_usage() const noexcept {
+      return sizeof(section) + this->local_palette.capacity() * sizeof(ele_t) +
+             this->packed.capacity() * sizeof(uint64_t);
+    }
+  };
+
+ private:
+  std::array<int64_t, 3> shape_xyz{0, 0, 0};
+  /// Section count in x, y and z
+  std::array<int64_t, 3> sections_xyz{0, 0, 0};
+  std::vector<section> sections;
+
+ public:
+  chunked_blocks() = default;
+  chunked_blocks(int64_t x, int64_t y, int64_t z) { this->resize(x, y, z); }
+
+  /// Reshape and set all blocks to 0
+  void resize(int64_t x, int64_t y, int64_t z) noexcept;
+
+  inline void set_zero() noexcept {
+    for (auto &s : this->sections) {
+      s = section{};
+    }
+  }
+
+  [[nodiscard]] inline int64_t x_range() const noexcept {
+    return this->shape_xyz[0];
+  }
+  [[nodiscard]] inline int64_t y_range() const noexcept {
+    return this->shape_xyz[1];
+  }
+  [[nodiscard]] inline int64_t z_range() const noexcept {
+    return this->shape_xyz[2];
+  }
+  [[nodiscard]] inline int64_t size() const noexcept {
+    return this->x_range() * this->y_range() * this->z_range();
+  }
+
+  [[nodiscard]] inline int64_t section_index(int64_t sx, int64_t sy,
+                                             int64_t sz) const noexcept {
+    return sx + this->sections_xyz[0] * (sz + this->sections_xyz[2] * sy);
+  }
+
+  [[nodiscard]] inline const section &section_of(int64_t x, int64_t y,
+                                                 int64_t z) const noexcept {
+    return this->sections[this->section_index(
+        x / section_width, y / section_width, z / section_width)];
+  }
+
+  [[nodiscard]] inline ele_t at(int64_t x, int64_t y,
+                                int64_t z) const noexcept {
+    assert(x >= 0 && x < this->x_range());
+    assert(y >= 0 && y < this->y_range());
+    assert(z >= 0 && z < this->z_range());
+    return this->section_of(x, y, z).at(
+        section::local_index(x % section_width, y % section_width,
+                             z % section_width));
+  }
+
+  void set(int64_t x, int64_t y, int64_t z, ele_t value) noexcept;
+
+  [[nodiscard]] inline const auto &section_list() const noexcept {
+    return this->sections;
+  }
+  [[nodiscard]] inline const auto &section_shape() const noexcept {
+    return this->sections_xyz;
+  }
+
+  /// Bytes taken by all sections, approximately.
+  size_t memory_usage() const noexcept;
+
+  int64_t non_zero_count() const noexcept;
+
+  /// Count of every block, dest must be as long as the global palette.
+  void stat_blocks(std::span<size_t> dest) const noexcept;
+
+  /// The largest block in all sections, 0 if all sections are air.
+  ele_t max_block() const noexcept;
+
+  /// Decode blocks with y and z fixed. dest should be as long as x_range()
+  void decode_row(int64_t y, int64_t z, std::span<ele_t> dest) const noexcept;
+
+  /// The tensor is stored in [x][z][y] col-major, like Schem
+  void from_dense(const Eigen::Tensor<ele_t, 3> &xzy) noexcept;
+  void to_dense(Eigen::Tensor<ele_t, 3> &xzy) const noexcept;
+};
+
+}  // namespace libSchem
+
+#endif  // SCHEM_CHUNKED_BLOCKS_H
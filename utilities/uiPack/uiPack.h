@@ -28,6 +28,9 @@ public:
   void *_uiPtr{nullptr};
   void (*progressRangeSet)(void *, int, int, int){nullptr};
   void (*progressAdd)(void *, int){nullptr};
+  // Polled by long operations, they stop and fail once it returns true
+  void *_cancelPtr{nullptr};
+  bool (*cancelCheck)(void *){nullptr};
 
 public:
   inline void rangeSet(int a, int b, int c) const noexcept {
@@ -38,6 +41,11 @@ public:
     if (progressAdd != nullptr)
       progressAdd(_uiPtr, d);
   }
+  inline bool isCancelled() const noexcept {
+    if (cancelCheck != nullptr)
+      return cancelCheck(_cancelPtr);
+    return false;
+  }
 };
 
 #endif // SCL_UIPACK_UIPACK_H
@@ -139,6 +139,12 @@ int main(int argc, char **argv) {
       ->check(CLI::PositiveNumber)
       ->default_val(std::thread::hardware_concurrency());
 
+  app.add_option("--image-parallel,--ip", input.image_parallel,
+                 "Convert and export multiple images concurrently. auto means "
+                 "only small images are processed concurrently.")
+      ->check(CLI::IsMember({"auto", "on", "off"}))
+      ->default_val("auto");
+
   // gpu
   app.add_flag("--gpu", input.prefer_gpu, "Use gpu as much as possible")
       ->default_val(is_gpu_accessible);
@@ -154,6 +160,10 @@ int main(int argc, char **argv) {
   app.add_flag("--list-gpu", input.list_gpu,
                "List all avaliable GPU platforms and devices and exit")
       ->default_val(false);
+  std::string simd_arch;
+  app.add_option("--simd-arch", simd_arch,
+                 "Force an instruction set for matching colors on cpu, like "
+                 "sse2 or avx2. Detected automatically by default.");
 
   // others
   app.add_flag("--disable-config", input.disable_config,
@@ -180,11 +190,19 @@ int main(int argc, char **argv) {
 
   CLI11_PARSE(app, argc, argv);
 
+  if (!simd_arch.empty() && !VCL_set_simd_arch(simd_arch.c_str())) {
+    fmt::println("Instruction set {} is not compiled or not supported.",
+                 simd_arch);
+    return __LINE__;
+  }
+
   if (show_config) {
     fmt::println("Version : {}", SC_VERSION_STR);
     fmt::println("Build type : {}", CMAKE_BUILD_TYPE);
     fmt::println("GPU API : {}", SC_GPU_API);
     fmt::println("Vectorize : {}", SC_VECTORIZE);
+    fmt::println("SIMD dispatch : {}", SC_SIMD_DISPATCH);
+    fmt::println("SIMD arch : {}", VCL_get_simd_arch());
     fmt::println("Gprof : {}", SC_GPROF);
     return 0;
   }
@@ -71,6 +71,9 @@ struct inputs {
   // compute
   uint16_t num_threads;
   bool benchmark{false};
+  // auto: convert small images concurrently, each one with a single thread.
+  // on: always convert images concurrently; off: convert images one by one.
+  std::string image_parallel{"auto"};
 
   // gpu
   bool prefer_gpu{false};
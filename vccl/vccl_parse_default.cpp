@@ -27,6 +27,11 @@ This file is part of SlopeCraft.
 #include <fmt/format.h>
 #include <fstream>
 #include <omp.h>
+#include <atomic>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <fmt/ranges.h>
 
 void cb_progress_range_set(void *, int, int, int) {}
 void cb_progress_add(void *, int) {}
@@ -162,6 +167,320 @@ void list_supported_formats() noexcept {
   cout << endl;
 }
 
+namespace {
+struct image_task_stats {
+  size_t images{0};
+  size_t pixels{0};
+  size_t blocks{0};
+  double seconds_convert{0};
+  double seconds_flat_diagram{0};
+  double seconds_build{0};
+  double seconds_export{0};
+
+  image_task_stats &operator+=(const image_task_stats &another) noexcept {
+    this->images += another.images;
+    this->pixels += another.pixels;
+    this->blocks += another.blocks;
+    this->seconds_convert += another.seconds_convert;
+    this->seconds_flat_diagram += another.seconds_flat_diagram;
+    this->seconds_build += another.seconds_build;
+    this->seconds_export += another.seconds_export;
+    return *this;
+  }
+
+  void print(double wall_time, size_t concurrent_images) const noexcept {
+    fmt::print(
+        "Processed {} images ({} pixels, {} blocks) in {} seconds, {:.2f} "
+        "images per second. {} of them were converted concurrently.\n",
+        this->images, this->pixels, this->blocks, wall_time,
+        this->images / std::max(wall_time, 1e-9), concurrent_images);
+    fmt::print(
+        "CPU time: convert {} s, flat diagram {} s, build {} s, export {} "
+        "s.\n",
+        this->seconds_convert, this->seconds_flat_diagram, this->seconds_build,
+        this->seconds_export);
+  }
+};
+
+// Images no larger than this are converted concurrently in auto mode, since
+// a single small image can not keep all threads busy.
+constexpr int64_t small_image_pixel_threshold = 512 * 512;
+
+int process_image(VCL_Kernel *kernel, const inputs &input,
+                  const std::string &img_filename, bool print_benchmark,
+                  image_task_stats &stats) noexcept {
+  double wt = 0;
+  const std::string pure_filename_no_extension =
+      std::filesystem::path(img_filename)
+          .filename()
+          .replace_extension("")
+          .string();
+  if (!input.need_to_read()) {
+    return 0;
+  }
+
+  QImage img(QString::fromLocal8Bit(img_filename.c_str()));
+
+  if (img.isNull()) {
+    fmt::print("Failed to open image {}\n", img_filename);
+    return __LINE__;
+  }
+
+  img = img.convertToFormat(QImage::Format::Format_ARGB32);
+
+  if (img.isNull()) {
+    return __LINE__;
+  }
+  if (!kernel->set_image(img.height(), img.width(),
+                         (const uint32_t *)img.scanLine(0), true)) {
+    fmt::print("Failed to set raw image to kernel.\n");
+    return __LINE__;
+  }
+
+  if (!input.need_to_convert()) {
+    return 0;
+  }
+
+  wt = omp_get_wtime();
+  if (!kernel->convert(input.algo, input.dither)) {
+    fmt::print("Failed to convert image {}.\n", img_filename);
+    return __LINE__;
+  }
+  wt = omp_get_wtime() - wt;
+
+  stats.images++;
+  stats.pixels += size_t(img.height()) * img.width();
+  stats.seconds_convert += wt;
+  if (print_benchmark) {
+    fmt::print("Converted {} pixels in {} seconds.\n",
+               img.height() * img.width(), wt);
+  }
+
+  if (input.make_converted_image) {
+    std::string dst_name_str(input.prefix);
+    dst_name_str += pure_filename_no_extension + "_converted.png";
+
+    memset(img.scanLine(0), 0, img.height() * img.width() * sizeof(uint32_t));
+
+    kernel->converted_image((uint32_t *)img.scanLine(0), nullptr, nullptr,
+                            true);
+
+    const bool ok = img.save(QString::fromLocal8Bit(dst_name_str.c_str()));
+
+    if (!ok) {
+      fmt::print("Failed to save image {}\n", dst_name_str);
+      return __LINE__;
+    }
+    // cout << dst_path << endl;
+  }
+
+  if (input.make_flat_diagram) {
+    double wtime[3];
+    for (uint8_t layer = 0; layer < input.layers; layer++) {
+      std::string dst_name_str(input.prefix);
+      dst_name_str += pure_filename_no_extension;
+      dst_name_str += "_flagdiagram_layer=";
+      dst_name_str += std::to_string(layer);
+      dst_name_str += ".png";
+
+      VCL_Kernel::flag_diagram_option option;
+      option.row_start = 0;
+      option.row_end = kernel->rows();
+      option.split_line_row_margin = input.flat_diagram_splitline_margin_row;
+      option.split_line_col_margin = input.flat_diagram_splitline_margin_col;
+      wtime[layer] = omp_get_wtime();
+      if (!kernel->export_flag_diagram(dst_name_str.c_str(), option, layer)) {
+        fmt::print("Failed to export flat diagram {}\n", dst_name_str);
+        return __LINE__;
+      }
+      wtime[layer] = omp_get_wtime() - wtime[layer];
+    }
+
+    for (int i = 0; i < input.layers; i++) {
+      stats.seconds_flat_diagram += wtime[i];
+    }
+    if (print_benchmark) {
+      fmt::print("Export flatdiagram containing {} images in {} seconds.\n",
+                 input.layers,
+                 fmt::join(std::span{wtime, size_t(input.layers)}, ", "));
+    }
+  }
+
+  if (!input.need_to_build()) {
+    return 0;
+  }
+
+  wt = omp_get_wtime();
+  if (!kernel->build()) {
+    fmt::print("Failed to build {}\n", img_filename);
+    return __LINE__;
+  }
+  wt = omp_get_wtime() - wt;
+
+  stats.blocks += kernel->xyz_size();
+  stats.seconds_build += wt;
+  if (print_benchmark) {
+    fmt::print("Built {} blocks in {} seconds.\n", kernel->xyz_size(), wt);
+  }
+
+  if (input.make_litematic) {
+    const std::string filename =
+        input.prefix + pure_filename_no_extension + ".litematic";
+
+    wt = omp_get_wtime();
+    const bool success = kernel->export_litematic(
+        filename.c_str(), "Genereated by VCCL", "VCCL is part of SlopeCraft");
+    wt = omp_get_wtime() - wt;
+
+    if (!success) {
+      fmt::println("Failed to export {}.", filename);
+      return __LINE__;
+    }
+
+    stats.seconds_export += wt;
+    if (print_benchmark) {
+      fmt::println("Export litematic with {} blocks in {} seconds.",
+                   kernel->xyz_size(), wt);
+    }
+  }
+
+  if (input.make_schematic) {
+    const std::string filename =
+        input.prefix + pure_filename_no_extension + ".schem";
+
+    wt = omp_get_wtime();
+    const bool success = kernel->export_WESchem(
+        filename.data(), {0, 0, 0}, {0, 0, 0}, "Genereated by VCCL");
+    wt = omp_get_wtime() - wt;
+
+    if (!success) {
+      fmt::println("Failed to export {}.", filename);
+      return __LINE__;
+    }
+
+    stats.seconds_export += wt;
+    if (print_benchmark) {
+      fmt::print("Export WE schem with {} blocks in {} seconds.\n",
+                 kernel->xyz_size(), wt);
+    }
+  }
+
+  if (input.make_structure) {
+    const std::string filename =
+        input.prefix + pure_filename_no_extension + ".nbt";
+
+    wt = omp_get_wtime();
+    const bool success = kernel->export_structure(
+        filename.c_str(), input.structure_is_air_void);
+    wt = omp_get_wtime() - wt;
+
+    if (!success) {
+      fmt::println("Failed to export {}.", filename);
+      return __LINE__;
+    }
+
+    stats.seconds_export += wt;
+    if (print_benchmark) {
+      fmt::print(
+          "Export vanilla structure file with {} blocks in {} seconds.\n",
+          kernel->xyz_size(), wt);
+    }
+  }
+
+  return 0;
+}
+
+// Returns {images to convert concurrently, images to convert one by one}.
+std::pair<std::vector<const std::string *>, std::vector<const std::string *>>
+split_images_by_size(const inputs &input) noexcept {
+  std::vector<const std::string *> small, large;
+
+  const bool can_be_concurrent = input.image_parallel != "off" &&
+                                 input.num_threads > 1 && !input.prefer_gpu &&
+                                 input.need_to_convert();
+  for (const auto &img_filename : input.images) {
+    if (!can_be_concurrent) {
+      large.emplace_back(&img_filename);
+      continue;
+    }
+    if (input.image_parallel == "on") {
+      small.emplace_back(&img_filename);
+      continue;
+    }
+    // reads only the header of image.
+    QImageReader reader{QString::fromLocal8Bit(img_filename.c_str())};
+    const QSize size = reader.size();
+    if (size.isValid() && int64_t(size.width()) * size.height() <=
+                              small_image_pixel_threshold) {
+      small.emplace_back(&img_filename);
+    } else {
+      large.emplace_back(&img_filename);
+    }
+  }
+
+  if (small.size() < 2) {
+    large.insert(large.begin(), small.begin(), small.end());
+    small.clear();
+  }
+  return {std::move(small), std::move(large)};
+}
+
+// Every worker owns a kernel and converts one image at a time with a single
+// thread, while block resources are shared among kernels. Images are taken
+// from an atomic counter, so at most one image per worker is in memory.
+int process_images_concurrently(const inputs &input,
+                                std::span<const std::string *const> images,
+                                image_task_stats &stats) noexcept {
+  const size_t num_workers =
+      std::min<size_t>(std::max<int>(input.num_threads, 1), images.size());
+
+  std::atomic<size_t> next_task{0};
+  std::atomic<int> error_code{0};
+  std::mutex lock;
+
+  auto worker = [&]() {
+    omp_set_num_threads(1);
+    VCL_Kernel *kernel = VCL_create_kernel();
+    if (kernel == nullptr) {
+      fmt::print("Failed to create kernel.\n");
+      int expected = 0;
+      error_code.compare_exchange_strong(expected, __LINE__);
+      return;
+    }
+    kernel->set_ui(nullptr, cb_progress_range_set, cb_progress_add);
+
+    image_task_stats local_stats;
+    while (error_code.load() == 0) {
+      const size_t idx = next_task.fetch_add(1);
+      if (idx >= images.size()) {
+        break;
+      }
+      const int ret =
+          process_image(kernel, input, *images[idx], false, local_stats);
+      if (ret != 0) {
+        int expected = 0;
+        error_code.compare_exchange_strong(expected, ret);
+        break;
+      }
+    }
+    VCL_destroy_kernel(kernel);
+
+    std::lock_guard<std::mutex> lk{lock};
+    stats += local_stats;
+  };
+
+  std::vector<std::thread> workers;
+  workers.reserve(num_workers);
+  for (size_t i = 0; i < num_workers; i++) {
+    workers.emplace_back(worker);
+  }
+  for (auto &t : workers) {
+    t.join();
+  }
+  return error_code.load();
+}
+}  // namespace
+
 int run(const inputs &input) noexcept {
   double wt = 0;
 
@@ -261,176 +580,33 @@ int run(const inputs &input) noexcept {
     }
   }
 
-  for (const auto &img_filename : input.images) {
-    const std::string pure_filename_no_extension =
-        std::filesystem::path(img_filename)
-            .filename()
-            .replace_extension("")
-            .string();
-    if (!input.need_to_read()) {
-      continue;
-    }
+  image_task_stats stats;
+  wt = omp_get_wtime();
 
-    QImage img(QString::fromLocal8Bit(img_filename.c_str()));
+  const auto [small_images, large_images] = split_images_by_size(input);
 
-    if (img.isNull()) {
-      fmt::print("Failed to open image {}\n", img_filename);
+  if (!small_images.empty()) {
+    const int ret = process_images_concurrently(input, small_images, stats);
+    if (ret != 0) {
       VCL_destroy_kernel(kernel);
-      return __LINE__;
-    }
-
-    img = img.convertToFormat(QImage::Format::Format_ARGB32);
-
-    if (img.isNull()) {
-      return __LINE__;
-    }
-    if (!kernel->set_image(img.height(), img.width(),
-                           (const uint32_t *)img.scanLine(0), true)) {
-      cout << "Failed to set raw image to kernel." << endl;
-      return __LINE__;
-    }
-
-    if (!input.need_to_convert()) {
-      continue;
-    }
-
-    wt = omp_get_wtime();
-    if (!kernel->convert(input.algo, input.dither)) {
-      cout << "Failed to convert image." << endl;
-      return __LINE__;
-    }
-    wt = omp_get_wtime() - wt;
-
-    if (input.benchmark) {
-      fmt::print("Converted {} pixels in {} seconds.\n",
-                 img.height() * img.width(), wt);
-    }
-
-    if (input.make_converted_image) {
-      std::string dst_name_str(input.prefix);
-      dst_name_str += pure_filename_no_extension + "_converted.png";
-
-      memset(img.scanLine(0), 0, img.height() * img.width() * sizeof(uint32_t));
-
-      kernel->converted_image((uint32_t *)img.scanLine(0), nullptr, nullptr,
-                              true);
-
-      const bool ok = img.save(QString::fromLocal8Bit(dst_name_str.c_str()));
-
-      if (!ok) {
-        fmt::print("Failed to save image {}\n", dst_name_str);
-        return __LINE__;
-      }
-      // cout << dst_path << endl;
-    }
-
-    if (input.make_flat_diagram) {
-      double wtime[3];
-      for (uint8_t layer = 0; layer < input.layers; layer++) {
-        std::string dst_name_str(input.prefix);
-        dst_name_str += pure_filename_no_extension;
-        dst_name_str += "_flagdiagram_layer=";
-        dst_name_str += std::to_string(layer);
-        dst_name_str += ".png";
-
-        VCL_Kernel::flag_diagram_option option;
-        option.row_start = 0;
-        option.row_end = kernel->rows();
-        option.split_line_row_margin = input.flat_diagram_splitline_margin_row;
-        option.split_line_col_margin = input.flat_diagram_splitline_margin_col;
-        wtime[layer] = omp_get_wtime();
-        if (!kernel->export_flag_diagram(dst_name_str.c_str(), option, layer)) {
-          fmt::print("Failed to export flat diagram {}\n", dst_name_str);
-          return __LINE__;
-        }
-        wtime[layer] = omp_get_wtime() - wtime[layer];
-      }
-
-      if (input.benchmark) {
-        fmt::print("Export flatdiagram containing {} images in ", input.layers);
-        for (int i = 0; i < input.layers; i++) {
-          cout << wtime[i] << ", ";
-        }
-        cout << " seconds.\n";
-      }
-    }
-
-    if (!input.need_to_build()) {
-      continue;
-    }
-
-    wt = omp_get_wtime();
-    if (!kernel->build()) {
-      cout << "Failed to build " << endl;
-      return __LINE__;
-    }
-    wt = omp_get_wtime() - wt;
-
-    if (input.benchmark) {
-      fmt::print("Built {} blocks in {} seconds.\n", kernel->xyz_size(), wt);
-    }
-
-    if (input.make_litematic) {
-      const std::string filename =
-          input.prefix + pure_filename_no_extension + ".litematic";
-
-      wt = omp_get_wtime();
-      const bool success = kernel->export_litematic(
-          filename.c_str(), "Genereated by VCCL", "VCCL is part of SlopeCraft");
-      wt = omp_get_wtime() - wt;
-
-      if (!success) {
-        fmt::println("Failed to export {}.", filename);
-        return __LINE__;
-      }
-
-      if (input.benchmark) {
-        fmt::println("Export litematic with {} blocks in {} seconds.",
-                     kernel->xyz_size(), wt);
-      }
+      return ret;
     }
+  }
 
-    if (input.make_schematic) {
-      const std::string filename =
-          input.prefix + pure_filename_no_extension + ".schem";
-
-      wt = omp_get_wtime();
-      const bool success = kernel->export_WESchem(
-          filename.data(), {0, 0, 0}, {0, 0, 0}, "Genereated by VCCL");
-      wt = omp_get_wtime() - wt;
-
-      if (!success) {
-        fmt::println("Failed to export {}.", filename);
-        return __LINE__;
-      }
-
-      if (input.benchmark) {
-        fmt::print("Export WE schem with {} blocks in {} seconds.\n",
-                   kernel->xyz_size(), wt);
-      }
+  for (const std::string *img_filename : large_images) {
+    const int ret =
+        process_image(kernel, input, *img_filename, input.benchmark, stats);
+    if (ret != 0) {
+      VCL_destroy_kernel(kernel);
+      return ret;
     }
+  }
+  wt = omp_get_wtime() - wt;
 
-    if (input.make_structure) {
-      const std::string filename =
-          input.prefix + pure_filename_no_extension + ".nbt";
-
-      wt = omp_get_wtime();
-      const bool success = kernel->export_structure(
-          filename.c_str(), input.structure_is_air_void);
-      wt = omp_get_wtime() - wt;
-
-      if (!success) {
-        fmt::println("Failed to export {}.", filename);
-        return __LINE__;
-      }
-
-      if (input.benchmark) {
-        fmt::print(
-            "Export vanilla structure file with {} blocks in {} seconds.\n",
-            kernel->xyz_size(), wt);
-      }
-    }
+  if (input.benchmark && input.need_to_convert()) {
+    stats.print(wt, small_images.size());
   }
+
   VCL_destroy_kernel(kernel);
   cout << "success." << endl;
 